@@ -0,0 +1,148 @@
+/*
+ * http_dl_parse.h²ԣѸӦͷN飬ÿļÿεĺʱܵMB/s
+ * main.cһηHTTP_DL_READBUF_LENСĻУȽ״̬ٽͷ
+ * صmain.cʶ𲢽Content-Length/Content-Range/Content-TypeͷֻȽ֡
+ *
+ * fuzz/corpus£h1_*ǴӱزԷץӦͷnginx_*s3_*cdn_*
+ * Ӧͷࡢֵedge_*parse_fuzzֹ򸲸Ǳ߽롣
+ * ڲֿĿ¼£
+ *   cc -O2 -Wall -I. -o parse_bench fuzz/parse_bench.c
+ *   ./parse_bench -n 200000 fuzz/corpus/h1_* fuzz/corpus/nginx_* fuzz/corpus/s3_* fuzz/corpus/cdn_*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "http_download.h"
+#include "http_dl_parse.h"
+
+#define HTTP_DL_BENCH_ITERS     100000
+#define HTTP_DL_BENCH_FILES     64
+
+typedef struct http_dl_bench_s {
+    const char *name;
+    char data[HTTP_DL_READBUF_LEN];
+    int len;
+    int ret;                        /* һνĽOKҲʱ */
+    double ns;                      /* ÿνƽʱ */
+} http_dl_bench_t;
+
+static http_dl_bench_t http_dl_benches[HTTP_DL_BENCH_FILES];
+static volatile long http_dl_bench_sink;     /* ñѽŻ */
+
+static int http_dl_bench_field_cb(const char *name, int nlen, const char *value, int vlen, void *arg)
+{
+    http_dl_range_t range;
+    const char *b;
+    long val;
+    int blen;
+
+    if (nlen == 14 && strncasecmp(name, "content-length", 14) == 0) {
+        if (http_dl_parse_ulong(value, vlen, &val) == HTTP_DL_PARSE_OK) {
+            http_dl_bench_sink += val;
+        }
+    } else if (nlen == 13 && strncasecmp(name, "content-range", 13) == 0) {
+        if (http_dl_parse_content_range(value, vlen, &range) == HTTP_DL_PARSE_OK) {
+            http_dl_bench_sink += range.entity_length;
+        }
+    } else if (nlen == 12 && strncasecmp(name, "content-type", 12) == 0) {
+        if (http_dl_parse_boundary(value, vlen, &b, &blen) == HTTP_DL_PARSE_OK) {
+            http_dl_bench_sink += blen;
+        }
+    }
+
+    return 0;
+}
+
+/* һӦͷĽ */
+static int http_dl_bench_parse(char *buf, int len)
+{
+    http_dl_status_t st;
+    int line_len, adv, used, ret;
+
+    ret = http_dl_parse_line(buf, len, HTTP_DL_READBUF_LEN, &line_len, &adv);
+    if (ret != HTTP_DL_PARSE_OK) {
+        return ret;
+    }
+    ret = http_dl_parse_status(buf, line_len, &st);
+    if (ret != HTTP_DL_PARSE_OK) {
+        return ret;
+    }
+    http_dl_bench_sink += st.code;
+
+    return http_dl_parse_fields(buf + adv, len - adv, HTTP_DL_READBUF_LEN - adv, &used,
+                                http_dl_bench_field_cb, NULL);
+}
+
+static double http_dl_bench_now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int http_dl_bench_load(http_dl_bench_t *bench, const char *name)
+{
+    FILE *fp;
+
+    fp = fopen(name, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "Open %s failed.\n", name);
+        return -1;
+    }
+    bench->name = name;
+    bench->len = fread(bench->data, 1, sizeof(bench->data), fp);
+    fclose(fp);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    http_dl_bench_t *bench;
+    char buf[HTTP_DL_READBUF_LEN];
+    long iters = HTTP_DL_BENCH_ITERS, i, bytes = 0;
+    double begin, total_ns = 0;
+    int nfiles = 0, first = 1, f;
+
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+        iters = strtol(argv[2], NULL, 10);
+        first = 3;
+    }
+    if (iters <= 0 || first >= argc || argc - first > HTTP_DL_BENCH_FILES) {
+        fprintf(stderr, "Usage: %s [-n iterations] <response> ... (at most %d files)\n",
+                argv[0], HTTP_DL_BENCH_FILES);
+        return 1;
+    }
+
+    for (f = first; f < argc; f++) {
+        if (http_dl_bench_load(&http_dl_benches[nfiles], argv[f]) != 0) {
+            return 1;
+        }
+        nfiles++;
+    }
+
+    for (f = 0; f < nfiles; f++) {
+        bench = &http_dl_benches[f];
+        begin = http_dl_bench_now_ns();
+        for (i = 0; i < iters; i++) {
+            /* 룬Ϊ˺main.cһÿδsocketݿʼ */
+            memcpy(buf, bench->data, bench->len);
+            bench->ret = http_dl_bench_parse(buf, bench->len);
+        }
+        bench->ns = (http_dl_bench_now_ns() - begin) / iters;
+        total_ns += bench->ns * iters;
+        bytes += (long)bench->len * iters;
+    }
+
+    for (f = 0; f < nfiles; f++) {
+        bench = &http_dl_benches[f];
+        printf("%-40s %5d B  %8.1f ns  %7.1f MB/s  ret %d\n", bench->name, bench->len,
+                bench->ns, bench->len / bench->ns * 1e3, bench->ret);
+    }
+    printf("total %ld responses, %.1f MB/s\n", iters * nfiles, bytes / total_ns * 1e3);
+
+    return 0;
+}
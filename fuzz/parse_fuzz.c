@@ -0,0 +1,207 @@
+/*
+ * http_dl_parse.hĲģԣͬһһȫÿֽڴϳΣ
+ * ιõĽ(״̬СÿͷContent-Length/Content-Range/boundaryĽ
+ * ķֵ)һֲ˵"κһֽڴϿһ"֤
+ *
+ * 뵱һӦ״̬У֮һԿнͷ(multipartÿεͷͬ)
+ * main.cһHTTP_DL_FUZZ_BUF_LENСĻͽߣ
+ * ETOOLONGϿλ޹ءΪ"X-Stop"ͷûصط0ECALLBACK
+ *
+ * (иļûʱ׼)ڲֿĿ¼£
+ *   cc -g -O1 -Wall -fsanitize=address,undefined -I. -o parse_fuzz fuzz/parse_fuzz.c
+ *   ./parse_fuzz fuzz/corpus/[a-z]*
+ * libFuzzerfuzz/corpusΪӣ·ֵдһĿ¼
+ *   clang -g -O1 -fsanitize=fuzzer,address,undefined -DHTTP_DL_LIBFUZZER -I. \
+ *       -o parse_fuzz fuzz/parse_fuzz.c && ./parse_fuzz -max_len=8192 new_corpus fuzz/corpus
+ * ¼fuzz/parse_bench.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include "http_dl_parse.h"
+
+#define HTTP_DL_FUZZ_BUF_LEN    256     /* ȡСһߵETOOLONG */
+#define HTTP_DL_FUZZ_LOG_LEN    (64 * 1024)
+
+/* ̵ļ¼ιļ¼ֽڱȽ */
+typedef struct http_dl_fuzz_log_s {
+    char buf[HTTP_DL_FUZZ_LOG_LEN];
+    int len;
+} http_dl_fuzz_log_t;
+
+static void http_dl_fuzz_printf(http_dl_fuzz_log_t *log, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    if (log->len >= HTTP_DL_FUZZ_LOG_LEN - 1) {
+        return;
+    }
+    va_start(ap, fmt);
+    n = vsnprintf(log->buf + log->len, HTTP_DL_FUZZ_LOG_LEN - log->len, fmt, ap);
+    va_end(ap);
+    if (n > 0) {
+        log->len += (n < HTTP_DL_FUZZ_LOG_LEN - log->len) ? n : HTTP_DL_FUZZ_LOG_LEN - 1 - log->len;
+    }
+}
+
+static int http_dl_fuzz_field_cb(const char *name, int nlen, const char *value, int vlen, void *arg)
+{
+    http_dl_fuzz_log_t *log = arg;
+    http_dl_range_t range;
+    const char *b;
+    long val;
+    int blen, ret;
+
+    http_dl_fuzz_printf(log, "F %.*s|%.*s\n", nlen, name, vlen, value);
+    if (nlen == 14 && strncasecmp(name, "content-length", 14) == 0) {
+        ret = http_dl_parse_ulong(value, vlen, &val);
+        http_dl_fuzz_printf(log, "L %d %ld\n", ret, (ret == HTTP_DL_PARSE_OK) ? val : 0);
+    } else if (nlen == 13 && strncasecmp(name, "content-range", 13) == 0) {
+        ret = http_dl_parse_content_range(value, vlen, &range);
+        if (ret == HTTP_DL_PARSE_OK) {
+            http_dl_fuzz_printf(log, "R %ld %ld %ld\n", range.first_byte_pos,
+                                range.last_byte_pos, range.entity_length);
+        } else {
+            http_dl_fuzz_printf(log, "R %d\n", ret);
+        }
+    } else if (nlen == 12 && strncasecmp(name, "content-type", 12) == 0) {
+        ret = http_dl_parse_boundary(value, vlen, &b, &blen);
+        http_dl_fuzz_printf(log, "B %d %.*s\n", ret, (ret == HTTP_DL_PARSE_OK) ? blen : 0, b);
+    } else if (nlen == 6 && strncasecmp(name, "x-stop", 6) == 0) {
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * chunksļιĽ(OKʾͷ)
+ * ÿһֻΪֹsocketȡͬ
+ */
+static int http_dl_fuzz_run(const char *data, int len, const int *chunks, int nchunks,
+                            http_dl_fuzz_log_t *log)
+{
+    char buf[HTTP_DL_FUZZ_BUF_LEN];
+    http_dl_status_t st;
+    int fed = 0, avail = 0, end, n, c, ret = HTTP_DL_PARSE_AGAIN;
+    int line_len, adv, used, status_done = 0;
+
+    log->len = 0;
+    for (c = 0; c < nchunks; c++) {
+        end = fed + chunks[c];
+        while (fed < end) {
+            n = (end - fed < HTTP_DL_FUZZ_BUF_LEN - avail) ? end - fed : HTTP_DL_FUZZ_BUF_LEN - avail;
+            memcpy(buf + avail, data + fed, n);
+            avail += n;
+            fed += n;
+
+            while (avail > 0) {
+                if (!status_done) {
+                    ret = http_dl_parse_line(buf, avail, sizeof(buf), &line_len, &adv);
+                    if (ret == HTTP_DL_PARSE_OK) {
+                        ret = http_dl_parse_status(buf, line_len, &st);
+                    }
+                    if (ret != HTTP_DL_PARSE_OK) {
+                        break;
+                    }
+                    http_dl_fuzz_printf(log, "S %d.%d %d %.*s\n", st.major, st.minor, st.code,
+                                        st.reason_len, st.reason);
+                    status_done = 1;
+                    used = adv;
+                } else {
+                    ret = http_dl_parse_fields(buf, avail, sizeof(buf), &used,
+                                                http_dl_fuzz_field_cb, log);
+                    if (ret == HTTP_DL_PARSE_OK) {
+                        http_dl_fuzz_printf(log, "E\n");
+                    }
+                }
+                memmove(buf, buf + used, avail - used);
+                avail -= used;
+                if (ret != HTTP_DL_PARSE_OK) {
+                    break;
+                }
+            }
+            if (ret != HTTP_DL_PARSE_OK && ret != HTTP_DL_PARSE_AGAIN) {
+                http_dl_fuzz_printf(log, "X %d\n", ret);
+                return ret;
+            }
+        }
+    }
+    if (avail > 0) {
+        ret = HTTP_DL_PARSE_AGAIN;
+    }
+    http_dl_fuzz_printf(log, "X %d %d\n", ret, avail);
+
+    return ret;
+}
+
+static int http_dl_fuzz_one(const char *data, int len)
+{
+    static http_dl_fuzz_log_t whole, split;
+    int chunks[2], k;
+
+    chunks[0] = len;
+    (void)http_dl_fuzz_run(data, len, chunks, 1, &whole);
+
+    for (k = 0; k <= len; k++) {
+        chunks[0] = k;
+        chunks[1] = len - k;
+        (void)http_dl_fuzz_run(data, len, chunks, 2, &split);
+        if (split.len != whole.len || memcmp(split.buf, whole.buf, whole.len) != 0) {
+            fprintf(stderr, "split at %d differs\n--- whole ---\n%.*s--- split ---\n%.*s",
+                    k, whole.len, whole.buf, split.len, split.buf);
+            abort();
+        }
+    }
+
+    return 0;
+}
+
+#ifdef HTTP_DL_LIBFUZZER
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size > 65536) {
+        return 0;
+    }
+
+    return http_dl_fuzz_one((const char *)data, (int)size);
+}
+#else
+static int http_dl_fuzz_file(FILE *fp, const char *name)
+{
+    static char data[65536];
+    size_t len;
+
+    len = fread(data, 1, sizeof(data), fp);
+    (void)http_dl_fuzz_one(data, (int)len);
+    printf("%s: %d bytes, %d splits ok\n", name, (int)len, (int)len + 1);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *fp;
+    int i;
+
+    if (argc < 2) {
+        return http_dl_fuzz_file(stdin, "stdin");
+    }
+
+    for (i = 1; i < argc; i++) {
+        fp = fopen(argv[i], "rb");
+        if (fp == NULL) {
+            fprintf(stderr, "Open %s failed.\n", argv[i]);
+            return 1;
+        }
+        (void)http_dl_fuzz_file(fp, argv[i]);
+        fclose(fp);
+    }
+
+    return 0;
+}
+#endif
@@ -0,0 +1,253 @@
+#ifndef __HTTP_DL_DELTA_H__
+#define __HTTP_DL_DELTA_H__
+
+/*
+ * 鼶(zsyncͬ˼·)ϵļ̶ȷֿ飬ÿrsyncĹУ
+ * XXH64ɿ嵥ͻڱؾɰ汾ֽڻһ鳤ĴڣУкٱȽXXH64
+ * ͬĿӾɰ汾ƣĿRangeءԳھɰ汾ƫƴ
+ * ɾݣ֮Ŀҵ
+ *
+ * 嵥ʽǼ"Name: value"(CRLFβнHTTPͷͬ)
+ *   HDL-Delta: 1           ǵһУʽ汾
+ *   Length: <ֽ>       ļĳ
+ *   Block-Size: <ֽ>   鳤һԲ
+ *   Hash: xxh64            ÿǿУ
+ * ֮ÿ12ֽڣУ(4ֽڣ)XXH64(8ֽڣhttp_dl_digest_finalͬ)
+ * MD4ûʵ֣zsync.zsyncļֱʹã-Mɱʽ嵥
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "http_dl_digest.h"
+#include "http_dl_parse.h"
+
+#define HTTP_DL_DELTA_VERSION   "1"
+#define HTTP_DL_DELTA_REC_LEN   12
+#define HTTP_DL_DELTA_BLOCK_MIN 512
+#define HTTP_DL_DELTA_BLOCK_MAX (16 << 20)
+
+typedef struct http_dl_manifest_s {
+    int fields;                     /* Ѿͷhttp_dl_manifest_cb */
+    long length;
+    long block_len;
+    long nblocks;
+    const unsigned char *recs;      /* ¼ָߵĻ */
+} http_dl_manifest_t;
+
+/* rsyncУͣaΪֽںͣbΪλüȨĺͣȡ16λ */
+static inline uint32_t http_dl_rsum(const unsigned char *p, long len)
+{
+    uint32_t a = 0, b = 0;
+    long i;
+
+    for (i = 0; i < len; i++) {
+        a += p[i];
+        b += (uint32_t)(len - i) * p[i];
+    }
+
+    return (a & 0xFFFF) | (b << 16);
+}
+
+/* һֽڣȥoutinڳlen */
+static inline uint32_t http_dl_rsum_roll(uint32_t s, unsigned char out, unsigned char in, long len)
+{
+    uint32_t a = (s & 0xFFFF) - out + in;
+    uint32_t b = (s >> 16) - (uint32_t)len * out + a;
+
+    return (a & 0xFFFF) | (b << 16);
+}
+
+static inline void http_dl_delta_strong(const unsigned char *p, long len, unsigned char *out)
+{
+    http_dl_digest_t dg;
+
+    http_dl_digest_init(&dg, HTTP_DL_DIGEST_XXH64);
+    http_dl_digest_update(&dg, p, len);
+    (void)http_dl_digest_final(&dg, out);
+}
+
+/* һļ¼ */
+static inline void http_dl_delta_record(const unsigned char *p, long len, unsigned char *rec)
+{
+    uint32_t s = http_dl_rsum(p, len);
+
+    rec[0] = s >> 24;
+    rec[1] = s >> 16;
+    rec[2] = s >> 8;
+    rec[3] = s;
+    http_dl_delta_strong(p, len, rec + 4);
+}
+
+static inline uint32_t http_dl_delta_weak(const http_dl_manifest_t *m, long i)
+{
+    const unsigned char *r = m->recs + i * HTTP_DL_DELTA_REC_LEN;
+
+    return ((uint32_t)r[0] << 24) | ((uint32_t)r[1] << 16) | ((uint32_t)r[2] << 8) | r[3];
+}
+
+#define HTTP_DL_MANIFEST_F_VERSION  0x1
+#define HTTP_DL_MANIFEST_F_LENGTH   0x2
+#define HTTP_DL_MANIFEST_F_BLOCK    0x4
+#define HTTP_DL_MANIFEST_F_HASH     0x8
+#define HTTP_DL_MANIFEST_F_ALL      0xF
+
+static int http_dl_manifest_cb(const char *name, int nlen, const char *value, int vlen, void *arg)
+{
+    http_dl_manifest_t *m = arg;
+
+    if (m->fields == 0) {
+        /* һбǰ汾ʶİ汾 */
+        if (nlen != 9 || strncasecmp(name, "hdl-delta", 9) != 0
+            || vlen != 1 || memcmp(value, HTTP_DL_DELTA_VERSION, 1) != 0) {
+            return HTTP_DL_PARSE_EINVAL;
+        }
+        m->fields |= HTTP_DL_MANIFEST_F_VERSION;
+    } else if (nlen == 6 && strncasecmp(name, "length", 6) == 0) {
+        if (http_dl_parse_ulong(value, vlen, &m->length) != HTTP_DL_PARSE_OK) {
+            return HTTP_DL_PARSE_EINVAL;
+        }
+        m->fields |= HTTP_DL_MANIFEST_F_LENGTH;
+    } else if (nlen == 10 && strncasecmp(name, "block-size", 10) == 0) {
+        if (http_dl_parse_ulong(value, vlen, &m->block_len) != HTTP_DL_PARSE_OK
+            || m->block_len < HTTP_DL_DELTA_BLOCK_MIN || m->block_len > HTTP_DL_DELTA_BLOCK_MAX) {
+            return HTTP_DL_PARSE_EINVAL;
+        }
+        m->fields |= HTTP_DL_MANIFEST_F_BLOCK;
+    } else if (nlen == 4 && strncasecmp(name, "hash", 4) == 0) {
+        if (vlen != 5 || strncasecmp(value, "xxh64", 5) != 0) {
+            return HTTP_DL_PARSE_EINVAL;
+        }
+        m->fields |= HTTP_DL_MANIFEST_F_HASH;
+    }
+    /* ͷԺչ */
+
+    return 0;
+}
+
+/* 嵥¼ĸ볤ȡ鳤Ե */
+static inline int http_dl_manifest_parse(const char *p, long len, http_dl_manifest_t *m)
+{
+    int used, ret;
+
+    bzero(m, sizeof(http_dl_manifest_t));
+    ret = http_dl_parse_fields(p, (len > INT_MAX) ? INT_MAX : (int)len, INT_MAX, &used,
+                                http_dl_manifest_cb, m);
+    if (ret != HTTP_DL_PARSE_OK) {
+        return HTTP_DL_PARSE_EINVAL;
+    }
+    if (m->fields != HTTP_DL_MANIFEST_F_ALL) {
+        return HTTP_DL_PARSE_EINVAL;
+    }
+
+    m->nblocks = (m->length + m->block_len - 1) / m->block_len;
+    if (m->nblocks > INT_MAX / 4 || (len - used) % HTTP_DL_DELTA_REC_LEN != 0
+        || (len - used) / HTTP_DL_DELTA_REC_LEN != m->nblocks) {
+        return HTTP_DL_PARSE_EINVAL;
+    }
+    m->recs = (const unsigned char *)p + used;
+
+    return HTTP_DL_PARSE_OK;
+}
+
+/* iھɰ汾seedoffҵͬһֻһ */
+typedef void (*http_dl_delta_match_cb_t)(long i, long off, void *arg);
+
+/*
+ * seed嵥еĿ飬ҵĿڴ治ʱ-1
+ * 鰴УͽϣÿһֽڲһΣк飻
+ * ļͬĿ(ȫ0)һСһβͲܻң
+ * ֻȽϾɰ汾ͬƫƺĩβļûֻмʱС
+ */
+static inline long http_dl_delta_match(const http_dl_manifest_t *m, const unsigned char *seed,
+                                       long seed_len, http_dl_delta_match_cb_t cb, void *arg)
+{
+    long bs = m->block_len, nfull = m->length / bs, tail = m->length % bs;
+    long i, off, found = 0, cand[2];
+    unsigned char strong[8];
+    uint32_t s, mask, h;
+    int *head, *next, j;
+    char *done;
+    int hit = 0, have_strong;
+
+    for (mask = 1; mask < nfull * 2; mask <<= 1) {
+        ;
+    }
+    mask--;
+    head = malloc((mask + 1) * sizeof(int));
+    next = malloc((nfull + 1) * sizeof(int));
+    done = calloc(m->nblocks + 1, 1);
+    if (head == NULL || next == NULL || done == NULL) {
+        free(head);
+        free(next);
+        free(done);
+        return -1;
+    }
+
+    memset(head, 0xFF, (mask + 1) * sizeof(int));
+    for (i = nfull - 1; i >= 0; i--) {
+        h = (http_dl_delta_weak(m, i) * 2654435761U) & mask;
+        next[i] = head[h];
+        head[h] = i;
+    }
+
+    for (off = 0, s = 0; nfull > 0 && found < nfull && off + bs <= seed_len; ) {
+        if (off == 0 || hit) {
+            s = http_dl_rsum(seed + off, bs);
+        }
+        hit = 0;
+        have_strong = 0;
+        for (j = head[(s * 2654435761U) & mask]; j >= 0; j = next[j]) {
+            if (http_dl_delta_weak(m, j) != s) {
+                continue;
+            }
+            if (!have_strong) {
+                http_dl_delta_strong(seed + off, bs, strong);
+                have_strong = 1;
+            }
+            if (memcmp(m->recs + j * HTTP_DL_DELTA_REC_LEN + 4, strong, 8) != 0) {
+                continue;
+            }
+            hit = 1;
+            if (!done[j]) {
+                done[j] = 1;
+                found++;
+                cb(j, off, arg);
+            }
+        }
+
+        if (hit) {
+            off += bs;
+        } else if (off + bs < seed_len) {
+            s = http_dl_rsum_roll(s, seed[off], seed[off + bs], bs);
+            off++;
+        } else {
+            break;
+        }
+    }
+
+    cand[0] = nfull * bs;
+    cand[1] = seed_len - tail;
+    for (j = 0; j < 2 && tail > 0; j++) {
+        off = cand[j];
+        if (off < 0 || off + tail > seed_len
+            || http_dl_rsum(seed + off, tail) != http_dl_delta_weak(m, nfull)) {
+            continue;
+        }
+        http_dl_delta_strong(seed + off, tail, strong);
+        if (memcmp(m->recs + nfull * HTTP_DL_DELTA_REC_LEN + 4, strong, 8) == 0) {
+            found++;
+            cb(nfull, off, arg);
+            break;
+        }
+    }
+
+    free(head);
+    free(next);
+    free(done);
+
+    return found;
+}
+
+#endif /* __HTTP_DL_DELTA_H__ */
@@ -0,0 +1,544 @@
+#ifndef __HTTP_DL_DIGEST_H__
+#define __HTTP_DL_DIGEST_H__
+
+/*
+ * ʽժҪ㣬ʱдļݱձ㣬ؽУ飬ٶһļ
+ * ֧SHA-256CRC32CXXH64x86ʱSHA-NISSE4.2ʱӲָ
+ */
+
+#include <stdio.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HTTP_DL_DIGEST_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+typedef enum http_dl_digest_type_e {
+    HTTP_DL_DIGEST_NONE = 0,
+    HTTP_DL_DIGEST_SHA256,
+    HTTP_DL_DIGEST_CRC32C,
+    HTTP_DL_DIGEST_XXH64,
+} http_dl_digest_type_t;
+
+#define HTTP_DL_DIGEST_MAX_LEN  32  /* SHA-25632ֽ */
+
+typedef struct http_dl_digest_s {
+    http_dl_digest_type_t type;
+    union {
+        struct {
+            uint32_t state[8];
+            uint64_t total;
+            unsigned char block[64];
+            int block_len;
+        } sha256;
+        uint32_t crc32c;
+        struct {
+            uint64_t v[4];
+            uint64_t total;
+            unsigned char block[32];
+            int block_len;
+        } xxh64;
+    } u;
+    unsigned char expect[HTTP_DL_DIGEST_MAX_LEN];   /* URLбиֵ */
+    int expect_len;                                 /* 0ʾֻ㲻У */
+    char hex[HTTP_DL_DIGEST_MAX_LEN * 2 + 1];       /* Ľʮ */
+} http_dl_digest_t;
+
+static const char *http_dl_digest_names[] = {
+    "none", "sha256", "crc32c", "xxh64",
+};
+
+static __inline__ int http_dl_digest_len(http_dl_digest_type_t type)
+{
+    switch (type) {
+    case HTTP_DL_DIGEST_SHA256:
+        return 32;
+    case HTTP_DL_DIGEST_CRC32C:
+        return 4;
+    case HTTP_DL_DIGEST_XXH64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+static __inline__ http_dl_digest_type_t http_dl_digest_type_parse(const char *name, int len)
+{
+    int i;
+
+    for (i = HTTP_DL_DIGEST_SHA256; i <= HTTP_DL_DIGEST_XXH64; i++) {
+        if (strlen(http_dl_digest_names[i]) == len
+            && strncasecmp(http_dl_digest_names[i], name, len) == 0) {
+            return i;
+        }
+    }
+
+    return HTTP_DL_DIGEST_NONE;
+}
+
+/* --------------------------- CPUԼ --------------------------- */
+
+#define HTTP_DL_CPU_SHA     0x1
+#define HTTP_DL_CPU_SSE42   0x2
+
+static __inline__ int http_dl_digest_cpu_features()
+{
+    static int features = -1;
+#ifdef HTTP_DL_DIGEST_X86
+    unsigned int eax, ebx, ecx, edx;
+#endif
+
+    if (features >= 0) {
+        return features;
+    }
+
+    features = 0;
+#ifdef HTTP_DL_DIGEST_X86
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2)) {
+        features |= HTTP_DL_CPU_SSE42;
+    }
+    /* SHA-NIleaf 7EBX bit 29ҪSSSE3/SSE4.1ֽͻ */
+    if ((features & HTTP_DL_CPU_SSE42)
+        && __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & (1U << 29))) {
+        features |= HTTP_DL_CPU_SHA;
+    }
+#endif
+
+    return features;
+}
+
+/* ----------------------------- SHA-256 ----------------------------- */
+
+static const uint32_t http_dl_sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define HTTP_DL_ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void http_dl_sha256_blocks_generic(uint32_t *state, const unsigned char *data, size_t nblocks)
+{
+    uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+    int i;
+
+    while (nblocks-- > 0) {
+        for (i = 0; i < 16; i++) {
+            w[i] = ((uint32_t)data[i * 4] << 24) | ((uint32_t)data[i * 4 + 1] << 16)
+                   | ((uint32_t)data[i * 4 + 2] << 8) | (uint32_t)data[i * 4 + 3];
+        }
+        for (i = 16; i < 64; i++) {
+            t1 = HTTP_DL_ROR32(w[i - 2], 17) ^ HTTP_DL_ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            t2 = HTTP_DL_ROR32(w[i - 15], 7) ^ HTTP_DL_ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            w[i] = t1 + w[i - 7] + t2 + w[i - 16];
+        }
+
+        a = state[0]; b = state[1]; c = state[2]; d = state[3];
+        e = state[4]; f = state[5]; g = state[6]; h = state[7];
+        for (i = 0; i < 64; i++) {
+            t1 = h + (HTTP_DL_ROR32(e, 6) ^ HTTP_DL_ROR32(e, 11) ^ HTTP_DL_ROR32(e, 25))
+                 + ((e & f) ^ (~e & g)) + http_dl_sha256_k[i] + w[i];
+            t2 = (HTTP_DL_ROR32(a, 2) ^ HTTP_DL_ROR32(a, 13) ^ HTTP_DL_ROR32(a, 22))
+                 + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+
+        data += 64;
+    }
+}
+
+#ifdef HTTP_DL_DIGEST_X86
+/* SHA-NIʵ֣ÿ4֣Ϣչsha256msg1/msg2msg[]4ѭʹ */
+__attribute__((target("sha,sse4.1,ssse3")))
+static void http_dl_sha256_blocks_shani(uint32_t *state, const unsigned char *data, size_t nblocks)
+{
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i state0, state1, abef_save, cdgh_save, tmp, m, msg[4];
+    int i;
+
+    tmp = _mm_loadu_si128((const __m128i *)&state[0]);
+    state1 = _mm_loadu_si128((const __m128i *)&state[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);             /* CDAB */
+    state1 = _mm_shuffle_epi32(state1, 0x1B);       /* EFGH */
+    state0 = _mm_alignr_epi8(tmp, state1, 8);       /* ABEF */
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);    /* CDGH */
+
+    while (nblocks-- > 0) {
+        abef_save = state0;
+        cdgh_save = state1;
+
+        for (i = 0; i < 16; i++) {
+            if (i < 4) {
+                msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + i * 16)), mask);
+            }
+            m = _mm_add_epi32(msg[i & 3], _mm_loadu_si128((const __m128i *)&http_dl_sha256_k[i * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, m);
+            if (i >= 3 && i < 15) {
+                tmp = _mm_alignr_epi8(msg[i & 3], msg[(i - 1) & 3], 4);
+                msg[(i + 1) & 3] = _mm_add_epi32(msg[(i + 1) & 3], tmp);
+                msg[(i + 1) & 3] = _mm_sha256msg2_epu32(msg[(i + 1) & 3], msg[i & 3]);
+            }
+            m = _mm_shuffle_epi32(m, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, m);
+            if (i >= 1 && i < 13) {
+                msg[(i - 1) & 3] = _mm_sha256msg1_epu32(msg[(i - 1) & 3], msg[i & 3]);
+            }
+        }
+
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+        data += 64;
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);          /* FEBA */
+    state1 = _mm_shuffle_epi32(state1, 0xB1);       /* DCHG */
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);    /* DCBA */
+    state1 = _mm_alignr_epi8(state1, tmp, 8);       /* ABEF */
+    _mm_storeu_si128((__m128i *)&state[0], state0);
+    _mm_storeu_si128((__m128i *)&state[4], state1);
+}
+#endif
+
+static void http_dl_sha256_blocks(uint32_t *state, const unsigned char *data, size_t nblocks)
+{
+#ifdef HTTP_DL_DIGEST_X86
+    if (http_dl_digest_cpu_features() & HTTP_DL_CPU_SHA) {
+        http_dl_sha256_blocks_shani(state, data, nblocks);
+        return;
+    }
+#endif
+    http_dl_sha256_blocks_generic(state, data, nblocks);
+}
+
+/* ----------------------------- CRC32C ------------------------------ */
+
+static uint32_t http_dl_crc32c_table[256];
+
+static void http_dl_crc32c_init_table()
+{
+    uint32_t crc;
+    int i, j;
+
+    if (http_dl_crc32c_table[1] != 0) {
+        return;
+    }
+
+    for (i = 0; i < 256; i++) {
+        crc = i;
+        for (j = 0; j < 8; j++) {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0x82F63B78) : (crc >> 1);
+        }
+        http_dl_crc32c_table[i] = crc;
+    }
+}
+
+static uint32_t http_dl_crc32c_generic(uint32_t crc, const unsigned char *data, size_t len)
+{
+    http_dl_crc32c_init_table();
+    while (len-- > 0) {
+        crc = http_dl_crc32c_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+#ifdef HTTP_DL_DIGEST_X86
+__attribute__((target("sse4.2")))
+static uint32_t http_dl_crc32c_sse42(uint32_t crc, const unsigned char *data, size_t len)
+{
+#ifdef __x86_64__
+    uint64_t crc64 = crc, v;
+
+    while (len >= 8) {
+        memcpy(&v, data, 8);
+        crc64 = _mm_crc32_u64(crc64, v);
+        data += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while (len-- > 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+
+    return crc;
+}
+#endif
+
+static uint32_t http_dl_crc32c_update(uint32_t crc, const unsigned char *data, size_t len)
+{
+#ifdef HTTP_DL_DIGEST_X86
+    if (http_dl_digest_cpu_features() & HTTP_DL_CPU_SSE42) {
+        return http_dl_crc32c_sse42(crc, data, len);
+    }
+#endif
+    return http_dl_crc32c_generic(crc, data, len);
+}
+
+/* ------------------------------ XXH64 ------------------------------ */
+
+#define HTTP_DL_XXH_P1  0x9E3779B185EBCA87ULL
+#define HTTP_DL_XXH_P2  0xC2B2AE3D27D4EB4FULL
+#define HTTP_DL_XXH_P3  0x165667B19E3779F9ULL
+#define HTTP_DL_XXH_P4  0x85EBCA77C2B2AE63ULL
+#define HTTP_DL_XXH_P5  0x27D4EB2F165667C5ULL
+#define HTTP_DL_ROL64(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
+
+static __inline__ uint64_t http_dl_xxh64_read64(const unsigned char *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, 8);   /* XXH64С˶ȡx86Ͼԭ */
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static __inline__ uint32_t http_dl_xxh64_read32(const unsigned char *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, 4);
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static __inline__ uint64_t http_dl_xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * HTTP_DL_XXH_P2;
+    acc = HTTP_DL_ROL64(acc, 31);
+    return acc * HTTP_DL_XXH_P1;
+}
+
+static __inline__ uint64_t http_dl_xxh64_merge(uint64_t acc, uint64_t val)
+{
+    acc ^= http_dl_xxh64_round(0, val);
+    return acc * HTTP_DL_XXH_P1 + HTTP_DL_XXH_P4;
+}
+
+static void http_dl_xxh64_stripes(uint64_t *v, const unsigned char *data, size_t nstripes)
+{
+    while (nstripes-- > 0) {
+        v[0] = http_dl_xxh64_round(v[0], http_dl_xxh64_read64(data));
+        v[1] = http_dl_xxh64_round(v[1], http_dl_xxh64_read64(data + 8));
+        v[2] = http_dl_xxh64_round(v[2], http_dl_xxh64_read64(data + 16));
+        v[3] = http_dl_xxh64_round(v[3], http_dl_xxh64_read64(data + 24));
+        data += 32;
+    }
+}
+
+/* ---------------------------- ͨýӿ ----------------------------- */
+
+static void http_dl_digest_init(http_dl_digest_t *dg, http_dl_digest_type_t type)
+{
+    bzero(&dg->u, sizeof(dg->u));
+    dg->type = type;
+    dg->hex[0] = '\0';
+
+    switch (type) {
+    case HTTP_DL_DIGEST_SHA256:
+        dg->u.sha256.state[0] = 0x6a09e667;
+        dg->u.sha256.state[1] = 0xbb67ae85;
+        dg->u.sha256.state[2] = 0x3c6ef372;
+        dg->u.sha256.state[3] = 0xa54ff53a;
+        dg->u.sha256.state[4] = 0x510e527f;
+        dg->u.sha256.state[5] = 0x9b05688c;
+        dg->u.sha256.state[6] = 0x1f83d9ab;
+        dg->u.sha256.state[7] = 0x5be0cd19;
+        break;
+    case HTTP_DL_DIGEST_CRC32C:
+        dg->u.crc32c = 0xFFFFFFFF;
+        break;
+    case HTTP_DL_DIGEST_XXH64:
+        /* seedΪ0 */
+        dg->u.xxh64.v[0] = HTTP_DL_XXH_P1 + HTTP_DL_XXH_P2;
+        dg->u.xxh64.v[1] = HTTP_DL_XXH_P2;
+        dg->u.xxh64.v[2] = 0;
+        dg->u.xxh64.v[3] = -HTTP_DL_XXH_P1;
+        break;
+    default:
+        break;
+    }
+}
+
+/* Ȳ벻һĻ棬鴦ʣಿ´ */
+static void http_dl_digest_update(http_dl_digest_t *dg, const unsigned char *data, size_t len)
+{
+    size_t n;
+
+    switch (dg->type) {
+    case HTTP_DL_DIGEST_SHA256:
+        dg->u.sha256.total += len;
+        if (dg->u.sha256.block_len > 0) {
+            n = 64 - dg->u.sha256.block_len;
+            n = (len < n) ? len : n;
+            memcpy(dg->u.sha256.block + dg->u.sha256.block_len, data, n);
+            dg->u.sha256.block_len += n;
+            data += n;
+            len -= n;
+            if (dg->u.sha256.block_len < 64) {
+                return;
+            }
+            http_dl_sha256_blocks(dg->u.sha256.state, dg->u.sha256.block, 1);
+            dg->u.sha256.block_len = 0;
+        }
+        if (len >= 64) {
+            http_dl_sha256_blocks(dg->u.sha256.state, data, len / 64);
+            data += len & ~(size_t)63;
+            len &= 63;
+        }
+        memcpy(dg->u.sha256.block, data, len);
+        dg->u.sha256.block_len = len;
+        break;
+    case HTTP_DL_DIGEST_CRC32C:
+        dg->u.crc32c = http_dl_crc32c_update(dg->u.crc32c, data, len);
+        break;
+    case HTTP_DL_DIGEST_XXH64:
+        dg->u.xxh64.total += len;
+        if (dg->u.xxh64.block_len > 0) {
+            n = 32 - dg->u.xxh64.block_len;
+            n = (len < n) ? len : n;
+            memcpy(dg->u.xxh64.block + dg->u.xxh64.block_len, data, n);
+            dg->u.xxh64.block_len += n;
+            data += n;
+            len -= n;
+            if (dg->u.xxh64.block_len < 32) {
+                return;
+            }
+            http_dl_xxh64_stripes(dg->u.xxh64.v, dg->u.xxh64.block, 1);
+            dg->u.xxh64.block_len = 0;
+        }
+        if (len >= 32) {
+            http_dl_xxh64_stripes(dg->u.xxh64.v, data, len / 32);
+            data += len & ~(size_t)31;
+            len &= 31;
+        }
+        memcpy(dg->u.xxh64.block, data, len);
+        dg->u.xxh64.block_len = len;
+        break;
+    default:
+        break;
+    }
+}
+
+/* 㣬дoutˣsha256sum/xxhsumȹߵһ£hex */
+static int http_dl_digest_final(http_dl_digest_t *dg, unsigned char *out)
+{
+    unsigned char pad[128];
+    uint64_t bits, h, *v;
+    const unsigned char *p;
+    int i, len, pad_len;
+
+    switch (dg->type) {
+    case HTTP_DL_DIGEST_SHA256:
+        bits = dg->u.sha256.total * 8;
+        pad_len = (dg->u.sha256.block_len < 56) ? (56 - dg->u.sha256.block_len)
+                                                : (120 - dg->u.sha256.block_len);
+        bzero(pad, sizeof(pad));
+        pad[0] = 0x80;
+        for (i = 0; i < 8; i++) {
+            pad[pad_len + i] = (unsigned char)(bits >> (56 - i * 8));
+        }
+        http_dl_digest_update(dg, pad, pad_len + 8);
+        for (i = 0; i < 8; i++) {
+            out[i * 4] = dg->u.sha256.state[i] >> 24;
+            out[i * 4 + 1] = dg->u.sha256.state[i] >> 16;
+            out[i * 4 + 2] = dg->u.sha256.state[i] >> 8;
+            out[i * 4 + 3] = dg->u.sha256.state[i];
+        }
+        break;
+    case HTTP_DL_DIGEST_CRC32C:
+        h = dg->u.crc32c ^ 0xFFFFFFFF;
+        for (i = 0; i < 4; i++) {
+            out[i] = (unsigned char)(h >> (24 - i * 8));
+        }
+        break;
+    case HTTP_DL_DIGEST_XXH64:
+        v = dg->u.xxh64.v;
+        if (dg->u.xxh64.total >= 32) {
+            h = HTTP_DL_ROL64(v[0], 1) + HTTP_DL_ROL64(v[1], 7)
+                + HTTP_DL_ROL64(v[2], 12) + HTTP_DL_ROL64(v[3], 18);
+            for (i = 0; i < 4; i++) {
+                h = http_dl_xxh64_merge(h, v[i]);
+            }
+        } else {
+            h = v[2] + HTTP_DL_XXH_P5;  /* v[2]seed */
+        }
+        h += dg->u.xxh64.total;
+
+        p = dg->u.xxh64.block;
+        len = dg->u.xxh64.block_len;
+        for (; len >= 8; p += 8, len -= 8) {
+            h ^= http_dl_xxh64_round(0, http_dl_xxh64_read64(p));
+            h = HTTP_DL_ROL64(h, 27) * HTTP_DL_XXH_P1 + HTTP_DL_XXH_P4;
+        }
+        if (len >= 4) {
+            h ^= (uint64_t)http_dl_xxh64_read32(p) * HTTP_DL_XXH_P1;
+            h = HTTP_DL_ROL64(h, 23) * HTTP_DL_XXH_P2 + HTTP_DL_XXH_P3;
+            p += 4;
+            len -= 4;
+        }
+        for (; len > 0; p++, len--) {
+            h ^= (*p) * HTTP_DL_XXH_P5;
+            h = HTTP_DL_ROL64(h, 11) * HTTP_DL_XXH_P1;
+        }
+        h ^= h >> 33;
+        h *= HTTP_DL_XXH_P2;
+        h ^= h >> 29;
+        h *= HTTP_DL_XXH_P3;
+        h ^= h >> 32;
+        for (i = 0; i < 8; i++) {
+            out[i] = (unsigned char)(h >> (56 - i * 8));
+        }
+        break;
+    default:
+        return 0;
+    }
+
+    len = http_dl_digest_len(dg->type);
+    for (i = 0; i < len; i++) {
+        sprintf(dg->hex + i * 2, "%02x", out[i]);
+    }
+
+    return len;
+}
+
+/* ʮƵֵȱ㷨һ */
+static int http_dl_digest_set_expect(http_dl_digest_t *dg, const char *hex, int hex_len)
+{
+    int i, hi, lo;
+
+    if (hex_len != http_dl_digest_len(dg->type) * 2) {
+        return -1;
+    }
+
+    for (i = 0; i < hex_len / 2; i++) {
+        if (!isxdigit(hex[i * 2]) || !isxdigit(hex[i * 2 + 1])) {
+            return -1;
+        }
+        hi = isdigit(hex[i * 2]) ? hex[i * 2] - '0' : tolower(hex[i * 2]) - 'a' + 10;
+        lo = isdigit(hex[i * 2 + 1]) ? hex[i * 2 + 1] - '0' : tolower(hex[i * 2 + 1]) - 'a' + 10;
+        dg->expect[i] = (hi << 4) | lo;
+    }
+    dg->expect_len = hex_len / 2;
+
+    return 0;
+}
+
+#endif /* __HTTP_DL_DIGEST_H__ */
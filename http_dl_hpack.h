@@ -0,0 +1,550 @@
+#ifndef __HTTP_DL_HPACK_H__
+#define __HTTP_DL_HPACK_H__
+
+/*
+ * HPACK(RFC 7541)HTTP/2ͷѹ
+ * ֧־̬̬Huffmanַÿͷͨصߣ
+ * ֻڷȫò붯̬Ҫά˵Ķ̬
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HTTP_DL_HPACK_TABLE_SIZE    4096    /* ̬ĬϴСSETTINGS_HEADER_TABLE_SIZE */
+#define HTTP_DL_HPACK_MAX_ENTRIES   (HTTP_DL_HPACK_TABLE_SIZE / 32) /* ÿ32ֽ */
+#define HTTP_DL_HPACK_STR_LEN       8192    /* ͷֵֻ󳤶 */
+#define HTTP_DL_HPACK_STATIC_LEN    61
+
+/* õľ̬ */
+#define HTTP_DL_HPACK_AUTHORITY     1
+#define HTTP_DL_HPACK_METHOD_GET    2
+#define HTTP_DL_HPACK_PATH          4
+#define HTTP_DL_HPACK_SCHEME_HTTP   6
+#define HTTP_DL_HPACK_SCHEME_HTTPS  7
+#define HTTP_DL_HPACK_ACCEPT_ENCODING   16
+#define HTTP_DL_HPACK_ACCEPT        19
+#define HTTP_DL_HPACK_RANGE         50
+#define HTTP_DL_HPACK_USER_AGENT    58
+
+typedef struct http_dl_hpack_entry_s {
+    char *name;                     /* namevalueͬһڴ */
+    char *value;
+    int nlen;
+    int vlen;
+} http_dl_hpack_entry_t;
+
+typedef struct http_dl_hpack_s {
+    http_dl_hpack_entry_t ents[HTTP_DL_HPACK_MAX_ENTRIES];  /* 飬headΪµı */
+    int head;
+    int count;
+    int size;                       /* ǰռãÿΪnlen + vlen + 32 */
+    int max_size;                   /* ԶͨСָãlimit */
+    int limit;                      /* SETTINGSͨĴС */
+    char nbuf[HTTP_DL_HPACK_STR_LEN];   /* Huffmanʱռ */
+    char vbuf[HTTP_DL_HPACK_STR_LEN];
+} http_dl_hpack_t;
+
+/* ÿһͷһΣط0ʱֹͣ */
+typedef int (*http_dl_hpack_cb_t)(const char *name, int nlen,
+                                  const char *value, int vlen, void *arg);
+
+static const char *http_dl_hpack_static[HTTP_DL_HPACK_STATIC_LEN][2] = {
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" },
+};
+
+/* HuffmanУ{, λ}256ΪEOS */
+static const struct {
+    uint32_t code;
+    int bits;
+} http_dl_hpack_huff[257] = {
+    { 0x00001ff8, 13 }, { 0x007fffd8, 23 }, { 0x0fffffe2, 28 }, { 0x0fffffe3, 28 },
+    { 0x0fffffe4, 28 }, { 0x0fffffe5, 28 }, { 0x0fffffe6, 28 }, { 0x0fffffe7, 28 },
+    { 0x0fffffe8, 28 }, { 0x00ffffea, 24 }, { 0x3ffffffc, 30 }, { 0x0fffffe9, 28 },
+    { 0x0fffffea, 28 }, { 0x3ffffffd, 30 }, { 0x0fffffeb, 28 }, { 0x0fffffec, 28 },
+    { 0x0fffffed, 28 }, { 0x0fffffee, 28 }, { 0x0fffffef, 28 }, { 0x0ffffff0, 28 },
+    { 0x0ffffff1, 28 }, { 0x0ffffff2, 28 }, { 0x3ffffffe, 30 }, { 0x0ffffff3, 28 },
+    { 0x0ffffff4, 28 }, { 0x0ffffff5, 28 }, { 0x0ffffff6, 28 }, { 0x0ffffff7, 28 },
+    { 0x0ffffff8, 28 }, { 0x0ffffff9, 28 }, { 0x0ffffffa, 28 }, { 0x0ffffffb, 28 },
+    { 0x00000014,  6 }, { 0x000003f8, 10 }, { 0x000003f9, 10 }, { 0x00000ffa, 12 },
+    { 0x00001ff9, 13 }, { 0x00000015,  6 }, { 0x000000f8,  8 }, { 0x000007fa, 11 },
+    { 0x000003fa, 10 }, { 0x000003fb, 10 }, { 0x000000f9,  8 }, { 0x000007fb, 11 },
+    { 0x000000fa,  8 }, { 0x00000016,  6 }, { 0x00000017,  6 }, { 0x00000018,  6 },
+    { 0x00000000,  5 }, { 0x00000001,  5 }, { 0x00000002,  5 }, { 0x00000019,  6 },
+    { 0x0000001a,  6 }, { 0x0000001b,  6 }, { 0x0000001c,  6 }, { 0x0000001d,  6 },
+    { 0x0000001e,  6 }, { 0x0000001f,  6 }, { 0x0000005c,  7 }, { 0x000000fb,  8 },
+    { 0x00007ffc, 15 }, { 0x00000020,  6 }, { 0x00000ffb, 12 }, { 0x000003fc, 10 },
+    { 0x00001ffa, 13 }, { 0x00000021,  6 }, { 0x0000005d,  7 }, { 0x0000005e,  7 },
+    { 0x0000005f,  7 }, { 0x00000060,  7 }, { 0x00000061,  7 }, { 0x00000062,  7 },
+    { 0x00000063,  7 }, { 0x00000064,  7 }, { 0x00000065,  7 }, { 0x00000066,  7 },
+    { 0x00000067,  7 }, { 0x00000068,  7 }, { 0x00000069,  7 }, { 0x0000006a,  7 },
+    { 0x0000006b,  7 }, { 0x0000006c,  7 }, { 0x0000006d,  7 }, { 0x0000006e,  7 },
+    { 0x0000006f,  7 }, { 0x00000070,  7 }, { 0x00000071,  7 }, { 0x00000072,  7 },
+    { 0x000000fc,  8 }, { 0x00000073,  7 }, { 0x000000fd,  8 }, { 0x00001ffb, 13 },
+    { 0x0007fff0, 19 }, { 0x00001ffc, 13 }, { 0x00003ffc, 14 }, { 0x00000022,  6 },
+    { 0x00007ffd, 15 }, { 0x00000003,  5 }, { 0x00000023,  6 }, { 0x00000004,  5 },
+    { 0x00000024,  6 }, { 0x00000005,  5 }, { 0x00000025,  6 }, { 0x00000026,  6 },
+    { 0x00000027,  6 }, { 0x00000006,  5 }, { 0x00000074,  7 }, { 0x00000075,  7 },
+    { 0x00000028,  6 }, { 0x00000029,  6 }, { 0x0000002a,  6 }, { 0x00000007,  5 },
+    { 0x0000002b,  6 }, { 0x00000076,  7 }, { 0x0000002c,  6 }, { 0x00000008,  5 },
+    { 0x00000009,  5 }, { 0x0000002d,  6 }, { 0x00000077,  7 }, { 0x00000078,  7 },
+    { 0x00000079,  7 }, { 0x0000007a,  7 }, { 0x0000007b,  7 }, { 0x00007ffe, 15 },
+    { 0x000007fc, 11 }, { 0x00003ffd, 14 }, { 0x00001ffd, 13 }, { 0x0ffffffc, 28 },
+    { 0x000fffe6, 20 }, { 0x003fffd2, 22 }, { 0x000fffe7, 20 }, { 0x000fffe8, 20 },
+    { 0x003fffd3, 22 }, { 0x003fffd4, 22 }, { 0x003fffd5, 22 }, { 0x007fffd9, 23 },
+    { 0x003fffd6, 22 }, { 0x007fffda, 23 }, { 0x007fffdb, 23 }, { 0x007fffdc, 23 },
+    { 0x007fffdd, 23 }, { 0x007fffde, 23 }, { 0x00ffffeb, 24 }, { 0x007fffdf, 23 },
+    { 0x00ffffec, 24 }, { 0x00ffffed, 24 }, { 0x003fffd7, 22 }, { 0x007fffe0, 23 },
+    { 0x00ffffee, 24 }, { 0x007fffe1, 23 }, { 0x007fffe2, 23 }, { 0x007fffe3, 23 },
+    { 0x007fffe4, 23 }, { 0x001fffdc, 21 }, { 0x003fffd8, 22 }, { 0x007fffe5, 23 },
+    { 0x003fffd9, 22 }, { 0x007fffe6, 23 }, { 0x007fffe7, 23 }, { 0x00ffffef, 24 },
+    { 0x003fffda, 22 }, { 0x001fffdd, 21 }, { 0x000fffe9, 20 }, { 0x003fffdb, 22 },
+    { 0x003fffdc, 22 }, { 0x007fffe8, 23 }, { 0x007fffe9, 23 }, { 0x001fffde, 21 },
+    { 0x007fffea, 23 }, { 0x003fffdd, 22 }, { 0x003fffde, 22 }, { 0x00fffff0, 24 },
+    { 0x001fffdf, 21 }, { 0x003fffdf, 22 }, { 0x007fffeb, 23 }, { 0x007fffec, 23 },
+    { 0x001fffe0, 21 }, { 0x001fffe1, 21 }, { 0x003fffe0, 22 }, { 0x001fffe2, 21 },
+    { 0x007fffed, 23 }, { 0x003fffe1, 22 }, { 0x007fffee, 23 }, { 0x007fffef, 23 },
+    { 0x000fffea, 20 }, { 0x003fffe2, 22 }, { 0x003fffe3, 22 }, { 0x003fffe4, 22 },
+    { 0x007ffff0, 23 }, { 0x003fffe5, 22 }, { 0x003fffe6, 22 }, { 0x007ffff1, 23 },
+    { 0x03ffffe0, 26 }, { 0x03ffffe1, 26 }, { 0x000fffeb, 20 }, { 0x0007fff1, 19 },
+    { 0x003fffe7, 22 }, { 0x007ffff2, 23 }, { 0x003fffe8, 22 }, { 0x01ffffec, 25 },
+    { 0x03ffffe2, 26 }, { 0x03ffffe3, 26 }, { 0x03ffffe4, 26 }, { 0x07ffffde, 27 },
+    { 0x07ffffdf, 27 }, { 0x03ffffe5, 26 }, { 0x00fffff1, 24 }, { 0x01ffffed, 25 },
+    { 0x0007fff2, 19 }, { 0x001fffe3, 21 }, { 0x03ffffe6, 26 }, { 0x07ffffe0, 27 },
+    { 0x07ffffe1, 27 }, { 0x03ffffe7, 26 }, { 0x07ffffe2, 27 }, { 0x00fffff2, 24 },
+    { 0x001fffe4, 21 }, { 0x001fffe5, 21 }, { 0x03ffffe8, 26 }, { 0x03ffffe9, 26 },
+    { 0x0ffffffd, 28 }, { 0x07ffffe3, 27 }, { 0x07ffffe4, 27 }, { 0x07ffffe5, 27 },
+    { 0x000fffec, 20 }, { 0x00fffff3, 24 }, { 0x000fffed, 20 }, { 0x001fffe6, 21 },
+    { 0x003fffe9, 22 }, { 0x001fffe7, 21 }, { 0x001fffe8, 21 }, { 0x007ffff3, 23 },
+    { 0x003fffea, 22 }, { 0x003fffeb, 22 }, { 0x01ffffee, 25 }, { 0x01ffffef, 25 },
+    { 0x00fffff4, 24 }, { 0x00fffff5, 24 }, { 0x03ffffea, 26 }, { 0x007ffff4, 23 },
+    { 0x03ffffeb, 26 }, { 0x07ffffe6, 27 }, { 0x03ffffec, 26 }, { 0x03ffffed, 26 },
+    { 0x07ffffe7, 27 }, { 0x07ffffe8, 27 }, { 0x07ffffe9, 27 }, { 0x07ffffea, 27 },
+    { 0x07ffffeb, 27 }, { 0x0ffffffe, 28 }, { 0x07ffffec, 27 }, { 0x07ffffed, 27 },
+    { 0x07ffffee, 27 }, { 0x07ffffef, 27 }, { 0x07fffff0, 27 }, { 0x03ffffee, 26 },
+    { 0x3fffffff, 30 },
+};
+
+/* ǹ淶Huffman룬ֻҪ(λ, )ķźÿλָ */
+static const uint16_t http_dl_hpack_huff_syms[257] = {
+     48,  49,  50,  97,  99, 101, 105, 111, 115, 116,  32,  37,
+     45,  46,  47,  51,  52,  53,  54,  55,  56,  57,  61,  65,
+     95,  98, 100, 102, 103, 104, 108, 109, 110, 112, 114, 117,
+     58,  66,  67,  68,  69,  70,  71,  72,  73,  74,  75,  76,
+     77,  78,  79,  80,  81,  82,  83,  84,  85,  86,  87,  89,
+    106, 107, 113, 118, 119, 120, 121, 122,  38,  42,  44,  59,
+     88,  90,  33,  34,  40,  41,  63,  39,  43, 124,  35,  62,
+      0,  36,  64,  91,  93, 126,  94, 125,  60,  96, 123,  92,
+    195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161,
+    167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+    132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170,
+    173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+    233,   1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+    151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182,
+    183, 188, 191, 197, 231, 239,   9, 142, 144, 145, 148, 159,
+    171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+    200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243,
+    255, 203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245,
+    246, 247, 248, 250, 251, 252, 253, 254,   2,   3,   4,   5,
+      6,   7,   8,  11,  12,  14,  15,  16,  17,  18,  19,  20,
+     21,  23,  24,  25,  26,  27,  28,  29,  30,  31, 127, 220,
+    249,  10,  13,  22, 256,
+};
+
+static const uint16_t http_dl_hpack_huff_counts[31] = {
+    0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3,
+    0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4,
+};
+
+static void http_dl_hpack_init(http_dl_hpack_t *hp, int limit)
+{
+    memset(hp->ents, 0, sizeof(hp->ents));
+    hp->head = 0;
+    hp->count = 0;
+    hp->size = 0;
+    hp->max_size = limit;
+    hp->limit = limit;
+}
+
+static void http_dl_hpack_evict(http_dl_hpack_t *hp, int max_size)
+{
+    http_dl_hpack_entry_t *e;
+    int tail;
+
+    while (hp->count > 0 && hp->size > max_size) {
+        tail = (hp->head + HTTP_DL_HPACK_MAX_ENTRIES - hp->count + 1) % HTTP_DL_HPACK_MAX_ENTRIES;
+        e = &hp->ents[tail];
+        hp->size -= e->nlen + e->vlen + 32;
+        free(e->name);
+        e->name = NULL;
+        hp->count--;
+    }
+}
+
+static void http_dl_hpack_destroy(http_dl_hpack_t *hp)
+{
+    http_dl_hpack_evict(hp, 0);
+}
+
+/* 붯̬0Ųʱն̬(RFC 7541 4.4)󣬷1ʾûм */
+static int http_dl_hpack_add(http_dl_hpack_t *hp, const char *name, int nlen,
+                             const char *value, int vlen)
+{
+    http_dl_hpack_entry_t *e;
+    char *p;
+    int need = nlen + vlen + 32;
+
+    if (need > hp->max_size) {
+        http_dl_hpack_evict(hp, 0);
+        return 1;
+    }
+
+    /* ȸƣnameṷ̈ı */
+    p = malloc(nlen + vlen + 1);
+    if (p == NULL) {
+        return -1;
+    }
+    memcpy(p, name, nlen);
+    memcpy(p + nlen, value, vlen);
+
+    http_dl_hpack_evict(hp, hp->max_size - need);
+    if (hp->count == HTTP_DL_HPACK_MAX_ENTRIES) {
+        free(p);
+        return -1;
+    }
+
+    hp->head = (hp->head + 1) % HTTP_DL_HPACK_MAX_ENTRIES;
+    e = &hp->ents[hp->head];
+    e->name = p;
+    e->nlen = nlen;
+    e->value = p + nlen;
+    e->vlen = vlen;
+    hp->count++;
+    hp->size += need;
+
+    return 0;
+}
+
+/* ȡ1~61Ϊ̬֮Ϊ̬(µǰ) */
+static int http_dl_hpack_lookup(http_dl_hpack_t *hp, uint32_t index,
+                                const char **name, int *nlen, const char **value, int *vlen)
+{
+    http_dl_hpack_entry_t *e;
+
+    if (index == 0) {
+        return -1;
+    }
+
+    if (index <= HTTP_DL_HPACK_STATIC_LEN) {
+        *name = http_dl_hpack_static[index - 1][0];
+        *nlen = strlen(*name);
+        *value = http_dl_hpack_static[index - 1][1];
+        *vlen = strlen(*value);
+        return 0;
+    }
+
+    index -= HTTP_DL_HPACK_STATIC_LEN + 1;
+    if (index >= hp->count) {
+        return -1;
+    }
+    e = &hp->ents[(hp->head + HTTP_DL_HPACK_MAX_ENTRIES - index) % HTTP_DL_HPACK_MAX_ENTRIES];
+    *name = e->name;
+    *nlen = e->nlen;
+    *value = e->value;
+    *vlen = e->vlen;
+
+    return 0;
+}
+
+/* ǰ׺Ϊprefixλĵֽ()-1 */
+static int http_dl_hpack_decode_int(const unsigned char *in, int len, int prefix, uint32_t *out)
+{
+    uint32_t mask = (1U << prefix) - 1, v;
+    int i, shift = 0;
+
+    if (len < 1) {
+        return -1;
+    }
+
+    v = in[0] & mask;
+    if (v < mask) {
+        *out = v;
+        return 1;
+    }
+
+    for (i = 1; i < len; i++) {
+        if (shift > 21) {
+            return -1;
+        }
+        v += (uint32_t)(in[i] & 0x7F) << shift;
+        shift += 7;
+        if ((in[i] & 0x80) == 0) {
+            *out = v;
+            return i + 1;
+        }
+    }
+
+    return -1;
+}
+
+static int http_dl_hpack_huff_decode(const unsigned char *in, int len, char *out, int cap)
+{
+    uint32_t code = 0, first = 0;
+    int i, bit, bits = 0, index = 0, olen = 0, ones = 0;
+
+    for (i = 0; i < len; i++) {
+        for (bit = 7; bit >= 0; bit--) {
+            code = (code << 1) | ((in[i] >> bit) & 1);
+            ones = ((in[i] >> bit) & 1) ? ones + 1 : 0;
+            bits++;
+            if (bits > 30) {
+                return -1;
+            }
+            /* 淶룺ͬλfirstΪλĵһ */
+            if (code - first < http_dl_hpack_huff_counts[bits]) {
+                if (http_dl_hpack_huff_syms[index + code - first] == 256 || olen >= cap) {
+                    /* ַвEOS */
+                    return -1;
+                }
+                out[olen++] = http_dl_hpack_huff_syms[index + code - first];
+                code = 0;
+                first = 0;
+                bits = 0;
+                index = 0;
+                ones = 0;
+                continue;
+            }
+            index += http_dl_hpack_huff_counts[bits];
+            first = (first + http_dl_hpack_huff_counts[bits]) << 1;
+        }
+    }
+
+    /* βEOSǰ׺(ȫ1)Ҳ7λ */
+    if (bits > 7 || ones != bits) {
+        return -1;
+    }
+
+    return olen;
+}
+
+/* һַĵֽHuffmanĽ⵽buf */
+static int http_dl_hpack_decode_str(const unsigned char *in, int len, char *buf,
+                                    const char **str, int *slen)
+{
+    uint32_t n;
+    int used;
+
+    used = http_dl_hpack_decode_int(in, len, 7, &n);
+    if (used < 0 || n > len - used) {
+        return -1;
+    }
+
+    if (in[0] & 0x80) {
+        *slen = http_dl_hpack_huff_decode(in + used, n, buf, HTTP_DL_HPACK_STR_LEN);
+        if (*slen < 0) {
+            return -1;
+        }
+        *str = buf;
+    } else {
+        if (n > HTTP_DL_HPACK_STR_LEN) {
+            return -1;
+        }
+        *str = (const char *)in + used;
+        *slen = n;
+    }
+
+    return used + n;
+}
+
+/* һͷ飬-1ʱӱCOMPRESSION_ERRORر */
+static int http_dl_hpack_decode(http_dl_hpack_t *hp, const unsigned char *in, int len,
+                                http_dl_hpack_cb_t cb, void *arg)
+{
+    const char *name, *value;
+    int nlen, vlen, used, prefix, pos = 0;
+    uint32_t index;
+
+    while (pos < len) {
+        if (in[pos] & 0x80) {
+            /* ʾ */
+            used = http_dl_hpack_decode_int(in + pos, len - pos, 7, &index);
+            if (used < 0
+                || http_dl_hpack_lookup(hp, index, &name, &nlen, &value, &vlen) != 0) {
+                return -1;
+            }
+            pos += used;
+        } else if ((in[pos] & 0xE0) == 0x20) {
+            /* ̬С */
+            used = http_dl_hpack_decode_int(in + pos, len - pos, 5, &index);
+            if (used < 0 || index > hp->limit) {
+                return -1;
+            }
+            hp->max_size = index;
+            http_dl_hpack_evict(hp, hp->max_size);
+            pos += used;
+            continue;
+        } else {
+            /* 0100000001 */
+            prefix = (in[pos] & 0x40) ? 6 : 4;
+            used = http_dl_hpack_decode_int(in + pos, len - pos, prefix, &index);
+            if (used < 0) {
+                return -1;
+            }
+            pos += used;
+            if (index == 0) {
+                used = http_dl_hpack_decode_str(in + pos, len - pos, hp->nbuf, &name, &nlen);
+                if (used < 0) {
+                    return -1;
+                }
+                pos += used;
+            } else if (http_dl_hpack_lookup(hp, index, &name, &nlen, &value, &vlen) != 0) {
+                return -1;
+            }
+            used = http_dl_hpack_decode_str(in + pos, len - pos, hp->vbuf, &value, &vlen);
+            if (used < 0) {
+                return -1;
+            }
+            pos += used;
+            if (prefix == 6) {
+                /*
+                 * ʱ̭nameõı(Ųʱ)ȰnameƵnbuf
+                 * صøƵġvaluevbufУӰ졣̬еֶ
+                 * http_dl_hpack_decode_strᳬnbuf
+                 */
+                if (name != hp->nbuf) {
+                    memcpy(hp->nbuf, name, nlen);
+                    name = hp->nbuf;
+                }
+                if (http_dl_hpack_add(hp, name, nlen, value, vlen) < 0) {
+                    return -1;
+                }
+            }
+        }
+
+        if (cb(name, nlen, value, vlen, arg) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* ǰ׺ΪprefixλfirstΪֽڵĸλ־дֽռ䲻㷵-1 */
+static int http_dl_hpack_encode_int(unsigned char *out, int cap, uint32_t v,
+                                    int prefix, unsigned char first)
+{
+    uint32_t mask = (1U << prefix) - 1;
+    int n = 0;
+
+    if (cap < 1) {
+        return -1;
+    }
+
+    if (v < mask) {
+        out[n++] = first | v;
+        return n;
+    }
+
+    out[n++] = first | mask;
+    v -= mask;
+    while (v >= 0x80) {
+        if (n >= cap) {
+            return -1;
+        }
+        out[n++] = (v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+    if (n >= cap) {
+        return -1;
+    }
+    out[n++] = v;
+
+    return n;
+}
+
+/* ̬е":method: GET" */
+static int http_dl_hpack_encode_indexed(unsigned char *out, int cap, int index)
+{
+    return http_dl_hpack_encode_int(out, cap, index, 7, 0x80);
+}
+
+/* ȡ̬indexֵΪ붯̬Huffman */
+static int http_dl_hpack_encode_literal(unsigned char *out, int cap, int index,
+                                        const char *value, int vlen)
+{
+    int n, m;
+
+    n = http_dl_hpack_encode_int(out, cap, index, 4, 0x00);
+    if (n < 0) {
+        return -1;
+    }
+    m = http_dl_hpack_encode_int(out + n, cap - n, vlen, 7, 0x00);
+    if (m < 0 || n + m + vlen > cap) {
+        return -1;
+    }
+    memcpy(out + n + m, value, vlen);
+
+    return n + m + vlen;
+}
+
+#endif /* __HTTP_DL_HPACK_H__ */
@@ -0,0 +1,80 @@
+#ifndef __HTTP_DL_MPSC_H__
+#define __HTTP_DL_MPSC_H__
+
+/*
+ * Ķߵ߶(VyukovʽMPSC)
+ * ڵǶԪУһԭӽһдڴ棬Ҳʧܣ
+ * ֻһ߳̽С߽headûnextʱʱϿ
+ * ʱӷNULLΪգ֮Ļѱ֤©
+ */
+
+#include <stddef.h>
+
+typedef struct http_dl_mpsc_node_s {
+    struct http_dl_mpsc_node_s *next;
+} http_dl_mpsc_node_t;
+
+typedef struct http_dl_mpsc_s {
+    http_dl_mpsc_node_t *head;          /* һ࣬ӵĽڵ */
+    char pad[64 - sizeof(void *)];      /* headtailڲͬcache line໥ʧЧ */
+    http_dl_mpsc_node_t *tail;          /* һ࣬һӽڵǰһ */
+    http_dl_mpsc_node_t stub;           /* Ϊʱheadtailָ */
+} http_dl_mpsc_t;
+
+static inline void http_dl_mpsc_init(http_dl_mpsc_t *q)
+{
+    q->stub.next = NULL;
+    q->head = &q->stub;
+    q->tail = &q->stub;
+}
+
+/* ̶߳Ե */
+static inline void http_dl_mpsc_push(http_dl_mpsc_t *q, http_dl_mpsc_node_t *node)
+{
+    http_dl_mpsc_node_t *prev;
+
+    __atomic_store_n(&node->next, NULL, __ATOMIC_RELAXED);
+    prev = __atomic_exchange_n(&q->head, node, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+}
+
+/* ̵ֻ߳ãΪջʱϿʱNULL */
+static inline http_dl_mpsc_node_t *http_dl_mpsc_pop(http_dl_mpsc_t *q)
+{
+    http_dl_mpsc_node_t *tail = q->tail;
+    http_dl_mpsc_node_t *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    http_dl_mpsc_node_t *head;
+
+    if (tail == &q->stub) {
+        if (next == NULL) {
+            return NULL;
+        }
+        /* stub */
+        q->tail = next;
+        tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next != NULL) {
+        q->tail = next;
+        return tail;
+    }
+
+    head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    if (tail != head) {
+        /*  */
+        return NULL;
+    }
+
+    /* tailһڵ㣬stub·ŻضβȡtailöжϿ */
+    http_dl_mpsc_push(q, &q->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next != NULL) {
+        q->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+#endif /* __HTTP_DL_MPSC_H__ */
@@ -0,0 +1,292 @@
+#ifndef __HTTP_DL_PARSE_H__
+#define __HTTP_DL_PARSE_H__
+
+/*
+ * HTTP/1.xӦ״̬кͷmultipart/byterangesÿεͷҲ
+ * ڴ棬Ҫ'\0'βֻ[p, p + len)еݣָ붼ָߵĻ
+ * УԭһΣκһֽڴϿһ
+ * ֶһг߻СʱȲβ
+ */
+
+#include <limits.h>
+#include <string.h>
+#include <strings.h>
+
+#define HTTP_DL_PARSE_AGAIN     1       /* лû */
+#define HTTP_DL_PARSE_OK        0
+#define HTTP_DL_PARSE_EINVAL    (-1)    /* ʽ */
+#define HTTP_DL_PARSE_ETOOLONG  (-2)    /* һбȵߵĻԶղ */
+#define HTTP_DL_PARSE_ECALLBACK (-3)    /* صط0Ҫֹͣ */
+
+typedef struct http_dl_status_s {
+    int major;
+    int minor;
+    int code;
+    const char *reason;             /* ԭΪ */
+    int reason_len;
+} http_dl_status_t;
+
+/*
+ * Content-Range: bytes first-last/lengthlengthδ֪("*")ʱΪ-1
+ * 416unsatisfied-range(Ǻšбܡܳ)û䣬firstlastΪ-1
+ */
+typedef struct http_dl_range_s {
+    long first_byte_pos;
+    long last_byte_pos;
+    long entity_length;
+} http_dl_range_t;
+
+/*
+ * ÿͷһΣnamevalueߵĿհסط0ʱֹͣhttp_dl_parse_fields
+ * ͳһECALLBACKAGAINȲԭɻصԼargС
+ */
+typedef int (*http_dl_field_cb_t)(const char *name, int nlen,
+                                  const char *value, int vlen, void *arg);
+
+/*
+ * [p, p + len)ĿͷһСʱOK*line_lenΪCRLFĳȣ
+ * *advΪͬCRLFĳȣбCRLFLFʽ
+ * maxΪ߻ĴСѾôûβʱETOOLONG
+ */
+static inline int http_dl_parse_line(const char *p, int len, int max, int *line_len, int *adv)
+{
+    const char *lf;
+
+    lf = memchr(p, '\n', len);
+    if (lf == NULL) {
+        return (len >= max) ? HTTP_DL_PARSE_ETOOLONG : HTTP_DL_PARSE_AGAIN;
+    }
+    if (lf == p || lf[-1] != '\r') {
+        return HTTP_DL_PARSE_EINVAL;
+    }
+
+    *line_len = lf - 1 - p;
+    *adv = lf + 1 - p;
+
+    return HTTP_DL_PARSE_OK;
+}
+
+/* *ppʼһǸʮһλLONG_MAXʱ*ppƵ֮ */
+static inline int http_dl_parse_digits(const char **pp, const char *end, long *val)
+{
+    const char *p = *pp;
+    unsigned int d;
+    long v = 0;
+
+    for (; p < end && (d = (unsigned char)*p - '0') <= 9; p++) {
+        if (v > (LONG_MAX - d) / 10) {
+            return HTTP_DL_PARSE_EINVAL;
+        }
+        v = v * 10 + d;
+    }
+    if (p == *pp) {
+        return HTTP_DL_PARSE_EINVAL;
+    }
+
+    *pp = p;
+    *val = v;
+
+    return HTTP_DL_PARSE_OK;
+}
+
+/* ֵ֣Content-Length */
+static inline int http_dl_parse_ulong(const char *p, int len, long *val)
+{
+    const char *end = p + len;
+
+    if (http_dl_parse_digits(&p, end, val) != HTTP_DL_PARSE_OK || p != end) {
+        return HTTP_DL_PARSE_EINVAL;
+    }
+
+    return HTTP_DL_PARSE_OK;
+}
+
+/*
+ * ״̬(CRLF)HTTP/DIGIT.DIGIT SP 3DIGIT [SP reason]RFC 9112 4
+ * еķʡ״̬ĿոԭҲܡ
+ * Ӧ"HTTP/1.1 200 ""HTTP/1.1 206 "ͷαȽһξ͹ˣ
+ * һ8ֽڼһ4ֽڵıȽϡ
+ */
+static inline int http_dl_parse_status(const char *p, int len, http_dl_status_t *st)
+{
+    if (len >= 12 && (len == 12 || p[12] == ' ')
+        && (memcmp(p, "HTTP/1.1 200", 12) == 0 || memcmp(p, "HTTP/1.1 206", 12) == 0)) {
+        st->major = 1;
+        st->minor = 1;
+        st->code = (p[11] == '0') ? 200 : 206;
+    } else {
+        if (len < 12 || memcmp(p, "HTTP/", 5) != 0
+            || (unsigned char)(p[5] - '0') > 9 || p[6] != '.' || (unsigned char)(p[7] - '0') > 9
+            || p[8] != ' ' || (unsigned char)(p[9] - '0') > 9
+            || (unsigned char)(p[10] - '0') > 9 || (unsigned char)(p[11] - '0') > 9
+            || (len > 12 && p[12] != ' ')) {
+            return HTTP_DL_PARSE_EINVAL;
+        }
+        st->major = p[5] - '0';
+        st->minor = p[7] - '0';
+        st->code = 100 * (p[9] - '0') + 10 * (p[10] - '0') + (p[11] - '0');
+    }
+
+    st->reason = p + ((len > 13) ? 13 : len);
+    st->reason_len = (len > 13) ? len - 13 : 0;
+
+    return HTTP_DL_PARSE_OK;
+}
+
+/*
+ * ͷ(CRLF)name ":" OWS value OWSRFC 9110 5
+ * впհ׺Ϳַ(ðǰĿհװRFC 9112 5.1ܾ)
+ * ֵвNULCRֵߵĿհȥ
+ */
+static inline int http_dl_parse_field(const char *p, int len, const char **name, int *nlen,
+                                      const char **value, int *vlen)
+{
+    const char *colon, *v, *end = p + len;
+    unsigned char c;
+
+    colon = memchr(p, ':', len);
+    if (colon == NULL || colon == p) {
+        return HTTP_DL_PARSE_EINVAL;
+    }
+    for (v = p; v < colon; v++) {
+        c = *v;
+        if (c <= ' ' || c >= 0x7f) {
+            return HTTP_DL_PARSE_EINVAL;
+        }
+    }
+
+    for (v = colon + 1; v < end && (*v == ' ' || *v == '\t'); v++) {
+        ;
+    }
+    while (end > v && (end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
+    }
+    if (memchr(v, '\0', end - v) != NULL || memchr(v, '\r', end - v) != NULL) {
+        return HTTP_DL_PARSE_EINVAL;
+    }
+
+    *name = p;
+    *nlen = colon - p;
+    *value = v;
+    *vlen = end - v;
+
+    return HTTP_DL_PARSE_OK;
+}
+
+/*
+ * [p, p + len)ͷУÿͷһcb*usedΪֽ
+ * ͷĿзOK(м*used)ݲAGAINʣµĲ´Ρ
+ * Կհ׿ͷ(obs-foldRFC 9112 5.2ѷ)ԵƴһͷС
+ */
+static inline int http_dl_parse_fields(const char *p, int len, int max, int *used,
+                                       http_dl_field_cb_t cb, void *arg)
+{
+    const char *name, *value;
+    int nlen, vlen, line_len, adv, ret;
+
+    *used = 0;
+    while (1) {
+        ret = http_dl_parse_line(p + *used, len - *used, max, &line_len, &adv);
+        if (ret != HTTP_DL_PARSE_OK) {
+            return ret;
+        }
+        if (line_len == 0) {
+            *used += adv;
+            return HTTP_DL_PARSE_OK;
+        }
+
+        if (p[*used] != ' ' && p[*used] != '\t') {
+            ret = http_dl_parse_field(p + *used, line_len, &name, &nlen, &value, &vlen);
+            if (ret != HTTP_DL_PARSE_OK) {
+                return ret;
+            }
+            if (cb(name, nlen, value, vlen, arg) != 0) {
+                return HTTP_DL_PARSE_ECALLBACK;
+            }
+        }
+        *used += adv;
+    }
+}
+
+/*
+ * Content-Rangeֵbytes first-last/lengthδ֪ʱΪ"*"RFC 9110 14.4
+ * еĴʡ"bytes"ҲܡҪfirst <= last֪lengthʱlast < length
+ * 416unsatisfied-range(Ǻšбܡܳ)ҲܣfirstlastΪ-1ܳȱ֡
+ */
+static inline int http_dl_parse_content_range(const char *p, int len, http_dl_range_t *range)
+{
+    const char *end = p + len;
+
+    if (len >= 5 && strncasecmp(p, "bytes", 5) == 0) {
+        for (p += 5; p < end && (*p == ' ' || *p == '\t'); p++) {
+            ;
+        }
+    }
+
+    if (end - p >= 2 && p[0] == '*' && p[1] == '/') {
+        range->first_byte_pos = -1;
+        range->last_byte_pos = -1;
+        return http_dl_parse_ulong(p + 2, end - p - 2, &range->entity_length);
+    }
+
+    if (http_dl_parse_digits(&p, end, &range->first_byte_pos) != HTTP_DL_PARSE_OK
+        || p == end || *p++ != '-'
+        || http_dl_parse_digits(&p, end, &range->last_byte_pos) != HTTP_DL_PARSE_OK
+        || p == end || *p++ != '/'
+        || range->first_byte_pos > range->last_byte_pos) {
+        return HTTP_DL_PARSE_EINVAL;
+    }
+
+    if (end - p == 1 && *p == '*') {
+        range->entity_length = -1;
+        return HTTP_DL_PARSE_OK;
+    }
+    if (http_dl_parse_ulong(p, end - p, &range->entity_length) != HTTP_DL_PARSE_OK
+        || range->last_byte_pos >= range->entity_length) {
+        return HTTP_DL_PARSE_EINVAL;
+    }
+
+    return HTTP_DL_PARSE_OK;
+}
+
+/*
+ * Content-TypemultipartboundaryԴţRFC 2046 5.1.170ַ
+ * *bֵָţûиòʽʱEINVAL
+ */
+static inline int http_dl_parse_boundary(const char *p, int len, const char **b, int *blen)
+{
+    const char *end = p + len, *q, *e;
+
+    for (q = memchr(p, ';', len); q != NULL; q = memchr(q, ';', end - q)) {
+        for (q++; q < end && (*q == ' ' || *q == '\t'); q++) {
+            ;
+        }
+        if (end - q <= 9 || strncasecmp(q, "boundary=", 9) != 0) {
+            continue;
+        }
+
+        q += 9;
+        if (*q == '"') {
+            q++;
+            e = memchr(q, '"', end - q);
+            if (e == NULL) {
+                return HTTP_DL_PARSE_EINVAL;
+            }
+        } else {
+            for (e = q; e < end && *e != ';' && *e != ' ' && *e != '\t'; e++) {
+                ;
+            }
+        }
+        if (e == q || e - q > 70) {
+            return HTTP_DL_PARSE_EINVAL;
+        }
+
+        *b = q;
+        *blen = e - q;
+        return HTTP_DL_PARSE_OK;
+    }
+
+    return HTTP_DL_PARSE_EINVAL;
+}
+
+#endif /* __HTTP_DL_PARSE_H__ */
@@ -1,18 +1,56 @@
 #ifndef __HTTP_DOWNLOAD_H__
 #define __HTTP_DOWNLOAD_H__
 
+#include <stddef.h>
 #include <sys/time.h>
 #include "list.h"
 
 #define HTTP_DL_BUF_LEN         128
-#define HTTP_DL_HOST_LEN        HTTP_DL_BUF_LEN
-#define HTTP_DL_PATH_LEN        HTTP_DL_BUF_LEN
-#define HTTP_DL_URL_LEN         (HTTP_DL_HOST_LEN + HTTP_DL_PATH_LEN)
-#define HTTP_DL_LOCAL_LEN       HTTP_DL_BUF_LEN
 #define HTTP_DL_READBUF_LEN     4096
-
-#define HTTP_DL_READ_TIMEOUT    10  /* λ */
-#define HTTP_DL_TIMEOUT_RETRIES 3   /* select3γʱ󣬽 */
+#define HTTP_DL_CACHE_LINE      64
+
+#define HTTP_DL_CONNECT_TIMEOUT 10  /* λ룬ӵĳʱ */
+#define HTTP_DL_FIRST_BYTE_TIMEOUT  30  /* λ룬󷢳ȴӦֽڵĳʱ */
+#define HTTP_DL_READ_TIMEOUT    10  /* λ룬չݵĳʱ */
+#define HTTP_DL_TOTAL_TIMEOUT   0   /* λ룬ʱƣ0ʾ */
+#define HTTP_DL_MAX_RETRIES     3   /* ԵĴ */
+#define HTTP_DL_RETRY_BASE_MS   500     /* һǰĵȴʱ䣬֮ÿη */
+#define HTTP_DL_RETRY_MAX_MS    30000   /* Եȴʱ */
+#define HTTP_DL_MAX_REDIRECTS   5   /* ض */
+#define HTTP_DL_REDIRECT_CACHE_LEN  64  /* ض򻺴Ŀ */
+#define HTTP_DL_CONN_POOL_LEN   16  /* keep-aliveӳص */
+#define HTTP_DL_RATE_MIN_READ   1024    /* ʱƲֵͣƬСread */
+#define HTTP_DL_RATE_MAX_KB     (1L << 24)  /* ٵޣKB/sʱ(now - last_ms) * rate */
+#define HTTP_DL_RCVBUF_MAX      (64 << 20)  /* ʱӻsocketջ */
+#define HTTP_DL_TUNE_MS         200     /* ÿӲTCP_INFOջļ */
+#define HTTP_DL_TRACE_SLOW_MS   1000    /* ʱֵд׷ļ */
+#define HTTP_DL_HIST_LEN        32      /* ׶ʱֱͼ2ݷͰһͰԼ36 */
+#define HTTP_DL_H2_HOSTS_LEN    16  /* -Hָhost */
+#define HTTP_DL_H2_MAX_STREAMS  100 /* ÿHTTP/2ͬʱеԶSETTINGSСʱԶԶΪ׼ */
+/*
+ * HTTP/2ĽմڰʱӻȡСļò꣬ļͣWINDOW_UPDATE
+ * һʱֱдļڲռڴ档
+ */
+#define HTTP_DL_H2_STREAM_WINDOW    (4 << 20)
+#define HTTP_DL_H2_CONN_WINDOW  (64 << 20)
+#define HTTP_DL_H2_FRAME_LEN    16384   /* SETTINGS_MAX_FRAME_SIZEĬֵ */
+#define HTTP_DL_H2_RBUF_LEN     (64 * 1024)
+#define HTTP_DL_H2_HBUF_LEN     (64 * 1024) /* HEADERSCONTINUATIONƴɵͷ */
+#define HTTP_DL_H2_HDR_LEN      16384   /* ͷޣԶĬϵ֡ */
+#define HTTP_DL_CLIENT_BUF_LEN  8192    /* ػÿͻδ */
+#define HTTP_DL_CLIENTS_MAX     64      /* ػͬʱӵĿͻ */
+#define HTTP_DL_PRIO_AGING_MS   30000   /* Ŷӳʱһȼ񲻻һֱŲ */
+#define HTTP_DL_PRIO_URGENT_MS  10000   /* ֹʱ䲻ֵʱֱᵽ߼ */
+#define HTTP_DL_PRIO_WEIGHTS    {8, 4, 1}   /* -rʱȼֵȫʵȨ */
+#define HTTP_DL_DEDUP_HASH_LEN  1024    /* ȥĹϣͰ */
+#define HTTP_DL_STR_HASH_LEN    4096    /* ַصĹϣͰ */
+#define HTTP_DL_POST_THREADS    2       /* ߳Ĭֵ */
+#define HTTP_DL_POST_THREADS_MAX 64
+#define HTTP_DL_MMAP_MIN        (1024 * 1024)   /* Сȵļӳ䵽ڴн */
+#define HTTP_DL_MMAP_READ_LEN   (256 * 1024)    /* ֱյӳʱÿֽ */
+#define HTTP_DL_BODY_READ_LEN   (64 * 1024)     /* ûӳʱÿֽ */
+#define HTTP_DL_DELTA_BLOCK_LEN 4096            /* -Mɿ嵥ʱĬϵĿ鳤 */
+#define HTTP_DL_MANIFEST_MAX    (64 << 20)      /* 嵥ޣÿ12ֽڣ4KBĿԼ20GB */
 
 typedef int bool;
 #define true 1
@@ -29,6 +67,8 @@ typedef struct http_dl_rbuf_s {
 
 typedef enum http_dl_stage_e {
     HTTP_DL_STAGE_INIT = 0,         /* ʱʼ״̬ */
+    HTTP_DL_STAGE_CONNECTING,       /* connectУȴsocketд */
+    HTTP_DL_STAGE_HANDSHAKE,        /* (TLS) */
     HTTP_DL_STAGE_SEND_REQUEST,     /* 󵽷ӳɹ */
     HTTP_DL_STAGE_PARSE_STATUS_LINE,/* ״̬ */
     HTTP_DL_STAGE_PARSE_HEADER,     /* ͷ */
@@ -36,56 +76,283 @@ typedef enum http_dl_stage_e {
     HTTP_DL_STAGE_FINISH,           /* ɣ쳣ɣ򽫴Ϣ¼err_msg */
 } http_dl_stage_t;
 
+#define HTTP_DL_STAGE_LEN       (HTTP_DL_STAGE_FINISH + 1)
+
 #define HTTP_DL_F_GENUINE_AGENT 0x00000001UL
 #define HTTP_DL_F_RESTART_FILE  0x00000002UL
-
+#define HTTP_DL_F_KEEPALIVE     0x00000004UL    /* ͬⱣ */
+#define HTTP_DL_F_HAS_LENGTH    0x00000008UL    /* ӦдContent-Length */
+#define HTTP_DL_F_REDIRECTING   0x00000010UL    /* յ3xxض򣬶Location */
+#define HTTP_DL_F_ACCEPT_ENCODING   0x00000020UL    /* ʱЭContent-Encodingѹ */
+#define HTTP_DL_F_TLS           0x00000040UL    /* httpsTLS */
+#define HTTP_DL_F_WANT_WRITE    0x00000080UL    /* ȴsocketдУûд(wbuf) */
+#define HTTP_DL_F_H2            0x00000100UL    /* ΪHTTP/2ϵһأûԼsocket */
+#define HTTP_DL_F_H2_CTRL       0x00000200UL    /* HTTP/2ӵĿ񣬸ֺշ֡ */
+#define HTTP_DL_F_CANCEL        0x00000400UL    /* ȡһ¼ѭʼʱ */
+#define HTTP_DL_F_RUNNING       0x00000800UL    /* ѴӶзռһ */
+#define HTTP_DL_F_REPAIR        0x00001000UL    /* ֻrepair=䣬дļԭλ */
+#define HTTP_DL_F_DELTA         0x00002000UL    /* delta=Ŀ嵥أֻؾɰ汾ûеĿ */
+#define HTTP_DL_F_HAS_RANGE     0x00004000UL    /* ӦдпɽContent-Rangerange_first */
+#define HTTP_DL_F_DISCARD       0x00008000UL    /* ʱļѾ(416)嶪 */
+
+/* ȼֵСȷ */
+typedef enum http_dl_prio_e {
+    HTTP_DL_PRIO_HIGH = 0,
+    HTTP_DL_PRIO_NORMAL,
+    HTTP_DL_PRIO_LOW,
+    HTTP_DL_PRIO_LEVELS,
+} http_dl_prio_t;
+
+/* ӦContent-Encoding */
+typedef enum http_dl_encoding_e {
+    HTTP_DL_ENCODING_IDENTITY = 0,
+    HTTP_DL_ENCODING_GZIP,
+    HTTP_DL_ENCODING_DEFLATE,
+    HTTP_DL_ENCODING_ZSTD,
+} http_dl_encoding_t;
+
+/* Ͱȫ֡ÿhostÿ */
+typedef struct http_dl_bucket_s {
+    long rate;                      /* ֽ/룬0ʾ */
+    long burst;                     /* Ͱ */
+    long tokens;
+    long last_ms;                   /* ϴβƵʱ䣬ʱ */
+} http_dl_bucket_t;
+
+/*
+ * ֲʱ֣ں˾ɰtimer wheelͬÿ64񣬵0һһtick
+ * ϲÿ²һȦתϲʱеĶʱ·ɢ²㡣
+ * 롢ɾO(1)
+ */
+#define HTTP_DL_TIMER_TICK_MS   100 /* һtickʱλ */
+#define HTTP_DL_TW_BITS         6
+#define HTTP_DL_TW_SIZE         (1 << HTTP_DL_TW_BITS)
+#define HTTP_DL_TW_MASK         (HTTP_DL_TW_SIZE - 1)
+#define HTTP_DL_TW_LEVELS       4   /* 64^4tickԼ19 */
+
+typedef struct http_dl_timer_s {
+    struct list_head list;          /* δʱʱΪ */
+    unsigned long expires;          /* ڵtick */
+    void (*func)(struct http_dl_timer_s *timer);
+} http_dl_timer_t;
+
+typedef struct http_dl_timer_wheel_s {
+    unsigned long tick;             /* һtick */
+    struct list_head slots[HTTP_DL_TW_LEVELS][HTTP_DL_TW_SIZE];
+} http_dl_timer_wheel_t;
+
+/* ԤɵHTTP/1ͷhttp_dl_req_tmpl */
+typedef struct http_dl_req_tmpl_s {
+    char *data;
+    int len;
+    unsigned short port;            /* ʱĶ˿ںUser-Agentͬʱ */
+    bool genuine;
+} http_dl_req_tmpl_t;
+
+/* ÿhost״̬ */
+typedef struct http_dl_host_s {
+    struct list_head list;
+    const char *host;               /* ַеhostͬһhostֻһָȽ */
+    http_dl_req_tmpl_t req;
+    http_dl_bucket_t bucket;
+    void *tls_session;              /* һεTLSỰٴʱָʡȥ */
+    bool h2;                        /* -HָhostHTTP/2 */
+} http_dl_host_t;
+
+struct http_dl_info_s;
+struct http_dl_h2_conn_s;
+struct iovec;
+
+/*
+ * ӵĴ㣬TCPTLSread/writeֵϵͳͬ
+ * ûݿɶʱ-HTTP_DL_ERR_AGAINhandshakeΪNULLʾҪ֡
+ */
+typedef struct http_dl_transport_s {
+    const char *name;
+    int (*handshake)(struct http_dl_info_s *info);  /* ɷHTTP_DL_OKȴsocket¼-HTTP_DL_ERR_AGAIN */
+    int (*read)(struct http_dl_info_s *info, char *buf, int len);
+    /* socketǷģֻдһΣдֽҪдģһֽҲдʱ-HTTP_DL_ERR_AGAIN */
+    int (*write)(struct http_dl_info_s *info, char *buf, int len);
+    int (*writev)(struct http_dl_info_s *info, struct iovec *iov, int iovcnt);
+    int (*pending)(struct http_dl_info_s *info);    /* ѽܵûֽڣselect */
+    void (*close)(void *tls);                       /* ͷŴ״̬socketɵ߹ر */
+} http_dl_transport_t;
+
+/*
+ * ÿ״̬¼ѭÿһֶҪʵֶμڿͷcache lineźã
+ * еʱÿֻǰcache lineURLļϢͽջ
+ * ֻڽͷͽʱõķں档ֶʱעⲻҪ嵽ȵĲм䡣
+ */
 typedef struct http_dl_info_s {
-    http_dl_stage_t stage;
-    unsigned long flags;
-
+    /* cache line 0֯selectÿÿ񶼷 */
     struct list_head list;
-
-    char url[HTTP_DL_URL_LEN];      /* Unchanged URL */
-    char host[HTTP_DL_HOST_LEN];    /* Extracted hostname */
-    char path[HTTP_DL_PATH_LEN];    /* Path, as well as dir and file (properly decoded) */
-    char local[HTTP_DL_LOCAL_LEN];  /* The local filename of the URL document */
-    unsigned short port;
-
+    unsigned long flags;
+    http_dl_stage_t stage;
     int sockfd;
+    const http_dl_transport_t *transport;
+    void *tls;                      /* TLS״̬ΪNULL */
+    http_dl_host_t *hs;             /* host״̬ʱȷ */
+    http_dl_prio_t prio;            /* Ŷʱڵļȴûᱻٸı */
     int filefd;
 
-    char buf[HTTP_DL_READBUF_LEN];
-    void *dont_touch;               /* buf_tailָbufһλã
-                                     * bufʱbuf_tail㳬bufָdont_touch
-                                     * ˣdont_touch𵽻ãʵ.
-                                     */
+    /* cache line 1ٺͽ */
+    http_dl_bucket_t bucket;        /*  */
     char *buf_data;
     char *buf_tail;
-
     long recv_len;                  /* ղɹwritefileеݳ */
+    long wire_len;                  /* socketյİ峤ȣѹʱrecv_lenͬ */
+
+    /* cache line 2дļ */
     long content_len;               /* httpỰ͵ݳȣעtotal_len */
     long restart_len;               /* ϵУʼյλãĿǰ֧rangeʽ */
     long total_len;                 /* ļʵ */
+    char *map;                      /* ļӳ䵽ڴ棬ֱдûӳʱΪNULL */
+    long map_len;                   /* ӳĳȣԤļ */
+    void *decoder;                  /* ѹ״̬http_dl_decoder_t */
+    struct http_dl_digest_s *digest;/* ر߼ժҪҪʱΪNULL */
+    long active_ms;                 /* һյݵʱ */
+
+    /* cache line 3ʱHTTP/2 */
+    http_dl_timer_t timer;          /* ׶ȡĽֹʱ䣬http_dl_task_deadline */
+    long begin_ms;                  /* ʼʱ䣬ʱӣͬ */
+    long stage_ms;                  /* ʼӻ󷢳ʱ */
+    struct http_dl_h2_conn_s *h2;   /* HTTP/2ӣΪڵӣΪԼ */
+    long h2_unacked;                /* ѽաûWINDOW_UPDATEֽ */
+
+    /* ²ÿֵ· */
+    long range_first;               /* ӦContent-Range㣬HTTP_DL_F_HAS_RANGE"*"ʱΪ-1 */
+    long range_len;                 /* ӦContent-Rangeļܳȣδ֪ʱΪ-1 */
+    int id;                         /* http_dl_submitţ1ʼ */
     int status_code;
-
-    char err_msg[HTTP_DL_BUF_LEN];
-
+    int result;                     /* HTTP_DL_OK-HTTP_DL_ERR_xxx */
+    int retries;                    /* ѾԵĴ */
+    int redirects;                  /* Ѿض */
+    http_dl_encoding_t encoding;    /* ӦContent-Encoding */
+    unsigned int stream_id;         /* 0ʾûз */
+    unsigned short port;
+    struct list_head h2_list;       /* ӵstreamswaitingϣڴdone */
+    long deadline_ms;               /* ϣɵʱ䣬ʱӣ0ʾû */
+    long queued_ms;                 /* 뵱ǰһеʱ */
+    struct list_head local_hash;    /* е񰴱ļǼȥ */
+    struct list_head digest_hash;   /* ժҪժҪǼ */
+    struct http_dl_info_s *dup_of;  /* ظϲ񣬽ΪNULL */
+    struct http_dl_repair_s *repair;/* Ҫ޲multipart/byterangesĽ״̬HTTP_DL_F_REPAIR */
+    struct http_dl_delta_s *delta;  /* 嵥ͻҪص䣬HTTP_DL_F_DELTA */
+    void (*done_cb)(struct http_dl_info_s *info, void *arg);    /* ʱãΪNULL */
+    void *done_arg;
+
+    long stage_us[HTTP_DL_STAGE_LEN];   /* γԽ׶εʱ䣬ʱӣ0ʾûо */
     struct timeval start_time;      /* Get content's start time */
     unsigned long elapsed_time;     /* Duration time of getting contents */
-} http_dl_info_t;
+    unsigned int rtt_us;            /* һδTCP_INFOȡõRTT0ʾûв */
+    int rcvbuf;                     /* ùsocketջ0ʾںԶ */
+    long tune_ms;                   /* ϴβʱ䣬0ʾǰӻûв */
+    unsigned long long tune_bytes;  /* ϴβʱۼյֽ */
+    char *wbuf;                     /* socketʱдµĲ֣д¼ѭд */
+    int wlen;
+
+    /* ַַУȲƣhttp_dl_str_get */
+    const char *url;                /* Unchanged URL */
+    const char *host;               /* Extracted hostname */
+    const char *path;               /* Path, as well as dir and fileָurlĩβ */
+    const char *local;              /* The local filename of the URL document */
+    const char *location;           /* ضʱLocationͷURLûʱΪNULL */
+    char err_msg[HTTP_DL_BUF_LEN];
+
+    char buf[HTTP_DL_READBUF_LEN];  /* buf_tailԵbuf + HTTP_DL_READBUF_LENд */
+} __attribute__((aligned(HTTP_DL_CACHE_LINE))) http_dl_info_t;
+
+#ifdef __LP64__
+/* 水cache lineֵ飬Ӽֶκ˶ԣһлʧ */
+_Static_assert(offsetof(http_dl_info_t, bucket) == 1 * HTTP_DL_CACHE_LINE, "cache line 0 overflows");
+_Static_assert(offsetof(http_dl_info_t, content_len) == 2 * HTTP_DL_CACHE_LINE, "cache line 1 overflows");
+_Static_assert(offsetof(http_dl_info_t, timer) == 3 * HTTP_DL_CACHE_LINE, "cache line 2 overflows");
+_Static_assert(offsetof(http_dl_info_t, range_first) == 4 * HTTP_DL_CACHE_LINE, "cache line 3 overflows");
+#endif
 
 typedef struct http_dl_list_s {
     char name[HTTP_DL_BUF_LEN];
     struct list_head list;
     int count;
-    int maxfd;
 } http_dl_list_t;
 
-typedef struct http_dl_range_s {
-    long first_byte_pos;
-    long last_byte_pos;
-    long entity_length;
-} http_dl_range_t;
+/* еkeep-aliveӣhost:port */
+typedef struct http_dl_conn_s {
+    struct list_head list;
+    const char *host;               /* ַеhost */
+    unsigned short port;
+    int sockfd;
+    int rcvbuf;                     /* http_dl_info_trcvbufӸʱ */
+    const http_dl_transport_t *transport;
+    void *tls;
+} http_dl_conn_t;
+
+/* HTTP/2֡(RFC 7540 6) */
+typedef enum http_dl_h2_frame_e {
+    HTTP_DL_H2_DATA = 0,
+    HTTP_DL_H2_HEADERS,
+    HTTP_DL_H2_PRIORITY,
+    HTTP_DL_H2_RST_STREAM,
+    HTTP_DL_H2_SETTINGS,
+    HTTP_DL_H2_PUSH_PROMISE,
+    HTTP_DL_H2_PING,
+    HTTP_DL_H2_GOAWAY,
+    HTTP_DL_H2_WINDOW_UPDATE,
+    HTTP_DL_H2_CONTINUATION,
+} http_dl_h2_frame_t;
+
+#define HTTP_DL_H2_FLAG_END_STREAM  0x01
+#define HTTP_DL_H2_FLAG_ACK         0x01    /* SETTINGSPING */
+#define HTTP_DL_H2_FLAG_END_HEADERS 0x04
+#define HTTP_DL_H2_FLAG_PADDED      0x08
+#define HTTP_DL_H2_FLAG_PRIORITY    0x20
+
+#define HTTP_DL_H2_SETTINGS_ENABLE_PUSH     0x2
+#define HTTP_DL_H2_SETTINGS_MAX_STREAMS     0x3
+#define HTTP_DL_H2_SETTINGS_INITIAL_WINDOW  0x4
+
+#define HTTP_DL_H2_NO_ERROR         0x0
+#define HTTP_DL_H2_PROTOCOL_ERROR   0x1
+#define HTTP_DL_H2_CANCEL           0x8
+
+#define HTTP_DL_H2_PREFACE  "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+
+/*
+ * HTTP/2ӣͬһhost:portΪһӡ
+ * ɿctrlctrlͨһdownloading listвselect
+ * Ҳdownloading listУselectctrlյַ
+ */
+typedef struct http_dl_h2_conn_s {
+    struct list_head list;
+    struct http_dl_info_s *ctrl;
+    struct list_head streams;       /* Ѿ */
+    struct list_head waiting;       /* ȴӽܲƵ */
+    int nstreams;
+    int max_streams;
+    unsigned int next_stream_id;
+    bool ready;                     /* ѷǰԣԷ */
+    bool settings;                  /* յSETTINGS(ǰ) */
+    bool goaway;                    /* յGOAWAYٷµ */
+    bool ping_sent;                 /* гʱʱPINGյκǰٴγʱΪѶ */
+    long recv_unacked;              /* ѽաûWINDOW_UPDATEֽ */
+    struct http_dl_hpack_s *hpack;  /* ӦͷĽ״̬ */
+    unsigned char *rbuf;            /* һ֡ */
+    int rlen;
+    unsigned char *hbuf;            /* ȴCONTINUATIONͷ */
+    int hlen;
+    unsigned int hstream;           /* hbuf0ʾû */
+    int hflags;                     /* ͷһ֡(HEADERS)flags */
+    unsigned char *wbuf;            /* ͵֡ÿselectǰһд */
+    int wlen;
+    int wcap;
+} http_dl_h2_conn_t;
+
+/* ض(301)fromΪURLǰ׺к滻Ϊto */
+typedef struct http_dl_redirect_s {
+    struct list_head list;
+    const char *from;               /* ַ */
+    const char *to;
+} http_dl_redirect_t;
 
 typedef enum http_dl_err_e {
     HTTP_DL_OK = 0,
@@ -101,12 +368,36 @@ typedef enum http_dl_err_e {
     HTTP_DL_ERR_RESOURCE,
     HTTP_DL_ERR_AGAIN,
     HTTP_DL_ERR_NOTFOUND,
+    HTTP_DL_ERR_REDIRECT,
+    HTTP_DL_ERR_DIGEST,
+    HTTP_DL_ERR_TIMEOUT,
+    HTTP_DL_ERR_TLS,
+    HTTP_DL_ERR_CANCELED,
 } http_dl_err_t;
 
 #define HTTP_URL_PREFIX    "http://"
 #define HTTP_URL_PRE_LEN    7       /* strlen("http://") */
+#define HTTPS_URL_PREFIX    "https://"
+#define HTTPS_URL_PRE_LEN   8       /* strlen("https://") */
 
 #define HTTP_ACCEPT "*/*"
+
+/* ÿhostԤɵͷΪUser-AgenthostportAccept */
+#define HTTP_DL_REQ_TMPL_FMT    "User-Agent: %s\r\n"              \
+                                "Host: %s:%d\r\n"                 \
+                                "Accept: %s\r\n"                  \
+                                "Connection: Keep-Alive\r\n"
+
+/* ʱֵ֧ĽѹЭ̵Content-Encoding */
+#if defined(HTTP_DL_WITH_ZSTD) && defined(HTTP_DL_WITH_ZLIB)
+#define HTTP_ACCEPT_ENCODING "zstd, gzip, deflate"
+#elif defined(HTTP_DL_WITH_ZSTD)
+#define HTTP_ACCEPT_ENCODING "zstd"
+#elif defined(HTTP_DL_WITH_ZLIB)
+#define HTTP_ACCEPT_ENCODING "gzip, deflate"
+#else
+#define HTTP_ACCEPT_ENCODING ""
+#endif
 /* HTTP/1.0 status codes from RFC1945, provided for reference.  */
 /* Successful 2xx.  */
 #define HTTP_STATUS_OK			        200
@@ -126,6 +417,7 @@ typedef enum http_dl_err_e {
 #define HTTP_STATUS_UNAUTHORIZED	    401
 #define HTTP_STATUS_FORBIDDEN		    403
 #define HTTP_STATUS_NOT_FOUND		    404
+#define HTTP_STATUS_RANGE_NOT_SATISFIABLE   416
 
 /* Server errors 5xx.  */
 #define HTTP_STATUS_INTERNAL		    500
@@ -140,6 +432,9 @@ typedef enum http_dl_err_e {
 /* The smaller value of the two.  */
 #define MINVAL(x, y) ((x) < (y) ? (x) : (y))
 
+/* The larger value of the two.  */
+#define MAXVAL(x, y) ((x) > (y) ? (x) : (y))
+
 #define RBUF_FD(rbuf) ((rbuf)->fd)
 #define TEXTHTML_S "text/html"
 
@@ -193,5 +488,117 @@ extern int http_dl_log_level;
         printf(fmt, ##arg); \
     } while(0)
 
+/* ״̬Ŀգhttp_dl_query */
+typedef struct http_dl_stat_s {
+    int id;
+    http_dl_stage_t stage;
+    int result;                     /* ǰΪHTTP_DL_OK */
+    int status_code;
+    int retries;
+    long done_len;                  /* ļеֽǰĲ */
+    long total_len;                 /* 0ʾ֪ */
+    unsigned int rtt_us;            /* 0ʾûв */
+    int rcvbuf;                     /* 0ʾջںԶ */
+    const char *local;              /* ֻͷǰЧ */
+    char err_msg[HTTP_DL_BUF_LEN];
+} http_dl_stat_t;
+
+typedef void (*http_dl_done_cb_t)(http_dl_info_t *info, void *arg);
+
+/* ¼̣߳ʱĸйϵ */
+typedef struct http_dl_event_s {
+    http_dl_stat_t stat;            /* stat.localurlָ¼Դĸ */
+    const char *url;
+    long queued_ms;                 /* һνеʱ䣬done_msͬΪʱ */
+    long done_ms;
+    unsigned long elapsed_ms;       /* õʱ */
+} http_dl_event_t;
+
+typedef void (*http_dl_post_cb_t)(const http_dl_event_t *ev, void *arg);
+
+/*
+ * ¼ѭļڵhttp_dl_poll߳ۼ(ֲ̹߳̾߳cache line)
+ * ʱ䵥λ룻busyhttp_dl_pollг˵ȴselectʱ䣬
+ * ûйreadparsecopyĲǵȡʱӹȿ
+ */
+typedef struct http_dl_prof_s {
+    unsigned long polls;            /* selectĴ¼ѭѵĴ */
+    unsigned long poll_timeouts;    /* selectʱأûfd */
+    unsigned long poll_empty;       /* fdûжӦݣɡTLS¼ */
+    unsigned long ready;            /* selectfd */
+    unsigned long reads;            /* socketĴTLSΪSSL_readĴ */
+    unsigned long read_again;       /* EAGAINTLS¼ */
+    unsigned long read_bytes;
+    unsigned long read_hist[HTTP_DL_HIST_LEN];  /* ÿζֽ2ݷͰ */
+    unsigned long writes;           /* дsocketĴ(HTTP/2֡) */
+    unsigned long write_bytes;
+    unsigned long wait_ns;          /* select */
+    unsigned long busy_ns;
+    unsigned long read_ns;          /* socketTLS */
+    unsigned long parse_ns;         /* ״̬СͷchunkHTTP/2֡ */
+    unsigned long copy_ns;          /* ĽѹժҪдļӳ */
+} http_dl_prof_t;
+
+/* ¼ѭжɶfdɶʱfuncfuncпɾԼ */
+typedef struct http_dl_watch_s {
+    struct list_head list;
+    int fd;
+    void (*func)(struct http_dl_watch_s *watch);
+} http_dl_watch_t;
+
+/* ػ̵ĿͻӡͻȶϿʱύ񶼽ͷ */
+typedef struct http_dl_client_s {
+    http_dl_watch_t watch;          /* ϿfdΪ-1 */
+    char buf[HTTP_DL_CLIENT_BUF_LEN];   /* һе */
+    int len;
+    int ntasks;                     /* ûн */
+} http_dl_client_t;
+
+/*
+ * ӿڣhttp_dl_init֮http_dl_submitύ񣬷http_dl_pollд䣬
+ * (ɹʧܻȡ)ʱύʱĻصӳءhost״̬ض򻺴
+ * ύ֮䱣Щӿڶ̰߳ȫģֻڵhttp_dl_poll߳ʹá
+ * ʱHTTP_DL_NO_MAINȥmain()main.cΪӵС
+ */
+void http_dl_init();
+void http_dl_destroy();
+int http_dl_submit(const char *url, const char *opts, http_dl_done_cb_t cb, void *arg);
+int http_dl_cancel(int id);
+int http_dl_query(int id, http_dl_stat_t *stat);
+int http_dl_release(int id);
+int http_dl_poll(long timeout_ms);
+void http_dl_watch_add(http_dl_watch_t *watch);
+void http_dl_watch_del(http_dl_watch_t *watch);
+
+/*
+ * nthreadṣ֮߳ÿʱһ߳еcb
+ * ͬһcbڲͬ߳ͬʱִСcbпʱĹ(У顢ѹϴ)
+ * Ӱ¼ѭܵĽӿڡhttp_dl_post_stopѽֹ̣ͣ߳
+ * http_dl_destroyҲáʱҪHTTP_DL_WITH_THREADS򷵻-HTTP_DL_ERR_INVALID
+ */
+int http_dl_post_start(int nthreads, http_dl_post_cb_t cb, void *arg);
+void http_dl_post_stop();
+
+/*
+ * ׷٣ʱslow_msʱĸ׶ΪChrome trace¼дpath
+ * chrome://tracingPerfetto򿪡http_dl_destroyʱJSONĽβرļ
+ */
+int http_dl_trace_open(const char *path, long slow_ms);
+
+/*
+ * TLScafileΪУ֤õCAļNULLʱϵͳĬϵģinsecureΪtrueʱУ֤顣
+ * cafileҪ֮һֱЧʱҪHTTP_DL_WITH_OPENSSL򷵻-HTTP_DL_ERR_INVALID
+ */
+int http_dl_tls_config(const char *cafile, bool insecure);
+
+/* ȡǰ߳¼ѭļֻڵhttp_dl_poll߳ʹ */
+void http_dl_prof_get(http_dl_prof_t *prof);
+
+/*
+ * õĿ嵥pathblock_lenֿ飬嵥дfdڷļһ𷢲
+ * ʱdelta=<嵥URL>Ҫhttp_dl_init
+ */
+int http_dl_delta_manifest(const char *path, long block_len, int fd);
+
 #endif /* __HTTP_DOWNLOAD_H__ */
 
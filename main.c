@@ -11,8 +11,43 @@
 #include <sys/select.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/xattr.h>
+#include <spawn.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <linux/tcp.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+#ifdef HTTP_DL_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HTTP_DL_WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HTTP_DL_WITH_THREADS
+#include <pthread.h>
+#include <semaphore.h>
+#endif
+#ifdef HTTP_DL_WITH_OPENSSL
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+#endif
 
 #include "http_download.h"
+#include "http_dl_digest.h"
+#include "http_dl_hpack.h"
+#include "http_dl_mpsc.h"
+#include "http_dl_parse.h"
+#include "http_dl_delta.h"
 
 int http_dl_log_level = 7;
 
@@ -20,28 +55,196 @@ static char *http_dl_agent_string = "Mozilla/5.0 (Windows NT 6.1; WOW64) " \
                                     "AppleWebKit/537.36 (KHTML, like Gecko) " \
                                     "Chrome/35.0.1916.153 Safari/537.36";
 static char *http_dl_agent_string_genuine = "Wget/1.5.3";
-static http_dl_list_t http_dl_list_initial;
+static unsigned long http_dl_task_flags;    /* ѡġÿ񶼴ϵflags */
+static http_dl_digest_type_t http_dl_digest_default;    /* -cָġÿ񶼼ժҪ */
+static LIST_HEAD(http_dl_hosts);            /* ÿhost״̬http_dl_host_t */
+static http_dl_bucket_t http_dl_rate_global;    /* -rȫ */
+static long http_dl_rate_host;              /* -Rÿhost٣ֽ/ */
+static long http_dl_rate_task;              /* -tÿ٣ֽ/ */
+static long http_dl_rcvbuf_max = HTTP_DL_RCVBUF_MAX;    /* -B0ʾջ */
+static int http_dl_busy_poll;               /* -bSO_BUSY_POLL΢0ʾ */
+static long http_dl_tcp_rmem_max;           /* net.ipv4.tcp_rmemޣںԶൽ */
+static long http_dl_core_rmem_max;          /* net.core.rmem_maxûȨʱSO_RCVBUF */
+static unsigned long http_dl_stage_hist[HTTP_DL_STAGE_LEN][HTTP_DL_HIST_LEN];  /* ׶ʱֱͼ */
+static unsigned long http_dl_total_hist[HTTP_DL_HIST_LEN];  /* ӵһη𵽽ʱ */
+static FILE *http_dl_trace_fp;              /* -g׷ļ */
+static long http_dl_trace_slow_ms;          /* http_dl_trace_open */
+static int http_dl_trace_count;             /* д׷¼ */
+static __thread http_dl_prof_t http_dl_prof;    /* ¼ѭļ */
+static http_dl_list_t http_dl_list_initial[HTTP_DL_PRIO_LEVELS];  /* Ŷӵÿȼһ */
 static http_dl_list_t http_dl_list_downloading;
 static http_dl_list_t http_dl_list_finished;
+static http_dl_list_t http_dl_list_retrying;    /* ȴԵɶʱ */
+static int http_dl_max_retries = HTTP_DL_MAX_RETRIES;   /* -n */
+#ifdef HTTP_DL_WITH_OPENSSL
+static char *http_dl_tls_cafile;            /* -AУ֤õCAļhttp_dl_tls_config */
+static bool http_dl_tls_insecure;           /* -kУ֤ */
+static SSL_CTX *http_dl_tls_ctx;
+#endif
+static LIST_HEAD(http_dl_conn_pool);         /* keep-alive */
+static LIST_HEAD(http_dl_h2_conns);          /* HTTP/2ӣhttp_dl_h2_conn_t */
+static LIST_HEAD(http_dl_h2_done);           /* Ѿȴ¼ѭ */
+static char *http_dl_h2_hosts[HTTP_DL_H2_HOSTS_LEN];    /* -HʹHTTP/2host"*"ʾȫ */
+static int http_dl_h2_hosts_count;
+static bool http_dl_h2_linger;              /* ûӱгʱػʹ */
+static int http_dl_conn_pool_count;
+static LIST_HEAD(http_dl_redirect_cache);    /* ض򻺴棬¼ǰ */
+static int http_dl_redirect_cache_count;
+static http_dl_timer_wheel_t http_dl_timer_wheel;   /* ĳʱʱ */
+static int http_dl_timer_wheel_count;       /* ʱеĶʱ */
+static long http_dl_timeout_connect = HTTP_DL_CONNECT_TIMEOUT * 1000;   /* -Tλmsͬ */
+static long http_dl_timeout_first_byte = HTTP_DL_FIRST_BYTE_TIMEOUT * 1000;
+static long http_dl_timeout_idle = HTTP_DL_READ_TIMEOUT * 1000;
+static long http_dl_timeout_total = HTTP_DL_TOTAL_TIMEOUT * 1000;
+static int http_dl_task_next_id;            /* һύ */
+static int http_dl_cancel_count;            /* ȡûн */
+static int http_dl_max_running;             /* -jͬʱе0ʾ */
+static int http_dl_running;                 /* ѷ𡢻ûн */
+static int http_dl_running_prio[HTTP_DL_PRIO_LEVELS];
+static http_dl_bucket_t http_dl_rate_prio[HTTP_DL_PRIO_LEVELS];    /* ȼֵõȫ */
+static long http_dl_sched_check_ms;         /* ϴμŶʱʱ */
+static http_dl_list_t http_dl_list_dup;     /* ϲϡظ */
+static struct list_head http_dl_dedup_local[HTTP_DL_DEDUP_HASH_LEN];   /* е񣬰ļ */
+static struct list_head http_dl_dedup_digest[HTTP_DL_DEDUP_HASH_LEN];  /* е񣬰ժҪ */
+static struct list_head http_dl_blobs[HTTP_DL_DEDUP_HASH_LEN];  /* УͨļժҪ */
+static LIST_HEAD(http_dl_watches);           /* ¼ѭfdhttp_dl_watch_t */
+static struct list_head http_dl_strs[HTTP_DL_STR_HASH_LEN];    /* ַأhttp_dl_str_get */
+
+static int http_dl_set_nonblock(int fd, bool on)
+{
+    int fl;
+
+    fl = fcntl(fd, F_GETFL);
+    if (fl == -1) {
+        return -HTTP_DL_ERR_SOCK;
+    }
+    fl = on ? (fl | O_NONBLOCK) : (fl & ~O_NONBLOCK);
+    if (fcntl(fd, F_SETFL, fl) == -1) {
+        return -HTTP_DL_ERR_SOCK;
+    }
 
-/* Count the digits in a (long) integer.  */
-static int http_dl_numdigit(long a)
+    return HTTP_DL_OK;
+}
+
+/* /proc/sysµֵnth0ʼtcp_rmemĵ2Ϊޣ0 */
+static long http_dl_sysctl_long(const char *path, int nth)
 {
-    int res = 1;
+    FILE *fp;
+    long val = 0;
 
-    while ((a /= 10) != 0) {
-        ++res;
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    while (nth-- >= 0) {
+        if (fscanf(fp, "%ld", &val) != 1) {
+            val = 0;
+            break;
+        }
     }
+    fclose(fp);
 
-    return res;
+    return val;
+}
+
+/*
+ * ½socketѡһдģҪNagleϲص
+ * HTTP/2WINDOW_UPDATEPINGС֡ҲȶԶ˵ACK-bʱSO_BUSY_POLL
+ * socketʱæһᣬCPUӳ١ѡʧܲӰء
+ */
+static void http_dl_sock_setup(int sockfd)
+{
+    int on = 1;
+
+    if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) != 0) {
+        http_dl_log_debug("Set TCP_NODELAY on socket fd %d failed: %s", sockfd, strerror(errno));
+    }
+#ifdef SO_BUSY_POLL
+    if (http_dl_busy_poll > 0
+        && setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &http_dl_busy_poll,
+                        sizeof(http_dl_busy_poll)) != 0) {
+        http_dl_log_debug("Set SO_BUSY_POLL on socket fd %d failed: %s", sockfd, strerror(errno));
+    }
+#endif
 }
 
-static int http_dl_conn(char *hostname, unsigned short port)
+/*
+ * ʵºRTTӵĽջÿHTTP_DL_TUNE_MSһTCP_INFO
+ * ܴʱԼڴ/RTTȡĴʱӻÿ෭һһ
+ * SO_RCVBUFں˾ͲԶںԼǵĿʱ֣
+ * Ŀ곬tcp_rmem޲Žӹܣ֮һֱ
+ */
+static void http_dl_sock_tune(http_dl_info_t *info, long now)
+{
+    struct tcp_info ti;
+    socklen_t len = sizeof(ti);
+    unsigned long long bytes;
+    unsigned int rtt;
+    long rate, target;
+    int cur, val;
+
+    if (http_dl_rcvbuf_max <= 0 || info->sockfd < 0
+        || (info->tune_ms != 0 && now - info->tune_ms < HTTP_DL_TUNE_MS)) {
+        return;
+    }
+
+    bzero(&ti, sizeof(ti));
+    if (getsockopt(info->sockfd, IPPROTO_TCP, TCP_INFO, &ti, &len) != 0) {
+        return;
+    }
+    /* շRTTƸ׼ûʱ÷ͷ */
+    rtt = (ti.tcpi_rcv_rtt != 0) ? ti.tcpi_rcv_rtt : ti.tcpi_rtt;
+    if (rtt != 0) {
+        info->rtt_us = rtt;
+    }
+    bytes = ti.tcpi_bytes_received;
+    if (info->tune_ms == 0 || rtt == 0 || now <= info->tune_ms) {
+        info->tune_ms = now;
+        info->tune_bytes = bytes;
+        return;
+    }
+
+    rate = (bytes - info->tune_bytes) * 1000 / (now - info->tune_ms);
+    info->tune_ms = now;
+    info->tune_bytes = bytes;
+    target = MINVAL(2 * rate / 1000 * rtt / 1000, http_dl_rcvbuf_max);
+
+    len = sizeof(cur);
+    if (getsockopt(info->sockfd, SOL_SOCKET, SO_RCVBUF, &cur, &len) != 0 || target <= cur) {
+        return;
+    }
+    if (info->rcvbuf == 0 && target <= http_dl_tcp_rmem_max) {
+        /* ں˻Զȥ */
+        return;
+    }
+
+    /* ں˻õֵһsk_buffĿ */
+    val = target / 2;
+    if (setsockopt(info->sockfd, SOL_SOCKET, SO_RCVBUFFORCE, &val, sizeof(val)) != 0) {
+        /* ûCAP_NET_ADMINSO_RCVBUFnet.core.rmem_maxƣܱڻС */
+        if (2 * http_dl_core_rmem_max <= cur
+            || setsockopt(info->sockfd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val)) != 0) {
+            return;
+        }
+    }
+    len = sizeof(cur);
+    if (getsockopt(info->sockfd, SOL_SOCKET, SO_RCVBUF, &cur, &len) == 0) {
+        info->rcvbuf = cur;
+    }
+    http_dl_log_debug("Socket fd %d: rtt %u us, %ld KB/s, receive buffer %d KB.",
+                        info->sockfd, rtt, rate >> 10, info->rcvbuf >> 10);
+}
+
+/*
+ * ӡ*in_progressΪtrueʱδɣsocketд
+ * http_dl_conn_finishȡ
+ */
+static int http_dl_conn(const char *hostname, unsigned short port, bool *in_progress)
 {
     int ret;
     struct sockaddr_in sa;
 
-    if (hostname == NULL) {
+    if (hostname == NULL || in_progress == NULL) {
         return -HTTP_DL_ERR_INVALID;
     }
 
@@ -59,11 +262,29 @@ static int http_dl_conn(char *hostname, unsigned short port)
     if ((ret = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
         return -HTTP_DL_ERR_SOCK;
     }
+    if (ret >= FD_SETSIZE) {
+        /* selectŲ£FD_SETԽ */
+        http_dl_log_error("Socket fd %d exceeds FD_SETSIZE %d.", ret, FD_SETSIZE);
+        close(ret);
+        return -HTTP_DL_ERR_SOCK;
+    }
+
+    if (http_dl_set_nonblock(ret, true) != HTTP_DL_OK) {
+        close(ret);
+        return -HTTP_DL_ERR_SOCK;
+    }
+    http_dl_sock_setup(ret);
 
     /* Connect the socket to the remote host.  */
+    *in_progress = false;
     if (connect(ret, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
-        close(ret);
-        return -HTTP_DL_ERR_CONN;
+        if (errno != EINPROGRESS) {
+            close(ret);
+            return -HTTP_DL_ERR_CONN;
+        }
+        *in_progress = true;
+        http_dl_log_debug("Created socket fd %d, connecting...", ret);
+        return ret;
     }
 
     http_dl_log_debug("Created and connected socket fd %d.", ret);
@@ -71,29 +292,19 @@ static int http_dl_conn(char *hostname, unsigned short port)
     return ret;
 }
 
-static int http_dl_iwrite(int fd, char *buf, int len)
+/* ӵsocketдȡӽ */
+static int http_dl_conn_finish(int sockfd)
 {
-    int res = 0;
+    int err = 0;
+    socklen_t len = sizeof(err);
 
-    if (buf == NULL || len <= 0) {
-        return -HTTP_DL_ERR_INVALID;
+    if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+        http_dl_log_debug("connect socket fd %d failed: %s", sockfd, strerror(err));
+        return -HTTP_DL_ERR_CONN;
     }
+    http_dl_log_debug("Connected socket fd %d.", sockfd);
 
-    /* 'write' may write less than LEN bytes, thus the outward loop
-    keeps trying it until all was written, or an error occurred.  The
-    inner loop is reserved for the usual EINTR f*kage, and the
-    innermost loop deals with the same during select().  */
-    while (len > 0) {
-        do {
-            res = write(fd, buf, len);
-        } while (res == -1 && errno == EINTR);
-        if (res <= 0) {
-            return -HTTP_DL_ERR_WRITE;
-        }
-        buf += res;
-        len -= res;
-    }
-    return len;
+    return HTTP_DL_OK;
 }
 
 static int http_dl_write(int fd, char *buf, int len)
@@ -120,6 +331,26 @@ static int http_dl_write(int fd, char *buf, int len)
     return already_write;
 }
 
+/* дļoffӰļƫƣO_APPEND򿪵ļ */
+static int http_dl_pwrite(int fd, char *buf, int len, long off)
+{
+    int res = 0, already_write = 0;
+
+    while (len > 0) {
+        do {
+            res = pwrite(fd, buf, len, off);
+        } while (res == -1 && errno == EINTR);
+        if (res <= 0) {
+            return already_write;
+        }
+        already_write += res;
+        buf += res;
+        len -= res;
+        off += res;
+    }
+    return already_write;
+}
+
 static void *http_dl_xrealloc(void *obj, size_t size)
 {
     void *res;
@@ -140,1233 +371,7239 @@ static void *http_dl_xrealloc(void *obj, size_t size)
     return res;
 }
 
-static void http_dl_reset_time(http_dl_info_t *di)
+/* FNV-1a */
+static unsigned int http_dl_hash(const void *data, int len)
 {
-    if (di == NULL) {
-        return;
+    const unsigned char *p = data;
+    unsigned int h = 2166136261U;
+
+    while (len-- > 0) {
+        h = (h ^ *p++) * 16777619U;
     }
 
-    gettimeofday(&di->start_time, NULL);
-    di->elapsed_time = -1;  /* for unsigned long, -1 means maximum time */
+    return h;
 }
 
-/* unit is msecs */
-static unsigned long http_dl_calc_elapsed(http_dl_info_t *di)
+/*
+ * ַأURLhostͱļڳУֻһݣü
+ * ͬһַǵõͬһָ룬hostΪʱֱӱȽָ롣
+ * еַֻhttp_dl_str_putֻ¼ѭʹã
+ */
+typedef struct http_dl_str_s {
+    struct list_head list;
+    unsigned int hval;
+    int ref;
+    int len;
+    char data[];
+} http_dl_str_t;
+
+static http_dl_str_t *http_dl_str_entry(const char *s)
 {
-    struct timeval t;
-    unsigned long ret;
+    return (http_dl_str_t *)(s - offsetof(http_dl_str_t, data));
+}
 
-    if (di == NULL) {
-        return -1;
+/* ȡsǰlenֽڳеַʧܷNULL */
+static const char *http_dl_str_get(const char *s, int len)
+{
+    http_dl_str_t *str;
+    struct list_head *head;
+    unsigned int hval = http_dl_hash(s, len);
+
+    head = &http_dl_strs[hval % HTTP_DL_STR_HASH_LEN];
+    list_for_each_entry(str, head, list, http_dl_str_t) {
+        if (str->hval == hval && str->len == len && memcmp(str->data, s, len) == 0) {
+            str->ref++;
+            return str->data;
+        }
     }
 
-    gettimeofday(&t, NULL);
-    ret = (t.tv_sec - di->start_time.tv_sec) * 1000
-           + (t.tv_usec - di->start_time.tv_usec) / 1000;
-    if (ret == 0) {
-        ret = 100;  /* 㲻delta timeôǿΪ100msٶ */
+    str = http_dl_xrealloc(NULL, sizeof(http_dl_str_t) + len + 1);
+    if (str == NULL) {
+        return NULL;
     }
-    di->elapsed_time = ret;
-
-    return ret;
+    str->hval = hval;
+    str->ref = 1;
+    str->len = len;
+    memcpy(str->data, s, len);
+    str->data[len] = '\0';
+    list_add(&str->list, head);
+
+    return str->data;
 }
 
-static int http_dl_init_filefd(http_dl_info_t *info)
+/* ʽ */
+static const char *http_dl_str_printf(const char *fmt, ...)
 {
-    int fd = -1, ret, restart_len;
-    struct stat file_stat;
+    char buf[512], *p = buf;
+    const char *s;
+    va_list ap;
+    int len;
 
-    if (info == NULL) {
-        http_dl_log_debug("Invalid input, info == NULL");
-        return -HTTP_DL_ERR_INVALID;
+    va_start(ap, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (len < 0) {
+        return NULL;
     }
-
-    bzero(&file_stat, sizeof(file_stat));
-    ret = stat(info->local, &file_stat);
-
-    if ((ret == 0) && (S_ISREG(file_stat.st_mode))) {
-        /* File already exist, and it is regular file. */
-        http_dl_log_debug("File %s is exist, and is regular file.", info->local);
-        restart_len = file_stat.st_size;
-        fd = open(info->local, O_RDWR | O_APPEND);
-    } else  {
-        http_dl_log_debug("%s status fail or non-regular file, create it.", info->local);
-        restart_len = 0;
-        fd = creat(info->local, 0644);
+    if (len >= sizeof(buf)) {
+        p = http_dl_xrealloc(NULL, len + 1);
+        if (p == NULL) {
+            return NULL;
+        }
+        va_start(ap, fmt);
+        vsnprintf(p, len + 1, fmt, ap);
+        va_end(ap);
     }
 
-    if (fd < 0) {
-        http_dl_log_debug("Open or create %s failed.", info->local);
-        return -HTTP_DL_ERR_FOPEN;
+    s = http_dl_str_get(p, len);
+    if (p != buf) {
+        http_dl_free(p);
     }
 
-    info->filefd = fd;
-    info->restart_len = restart_len;
-    info->flags |= HTTP_DL_F_RESTART_FILE;
+    return s;
+}
 
-    http_dl_log_debug("Open file %s success, fd[%d], restart_len[%ld].",
-                        info->local, info->filefd, info->restart_len);
+static const char *http_dl_str_ref(const char *s)
+{
+    if (s != NULL) {
+        http_dl_str_entry(s)->ref++;
+    }
 
-    return HTTP_DL_OK;
+    return s;
 }
 
-static http_dl_info_t *http_dl_create_info(char *url)
+static void http_dl_str_put(const char *s)
 {
-    http_dl_info_t *di;
-    int url_len;
-    char *p, *host, *path, *local;
-    int host_len, path_len, local_len;
-    int port = 0;
-
-    if (url == NULL) {
-        http_dl_log_debug("invalid input url");
-        return NULL;
-    }
+    http_dl_str_t *str;
 
-    url_len = strlen(url);
-    if (url_len >= HTTP_DL_URL_LEN) {
-        http_dl_log_debug("url is longer than %d: %s", HTTP_DL_URL_LEN - 1, url);
-        return NULL;
+    if (s == NULL) {
+        return;
     }
 
-    if ((p = strstr(url, HTTP_URL_PREFIX)) != NULL) {
-        p = p + HTTP_URL_PRE_LEN;
-    } else {
-        p = url;
+    str = http_dl_str_entry(s);
+    if (--str->ref == 0) {
+        list_del(&str->list);
+        http_dl_free(str);
     }
+}
 
-    /* hostԼܴڵport */
-    for (host = p, host_len = 0; *p != '/' && *p != ':' && *p != '\0'; p++, host_len++) {
-        (void)0;
-    }
-    if (*p == ':') {
-        p++;
-        while (isdigit(*p)) {
-            port = port * 10 + (*p - '0');
-            if (port > 0xFFFF) {
-                http_dl_log_debug("invalid port: %s", url);
-                return NULL;
-            }
-            p++;
-        }
-        if (*p != '/') {
-            http_dl_log_debug("invalid port: %s", url);
-            return NULL;
-        }
-    } else if (*p == '\0') {
-        http_dl_log_debug("invalid host: %s", host);
-        return NULL;
-    }
-    if (host_len <= 0 || host_len >= HTTP_DL_HOST_LEN) {
-        http_dl_log_debug("invalid host length: %s", host);
-        return NULL;
-    }
+/* ַĹϣֵѾ */
+static unsigned int http_dl_str_hash(const char *s)
+{
+    return http_dl_str_entry(s)->hval;
+}
 
-    /* path */
-    for (path = p, path_len = 0; *p != '\0' && *p != ' ' && *p != '\n'; p++, path_len++) {
-        (void)0;
-    }
-    if (path_len <= 0 || path_len >= HTTP_DL_PATH_LEN) {
-        http_dl_log_debug("invalid path length: %s", path);
-        return NULL;
-    }
+/* http_dl_info_tcache line룬mallocֻ֤16ֽڣʱҪ롣ص */
+static http_dl_info_t *http_dl_info_alloc()
+{
+    void *res;
 
-    /* رļlocal */
-    p--;
-    for (local_len = 0; *p != '/'; p--, local_len++) {
-        (void)0;
-    }
-    local = p + 1;
-    if (local_len <= 0 || local_len >= HTTP_DL_LOCAL_LEN) {
-        http_dl_log_debug("invalid local file name: %s", local);
+    if (posix_memalign(&res, HTTP_DL_CACHE_LINE, sizeof(http_dl_info_t)) != 0) {
+        http_dl_log_debug("allocate %d failed", (int)sizeof(http_dl_info_t));
         return NULL;
     }
+    bzero(res, sizeof(http_dl_info_t));
 
-    di = http_dl_xrealloc(NULL, sizeof(http_dl_info_t));
-    if (di == NULL) {
-        http_dl_log_debug("allocate failed");
-        return NULL;
-    }
+    return res;
+}
 
-    bzero(di, sizeof(http_dl_info_t));
-    memcpy(di->url, url, url_len);
-    memcpy(di->host, host, host_len);
-    memcpy(di->path, path, path_len);
-    memcpy(di->local, local, local_len);
-    if (port != 0) {
-        di->port = port;
-    } else {
-        di->port = 80;  /* Ĭϵhttp˿ */
-    }
+static int http_dl_plain_read(http_dl_info_t *info, char *buf, int len)
+{
+    int ret;
 
-    di->stage = HTTP_DL_STAGE_INIT;
-    INIT_LIST_HEAD(&di->list);
+    do {
+        ret = read(info->sockfd, buf, len);
+    } while (ret == -1 && errno == EINTR);
 
-    di->recv_len = 0;
-    di->content_len = 0;
-    di->total_len = 0;
-    di->status_code = HTTP_DL_OK;
-    di->sockfd = -1;
-    if (http_dl_init_filefd(di) != HTTP_DL_OK) {
-        http_dl_log_error("Initialize file fd failed: %s.", di->local);
-        goto err_out;
+    if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return -HTTP_DL_ERR_AGAIN;
     }
 
-    di->buf_data = di->buf;
-    di->buf_tail = di->buf;
-
-    return di;
-
-err_out:
-    http_dl_free(di);
-
-    return NULL;
+    return ret;
 }
 
-static void http_dl_add_info_to_list(http_dl_info_t *info, http_dl_list_t *list)
+/* socketǷģֻдһΣдֽһֽҲдʱ-HTTP_DL_ERR_AGAIN */
+static int http_dl_plain_write(http_dl_info_t *info, char *buf, int len)
 {
-    if (info == NULL || list == NULL) {
-        return;
+    int ret;
+
+    do {
+        ret = write(info->sockfd, buf, len);
+    } while (ret == -1 && errno == EINTR);
+
+    if (ret < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? -HTTP_DL_ERR_AGAIN : -HTTP_DL_ERR_WRITE;
     }
+    http_dl_prof.writes++;
+    http_dl_prof.write_bytes += ret;
 
-    list_add_tail(&info->list, &list->list);
-    list->count++;
+    return ret;
 }
 
-static void http_dl_add_info_to_download_list(http_dl_info_t *info)
+static int http_dl_plain_writev(http_dl_info_t *info, struct iovec *iov, int iovcnt)
 {
-    if (info == NULL) {
-        return;
+    ssize_t ret;
+
+    do {
+        ret = writev(info->sockfd, iov, iovcnt);
+    } while (ret == -1 && errno == EINTR);
+
+    if (ret < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? -HTTP_DL_ERR_AGAIN : -HTTP_DL_ERR_WRITE;
     }
+    http_dl_prof.writes++;
+    http_dl_prof.write_bytes += ret;
 
-    http_dl_add_info_to_list(info, &http_dl_list_downloading);
-    if (http_dl_list_downloading.maxfd < info->sockfd) {
-        http_dl_list_downloading.maxfd = info->sockfd;
-    }
+    return ret;
 }
 
-static void http_dl_del_info_from_download_list(http_dl_info_t *info)
+static const http_dl_transport_t http_dl_transport_plain = {
+    .name = "tcp",
+    .read = http_dl_plain_read,
+    .write = http_dl_plain_write,
+    .writev = http_dl_plain_writev,
+};
+
+#ifdef HTTP_DL_WITH_OPENSSL
+/*
+ * TLS䣬OpenSSLsocketʼǷģ
+ * ¼ѭаWANT_READ/WANT_WRITEƽ
+ * ỰƱݰhost(TLS 1.3Ʊ֮ŵֻûصȡ)
+ * ´ͬһhostʱָỰʡȥ֣
+ * ں֧ʱkTLSӽںɡ
+ */
+static int http_dl_tls_new_session(SSL *ssl, SSL_SESSION *sess)
 {
-    if (info == NULL) {
-        return;
-    }
+    http_dl_info_t *info = SSL_get_app_data(ssl);
 
-    list_del_init(&info->list);
-    http_dl_list_downloading.count--;
-    if (http_dl_list_downloading.count == 0) {
-        http_dl_list_downloading.maxfd = -1;
-    } else {
-        /*
-         * ע: ʱӦdownloading listҳµmaxfdʹķܿҵһ
-         *       ôȷõֵ
-         */
-        if (http_dl_list_downloading.maxfd == info->sockfd) {
-            http_dl_list_downloading.maxfd = info->sockfd - 1;
-        }
+    if (info == NULL || info->hs == NULL) {
+        return 0;
     }
-}
 
-static void http_dl_init()
-{
-    http_dl_list_initial.count = 0;
-    http_dl_list_initial.maxfd = -1;
-    INIT_LIST_HEAD(&http_dl_list_initial.list);
-    sprintf(http_dl_list_initial.name, "Initial list");
-
-    http_dl_list_downloading.count = 0;
-    http_dl_list_downloading.maxfd = -1;
-    INIT_LIST_HEAD(&http_dl_list_downloading.list);
-    sprintf(http_dl_list_downloading.name, "Downloading list");
+    if (info->hs->tls_session != NULL) {
+        SSL_SESSION_free(info->hs->tls_session);
+    }
+    info->hs->tls_session = sess;
+    http_dl_log_debug("Save TLS session of %s.", info->host);
 
-    http_dl_list_finished.count = 0;
-    http_dl_list_finished.maxfd = -1;
-    INIT_LIST_HEAD(&http_dl_list_finished.list);
-    sprintf(http_dl_list_finished.name, "Finished list");
+    return 1;   /* sess */
 }
 
-static void http_dl_list_destroy(http_dl_list_t *list)
+static int http_dl_tls_init()
 {
-    http_dl_info_t *info, *next_info;
+    SSL_CTX *ctx;
 
-    if (list == NULL) {
-        return;
+    if (http_dl_tls_ctx != NULL) {
+        return HTTP_DL_OK;
     }
 
-    list_for_each_entry_safe(info, next_info, &list->list, list, http_dl_info_t) {
-        http_dl_log_debug("[%s] delete %s", list->name, info->url);
-        list_del_init(&info->list);
-        http_dl_free(info);
-        list->count--;
+    ctx = SSL_CTX_new(TLS_client_method());
+    if (ctx == NULL) {
+        http_dl_log_error("Create TLS context failed.");
+        return -HTTP_DL_ERR_TLS;
     }
 
-    if (list->count != 0) {
-        http_dl_log_error("[%s] FATAL error, after destroy list->count %d (should 0).",
-                                list->name, list->count);
-    } else {
-        http_dl_log_debug("[%s] destroy success.", list->name);
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    /* ٷclose_notifyͶϿǷContent-Lengthж */
+    SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+    /* дĲӵĻУsocketддhttp_dl_tls_write */
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
+
+    if (!http_dl_tls_insecure) {
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+        if (http_dl_tls_cafile != NULL) {
+            if (SSL_CTX_load_verify_locations(ctx, http_dl_tls_cafile, NULL) != 1) {
+                http_dl_log_error("Load CA file %s failed.", http_dl_tls_cafile);
+                SSL_CTX_free(ctx);
+                return -HTTP_DL_ERR_TLS;
+            }
+        } else {
+            SSL_CTX_set_default_verify_paths(ctx);
+        }
     }
-}
 
-static void http_dl_destroy()
-{
-    http_dl_list_destroy(&http_dl_list_initial);
-    http_dl_list_destroy(&http_dl_list_downloading);
-    http_dl_list_destroy(&http_dl_list_finished);
-}
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, http_dl_tls_new_session);
 
-static void http_dl_list_debug(http_dl_list_t *list)
-{
-    http_dl_info_t *info;
+    http_dl_tls_ctx = ctx;
 
-    if (list == NULL) {
-        return;
-    }
+    return HTTP_DL_OK;
+}
 
-    http_dl_print_raw("\n%s [%d]:\n", list->name, list->count);
-    list_for_each_entry(info, &list->list, list, http_dl_info_t) {
-        if (info->recv_len == 0) {
-            http_dl_print_raw("\t%s\n", info->url);
-        } else if (info->elapsed_time == -1) {
-            http_dl_print_raw("\t%s [%ld B/%ld B], restart[%ld B], total[%ld B]\n",
-                                info->local, info->recv_len, info->content_len,
-                                info->restart_len, info->total_len);
-        } else {
-            http_dl_print_raw("\t%s [%ld B/%ld B], restart[%ld B], total[%ld B] [%ld KB/s]\n",
-                                info->local,
-                                info->recv_len,
-                                info->content_len,
-                                info->restart_len,
-                                info->total_len,
-                                info->recv_len / info->elapsed_time);
-        }
+static void http_dl_tls_destroy()
+{
+    if (http_dl_tls_ctx != NULL) {
+        SSL_CTX_free(http_dl_tls_ctx);
+        http_dl_tls_ctx = NULL;
     }
-    http_dl_print_raw("--------------\n");
 }
 
-static void http_dl_debug_show()
+/* ѾӲӰ죬֮Ӱµô */
+int http_dl_tls_config(const char *cafile, bool insecure)
 {
-    http_dl_list_debug(&http_dl_list_initial);
-    http_dl_list_debug(&http_dl_list_downloading);
-    http_dl_list_debug(&http_dl_list_finished);
+    http_dl_tls_cafile = (char *)cafile;
+    http_dl_tls_insecure = insecure;
+    http_dl_tls_destroy();
+
+    return HTTP_DL_OK;
 }
 
-static int http_dl_send_req(http_dl_info_t *di)
+static SSL *http_dl_tls_new(http_dl_info_t *info)
 {
-    int ret, nwrite;
-    char range[HTTP_DL_BUF_LEN], *useragent;
-    char *request;
-    int request_len;
-    char *command = "GET";
-
-    if (di == NULL) {
-        return -HTTP_DL_ERR_INVALID;
-    }
+    struct in_addr addr;
+    SSL *ssl;
 
-    if (di->stage < HTTP_DL_STAGE_SEND_REQUEST) {
-        ret = http_dl_conn(di->host, di->port);
-        if (ret < 0) {
-            http_dl_log_debug("connect failed: %s:%d", di->host, di->port);
-            return -HTTP_DL_ERR_CONN;
-        }
-        di->sockfd = ret;
-        di->stage = HTTP_DL_STAGE_SEND_REQUEST;
+    if (http_dl_tls_init() != HTTP_DL_OK) {
+        return NULL;
     }
 
-    bzero(range, sizeof(range));
-    if (di->restart_len != 0) { /* ϵ */
-        if (sizeof(range) < (http_dl_numdigit(di->restart_len) + 17)) {
-            http_dl_log_error("range string is longer than %d", sizeof(range) - 17);
-            return -HTTP_DL_ERR_INVALID;
-        }
-        sprintf(range, "Range: bytes=%ld-\r\n", di->restart_len);
+    ssl = SSL_new(http_dl_tls_ctx);
+    if (ssl == NULL) {
+        return NULL;
     }
 
-    if (di->flags & HTTP_DL_F_GENUINE_AGENT) {
-        useragent = http_dl_agent_string_genuine;
+    SSL_set_fd(ssl, info->sockfd);
+    SSL_set_app_data(ssl, info);
+    if (inet_pton(AF_INET, info->host, &addr) == 1) {
+        /* IPַSNIֻУ֤еIP */
+        X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), info->host);
     } else {
-        useragent = http_dl_agent_string;
-    }
-
-    request_len = strlen(command) + strlen(di->path)
-                + strlen(useragent)
-                + strlen(di->host) + http_dl_numdigit(di->port)
-                + strlen(HTTP_ACCEPT)
-                + strlen(range)
-                + 64;
-    request = http_dl_xrealloc(NULL, request_len);
-    if (request == NULL) {
-        http_dl_log_error("allocate request buffer %d failed.", request_len);
-        return -HTTP_DL_ERR_RESOURCE;
+        SSL_set_tlsext_host_name(ssl, info->host);
+        SSL_set1_host(ssl, info->host);
     }
 
-    bzero(request, request_len);
-    sprintf(request, "%s %s HTTP/1.0\r\n"
-                     "User-Agent: %s\r\n"
-                     "Host: %s:%d\r\n"
-                     "Accept: %s\r\n"
-                     "%s\r\n",
-                     command, di->path,
-                     useragent,
-                     di->host, di->port,
-                     HTTP_ACCEPT,
-                     range);
-    http_dl_log_debug("\n--- request begin ---\n%s--- request end ---\n", request);
-
-    nwrite = http_dl_iwrite(di->sockfd, request, strlen(request));
-    if (nwrite < 0) {
-        http_dl_log_debug("write HTTP request failed.");
-        ret = -HTTP_DL_ERR_WRITE;
-        goto err_out;
+    if (info->hs != NULL && info->hs->tls_session != NULL) {
+        SSL_set_session(ssl, info->hs->tls_session);
     }
 
-    http_dl_log_info("HTTP request sent, awaiting response...");
-    ret = HTTP_DL_OK;
-
-err_out:
-    http_dl_free(request);
+    if (info->flags & HTTP_DL_F_H2_CTRL) {
+        /* ͨALPNЭHTTP/2֧ʱ˻HTTP/1 */
+        SSL_set_alpn_protos(ssl, (const unsigned char *)"\x02h2", 3);
+    }
 
-    return ret;
+    return ssl;
 }
 
-static void http_dl_list_proc_initial()
+static int http_dl_tls_handshake(http_dl_info_t *info)
 {
-    http_dl_list_t *dl_list;
-    http_dl_info_t *info, *next_info;
-    int res;
+    SSL *ssl = info->tls;
+    int ret, err;
+    bool ktls_tx = false, ktls_rx = false;
+    long verify;
+
+    if (ssl == NULL) {
+        ssl = http_dl_tls_new(info);
+        if (ssl == NULL) {
+            snprintf(info->err_msg, sizeof(info->err_msg), "Create TLS connection failed");
+            return -HTTP_DL_ERR_TLS;
+        }
+        info->tls = ssl;
+    }
 
-    dl_list = &http_dl_list_initial;
+    ERR_clear_error();
+    ret = SSL_connect(ssl);
+    if (ret == 1) {
+#if defined(BIO_get_ktls_send) && defined(BIO_get_ktls_recv)
+        ktls_tx = BIO_get_ktls_send(SSL_get_wbio(ssl));
+        ktls_rx = BIO_get_ktls_recv(SSL_get_rbio(ssl));
+#endif
+        http_dl_log_info("TLS connected to %s:%d, %s %s, %s session, kTLS tx %s rx %s",
+                            info->host, info->port, SSL_get_version(ssl), SSL_get_cipher(ssl),
+                            SSL_session_reused(ssl) ? "resumed" : "new",
+                            ktls_tx ? "on" : "off", ktls_rx ? "on" : "off");
+        return HTTP_DL_OK;
+    }
 
-    if (dl_list->count == 0) {
-        return;
+    err = SSL_get_error(ssl, ret);
+    if (err == SSL_ERROR_WANT_READ) {
+        info->flags &= ~HTTP_DL_F_WANT_WRITE;
+        return -HTTP_DL_ERR_AGAIN;
+    } else if (err == SSL_ERROR_WANT_WRITE) {
+        info->flags |= HTTP_DL_F_WANT_WRITE;
+        return -HTTP_DL_ERR_AGAIN;
     }
 
-    list_for_each_entry_safe(info, next_info, &dl_list->list, list, http_dl_info_t) {
-        list_del_init(&info->list);
-        dl_list->count--;
-        res = http_dl_send_req(info);
-        if (res == HTTP_DL_OK) {
-            http_dl_add_info_to_download_list(info);
-        } else {
-            http_dl_log_debug("re-add %s to %s", info->url, dl_list->name);
-            http_dl_add_info_to_list(info, dl_list);
-        }
+    verify = SSL_get_verify_result(ssl);
+    if (verify != X509_V_OK) {
+        snprintf(info->err_msg, sizeof(info->err_msg), "TLS handshake failed: %s",
+                    X509_verify_cert_error_string(verify));
+    } else {
+        snprintf(info->err_msg, sizeof(info->err_msg), "TLS handshake failed: %s",
+                    ERR_reason_error_string(ERR_peek_last_error()));
     }
+    http_dl_log_error("%s: %s", info->url, info->err_msg);
 
-    return;
+    return -HTTP_DL_ERR_TLS;
 }
 
-static int http_dl_parse_status_line(http_dl_info_t *info)
+static int http_dl_tls_read(http_dl_info_t *info, char *buf, int len)
 {
-    int reason_nbytes;
-    int mjr, mnr, statcode;
-    char *line_end, *p;
+    int ret;
 
-    if (info == NULL) {
-        return -HTTP_DL_ERR_INVALID;
+    ERR_clear_error();
+    ret = SSL_read(info->tls, buf, len);
+    if (ret > 0) {
+        return ret;
     }
 
-    if (info->stage != HTTP_DL_STAGE_PARSE_STATUS_LINE) {
-        http_dl_log_debug("Wrong stage %d.", info->stage);
-        return -HTTP_DL_ERR_INTERNAL;
+    switch (SSL_get_error(info->tls, ret)) {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        /* һļ¼ֻյ˻ỰƱ */
+        return -HTTP_DL_ERR_AGAIN;
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    default:
+        http_dl_log_error("SSL_read failed: %s", ERR_reason_error_string(ERR_peek_last_error()));
+        return -1;
     }
+}
 
-    *(info->buf_tail) = '\0';   /* ַʱȷԽ */
-
-    line_end = strstr(info->buf_data, "\r\n");
-    if (line_end == NULL) {
-        /* status lineû... */
-        http_dl_log_debug("Incompleted status line: %s", info->buf_data);
-        return HTTP_DL_OK;
-    }
+/*
+ * ֻͬдһΡĿ˲д(PARTIAL_WRITE)Ѿдֽ
+ * ͻʱSSL_writeWANT_WRITE(ԿµҲWANT_READ)-HTTP_DL_ERR_AGAIN
+ * ʣµɵ߱棬socketдͬݽд(ACCEPT_MOVING_WRITE_BUFFER)
+ */
+static int http_dl_tls_write(http_dl_info_t *info, char *buf, int len)
+{
+    int ret, err;
 
-    /* The standard format of HTTP-Version is: `HTTP/X.Y', where X is
-     major version, and Y is minor version.  */
-    if (strncmp(info->buf_data, "HTTP/", 5) != 0) {
-        http_dl_log_debug("Invalid status line: %s", info->buf_data);
-        return -HTTP_DL_ERR_INVALID;
+    ERR_clear_error();
+    ret = SSL_write(info->tls, buf, len);
+    if (ret <= 0) {
+        err = SSL_get_error(info->tls, ret);
+        if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {
+            return -HTTP_DL_ERR_AGAIN;
+        }
+        http_dl_log_error("SSL_write failed: %d", err);
+        return -HTTP_DL_ERR_WRITE;
     }
-    info->buf_data += 5;
+    http_dl_prof.writes++;
+    http_dl_prof.write_bytes += ret;
 
-    /* Calculate major HTTP version.  */
-    p = info->buf_data;
-    for (mjr = 0; isdigit(*p); p++) {
-        mjr = 10 * mjr + (*p - '0');
-    }
-    if (*p != '.' || p == info->buf_data) {
-        http_dl_log_debug("Invalid status line: %s", info->buf_data);
-        return -HTTP_DL_ERR_INVALID;
-    }
-    p++;
-    info->buf_data = p;
+    return ret;
+}
 
-    /* Calculate minor HTTP version.  */
-    for (mnr = 0; isdigit(*p); p++) {
-        mnr = 10 * mnr + (*p - '0');
-    }
-    if (*p != ' ' || p == info->buf_data) {
-        http_dl_log_debug("Invalid status line: %s", info->buf_data);
-        return -HTTP_DL_ERR_INVALID;
+/* SSL_writeûзɢдջƴдһֻһTLS¼ֵͬhttp_dl_tls_write */
+static int http_dl_tls_writev(http_dl_info_t *info, struct iovec *iov, int iovcnt)
+{
+    char buf[HTTP_DL_READBUF_LEN], *p;
+    int i, n, ret, len = 0, done = 0;
+    size_t left;
+
+    for (i = 0; i < iovcnt || len > 0; i++) {
+        p = (i < iovcnt) ? iov[i].iov_base : buf;
+        left = (i < iovcnt) ? iov[i].iov_len : 0;
+        while (left > 0 || i >= iovcnt) {
+            n = MINVAL(left, sizeof(buf) - len);
+            memcpy(buf + len, p, n);
+            len += n;
+            p += n;
+            left -= n;
+            if (len < sizeof(buf) && i < iovcnt) {
+                continue;
+            }
+            /* ˣiovƴ */
+            ret = http_dl_tls_write(info, buf, len);
+            if (ret < 0) {
+                return (done > 0 && ret == -HTTP_DL_ERR_AGAIN) ? done : ret;
+            }
+            done += ret;
+            if (ret < len) {
+                return done;
+            }
+            len = 0;
+            if (i >= iovcnt) {
+                break;
+            }
+        }
     }
 
-    http_dl_log_debug("Version is HTTP/%d.%d", mjr, mnr);
+    return done;
+}
 
-    p++;
-    info->buf_data = p;
+static int http_dl_tls_pending(http_dl_info_t *info)
+{
+    return SSL_pending(info->tls);
+}
 
-    /* Calculate status code.  */
-    if (!(isdigit(p[0]) && isdigit(p[1]) && isdigit(p[2]))) {
-        http_dl_log_debug("Invalid status line: %s", info->buf_data);
-        return -HTTP_DL_ERR_INVALID;
+static void http_dl_tls_close(void *tls)
+{
+    if (tls == NULL) {
+        return;
     }
-    statcode = 100 * (p[0] - '0') + 10 * (p[1] - '0') + (p[2] - '0');
-    http_dl_log_debug("Status code is %d", statcode);
 
-    /* Set up the reason phrase pointer.  */
-    p += 3;
-    info->buf_data = p;
-    if (*p != ' ') {
-        http_dl_log_debug("Invalid status line: %s", info->buf_data);
-        return -HTTP_DL_ERR_INVALID;
+    if (SSL_is_init_finished((SSL *)tls)) {
+        /* ֻclose_notifyȴԶ˻Ӧ */
+        (void)SSL_shutdown(tls);
     }
-    info->buf_data++;
-    reason_nbytes = line_end - info->buf_data;
-    bzero(info->err_msg, sizeof(info->err_msg));
-    memcpy(info->err_msg, info->buf_data, MINVAL((sizeof(info->err_msg) - 1), reason_nbytes));
-    info->status_code = statcode;
-
-    http_dl_log_debug("Finish parse HTTP status line: %s", info->err_msg);
+    SSL_free(tls);
+}
 
-    info->stage = HTTP_DL_STAGE_PARSE_HEADER;
+static const http_dl_transport_t http_dl_transport_tls = {
+    .name = "tls",
+    .handshake = http_dl_tls_handshake,
+    .read = http_dl_tls_read,
+    .write = http_dl_tls_write,
+    .writev = http_dl_tls_writev,
+    .pending = http_dl_tls_pending,
+    .close = http_dl_tls_close,
+};
+#else
+int http_dl_tls_config(const char *cafile, bool insecure)
+{
+    http_dl_log_error("Built without OpenSSL, TLS is not supported.");
+    return -HTTP_DL_ERR_INVALID;
+}
+#endif
 
-    info->buf_data = line_end + 2;  /* Թ"\r\n" */
-    if (info->buf_data < info->buf_tail) {
-        /* δ꣬תһstage */
-        return -HTTP_DL_ERR_AGAIN;
+static const http_dl_transport_t *http_dl_transport_get(http_dl_info_t *info)
+{
+#ifdef HTTP_DL_WITH_OPENSSL
+    if (info->flags & HTTP_DL_F_TLS) {
+        return &http_dl_transport_tls;
     }
-
-    return HTTP_DL_OK;
+#endif
+    return &http_dl_transport_plain;
 }
 
-/* Skip LWS (linear white space), if present.  Returns number of
-   characters to skip.  */
-static int http_dl_clac_lws(const char *string)
+/* Ѿյselect */
+static int http_dl_conn_pending(http_dl_info_t *info)
 {
-    const char *p = string;
-
-    if (string == NULL) {
+    if (info->transport == NULL || info->transport->pending == NULL || info->tls == NULL) {
         return 0;
     }
 
-    while (*p == ' ' || *p == '\t') {
-        ++p;
-    }
-
-    return (p - string);
+    return info->transport->pending(info);
 }
 
-static int http_dl_header_extract_long_num(const char *val, void *closure)
-{
-    const char *p = val;
-    long result;
+static void http_dl_h2_stream_close(http_dl_info_t *info);
 
-    if (val == NULL || closure == NULL) {
-        return -HTTP_DL_ERR_INVALID;
+/* رӣͬʱͷŴ״̬ */
+static void http_dl_conn_close(http_dl_info_t *info)
+{
+    if (info->flags & HTTP_DL_F_H2) {
+        /* HTTP/2ûԼӣֻȡ */
+        http_dl_h2_stream_close(info);
+        return;
     }
 
-    for (result = 0; isdigit(*p); p++) {
-        result = 10 * result + (*p - '0');
-    }
-    if (*p != '\r') {
-        return -HTTP_DL_ERR_INVALID;
+    if (info->transport != NULL && info->transport->close != NULL) {
+        info->transport->close(info->tls);
     }
+    info->tls = NULL;
 
-    *(long *)closure = result;
+    /* ûдһϣʱ */
+    http_dl_free(info->wbuf);
+    info->wbuf = NULL;
+    info->wlen = 0;
+    info->flags &= ~HTTP_DL_F_WANT_WRITE;
 
-    return HTTP_DL_OK;
+    if (info->sockfd >= 0) {
+        http_dl_log_debug("close opened socket fd %d", info->sockfd);
+        close(info->sockfd);
+        info->sockfd = -1;
+    }
 }
 
-static int http_dl_header_dup_str_to_buf(const char *val, void *buf)
+static void http_dl_conn_free(http_dl_conn_t *conn)
 {
-    int len;
-    char *val_end;
-
-    if (val == NULL || buf == NULL) {
-        return -HTTP_DL_ERR_INVALID;
-    }
-
-    val_end = strstr(val, "\r\n");
-    if (val_end == NULL) {
-        return -HTTP_DL_ERR_INVALID;
+    if (conn->transport->close != NULL) {
+        conn->transport->close(conn->tls);
     }
-
-    len = val_end - val;
-    if (len <= 0) {
-        return -HTTP_DL_ERR_INVALID;
-    }
-
-    bzero(buf, HTTP_DL_BUF_LEN);
-    memcpy(buf, val, MINVAL(len, HTTP_DL_BUF_LEN - 1));
-
-    return HTTP_DL_OK;
+    close(conn->sockfd);
+    http_dl_str_put(conn->host);
+    http_dl_free(conn);
 }
 
 /*
- * Content-Range: bytes 1113952-1296411/9570351
- * Content-Range: bytes 0-12903171/12903172
+ * ӳȡһhost:portͬĿӣʹãû򷵻-1
+ * ȡǰMSG_PEEKһ£ԶѹرջݵֱӶ
  */
-static int http_dl_header_parse_range(const char *hdr, void *arg)
+static int http_dl_conn_pool_get(http_dl_info_t *info)
 {
-    http_dl_range_t *closure = (http_dl_range_t *)arg;
-    long num;
+    http_dl_conn_t *conn, *next_conn;
+    const http_dl_transport_t *transport = http_dl_transport_get(info);
+    char c;
+    int ret;
 
-    if (closure == NULL) {
-        return -HTTP_DL_ERR_INVALID;
-    }
+    list_for_each_entry_safe(conn, next_conn, &http_dl_conn_pool, list, http_dl_conn_t) {
+        if (conn->port != info->port || conn->transport != transport
+            || conn->host != info->host) {
+            continue;
+        }
 
-    /* Certain versions of Nutscape proxy server send out
-    `Content-Length' without "bytes" specifier, which is a breach of
-    RFC2068 (as well as the HTTP/1.1 draft which was current at the
-    time).  But hell, I must support it...  */
-    if (strncasecmp(hdr, "bytes", 5) == 0) {
-        hdr += 5;
-        hdr += http_dl_clac_lws(hdr);
-        if (!*hdr) {
-            return -HTTP_DL_ERR_INVALID;
+        list_del_init(&conn->list);
+        http_dl_conn_pool_count--;
+
+        ret = recv(conn->sockfd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            http_dl_log_debug("Reuse pooled socket fd %d for %s:%d.",
+                                conn->sockfd, info->host, info->port);
+            info->sockfd = conn->sockfd;
+            info->rcvbuf = conn->rcvbuf;
+            info->transport = conn->transport;
+            info->tls = conn->tls;
+#ifdef HTTP_DL_WITH_OPENSSL
+            if (info->tls != NULL) {
+                SSL_set_app_data(info->tls, info);
+            }
+#endif
+            http_dl_str_put(conn->host);
+            http_dl_free(conn);
+            return info->sockfd;
         }
+
+        http_dl_log_debug("Pooled socket fd %d is stale, close it.", conn->sockfd);
+        http_dl_conn_free(conn);
     }
 
-    if (!isdigit(*hdr)) {
-        return -HTTP_DL_ERR_INVALID;
+    return -1;
+}
+
+/* ӷӳأٳ */
+static void http_dl_conn_pool_put(http_dl_info_t *info)
+{
+    http_dl_conn_t *conn;
+
+    if (http_dl_conn_pool_count >= HTTP_DL_CONN_POOL_LEN) {
+        conn = list_entry(http_dl_conn_pool.next, http_dl_conn_t, list);
+        list_del_init(&conn->list);
+        http_dl_conn_pool_count--;
+        http_dl_conn_free(conn);
     }
 
-    for (num = 0; isdigit(*hdr); hdr++) {
-        num = 10 * num + (*hdr - '0');
+    conn = http_dl_xrealloc(NULL, sizeof(http_dl_conn_t));
+    if (conn == NULL) {
+        http_dl_conn_close(info);
+        return;
     }
 
-    if (*hdr != '-' || !isdigit(*(hdr + 1))) {
-        return -HTTP_DL_ERR_INVALID;
+    bzero(conn, sizeof(http_dl_conn_t));
+    conn->host = http_dl_str_ref(info->host);
+    conn->port = info->port;
+    conn->sockfd = info->sockfd;
+    conn->rcvbuf = info->rcvbuf;
+    conn->transport = info->transport;
+    conn->tls = info->tls;
+#ifdef HTTP_DL_WITH_OPENSSL
+    if (conn->tls != NULL) {
+        SSL_set_app_data(conn->tls, NULL);
     }
+#endif
+    list_add_tail(&conn->list, &http_dl_conn_pool);
+    http_dl_conn_pool_count++;
 
-    closure->first_byte_pos = num;
-    ++hdr;
+    http_dl_log_debug("Put socket fd %d of %s:%d into pool.", info->sockfd, info->host, info->port);
+    info->sockfd = -1;
+    info->tls = NULL;
+}
 
-    for (num = 0; isdigit(*hdr); hdr++) {
-        num = 10 * num + (*hdr - '0');
-    }
+static void http_dl_conn_pool_destroy()
+{
+    http_dl_conn_t *conn, *next_conn;
 
-    if (*hdr != '/' || !isdigit(*(hdr + 1))) {
-        return -HTTP_DL_ERR_INVALID;
+    list_for_each_entry_safe(conn, next_conn, &http_dl_conn_pool, list, http_dl_conn_t) {
+        list_del_init(&conn->list);
+        http_dl_conn_free(conn);
     }
+    http_dl_conn_pool_count = 0;
+}
 
-    closure->last_byte_pos = num;
-    ++hdr;
+/* ʱӣλms */
+static long http_dl_now_ms()
+{
+    struct timespec ts;
 
-    for (num = 0; isdigit(*hdr); hdr++) {
-        num = 10 * num + (*hdr - '0');
-    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-    closure->entity_length = num;
-    return HTTP_DL_OK;
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-#if 0
-/* Strdup HEADER, and place the pointer to CLOSURE. XXX ǵͷŶѿռbuffer */
-static int http_dl_header_alloc_and_dup_str(const char *val, void *closure)
+/* http_dl_now_msͬһʱӣλ΢룬ڸ׶εļʱ */
+static long http_dl_now_us()
 {
-    int len;
-    char *p, *val_end;
-
-    if (val == NULL || closure == NULL) {
-        return -HTTP_DL_ERR_INVALID;
-    }
+    struct timespec ts;
 
-    val_end = strstr(val, "\r\n");
-    if (val_end == NULL) {
-        return -HTTP_DL_ERR_INVALID;
-    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-    len = val_end - val;
-    if (len <= 0) {
-        return -HTTP_DL_ERR_INVALID;
-    }
-    len++;
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
-    p = http_dl_xrealloc(NULL, len);
-    if (p == NULL) {
-        return -HTTP_DL_ERR_INVALID;
-    }
-    bzero(p, len);
-    memcpy(p, val, len);
+/* ¼ѭʱãvDSOʵ֣ں */
+static long http_dl_now_ns()
+{
+    struct timespec ts;
 
-    *(char **)closure = p;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-    return HTTP_DL_OK;
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
 }
 
-/* "none"ô*closure10 */
-static int http_dl_header_judge_str_none(const char *val, void *closure)
+static void http_dl_timer_wheel_init(long now)
 {
-    char *val_end, *res;
-    int *where = (int *)closure;
+    int level, i;
 
-    if (val == NULL || closure == NULL) {
-        return -HTTP_DL_ERR_INVALID;
+    for (level = 0; level < HTTP_DL_TW_LEVELS; level++) {
+        for (i = 0; i < HTTP_DL_TW_SIZE; i++) {
+            INIT_LIST_HEAD(&http_dl_timer_wheel.slots[level][i]);
+        }
     }
+    http_dl_timer_wheel.tick = now / HTTP_DL_TIMER_TICK_MS;
+    http_dl_timer_wheel_count = 0;
+}
 
-    if ((val_end = strstr(val, "\r\n")) == NULL) {
-        return -HTTP_DL_ERR_INVALID;
+/* 뵽ڵtickӦĸ */
+static void http_dl_timer_internal_add(http_dl_timer_t *timer)
+{
+    http_dl_timer_wheel_t *tw = &http_dl_timer_wheel;
+    unsigned long expires = timer->expires;
+    unsigned long idx = expires - tw->tick;
+    unsigned long max = (1UL << (HTTP_DL_TW_BITS * HTTP_DL_TW_LEVELS)) - 1;
+    int level;
+
+    if ((long)idx < 0) {
+        /* Ѿڣһtick */
+        list_add_tail(&timer->list, &tw->slots[0][tw->tick & HTTP_DL_TW_MASK]);
+        return;
     }
 
-    res = strstr(val, "none");
-    if (res != NULL && res < val_end) {
-        *where = 1;
-    } else {
-        *where = 0;
+    if (idx > max) {
+        idx = max;
+        expires = tw->tick + max;
+        timer->expires = expires;
     }
 
-    return HTTP_DL_OK;
-}
+    for (level = 0; level < HTTP_DL_TW_LEVELS - 1; level++) {
+        if (idx < (1UL << (HTTP_DL_TW_BITS * (level + 1)))) {
+            break;
+        }
+    }
+    list_add_tail(&timer->list,
+            &tw->slots[level][(expires >> (HTTP_DL_TW_BITS * level)) & HTTP_DL_TW_MASK]);
+}
+
+static void http_dl_timer_del(http_dl_timer_t *timer)
+{
+    if (!list_empty(&timer->list)) {
+        list_del_init(&timer->list);
+        http_dl_timer_wheel_count--;
+    }
+}
+
+/* ()ʱexpirestick */
+static void http_dl_timer_mod(http_dl_timer_t *timer, unsigned long expires)
+{
+    http_dl_timer_del(timer);
+    timer->expires = expires;
+    http_dl_timer_internal_add(timer);
+    http_dl_timer_wheel_count++;
+}
+
+/* level㵱ǰĶʱ·ɢ²㣬ظ±꣬Ϊ0ʱҪһ */
+static int http_dl_timer_cascade(int level)
+{
+    http_dl_timer_wheel_t *tw = &http_dl_timer_wheel;
+    http_dl_timer_t *timer, *next_timer;
+    int index = (tw->tick >> (HTTP_DL_TW_BITS * level)) & HTTP_DL_TW_MASK;
+    LIST_HEAD(tmp);
+
+    list_splice_init(&tw->slots[level][index], &tmp);
+    list_for_each_entry_safe(timer, next_timer, &tmp, list, http_dl_timer_t) {
+        list_del_init(&timer->list);
+        http_dl_timer_internal_add(timer);
+    }
+
+    return index;
+}
+
+/* nowΪֹеڵĶʱصпöʱ */
+static void http_dl_timer_run(long now)
+{
+    http_dl_timer_wheel_t *tw = &http_dl_timer_wheel;
+    unsigned long target = now / HTTP_DL_TIMER_TICK_MS;
+    http_dl_timer_t *timer;
+    int index, level;
+    LIST_HEAD(work);
+
+    while ((long)(target - tw->tick) >= 0) {
+        index = tw->tick & HTTP_DL_TW_MASK;
+        if (index == 0) {
+            for (level = 1; level < HTTP_DL_TW_LEVELS; level++) {
+                if (http_dl_timer_cascade(level) != 0) {
+                    break;
+                }
+            }
+        }
+        tw->tick++;
+
+        list_splice_init(&tw->slots[0][index], &work);
+        while (!list_empty(&work)) {
+            timer = list_entry(work.next, http_dl_timer_t, list);
+            list_del_init(&timer->list);
+            http_dl_timer_wheel_count--;
+            timer->func(timer);
+        }
+    }
+}
+
+/*
+ * һҪʱֵĺûжʱʱ-1
+ * ֻڵ0ңҲһȦʱȵϲ·ŵʱ̡
+ */
+static long http_dl_timer_next_ms(long now)
+{
+    http_dl_timer_wheel_t *tw = &http_dl_timer_wheel;
+    int index = tw->tick & HTTP_DL_TW_MASK;
+    int i, boundary = HTTP_DL_TW_SIZE - index;
+    long ms;
+
+    if (http_dl_timer_wheel_count == 0) {
+        return -1;
+    }
+
+    for (i = 0; i < boundary; i++) {
+        if (!list_empty(&tw->slots[0][index + i])) {
+            break;
+        }
+    }
+
+    ms = (long)(tw->tick + i) * HTTP_DL_TIMER_TICK_MS - now;
+
+    return (ms > 0) ? ms : 0;
+}
+
+/*
+ * ǰ׶μĽֹʱ䣬0ʾûСwhatضӦʱơ
+ * гʱactive_msΪ׼յʱֻactive_msʱ
+ * ʱʱֻûĽֹʱ䣬ֵٰá
+ */
+static long http_dl_task_deadline(http_dl_info_t *info, const char **what)
+{
+    long deadline = 0, total;
+    const char *name = NULL;
+
+    switch (info->stage) {
+    case HTTP_DL_STAGE_CONNECTING:
+    case HTTP_DL_STAGE_HANDSHAKE:
+        if (http_dl_timeout_connect > 0) {
+            deadline = info->stage_ms + http_dl_timeout_connect;
+            name = "Connect";
+        }
+        break;
+    case HTTP_DL_STAGE_SEND_REQUEST:
+        if (http_dl_timeout_first_byte > 0) {
+            deadline = info->stage_ms + http_dl_timeout_first_byte;
+            name = "First byte";
+        }
+        break;
+    case HTTP_DL_STAGE_PARSE_STATUS_LINE:
+    case HTTP_DL_STAGE_PARSE_HEADER:
+    case HTTP_DL_STAGE_RECV_CONTENT:
+        if (http_dl_timeout_idle > 0) {
+            deadline = info->active_ms + http_dl_timeout_idle;
+            name = "Idle";
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (http_dl_timeout_total > 0 && !(info->flags & HTTP_DL_F_H2_CTRL)) {
+        /* HTTP/2ϵãܵʱ */
+        total = info->begin_ms + http_dl_timeout_total;
+        if (deadline == 0 || total < deadline) {
+            deadline = total;
+            name = "Total";
+        }
+    }
+
+    if (what != NULL) {
+        *what = name;
+    }
+
+    return deadline;
+}
+
+/* ׶α仯µĽֹʱĶʱ */
+static void http_dl_task_timer_update(http_dl_info_t *info)
+{
+    long deadline;
+
+    deadline = http_dl_task_deadline(info, NULL);
+    if (deadline == 0) {
+        http_dl_timer_del(&info->timer);
+        return;
+    }
+
+    http_dl_timer_mod(&info->timer,
+            (deadline + HTTP_DL_TIMER_TICK_MS - 1) / HTTP_DL_TIMER_TICK_MS);
+}
+
+static void http_dl_bucket_init(http_dl_bucket_t *b, long rate)
+{
+    bzero(b, sizeof(http_dl_bucket_t));
+    if (rate <= 0) {
+        return;
+    }
+
+    /* Ͱȡ100msװһread */
+    b->rate = rate;
+    b->burst = (rate / 10 > HTTP_DL_READBUF_LEN) ? (rate / 10) : HTTP_DL_READBUF_LEN;
+    b->tokens = b->burst;
+    b->last_ms = http_dl_now_ms();
+}
+
+static void http_dl_bucket_refill(http_dl_bucket_t *b, long now);
+
+/* ޸ʣͰе */
+static void http_dl_bucket_set_rate(http_dl_bucket_t *b, long rate)
+{
+    if (b->rate == 0 || rate <= 0) {
+        http_dl_bucket_init(b, rate);
+        return;
+    }
+
+    http_dl_bucket_refill(b, http_dl_now_ms());
+    b->rate = rate;
+    b->burst = (rate / 10 > HTTP_DL_READBUF_LEN) ? (rate / 10) : HTTP_DL_READBUF_LEN;
+    b->tokens = MINVAL(b->tokens, b->burst);
+}
+
+static void http_dl_bucket_refill(http_dl_bucket_t *b, long now)
+{
+    long add;
+
+    if (b->rate == 0) {
+        return;
+    }
+
+    add = (now - b->last_ms) * b->rate / 1000;
+    if (add > 0) {
+        b->tokens = MINVAL(b->tokens + add, b->burst);
+        b->last_ms = now;
+    }
+}
+
+/* ƴﵽɶ޻ȴʱ䣬λms0ʾԶ */
+static long http_dl_bucket_wait_ms(http_dl_bucket_t *b, long now)
+{
+    long need;
+
+    if (b->rate == 0) {
+        return 0;
+    }
+
+    http_dl_bucket_refill(b, now);
+    need = MINVAL(HTTP_DL_RATE_MIN_READ, b->burst);
+    if (b->tokens >= need) {
+        return 0;
+    }
+
+    return ((need - b->tokens) * 1000 + b->rate - 1) / b->rate;
+}
+
+static bool http_dl_h2_host_match(const char *host)
+{
+    int i;
+
+    for (i = 0; i < http_dl_h2_hosts_count; i++) {
+        if (strcmp(http_dl_h2_hosts[i], "*") == 0 || strcasecmp(http_dl_h2_hosts[i], host) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* hostǳеַ */
+static http_dl_host_t *http_dl_host_get(const char *host)
+{
+    http_dl_host_t *hs;
+
+    list_for_each_entry(hs, &http_dl_hosts, list, http_dl_host_t) {
+        if (hs->host == host) {
+            return hs;
+        }
+    }
+
+    hs = http_dl_xrealloc(NULL, sizeof(http_dl_host_t));
+    if (hs == NULL) {
+        return NULL;
+    }
+
+    bzero(hs, sizeof(http_dl_host_t));
+    hs->host = http_dl_str_ref(host);
+    http_dl_bucket_init(&hs->bucket, http_dl_rate_host);
+    hs->h2 = http_dl_h2_host_match(host);
+    list_add_tail(&hs->list, &http_dl_hosts);
+
+    return hs;
+}
+
+static void http_dl_host_destroy()
+{
+    http_dl_host_t *hs, *next_hs;
+
+    list_for_each_entry_safe(hs, next_hs, &http_dl_hosts, list, http_dl_host_t) {
+        list_del_init(&hs->list);
+#ifdef HTTP_DL_WITH_OPENSSL
+        if (hs->tls_session != NULL) {
+            SSL_SESSION_free(hs->tls_session);
+        }
 #endif
+        http_dl_free(hs->req.data);
+        http_dl_str_put(hs->host);
+        http_dl_free(hs);
+    }
+}
+
+/*
+ * -rʱȫʰȨطָڽеȼֻһڽʱռȫʣ
+ * ȼֵȼһݡʱá
+ */
+static void http_dl_rate_prio_share()
+{
+    int weights[HTTP_DL_PRIO_LEVELS] = HTTP_DL_PRIO_WEIGHTS;
+    int i, sum = 0;
+
+    if (http_dl_rate_global.rate == 0) {
+        return;
+    }
+
+    for (i = 0; i < HTTP_DL_PRIO_LEVELS; i++) {
+        if (http_dl_running_prio[i] > 0) {
+            sum += weights[i];
+        }
+    }
+    for (i = 0; i < HTTP_DL_PRIO_LEVELS; i++) {
+        if (http_dl_running_prio[i] > 0) {
+            http_dl_bucket_set_rate(&http_dl_rate_prio[i],
+                                    http_dl_rate_global.rate * weights[i] / sum);
+        }
+    }
+}
+
+/* Ӷз-rʱȼķݶ */
+static http_dl_bucket_t *http_dl_rate_prio_bucket(http_dl_info_t *info)
+{
+    if (http_dl_rate_global.rate == 0 || !(info->flags & HTTP_DL_F_RUNNING)) {
+        return NULL;
+    }
+
+    return &http_dl_rate_prio[info->prio];
+}
+
+/* ȫ(ȼķݶ)host٣ȡĵȴʱ */
+static long http_dl_rate_wait_ms(http_dl_info_t *info, long now)
+{
+    http_dl_bucket_t *pb;
+    long wait, ret;
+
+    ret = http_dl_bucket_wait_ms(&http_dl_rate_global, now);
+    pb = http_dl_rate_prio_bucket(info);
+    if (pb != NULL) {
+        wait = http_dl_bucket_wait_ms(pb, now);
+        ret = (wait > ret) ? wait : ret;
+    }
+    if (info->hs != NULL) {
+        wait = http_dl_bucket_wait_ms(&info->hs->bucket, now);
+        ret = (wait > ret) ? wait : ret;
+    }
+    wait = http_dl_bucket_wait_ms(&info->bucket, now);
+
+    return (wait > ret) ? wait : ret;
+}
+
+/* Զȡֽٵ */
+static long http_dl_rate_allow(http_dl_info_t *info)
+{
+    http_dl_bucket_t *pb = http_dl_rate_prio_bucket(info);
+    long allow = LONG_MAX;
+
+    if (http_dl_rate_global.rate != 0) {
+        allow = MINVAL(allow, http_dl_rate_global.tokens);
+    }
+    if (pb != NULL) {
+        allow = MINVAL(allow, pb->tokens);
+    }
+    if (info->hs != NULL && info->hs->bucket.rate != 0) {
+        allow = MINVAL(allow, info->hs->bucket.tokens);
+    }
+    if (info->bucket.rate != 0) {
+        allow = MINVAL(allow, info->bucket.tokens);
+    }
+
+    return allow;
+}
+
+static void http_dl_rate_consume(http_dl_info_t *info, long n)
+{
+    http_dl_bucket_t *pb = http_dl_rate_prio_bucket(info);
+
+    if (http_dl_rate_global.rate != 0) {
+        http_dl_rate_global.tokens -= n;
+    }
+    if (pb != NULL) {
+        pb->tokens -= n;
+    }
+    if (info->hs != NULL && info->hs->bucket.rate != 0) {
+        info->hs->bucket.tokens -= n;
+    }
+    if (info->bucket.rate != 0) {
+        info->bucket.tokens -= n;
+    }
+}
+
+static const char *http_dl_stage_names[HTTP_DL_STAGE_LEN] = {
+    "init", "connect", "handshake", "wait first byte",
+    "status line", "headers", "content", "finish"
+};
+
+/* iͰ[2^(i-1), 2^i)΢룬һͰ */
+static void http_dl_hist_add(unsigned long *hist, long us)
+{
+    int i = (us <= 0) ? 0 : (int)(sizeof(long) * 8) - __builtin_clzl(us);
+
+    hist[MINVAL(i, HTTP_DL_HIST_LEN - 1)]++;
+}
+
+/* һγԽ׶εʱֱͼHTTP/2Ŀӣ */
+static void http_dl_stage_account(http_dl_info_t *info, long end_us)
+{
+    int i, j;
+
+    if (info->flags & HTTP_DL_F_H2_CTRL) {
+        return;
+    }
+
+    for (i = 0; i < HTTP_DL_STAGE_FINISH; i++) {
+        if (info->stage_us[i] == 0) {
+            continue;
+        }
+        /* ʱӺ֣׶γһĽ׶ */
+        for (j = i + 1; j < HTTP_DL_STAGE_FINISH && info->stage_us[j] == 0; j++) {
+            (void)0;
+        }
+        http_dl_hist_add(http_dl_stage_hist[i],
+                            ((j < HTTP_DL_STAGE_FINISH) ? info->stage_us[j] : end_us) - info->stage_us[i]);
+    }
+}
+
+/*
+ * л׶β½ʱ䡣صINITʾضԿʼµһγԣ
+ * һεʱȼֱͼ׷¼ֻһγԵĸ׶Ρ
+ */
+static void http_dl_stage_set(http_dl_info_t *info, http_dl_stage_t stage)
+{
+    if (stage == HTTP_DL_STAGE_INIT) {
+        if (info->stage != HTTP_DL_STAGE_FINISH) {
+            http_dl_stage_account(info, http_dl_now_us());
+        }
+        bzero(info->stage_us, sizeof(info->stage_us));
+    } else {
+        info->stage_us[stage] = http_dl_now_us();
+    }
+    info->stage = stage;
+}
+
+/* JSONַĹߴ */
+static void http_dl_json_str(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(fp, "\\%c", *s);
+        } else if ((unsigned char)*s < 0x20) {
+            fprintf(fp, "\\u%04x", *s);
+        } else {
+            fputc(*s, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+/* һChrome trace¼(ph X)ÿռһ(tidΪ) */
+static void http_dl_trace_event(http_dl_info_t *info, const char *name, long ts, long dur)
+{
+    fprintf(http_dl_trace_fp, "%s{\"name\":\"%s\",\"cat\":\"http_dl\",\"ph\":\"X\","
+                                "\"ts\":%ld,\"dur\":%ld,\"pid\":%d,\"tid\":%d",
+            http_dl_trace_count++ ? ",\n" : "", name, ts, dur, (int)getpid(), info->id);
+}
+
+/*
+ * ʱʱ-GֵͰĸ׶д-g׷ļУ
+ * chrome://tracingPerfetto򿪡һУʱ(ŶԺض)
+ * ԼһγԵĸ׶Ρ
+ */
+static void http_dl_trace_task(http_dl_info_t *info, long end_us)
+{
+    long begin_us = info->begin_ms * 1000;
+    int i, j;
+
+    if (http_dl_trace_fp == NULL || info->begin_ms == 0 || (info->flags & HTTP_DL_F_H2_CTRL)
+        || end_us - begin_us < http_dl_trace_slow_ms * 1000) {
+        return;
+    }
+
+    fprintf(http_dl_trace_fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                                "\"args\":{\"name\":",
+            http_dl_trace_count++ ? ",\n" : "", (int)getpid(), info->id);
+    http_dl_json_str(http_dl_trace_fp, info->local);
+    fprintf(http_dl_trace_fp, "}}");
+
+    http_dl_trace_event(info, "task", begin_us, end_us - begin_us);
+    fprintf(http_dl_trace_fp, ",\"args\":{\"url\":");
+    http_dl_json_str(http_dl_trace_fp, info->url);
+    fprintf(http_dl_trace_fp, ",\"status\":%d,\"result\":%d,\"retries\":%d,\"redirects\":%d,"
+                                "\"bytes\":%ld,\"wire\":%ld,\"rtt_us\":%u}}",
+            info->status_code, info->result, info->retries, info->redirects,
+            info->recv_len, info->wire_len, info->rtt_us);
+
+    for (i = 0; i < HTTP_DL_STAGE_FINISH; i++) {
+        if (info->stage_us[i] == 0) {
+            continue;
+        }
+        for (j = i + 1; j < HTTP_DL_STAGE_FINISH && info->stage_us[j] == 0; j++) {
+            (void)0;
+        }
+        http_dl_trace_event(info, http_dl_stage_names[i], info->stage_us[i],
+                            ((j < HTTP_DL_STAGE_FINISH) ? info->stage_us[j] : end_us) - info->stage_us[i]);
+        fprintf(http_dl_trace_fp, "}");
+    }
+    fflush(http_dl_trace_fp);
+}
+
+static void http_dl_trace_close()
+{
+    if (http_dl_trace_fp == NULL) {
+        return;
+    }
+    fprintf(http_dl_trace_fp, "\n]}\n");
+    fclose(http_dl_trace_fp);
+    http_dl_trace_fp = NULL;
+}
+
+int http_dl_trace_open(const char *path, long slow_ms)
+{
+    http_dl_trace_close();
+    http_dl_trace_slow_ms = slow_ms;
+    http_dl_trace_count = 0;
+    http_dl_trace_fp = fopen(path, "w");
+    if (http_dl_trace_fp == NULL) {
+        http_dl_log_error("Open trace file %s failed: %s", path, strerror(errno));
+        return -HTTP_DL_ERR_FOPEN;
+    }
+    fprintf(http_dl_trace_fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    return HTTP_DL_OK;
+}
+
+/* socket¼ѭеĶ */
+static int http_dl_sock_read(http_dl_info_t *info, char *buf, int len)
+{
+    long begin = http_dl_now_ns();
+    int nread;
+
+    nread = info->transport->read(info, buf, len);
+    http_dl_prof.read_ns += http_dl_now_ns() - begin;
+    http_dl_prof.reads++;
+    if (nread > 0) {
+        http_dl_prof.read_bytes += nread;
+        http_dl_hist_add(http_dl_prof.read_hist, nread);
+    } else if (nread == -HTTP_DL_ERR_AGAIN) {
+        http_dl_prof.read_again++;
+    }
+
+    return nread;
+}
+
+void http_dl_prof_get(http_dl_prof_t *prof)
+{
+    memcpy(prof, &http_dl_prof, sizeof(http_dl_prof_t));
+}
+
+static void http_dl_reset_time(http_dl_info_t *di)
+{
+    if (di == NULL) {
+        return;
+    }
+
+    gettimeofday(&di->start_time, NULL);
+    di->elapsed_time = -1;  /* for unsigned long, -1 means maximum time */
+}
+
+/* unit is msecs */
+static unsigned long http_dl_calc_elapsed(http_dl_info_t *di)
+{
+    struct timeval t;
+    unsigned long ret;
+
+    if (di == NULL) {
+        return -1;
+    }
+
+    gettimeofday(&t, NULL);
+    ret = (t.tv_sec - di->start_time.tv_sec) * 1000
+           + (t.tv_usec - di->start_time.tv_usec) / 1000;
+    if (ret == 0) {
+        ret = 100;  /* 㲻delta timeôǿΪ100msٶ */
+    }
+    di->elapsed_time = ret;
+
+    return ret;
+}
+
+/*
+ * ӳʱļԤ䵽ճȣļȲٵʵյĳȡ
+ * չмʵյĳȣ;ɱΪ׼ʱȥ
+ */
+#define HTTP_DL_XATTR_LEN       "user.http_dl.received"
+
+static int http_dl_mark_len(int fd, long len)
+{
+    char val[24];
+
+    return fsetxattr(fd, HTTP_DL_XATTR_LEN, val, sprintf(val, "%ld", len), 0);
+}
+
+/* ûм¼ʱ-1 */
+static long http_dl_marked_len(int fd)
+{
+    char val[24];
+    ssize_t n;
+
+    n = fgetxattr(fd, HTTP_DL_XATTR_LEN, val, sizeof(val) - 1);
+    if (n <= 0) {
+        return -1;
+    }
+    val[n] = '\0';
+
+    return strtol(val, NULL, 10);
+}
+
+static int http_dl_init_filefd(http_dl_info_t *info)
+{
+    int fd = -1, ret;
+    long restart_len, len;
+    struct stat file_stat;
+
+    if (info == NULL) {
+        http_dl_log_debug("Invalid input, info == NULL");
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    bzero(&file_stat, sizeof(file_stat));
+    ret = stat(info->local, &file_stat);
+
+    if (info->flags & HTTP_DL_F_REPAIR) {
+        /* ޲ԭλд׷ҲضϣļѾ */
+        if (ret != 0 || !S_ISREG(file_stat.st_mode)) {
+            http_dl_log_error("Nothing to repair, %s is not a regular file.", info->local);
+            return -HTTP_DL_ERR_FOPEN;
+        }
+        restart_len = 0;
+        fd = open(info->local, O_RDWR);
+    } else if ((ret == 0) && (S_ISREG(file_stat.st_mode))) {
+        /* File already exist, and it is regular file. */
+        http_dl_log_debug("File %s is exist, and is regular file.", info->local);
+        restart_len = file_stat.st_size;
+        fd = open(info->local, O_RDWR | O_APPEND);
+        len = (fd >= 0) ? http_dl_marked_len(fd) : -1;
+        if (len >= 0 && len <= restart_len) {
+            /* ϴӳʱ;˳Ԥβյ */
+            http_dl_log_info("%s was preallocated, resume from %ld of %ld bytes.",
+                                info->local, len, restart_len);
+            if (ftruncate(fd, len) != 0) {
+                http_dl_log_error("Truncate %s to %ld failed.", info->local, len);
+                close(fd);
+                return -HTTP_DL_ERR_WRITE;
+            }
+            restart_len = len;
+            (void)fremovexattr(fd, HTTP_DL_XATTR_LEN);
+        }
+    } else  {
+        http_dl_log_debug("%s status fail or non-regular file, create it.", info->local);
+        restart_len = 0;
+        /* ɶдʱժҪҪдĲ */
+        fd = open(info->local, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    }
+
+    if (fd < 0) {
+        http_dl_log_debug("Open or create %s failed.", info->local);
+        return -HTTP_DL_ERR_FOPEN;
+    }
+
+    info->filefd = fd;
+    info->restart_len = restart_len;
+    info->flags |= HTTP_DL_F_RESTART_FILE;
+
+    http_dl_log_debug("Open file %s success, fd[%d], restart_len[%ld].",
+                        info->local, info->filefd, info->restart_len);
+
+    return HTTP_DL_OK;
+}
+
+/*
+ * ֪ĴļԤ䵽ճȣӳ䵽ڴ棬ֱյƵӳ
+ * ʡȽbufwriteһδԤʧ()ʱӳ䣬Ȼwrite
+ * ֮дӳʱ䲻̿յSIGBUS
+ */
+static void http_dl_sink_map(http_dl_info_t *info)
+{
+    void *map;
+    int err;
+
+    if (info->map != NULL || info->filefd < 0 || info->decoder != NULL
+        || !(info->flags & HTTP_DL_F_HAS_LENGTH) || info->total_len < HTTP_DL_MMAP_MIN
+        || info->restart_len + info->content_len != info->total_len) {
+        return;
+    }
+
+    /* ȼյĳչļ֧չʱӳ䣬;ɱ޷ */
+    if (http_dl_mark_len(info->filefd, info->restart_len) != 0) {
+        http_dl_log_debug("Set %s on %s failed, write it instead.", HTTP_DL_XATTR_LEN, info->local);
+        return;
+    }
+    err = posix_fallocate(info->filefd, info->restart_len, info->total_len - info->restart_len);
+    if (err == 0) {
+        map = mmap(NULL, info->total_len, PROT_READ | PROT_WRITE, MAP_SHARED, info->filefd, 0);
+        if (map != MAP_FAILED) {
+            (void)madvise(map, info->total_len, MADV_SEQUENTIAL);
+            info->map = map;
+            info->map_len = info->total_len;
+            return;
+        }
+    }
+
+    http_dl_log_debug("Map %s failed, write it instead.", info->local);
+    if (ftruncate(info->filefd, info->restart_len) != 0) {
+        http_dl_log_error("Truncate %s to %ld failed.", info->local, info->restart_len);
+        return;
+    }
+    (void)fremovexattr(info->filefd, HTTP_DL_XATTR_LEN);
+}
+
+/* ӳ䣬ļضϵʵյĳȣ֮ʱļȷ */
+static void http_dl_sink_unmap(http_dl_info_t *info)
+{
+    long len = info->restart_len + info->recv_len;
+
+    if (info->map == NULL) {
+        return;
+    }
+
+    (void)munmap(info->map, info->map_len);
+    if (len < info->map_len && ftruncate(info->filefd, len) != 0) {
+        /* ¼´ʱٽض */
+        http_dl_log_error("Truncate %s to %ld failed.", info->local, len);
+    } else {
+        (void)fremovexattr(info->filefd, HTTP_DL_XATTR_LEN);
+    }
+    info->map = NULL;
+    info->map_len = 0;
+}
+
+/*
+ * ֱӽյλúͳȣֱӽʱNULL
+ * ӳʱӳеһΣõһ󻺳յд
+ * ÿֻinfo->buf4KٺܶϵͳábufлûдİʱҪд֤˳
+ */
+static char *http_dl_sink_direct(http_dl_info_t *info, int *len)
+{
+    static char body_buf[HTTP_DL_BODY_READ_LEN];
+    long pos = info->restart_len + info->recv_len;
+
+    if (info->stage != HTTP_DL_STAGE_RECV_CONTENT || info->buf_data != info->buf_tail) {
+        return NULL;
+    }
+
+    if (info->map == NULL) {
+        *len = sizeof(body_buf);
+        return body_buf;
+    }
+
+    if (pos >= info->map_len) {
+        return NULL;
+    }
+    *len = MINVAL(info->map_len - pos, HTTP_DL_MMAP_READ_LEN);
+
+    return info->map + pos;
+}
+
+/* ̵ΨһڣдɹĲͬʱժҪֱյӳеݲٸ */
+static int http_dl_sink_write(http_dl_info_t *info, char *data, int len)
+{
+    char *dst;
+    int ret;
+
+    if (info->map != NULL) {
+        dst = info->map + info->restart_len + info->recv_len;
+        ret = MINVAL(len, info->map + info->map_len - dst);
+        if (dst != data) {
+            memcpy(dst, data, ret);
+        }
+    } else {
+        ret = http_dl_write(info->filefd, data, len);
+    }
+    if (ret > 0) {
+        info->recv_len += ret;
+        if (info->map != NULL) {
+            (void)http_dl_mark_len(info->filefd, info->restart_len + info->recv_len);
+        }
+        if (info->digest != NULL) {
+            http_dl_digest_update(info->digest, (unsigned char *)data, ret);
+        }
+    }
+
+    return ret;
+}
+
+/* ΪժҪ㣬hexΪNULLʱͬʱֵ */
+static int http_dl_digest_attach(http_dl_info_t *info, http_dl_digest_type_t type,
+                                 const char *hex, int hex_len)
+{
+    if (info->digest == NULL) {
+        info->digest = http_dl_xrealloc(NULL, sizeof(http_dl_digest_t));
+        if (info->digest == NULL) {
+            return -HTTP_DL_ERR_RESOURCE;
+        }
+        bzero(info->digest, sizeof(http_dl_digest_t));
+    }
+
+    http_dl_digest_init(info->digest, type);
+    info->digest->expect_len = 0;
+    if (hex != NULL && http_dl_digest_set_expect(info->digest, hex, hex_len) != 0) {
+        http_dl_log_error("Invalid %s digest for %s.", http_dl_digest_names[type], info->url);
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    return HTTP_DL_OK;
+}
+
+/*
+ * ϵʱժҪҪļȰѱеrestart_lenֽڶ
+ * ֻڿʼհʱһΣյȻձ㡣
+ */
+static int http_dl_digest_file(http_dl_info_t *info, long len)
+{
+    char buf[HTTP_DL_READBUF_LEN * 4];
+    long off = 0;
+    int nread;
+
+    while (off < len) {
+        nread = pread(info->filefd, buf, MINVAL(sizeof(buf), len - off), off);
+        if (nread <= 0) {
+            http_dl_log_error("Read %s for digest failed at %ld.", info->local, off);
+            return -HTTP_DL_ERR_READ;
+        }
+        http_dl_digest_update(info->digest, (unsigned char *)buf, nread);
+        off += nread;
+    }
+
+    return HTTP_DL_OK;
+}
+
+static int http_dl_digest_prefix(http_dl_info_t *info)
+{
+    if (info->digest == NULL || info->restart_len == 0) {
+        return HTTP_DL_OK;
+    }
+
+    return http_dl_digest_file(info, info->restart_len);
+}
+
+/* ؽʱժҪֵʧ */
+static void http_dl_digest_verify(http_dl_info_t *info)
+{
+    unsigned char out[HTTP_DL_DIGEST_MAX_LEN];
+    int len;
+
+    if (info->digest == NULL || info->stage != HTTP_DL_STAGE_RECV_CONTENT) {
+        return;
+    }
+
+    len = http_dl_digest_final(info->digest, out);
+    http_dl_log_debug("%s %s: %s", info->local,
+                        http_dl_digest_names[info->digest->type], info->digest->hex);
+    if (info->digest->expect_len == 0) {
+        return;
+    }
+
+    if (len != info->digest->expect_len || memcmp(out, info->digest->expect, len) != 0) {
+        http_dl_log_error("%s %s mismatch, got %s.", info->local,
+                            http_dl_digest_names[info->digest->type], info->digest->hex);
+        snprintf(info->err_msg, sizeof(info->err_msg), "%s mismatch",
+                    http_dl_digest_names[info->digest->type]);
+        info->result = -HTTP_DL_ERR_DIGEST;
+    }
+}
+
+/*
+ * ޲ļȱʧ𻵵(repair=)һ䣬Ӧ
+ * multipart/byterangesʱΰContent-Rangeдԭλãֻһʱֱд
+ * ֧Range200ʱļдһ顣䰴źáϲHTTP_DL_REPAIR_MAXʱ
+ * ϲС䣬һݻһ̫Rangeͷ
+ */
+#define HTTP_DL_REPAIR_MAX      32
+#define HTTP_DL_REPAIR_SPEC_LEN (8 + HTTP_DL_REPAIR_MAX * 42)   /* "bytes="32"first-last," */
+#define HTTP_DL_REPAIR_HEAD_LEN 1024    /* ָкһͷ */
+
+typedef enum http_dl_part_e {
+    HTTP_DL_PART_DELIM = 0,         /* ҷָ"--boundary"֮ǰǰԺһ֮CRLF */
+    HTTP_DL_PART_HEADER,            /* ͷΪֹ */
+    HTTP_DL_PART_DATA,              /* ݣContent-Rangeĳдļ */
+    HTTP_DL_PART_END,               /* յָ"--boundary--"֮β */
+} http_dl_part_t;
+
+typedef struct http_dl_span_s {
+    long first;
+    long last;                      /* last */
+    bool done;
+} http_dl_span_t;
+
+typedef struct http_dl_repair_s {
+    http_dl_span_t ranges[HTTP_DL_REPAIR_MAX];
+    int nranges;
+    bool holes;                     /* repair=holesļļеĿնȷ */
+    long file_len;                  /* ʱļĳȣӦеļȱ֮ͬ */
+    char spec[HTTP_DL_REPAIR_SPEC_LEN];     /* Rangeֵֻû޲ */
+
+    /* ΪһӦ״̬http_dl_repair_reset */
+    char delim[2 + 70 + 1];         /* "--"boundaryӦΪ */
+    int delim_len;
+    http_dl_part_t state;
+    http_dl_range_t part;           /* ǰεContent-Range */
+    bool has_part;
+    long pos;                       /* ǰһֽļеλ */
+    long left;                      /* ǰλûյֽ */
+    char head[HTTP_DL_REPAIR_HEAD_LEN];     /* ķָкͶͷ */
+    int head_len;
+} http_dl_repair_t;
+
+static int http_dl_repair_cmp(const void *a, const void *b)
+{
+    long x = ((const http_dl_span_t *)a)->first, y = ((const http_dl_span_t *)b)->first;
+
+    return (x > y) - (x < y);
+}
+
+/* ϲصڵ䣬ȻmaxʱϲСһ */
+static void http_dl_repair_squeeze(http_dl_repair_t *rp, int max)
+{
+    int i, n, min_i;
+
+    qsort(rp->ranges, rp->nranges, sizeof(rp->ranges[0]), http_dl_repair_cmp);
+    for (i = 1, n = 0; i < rp->nranges; i++) {
+        if (rp->ranges[i].first <= rp->ranges[n].last + 1) {
+            rp->ranges[n].last = MAXVAL(rp->ranges[n].last, rp->ranges[i].last);
+        } else {
+            rp->ranges[++n] = rp->ranges[i];
+        }
+    }
+    rp->nranges = (rp->nranges > 0) ? n + 1 : 0;
+
+    while (rp->nranges > max) {
+        for (i = 1, min_i = 1; i < rp->nranges; i++) {
+            if (rp->ranges[i].first - rp->ranges[i - 1].last
+                < rp->ranges[min_i].first - rp->ranges[min_i - 1].last) {
+                min_i = i;
+            }
+        }
+        rp->ranges[min_i - 1].last = rp->ranges[min_i].last;
+        memmove(&rp->ranges[min_i], &rp->ranges[min_i + 1],
+                (rp->nranges - min_i - 1) * sizeof(rp->ranges[0]));
+        rp->nranges--;
+    }
+}
+
+static void http_dl_repair_add(http_dl_repair_t *rp, long first, long last)
+{
+    if (rp->nranges == HTTP_DL_REPAIR_MAX) {
+        /* ڳһλ */
+        http_dl_repair_squeeze(rp, HTTP_DL_REPAIR_MAX - 1);
+    }
+    rp->ranges[rp->nranges].first = first;
+    rp->ranges[rp->nranges].last = last;
+    rp->ranges[rp->nranges].done = false;
+    rp->nranges++;
+}
+
+/* repair=holesԶŷָfirst-lastlast */
+static int http_dl_repair_parse(http_dl_info_t *info, const char *val, int len)
+{
+    http_dl_repair_t *rp;
+    const char *p = val, *end = val + len;
+    long first, last;
+
+    if (info->repair == NULL) {
+        info->repair = http_dl_xrealloc(NULL, sizeof(http_dl_repair_t));
+        if (info->repair == NULL) {
+            return -HTTP_DL_ERR_RESOURCE;
+        }
+    }
+    rp = info->repair;
+    bzero(rp, sizeof(http_dl_repair_t));
+    info->flags |= HTTP_DL_F_REPAIR;
+
+    if (len == 5 && strncmp(val, "holes", 5) == 0) {
+        rp->holes = true;
+        return HTTP_DL_OK;
+    }
+
+    while (p < end) {
+        if (http_dl_parse_digits(&p, end, &first) != HTTP_DL_PARSE_OK
+            || p == end || *p++ != '-'
+            || http_dl_parse_digits(&p, end, &last) != HTTP_DL_PARSE_OK
+            || first > last || (p < end && *p++ != ',')) {
+            http_dl_log_error("Invalid repair ranges %.*s for %s.", len, val, info->url);
+            return -HTTP_DL_ERR_INVALID;
+        }
+        http_dl_repair_add(rp, first, last);
+    }
+    http_dl_repair_squeeze(rp, HTTP_DL_REPAIR_MAX);
+
+    return HTTP_DL_OK;
+}
+
+/* ļ򿪺ãļȣrepair=holesʱSEEK_HOLE/SEEK_DATAҳնΪ */
+static int http_dl_repair_prepare(http_dl_info_t *info)
+{
+    http_dl_repair_t *rp = info->repair;
+    struct stat st;
+    off_t hole, data;
+
+    if (fstat(info->filefd, &st) != 0) {
+        return -HTTP_DL_ERR_FOPEN;
+    }
+    rp->file_len = st.st_size;
+
+#ifdef SEEK_HOLE
+    for (data = 0; rp->holes && data < rp->file_len; ) {
+        hole = lseek(info->filefd, data, SEEK_HOLE);
+        if (hole < 0 || hole >= rp->file_len) {
+            break;
+        }
+        data = lseek(info->filefd, hole, SEEK_DATA);
+        if (data < 0) {
+            /* ENXIOնһֱļĩβ */
+            data = rp->file_len;
+        }
+        http_dl_repair_add(rp, hole, data - 1);
+    }
+#else
+    if (rp->holes) {
+        http_dl_log_error("Finding holes in %s is not supported.", info->local);
+        return -HTTP_DL_ERR_INVALID;
+    }
+#endif
+    http_dl_repair_squeeze(rp, HTTP_DL_REPAIR_MAX);
+    http_dl_log_debug("Repair %s: %d ranges in %ld bytes.", info->local, rp->nranges, rp->file_len);
+
+    return HTTP_DL_OK;
+}
+
+/* ɱRangeֵֻû޲ */
+static const char *http_dl_repair_spec(http_dl_info_t *info)
+{
+    http_dl_repair_t *rp = info->repair;
+    int i, n;
+
+    n = sprintf(rp->spec, "bytes=");
+    for (i = 0; i < rp->nranges; i++) {
+        if (!rp->ranges[i].done) {
+            n += sprintf(rp->spec + n, "%ld-%ld,", rp->ranges[i].first, rp->ranges[i].last);
+        }
+    }
+    if (rp->spec[n - 1] == ',') {
+        rp->spec[n - 1] = '\0';
+    }
+
+    return rp->spec;
+}
+
+/* ÿյӦǰһӦĽ״̬Ѿ޲õ䱣ʱ */
+static void http_dl_repair_reset(http_dl_info_t *info)
+{
+    http_dl_repair_t *rp = info->repair;
+
+    if (rp == NULL) {
+        return;
+    }
+    rp->delim_len = 0;
+    rp->state = HTTP_DL_PART_DELIM;
+    rp->has_part = false;
+    rp->pos = 0;
+    rp->left = 0;
+    rp->head_len = 0;
+}
+
+/* ӦͷеContent-Rangeļ뱾زͬ˵ϵļѾ */
+static int http_dl_repair_range(http_dl_info_t *info, const char *value, int vlen)
+{
+    http_dl_repair_t *rp = info->repair;
+
+    if (http_dl_parse_content_range(value, vlen, &rp->part) != HTTP_DL_PARSE_OK
+        || rp->part.first_byte_pos < 0) {
+        http_dl_log_error("Invalid Content-Range %.*s for %s.",
+                            MINVAL(vlen, HTTP_DL_BUF_LEN), value, info->url);
+        return -HTTP_DL_ERR_INVALID;
+    }
+    if (rp->part.entity_length >= 0 && rp->part.entity_length != rp->file_len) {
+        http_dl_log_error("%s is %ld bytes on server, but %ld bytes locally.",
+                            info->url, rp->part.entity_length, rp->file_len);
+        snprintf(info->err_msg, sizeof(info->err_msg), "Remote file size changed");
+        return -HTTP_DL_ERR_INVALID;
+    }
+    rp->has_part = true;
+
+    return HTTP_DL_OK;
+}
+
+static int http_dl_repair_part_cb(const char *name, int nlen, const char *value, int vlen,
+                                  void *arg)
+{
+    if (nlen == 13 && strncasecmp(name, "content-range", 13) == 0) {
+        return http_dl_repair_range(arg, value, vlen);
+    }
+
+    return 0;
+}
+
+/* ʼдһΣpart.firstд𣬳Content-Rangeȷ */
+static void http_dl_repair_part_begin(http_dl_repair_t *rp)
+{
+    rp->pos = rp->part.first_byte_pos;
+    rp->left = rp->part.last_byte_pos - rp->part.first_byte_pos + 1;
+    rp->state = HTTP_DL_PART_DATA;
+}
+
+/* ͷ꣺ȷӦʽ200/206߱ѹ˶дļ */
+static int http_dl_repair_begin(http_dl_info_t *info)
+{
+    http_dl_repair_t *rp = info->repair;
+
+    if (info->encoding != HTTP_DL_ENCODING_IDENTITY) {
+        snprintf(info->err_msg, sizeof(info->err_msg), "Compressed response for repair");
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    if (info->status_code == HTTP_STATUS_PARTIAL_CONTENTS && rp->delim_len > 0) {
+        rp->state = HTTP_DL_PART_DELIM;
+    } else if (info->status_code == HTTP_STATUS_PARTIAL_CONTENTS && rp->has_part) {
+        http_dl_repair_part_begin(rp);
+    } else if (info->status_code == HTTP_STATUS_OK) {
+        /* ֧Rangeļдһ飬Ȳʱܸ */
+        if ((info->flags & HTTP_DL_F_HAS_LENGTH) && info->content_len != rp->file_len) {
+            http_dl_log_error("%s is %ld bytes on server, but %ld bytes locally.",
+                                info->url, info->content_len, rp->file_len);
+            snprintf(info->err_msg, sizeof(info->err_msg), "Remote file size changed");
+            return -HTTP_DL_ERR_INVALID;
+        }
+        http_dl_log_info("%s does not support ranges, rewrite %s.", info->host, info->local);
+        rp->part.first_byte_pos = 0;
+        rp->part.last_byte_pos = LONG_MAX - 1;
+        http_dl_repair_part_begin(rp);
+    } else {
+        if (info->err_msg[0] == '\0') {
+            snprintf(info->err_msg, sizeof(info->err_msg), "Unexpected status %d for repair",
+                        info->status_code);
+        }
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    return HTTP_DL_OK;
+}
+
+/* [first, pos)ѾдļȫеΪ޲ */
+static void http_dl_repair_mark(http_dl_repair_t *rp, long first, long pos)
+{
+    int i;
+
+    for (i = 0; i < rp->nranges; i++) {
+        if (rp->ranges[i].first >= first && rp->ranges[i].last < pos) {
+            rp->ranges[i].done = true;
+        }
+    }
+}
+
+static int http_dl_repair_data(http_dl_info_t *info, char *data, int len)
+{
+    http_dl_repair_t *rp = info->repair;
+    int ret;
+
+    ret = http_dl_pwrite(info->filefd, data, MINVAL(len, rp->left), rp->pos);
+    rp->pos += ret;
+    rp->left -= ret;
+    info->recv_len += ret;
+    http_dl_repair_mark(rp, rp->part.first_byte_pos, rp->pos);
+    if (rp->left == 0) {
+        rp->state = (rp->delim_len > 0) ? HTTP_DL_PART_DELIM : HTTP_DL_PART_END;
+    }
+
+    return ret;
+}
+
+/*
+ * ָкͶͷheadУнͷʱheadжǶݣ
+ * ˻ظ(ֻĵͷΪֹ)֮ݴĵֽʽʱش롣
+ */
+static int http_dl_repair_frame(http_dl_info_t *info, char *data, int len)
+{
+    http_dl_repair_t *rp = info->repair;
+    int old = rp->head_len, n, off = 0, line_len, adv, used, ret = HTTP_DL_PARSE_OK;
+
+    n = MINVAL(len, sizeof(rp->head) - old);
+    memcpy(rp->head + old, data, n);
+    rp->head_len += n;
+
+    while (rp->state == HTTP_DL_PART_DELIM || rp->state == HTTP_DL_PART_HEADER) {
+        if (rp->state == HTTP_DL_PART_DELIM) {
+            ret = http_dl_parse_line(rp->head + off, rp->head_len - off, sizeof(rp->head),
+                                        &line_len, &adv);
+            if (ret != HTTP_DL_PARSE_OK) {
+                break;
+            }
+            if (line_len >= rp->delim_len && memcmp(rp->head + off, rp->delim, rp->delim_len) == 0) {
+                /* ָкпհף"--"ʾһѾ */
+                if (line_len >= rp->delim_len + 2 && memcmp(rp->head + off + rp->delim_len, "--", 2) == 0) {
+                    rp->state = HTTP_DL_PART_END;
+                } else {
+                    rp->has_part = false;
+                    rp->state = HTTP_DL_PART_HEADER;
+                }
+            }
+            off += adv;
+        } else {
+            ret = http_dl_parse_fields(rp->head + off, rp->head_len - off, sizeof(rp->head),
+                                        &used, http_dl_repair_part_cb, info);
+            off += used;
+            if (ret != HTTP_DL_PARSE_OK) {
+                break;
+            }
+            if (!rp->has_part) {
+                http_dl_log_error("Part without Content-Range from %s.", info->url);
+                return -HTTP_DL_ERR_INVALID;
+            }
+            http_dl_repair_part_begin(rp);
+        }
+    }
+
+    if (ret != HTTP_DL_PARSE_OK && ret != HTTP_DL_PARSE_AGAIN) {
+        http_dl_log_error("Invalid multipart/byteranges from %s.", info->url);
+        return -HTTP_DL_ERR_INVALID;
+    }
+    if (rp->state == HTTP_DL_PART_DATA || rp->state == HTTP_DL_PART_END) {
+        /* off֮ĶǶ(β)ڵߵ */
+        rp->head_len = 0;
+        return off - old;
+    }
+
+    /* лȥʣµ´ */
+    memmove(rp->head, rp->head + off, rp->head_len - off);
+    rp->head_len -= off;
+
+    return n;
+}
+
+/* ޲İ壬ĵֽСlenʾдļʽ󷵻ش */
+static int http_dl_repair_write(http_dl_info_t *info, char *data, int len)
+{
+    http_dl_repair_t *rp = info->repair;
+    int ret, done = 0;
+
+    while (done < len) {
+        if (rp->state == HTTP_DL_PART_DATA) {
+            ret = http_dl_repair_data(info, data + done, len - done);
+            if (ret == 0) {
+                break;
+            }
+        } else if (rp->state == HTTP_DL_PART_END) {
+            ret = len - done;
+        } else {
+            ret = http_dl_repair_frame(info, data + done, len - done);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+        done += ret;
+    }
+
+    return done;
+}
+
+/* ޲䶼дòɹժҪʱΪļģhttp_dl_digest_verifyУ */
+static void http_dl_repair_finish(http_dl_info_t *info)
+{
+    http_dl_repair_t *rp = info->repair;
+    int i, missing = 0;
+
+    if (!(info->flags & HTTP_DL_F_REPAIR) || info->stage != HTTP_DL_STAGE_RECV_CONTENT) {
+        return;
+    }
+
+    for (i = 0; i < rp->nranges; i++) {
+        missing += !rp->ranges[i].done;
+    }
+    if (missing > 0) {
+        http_dl_log_error("%s: %d of %d ranges not repaired.", info->local, missing, rp->nranges);
+        snprintf(info->err_msg, sizeof(info->err_msg), "%d ranges not repaired", missing);
+        info->result = -HTTP_DL_ERR_READ;
+        return;
+    }
+
+    if (info->digest != NULL) {
+        http_dl_digest_init(info->digest, info->digest->type);
+        if (http_dl_digest_file(info, rp->file_len) != HTTP_DL_OK) {
+            /* ֵʱ޺ˣֻժҪֱӶ */
+            if (info->digest->expect_len > 0) {
+                snprintf(info->err_msg, sizeof(info->err_msg), "Read repaired file for digest failed");
+                info->result = -HTTP_DL_ERR_READ;
+                return;
+            }
+            http_dl_free(info->digest);
+            info->digest = NULL;
+        }
+    }
+}
+
+/*
+ * (delta=)ȡ嵥ھɰ汾ҳļѾеĿ飬ƵʱļУ
+ * Ŀϲ䣬޲߼RangeأÿHTTP_DL_REPAIR_MAX䣬
+ * һдٷһȫдáժҪУͨʱļΪļ֮ǰɰ汾һֱ
+ */
+typedef struct http_dl_delta_s {
+    const char *manifest;           /* 嵥URL */
+    const char *target;             /* ļURLȡ嵥ʱinfo->url嵥 */
+    const char *base;               /* base=ľɰ汾ĬΪļԼ */
+    const char *tmp;                /* ƴļʱļlocal".delta" */
+    char *mbuf;                     /* յĿ嵥ƴʱļͷ */
+    long mlen;
+    long mcap;
+    http_dl_span_t *spans;          /* ɰ汾ûСҪص䣬ڵĿѺϲ */
+    long nspans;
+    long cap;
+    long next;                      /* һspans￪ʼ */
+} http_dl_delta_t;
+
+/* Ӿɰ汾ƿʱģhttp_dl_delta_copy */
+typedef struct http_dl_delta_copy_s {
+    http_dl_info_t *info;
+    const http_dl_manifest_t *m;
+    const char *seed;
+    char *have;                     /* ļÿһǷѾ */
+    long reused;
+    bool failed;
+} http_dl_delta_copy_t;
+
+/* delta=<嵥URL>base=<ɰ汾·> */
+static int http_dl_delta_opt(http_dl_info_t *info, const char *key, const char *val, int len)
+{
+    http_dl_delta_t *dt = info->delta;
+    const char *s;
+
+    if (len <= 0) {
+        http_dl_log_error("Empty %s= for %s.", key, info->url);
+        return -HTTP_DL_ERR_INVALID;
+    }
+    if (dt == NULL) {
+        dt = http_dl_xrealloc(NULL, sizeof(http_dl_delta_t));
+        if (dt == NULL) {
+            return -HTTP_DL_ERR_RESOURCE;
+        }
+        bzero(dt, sizeof(http_dl_delta_t));
+        info->delta = dt;
+    }
+
+    s = http_dl_str_get(val, len);
+    if (s == NULL) {
+        return -HTTP_DL_ERR_RESOURCE;
+    }
+    if (strcmp(key, "delta") == 0) {
+        http_dl_str_put(dt->manifest);
+        dt->manifest = s;
+        info->flags |= HTTP_DL_F_DELTA;
+    } else {
+        http_dl_str_put(dt->base);
+        dt->base = s;
+    }
+
+    return HTTP_DL_OK;
+}
+
+static void http_dl_delta_free(http_dl_info_t *info)
+{
+    http_dl_delta_t *dt = info->delta;
+
+    if (dt == NULL) {
+        return;
+    }
+    http_dl_str_put(dt->manifest);
+    http_dl_str_put(dt->target);
+    http_dl_str_put(dt->base);
+    http_dl_str_put(dt->tmp);
+    http_dl_free(dt->mbuf);
+    http_dl_free(dt->spans);
+    http_dl_free(dt);
+    info->delta = NULL;
+}
+
+/* ȡ嵥Ӧֻ200ûЭѹ */
+static int http_dl_delta_begin(http_dl_info_t *info)
+{
+    if (info->status_code != HTTP_STATUS_OK) {
+        if (info->err_msg[0] == '\0') {
+            snprintf(info->err_msg, sizeof(info->err_msg), "Unexpected status %d for manifest",
+                        info->status_code);
+        }
+        return -HTTP_DL_ERR_INVALID;
+    }
+    if (info->encoding != HTTP_DL_ENCODING_IDENTITY) {
+        snprintf(info->err_msg, sizeof(info->err_msg), "Compressed manifest");
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    return HTTP_DL_OK;
+}
+
+/* 嵥İڴУٽ */
+static int http_dl_delta_collect(http_dl_info_t *info, const char *data, int len)
+{
+    http_dl_delta_t *dt = info->delta;
+    char *p;
+    long cap;
+
+    if (dt->mlen + len > HTTP_DL_MANIFEST_MAX) {
+        http_dl_log_error("Manifest %s is larger than %d bytes.", info->url, HTTP_DL_MANIFEST_MAX);
+        snprintf(info->err_msg, sizeof(info->err_msg), "Manifest too large");
+        return -HTTP_DL_ERR_INVALID;
+    }
+    if (dt->mlen + len > dt->mcap) {
+        for (cap = MAXVAL(dt->mcap, HTTP_DL_READBUF_LEN); cap < dt->mlen + len; cap <<= 1) {
+            (void)0;
+        }
+        p = http_dl_xrealloc(dt->mbuf, cap);
+        if (p == NULL) {
+            return -HTTP_DL_ERR_RESOURCE;
+        }
+        dt->mbuf = p;
+        dt->mcap = cap;
+    }
+    memcpy(dt->mbuf + dt->mlen, data, len);
+    dt->mlen += len;
+
+    return len;
+}
+
+/* 嵥½ǰյĲ */
+static void http_dl_delta_reset(http_dl_info_t *info)
+{
+    if (info->delta != NULL && !(info->flags & HTTP_DL_F_REPAIR)) {
+        info->delta->mlen = 0;
+    }
+}
+
+/* iھɰ汾offƵʱļ */
+static void http_dl_delta_copy(long i, long off, void *arg)
+{
+    http_dl_delta_copy_t *cp = arg;
+    long bs = cp->m->block_len, len = MINVAL(bs, cp->m->length - i * bs);
+
+    if (http_dl_pwrite(cp->info->filefd, (char *)cp->seed + off, len, i * bs) != len) {
+        cp->failed = true;
+        return;
+    }
+    cp->have[i] = 1;
+    cp->reused += len;
+}
+
+static int http_dl_delta_span_add(http_dl_delta_t *dt, long first, long last)
+{
+    http_dl_span_t *p;
+    long cap;
+
+    if (dt->nspans == dt->cap) {
+        cap = (dt->cap == 0) ? 64 : dt->cap * 2;
+        p = http_dl_xrealloc(dt->spans, cap * sizeof(http_dl_span_t));
+        if (p == NULL) {
+            return -HTTP_DL_ERR_RESOURCE;
+        }
+        dt->spans = p;
+        dt->cap = cap;
+    }
+    dt->spans[dt->nspans].first = first;
+    dt->spans[dt->nspans].last = last;
+    dt->spans[dt->nspans].done = false;
+    dt->nspans++;
+
+    return HTTP_DL_OK;
+}
+
+/* ھɰ汾ҿ鲢ƣ򲻿ͨļʱյģп鶼 */
+static int http_dl_delta_scan(http_dl_info_t *info, const http_dl_manifest_t *m,
+                              http_dl_delta_copy_t *cp)
+{
+    const char *base = (info->delta->base != NULL) ? info->delta->base : info->local;
+    struct stat st;
+    void *seed;
+    int fd, ret = HTTP_DL_OK;
+
+    fd = open(base, O_RDONLY);
+    if (fd < 0) {
+        http_dl_log_info("No previous version %s, fetch all blocks.", base);
+        return HTTP_DL_OK;
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return HTTP_DL_OK;
+    }
+
+    seed = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (seed == MAP_FAILED) {
+        http_dl_log_error("Map %s failed, fetch all blocks.", base);
+        return HTTP_DL_OK;
+    }
+    (void)madvise(seed, st.st_size, MADV_SEQUENTIAL);
+
+    cp->seed = seed;
+    if (http_dl_delta_match(m, seed, st.st_size, http_dl_delta_copy, cp) < 0) {
+        ret = -HTTP_DL_ERR_RESOURCE;
+    } else if (cp->failed) {
+        http_dl_log_error("Write %s failed.", info->delta->tmp);
+        ret = -HTTP_DL_ERR_WRITE;
+    }
+    munmap(seed, st.st_size);
+
+    return ret;
+}
+
+/*
+ * 嵥꣺ʱļƴɰ汾еĿ飬ûеĿϲ䣬
+ * ֮޲Щ䣬дʱļ
+ */
+static int http_dl_delta_build(http_dl_info_t *info)
+{
+    http_dl_delta_t *dt = info->delta;
+    http_dl_manifest_t m;
+    http_dl_delta_copy_t cp;
+    long i, j;
+    int fd, ret;
+
+    if (http_dl_manifest_parse(dt->mbuf, dt->mlen, &m) != HTTP_DL_PARSE_OK) {
+        http_dl_log_error("Invalid manifest %s.", info->url);
+        snprintf(info->err_msg, sizeof(info->err_msg), "Invalid manifest");
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    bzero(&cp, sizeof(cp));
+    cp.info = info;
+    cp.m = &m;
+    cp.have = http_dl_xrealloc(NULL, m.nblocks + 1);
+    info->repair = http_dl_xrealloc(NULL, sizeof(http_dl_repair_t));
+    dt->tmp = http_dl_str_printf("%s.delta", info->local);
+    if (cp.have == NULL || info->repair == NULL || dt->tmp == NULL) {
+        ret = -HTTP_DL_ERR_RESOURCE;
+        goto out;
+    }
+    bzero(cp.have, m.nblocks + 1);
+    bzero(info->repair, sizeof(http_dl_repair_t));
+
+    fd = open(dt->tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        http_dl_log_error("Create %s failed.", dt->tmp);
+        ret = -HTTP_DL_ERR_FOPEN;
+        goto out;
+    }
+    info->filefd = fd;
+    info->restart_len = 0;
+    if (ftruncate(fd, m.length) != 0) {
+        ret = -HTTP_DL_ERR_WRITE;
+        goto out;
+    }
+
+    ret = http_dl_delta_scan(info, &m, &cp);
+    for (i = 0; ret == HTTP_DL_OK && i < m.nblocks; i = j) {
+        if (cp.have[i]) {
+            j = i + 1;
+            continue;
+        }
+        for (j = i + 1; j < m.nblocks && !cp.have[j]; j++) {
+            (void)0;
+        }
+        ret = http_dl_delta_span_add(dt, i * m.block_len, MINVAL(j * m.block_len, m.length) - 1);
+    }
+    if (ret != HTTP_DL_OK) {
+        goto out;
+    }
+
+    http_dl_log_info("Delta %s: %ld of %ld bytes reused, %ld ranges to fetch.",
+                        info->local, cp.reused, m.length, dt->nspans);
+    info->repair->file_len = m.length;
+    info->flags |= HTTP_DL_F_REPAIR;
+    dt->next = 0;
+
+out:
+    http_dl_free(cp.have);
+    http_dl_free(dt->mbuf);
+    dt->mbuf = NULL;
+    dt->mlen = 0;
+    dt->mcap = 0;
+    if (ret != HTTP_DL_OK) {
+        if (info->filefd >= 0) {
+            close(info->filefd);
+            info->filefd = -1;
+        }
+        if (dt->tmp != NULL) {
+            unlink(dt->tmp);
+            http_dl_str_put(dt->tmp);
+            dt->tmp = NULL;
+        }
+        http_dl_free(info->repair);
+        info->repair = NULL;
+        dt->nspans = 0;
+        if (info->err_msg[0] == '\0') {
+            snprintf(info->err_msg, sizeof(info->err_msg), "Build %s from previous version failed",
+                        info->local);
+        }
+    }
+
+    return ret;
+}
+
+/* ʱɹʱļ滻ļɾļԭ */
+static void http_dl_delta_finish(http_dl_info_t *info)
+{
+    http_dl_delta_t *dt = info->delta;
+
+    if (dt == NULL || dt->tmp == NULL) {
+        return;
+    }
+
+    if (info->result == HTTP_DL_OK && rename(dt->tmp, info->local) != 0) {
+        http_dl_log_error("Rename %s to %s failed.", dt->tmp, info->local);
+        snprintf(info->err_msg, sizeof(info->err_msg), "Rename %s failed", dt->tmp);
+        info->result = -HTTP_DL_ERR_WRITE;
+    }
+    if (info->result != HTTP_DL_OK) {
+        unlink(dt->tmp);
+    }
+    http_dl_str_put(dt->tmp);
+    dt->tmp = NULL;
+}
+
+/* ɿ嵥http_download.h */
+int http_dl_delta_manifest(const char *path, long block_len, int fd)
+{
+    char head[HTTP_DL_BUF_LEN];
+    const unsigned char *data = NULL;
+    unsigned char *recs;
+    struct stat st;
+    long i, nblocks;
+    int sfd, len, ret = HTTP_DL_OK;
+
+    if (block_len < HTTP_DL_DELTA_BLOCK_MIN || block_len > HTTP_DL_DELTA_BLOCK_MAX) {
+        http_dl_log_error("Block size must be between %d and %d.",
+                            HTTP_DL_DELTA_BLOCK_MIN, HTTP_DL_DELTA_BLOCK_MAX);
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    sfd = open(path, O_RDONLY);
+    if (sfd < 0 || fstat(sfd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        http_dl_log_error("Open %s failed.", path);
+        if (sfd >= 0) {
+            close(sfd);
+        }
+        return -HTTP_DL_ERR_FOPEN;
+    }
+    nblocks = (st.st_size + block_len - 1) / block_len;
+    if (nblocks * HTTP_DL_DELTA_REC_LEN > HTTP_DL_MANIFEST_MAX) {
+        http_dl_log_error("%s has too many blocks, use a larger block size.", path);
+        close(sfd);
+        return -HTTP_DL_ERR_INVALID;
+    }
+    if (st.st_size > 0) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, sfd, 0);
+    }
+    close(sfd);
+    if (data == MAP_FAILED) {
+        http_dl_log_error("Map %s failed.", path);
+        return -HTTP_DL_ERR_FOPEN;
+    }
+
+    recs = http_dl_xrealloc(NULL, nblocks * HTTP_DL_DELTA_REC_LEN + 1);
+    if (recs == NULL) {
+        ret = -HTTP_DL_ERR_RESOURCE;
+        goto out;
+    }
+    for (i = 0; i < nblocks; i++) {
+        http_dl_delta_record(data + i * block_len, MINVAL(block_len, st.st_size - i * block_len),
+                                recs + i * HTTP_DL_DELTA_REC_LEN);
+    }
+
+    len = snprintf(head, sizeof(head), "HDL-Delta: %s\r\nLength: %ld\r\nBlock-Size: %ld\r\n"
+                    "Hash: xxh64\r\n\r\n", HTTP_DL_DELTA_VERSION, (long)st.st_size, block_len);
+    if (http_dl_write(fd, head, len) != len
+        || http_dl_write(fd, (char *)recs, nblocks * HTTP_DL_DELTA_REC_LEN)
+            != nblocks * HTTP_DL_DELTA_REC_LEN) {
+        http_dl_log_error("Write manifest of %s failed.", path);
+        ret = -HTTP_DL_ERR_WRITE;
+    }
+    http_dl_free(recs);
+
+out:
+    if (data != NULL) {
+        munmap((void *)data, st.st_size);
+    }
+
+    return ret;
+}
+
+/*
+ * ʽѹλhttp_dl_recv_respдļ֮䡣ÿһѹ״̬
+ * bufferеһΰ壬ݷֿдļ塣
+ */
+typedef struct http_dl_decoder_s {
+#ifdef HTTP_DL_WITH_ZLIB
+    z_stream zs;
+    bool raw_deflate;               /* ַdeflatezlibͷ谴raw deflate */
+#endif
+#ifdef HTTP_DL_WITH_ZSTD
+    ZSTD_DStream *zds;
+#endif
+    bool stream_end;
+} http_dl_decoder_t;
+
+static http_dl_encoding_t http_dl_encoding_parse(const char *val, int len)
+{
+    if ((len >= 4 && strncasecmp(val, "gzip", 4) == 0)
+        || (len >= 6 && strncasecmp(val, "x-gzip", 6) == 0)) {
+        return HTTP_DL_ENCODING_GZIP;
+    } else if (len >= 7 && strncasecmp(val, "deflate", 7) == 0) {
+        return HTTP_DL_ENCODING_DEFLATE;
+    } else if (len >= 4 && strncasecmp(val, "zstd", 4) == 0) {
+        return HTTP_DL_ENCODING_ZSTD;
+    }
+
+    return HTTP_DL_ENCODING_IDENTITY;
+}
+
+static void http_dl_decoder_free(http_dl_info_t *info)
+{
+    http_dl_decoder_t *dec = info->decoder;
+
+    if (dec == NULL) {
+        return;
+    }
+
+#ifdef HTTP_DL_WITH_ZLIB
+    if (info->encoding == HTTP_DL_ENCODING_GZIP || info->encoding == HTTP_DL_ENCODING_DEFLATE) {
+        inflateEnd(&dec->zs);
+    }
+#endif
+#ifdef HTTP_DL_WITH_ZSTD
+    if (info->encoding == HTTP_DL_ENCODING_ZSTD) {
+        ZSTD_freeDStream(dec->zds);
+    }
+#endif
+
+    http_dl_free(dec);
+    info->decoder = NULL;
+}
+
+static int http_dl_decoder_init(http_dl_info_t *info)
+{
+    http_dl_decoder_t *dec;
+    int ret = -HTTP_DL_ERR_INVALID;
+
+    if (info->encoding == HTTP_DL_ENCODING_IDENTITY || info->decoder != NULL) {
+        return HTTP_DL_OK;
+    }
+
+    dec = http_dl_xrealloc(NULL, sizeof(http_dl_decoder_t));
+    if (dec == NULL) {
+        return -HTTP_DL_ERR_RESOURCE;
+    }
+    bzero(dec, sizeof(http_dl_decoder_t));
+
+    switch (info->encoding) {
+#ifdef HTTP_DL_WITH_ZLIB
+    case HTTP_DL_ENCODING_GZIP:
+        ret = (inflateInit2(&dec->zs, 16 + MAX_WBITS) == Z_OK) ? HTTP_DL_OK : -HTTP_DL_ERR_RESOURCE;
+        break;
+    case HTTP_DL_ENCODING_DEFLATE:
+        ret = (inflateInit2(&dec->zs, MAX_WBITS) == Z_OK) ? HTTP_DL_OK : -HTTP_DL_ERR_RESOURCE;
+        break;
+#endif
+#ifdef HTTP_DL_WITH_ZSTD
+    case HTTP_DL_ENCODING_ZSTD:
+        dec->zds = ZSTD_createDStream();
+        if (dec->zds != NULL && !ZSTD_isError(ZSTD_initDStream(dec->zds))) {
+            ret = HTTP_DL_OK;
+        } else {
+            ZSTD_freeDStream(dec->zds);
+            ret = -HTTP_DL_ERR_RESOURCE;
+        }
+        break;
+#endif
+    default:
+        http_dl_log_error("Content-Encoding %d not supported by this build.", info->encoding);
+        break;
+    }
+
+    if (ret != HTTP_DL_OK) {
+        http_dl_free(dec);
+        return ret;
+    }
+
+    info->decoder = dec;
+    http_dl_log_debug("Decoder of encoding %d ready for %s.", info->encoding, info->local);
+
+    return HTTP_DL_OK;
+}
+
+/* ѹdataеlenֽڲдļǱȫ */
+static int http_dl_decoder_write(http_dl_info_t *info, char *data, int len)
+{
+    http_dl_decoder_t *dec = info->decoder;
+#if defined(HTTP_DL_WITH_ZLIB) || defined(HTTP_DL_WITH_ZSTD)
+    char out[HTTP_DL_READBUF_LEN * 4];
+    int out_len, nwrite;
+#endif
+#ifdef HTTP_DL_WITH_ZLIB
+    int zret;
+#endif
+#ifdef HTTP_DL_WITH_ZSTD
+    ZSTD_inBuffer zin;
+    ZSTD_outBuffer zout;
+    size_t zsret;
+#endif
+
+    if (dec->stream_end) {
+        /* ѹ֮ĶֱӺ */
+        return HTTP_DL_OK;
+    }
+
+    switch (info->encoding) {
+#ifdef HTTP_DL_WITH_ZLIB
+    case HTTP_DL_ENCODING_GZIP:
+    case HTTP_DL_ENCODING_DEFLATE:
+        dec->zs.next_in = (unsigned char *)data;
+        dec->zs.avail_in = len;
+        do {
+            dec->zs.next_out = (unsigned char *)out;
+            dec->zs.avail_out = sizeof(out);
+            zret = inflate(&dec->zs, Z_NO_FLUSH);
+            if (zret == Z_DATA_ERROR && info->encoding == HTTP_DL_ENCODING_DEFLATE
+                && !dec->raw_deflate && dec->zs.total_out == 0) {
+                http_dl_log_debug("No zlib header in deflate stream, try raw deflate.");
+                dec->raw_deflate = true;
+                if (inflateReset2(&dec->zs, -MAX_WBITS) != Z_OK) {
+                    return -HTTP_DL_ERR_INTERNAL;
+                }
+                dec->zs.next_in = (unsigned char *)data;
+                dec->zs.avail_in = len;
+                continue;
+            }
+            if (zret != Z_OK && zret != Z_STREAM_END && zret != Z_BUF_ERROR) {
+                http_dl_log_error("inflate %s failed, %d.", info->local, zret);
+                return -HTTP_DL_ERR_READ;
+            }
+
+            out_len = sizeof(out) - dec->zs.avail_out;
+            nwrite = http_dl_sink_write(info, out, out_len);
+            if (nwrite < out_len) {
+                return -HTTP_DL_ERR_WRITE;
+            }
+
+            if (zret == Z_STREAM_END) {
+                dec->stream_end = true;
+                break;
+            } else if (zret == Z_BUF_ERROR) {
+                break;
+            }
+        } while (dec->zs.avail_in > 0 || dec->zs.avail_out == 0);
+        break;
+#endif
+#ifdef HTTP_DL_WITH_ZSTD
+    case HTTP_DL_ENCODING_ZSTD:
+        zin.src = data;
+        zin.size = len;
+        zin.pos = 0;
+        do {
+            zout.dst = out;
+            zout.size = sizeof(out);
+            zout.pos = 0;
+            zsret = ZSTD_decompressStream(dec->zds, &zout, &zin);
+            if (ZSTD_isError(zsret)) {
+                http_dl_log_error("zstd decompress %s failed, %s.",
+                                    info->local, ZSTD_getErrorName(zsret));
+                return -HTTP_DL_ERR_READ;
+            }
+
+            out_len = zout.pos;
+            nwrite = http_dl_sink_write(info, out, out_len);
+            if (nwrite < out_len) {
+                return -HTTP_DL_ERR_WRITE;
+            }
+        } while (zin.pos < zin.size || zout.pos == zout.size);
+        break;
+#endif
+    default:
+        return -HTTP_DL_ERR_INTERNAL;
+    }
+
+    return HTTP_DL_OK;
+}
+
+/*
+ * urlinfoеurlhostpathportlocalﴦ
+ * ͸ضʱáurlhostַأpathָurlĩβԭͷš
+ */
+static int http_dl_parse_url(const char *url, http_dl_info_t *di)
+{
+    const char *p, *host, *path, *new_url, *new_host;
+    int host_len, path_len;
+    int port = 0;
+    bool tls = false;
+
+    if (url == NULL || di == NULL) {
+        http_dl_log_debug("invalid input url");
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    if (strncasecmp(url, HTTPS_URL_PREFIX, HTTPS_URL_PRE_LEN) == 0) {
+#ifndef HTTP_DL_WITH_OPENSSL
+        http_dl_log_error("Built without OpenSSL, https is not supported: %s", url);
+        return -HTTP_DL_ERR_INVALID;
+#endif
+        p = url + HTTPS_URL_PRE_LEN;
+        tls = true;
+    } else if ((p = strstr(url, HTTP_URL_PREFIX)) != NULL) {
+        p = p + HTTP_URL_PRE_LEN;
+    } else {
+        p = url;
+    }
+
+    /* hostԼܴڵport */
+    for (host = p, host_len = 0; *p != '/' && *p != ':' && *p != '\0'; p++, host_len++) {
+        (void)0;
+    }
+    if (*p == ':') {
+        p++;
+        while (isdigit(*p)) {
+            port = port * 10 + (*p - '0');
+            if (port > 0xFFFF) {
+                http_dl_log_debug("invalid port: %s", url);
+                return -HTTP_DL_ERR_INVALID;
+            }
+            p++;
+        }
+        if (*p != '/') {
+            http_dl_log_debug("invalid port: %s", url);
+            return -HTTP_DL_ERR_INVALID;
+        }
+    } else if (*p == '\0') {
+        http_dl_log_debug("invalid host: %s", host);
+        return -HTTP_DL_ERR_INVALID;
+    }
+    if (host_len <= 0) {
+        http_dl_log_debug("invalid host length: %s", host);
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    /* path */
+    for (path = p, path_len = 0; *p != '\0' && *p != ' ' && *p != '\n'; p++, path_len++) {
+        (void)0;
+    }
+    if (path_len <= 0) {
+        http_dl_log_debug("invalid path length: %s", path);
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    /* urlصpathĽβpathĩβ */
+    new_url = http_dl_str_get(url, p - url);
+    new_host = http_dl_str_get(host, host_len);
+    if (new_url == NULL || new_host == NULL) {
+        http_dl_str_put(new_url);
+        http_dl_str_put(new_host);
+        return -HTTP_DL_ERR_RESOURCE;
+    }
+    http_dl_str_put(di->url);
+    http_dl_str_put(di->host);
+    di->url = new_url;
+    di->host = new_host;
+    di->path = new_url + (path - url);
+    if (port != 0) {
+        di->port = port;
+    } else if (tls) {
+        di->port = 443; /* Ĭϵhttps˿ */
+    } else {
+        di->port = 80;  /* Ĭϵhttp˿ */
+    }
+
+    if (tls) {
+        di->flags |= HTTP_DL_F_TLS;
+    } else {
+        di->flags &= ~HTTP_DL_F_TLS;
+    }
+
+    return HTTP_DL_OK;
+}
+
+static void http_dl_info_put_strs(http_dl_info_t *info);
+
+static http_dl_info_t *http_dl_create_info(const char *url)
+{
+    http_dl_info_t *di;
+    const char *local;
+
+    if (url == NULL) {
+        http_dl_log_debug("invalid input url");
+        return NULL;
+    }
+
+    di = http_dl_info_alloc();
+    if (di == NULL) {
+        http_dl_log_debug("allocate failed");
+        return NULL;
+    }
+
+    if (http_dl_parse_url(url, di) != HTTP_DL_OK) {
+        goto err_out;
+    }
+
+    /* رļlocal */
+    local = strrchr(di->path, '/') + 1;
+    if (*local == '\0') {
+        http_dl_log_debug("invalid local file name: %s", di->path);
+        goto err_out;
+    }
+    /* ضỻurllocal */
+    di->local = http_dl_str_get(local, strlen(local));
+    if (di->local == NULL) {
+        goto err_out;
+    }
+
+    di->stage = HTTP_DL_STAGE_INIT;
+    di->prio = HTTP_DL_PRIO_NORMAL;
+    INIT_LIST_HEAD(&di->list);
+    INIT_LIST_HEAD(&di->h2_list);
+    INIT_LIST_HEAD(&di->timer.list);
+
+    di->recv_len = 0;
+    di->content_len = 0;
+    di->total_len = 0;
+    di->status_code = HTTP_DL_OK;
+    di->sockfd = -1;
+    /* ֮Ŵļظдļ */
+    di->filefd = -1;
+    INIT_LIST_HEAD(&di->local_hash);
+    INIT_LIST_HEAD(&di->digest_hash);
+
+    di->buf_data = di->buf;
+    di->buf_tail = di->buf;
+
+    return di;
+
+err_out:
+    http_dl_info_put_strs(di);
+    http_dl_free(di);
+
+    return NULL;
+}
+
+/* ٵֵKB/s0ʾ٣ҲHTTP_DL_RATE_MAX_KB*rateΪֽ/ */
+static int http_dl_parse_rate(const char *p, int len, long *rate)
+{
+    long kb;
+
+    if (http_dl_parse_ulong(p, len, &kb) != HTTP_DL_PARSE_OK || kb > HTTP_DL_RATE_MAX_KB) {
+        return -HTTP_DL_ERR_INVALID;
+    }
+    *rate = kb * 1024;
+
+    return HTTP_DL_OK;
+}
+
+/*
+ * URLбURL֮ĿѡֶΣԿհ׷ָkey=valueĿǰ֧֣
+ *   sha256=<hex> crc32c=<hex> xxh64=<hex>  ʱУժҪ
+ *   rate=<KB/s>                            ٣-t
+ *   prio=high|normal|low                   ŶӵȼĬnormal
+ *   deadline=<>                          ϣύɣͬȷֹʱ
+ *   repair=<first-last,...>|holes          ֻļеЩ(last)
+ *                                          ļеĿնдԭλ
+ *   delta=<嵥URL> [base=<ɰ汾>]        嵥أɰ汾еĿ鲻أ
+ *                                          ɰ汾ĬΪļԼ
+ */
+static int http_dl_parse_task_opts(http_dl_info_t *info, char *opts)
+{
+    long rate;
+    char *key, *val, *end;
+    http_dl_digest_type_t type;
+
+    for (key = opts; *key != '\0'; key = end) {
+        key += strspn(key, " \t");
+        if (*key == '\0') {
+            break;
+        }
+        end = key + strcspn(key, " \t");
+        val = memchr(key, '=', end - key);
+        if (val == NULL) {
+            http_dl_log_error("Invalid option %.*s for %s.", (int)(end - key), key, info->url);
+            return -HTTP_DL_ERR_INVALID;
+        }
+
+        if (val - key == 4 && strncmp(key, "rate", 4) == 0) {
+            val++;
+            if (http_dl_parse_rate(val, end - val, &rate) != HTTP_DL_OK) {
+                http_dl_log_error("Invalid rate %.*s for %s.", (int)(end - val), val, info->url);
+                return -HTTP_DL_ERR_INVALID;
+            }
+            http_dl_bucket_init(&info->bucket, rate);
+            continue;
+        }
+        if (val - key == 4 && strncmp(key, "prio", 4) == 0) {
+            val++;
+            if (end - val == 4 && strncmp(val, "high", 4) == 0) {
+                info->prio = HTTP_DL_PRIO_HIGH;
+            } else if (end - val == 6 && strncmp(val, "normal", 6) == 0) {
+                info->prio = HTTP_DL_PRIO_NORMAL;
+            } else if (end - val == 3 && strncmp(val, "low", 3) == 0) {
+                info->prio = HTTP_DL_PRIO_LOW;
+            } else {
+                http_dl_log_error("Invalid priority %.*s for %s.", (int)(end - val), val, info->url);
+                return -HTTP_DL_ERR_INVALID;
+            }
+            continue;
+        }
+        if (val - key == 8 && strncmp(key, "deadline", 8) == 0) {
+            info->deadline_ms = http_dl_now_ms() + strtol(val + 1, NULL, 10) * 1000;
+            continue;
+        }
+        if (val - key == 6 && strncmp(key, "repair", 6) == 0) {
+            val++;
+            if (http_dl_repair_parse(info, val, end - val) != HTTP_DL_OK) {
+                return -HTTP_DL_ERR_INVALID;
+            }
+            continue;
+        }
+        if ((val - key == 5 && strncmp(key, "delta", 5) == 0)
+            || (val - key == 4 && strncmp(key, "base", 4) == 0)) {
+            *val++ = '\0';
+            if (http_dl_delta_opt(info, key, val, end - val) != HTTP_DL_OK) {
+                return -HTTP_DL_ERR_INVALID;
+            }
+            continue;
+        }
+
+        type = http_dl_digest_type_parse(key, val - key);
+        if (type != HTTP_DL_DIGEST_NONE) {
+            val++;
+            if (http_dl_digest_attach(info, type, val, end - val) != HTTP_DL_OK) {
+                return -HTTP_DL_ERR_INVALID;
+            }
+            continue;
+        }
+
+        http_dl_log_error("Unknown option %.*s for %s.", (int)(end - key), key, info->url);
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    if (info->delta != NULL && (info->delta->manifest == NULL || (info->flags & HTTP_DL_F_REPAIR))) {
+        http_dl_log_error("base= needs delta=, and delta= can not go with repair= for %s.", info->url);
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    return HTTP_DL_OK;
+}
+
+/*
+ * ¼һضfromtoļͬĿ¼ǰ׺¼
+ * ͬһĿ¼µҲֱУֻ¼URL
+ */
+static void http_dl_redirect_free(http_dl_redirect_t *rd)
+{
+    list_del_init(&rd->list);
+    http_dl_redirect_cache_count--;
+    http_dl_str_put(rd->from);
+    http_dl_str_put(rd->to);
+    http_dl_free(rd);
+}
+
+static void http_dl_redirect_cache_add(const char *from, const char *to)
+{
+    http_dl_redirect_t *rd, *rd_old, *next_rd;
+    const char *from_tail, *to_tail;
+    int from_len, to_len;
+
+    from_len = strlen(from);
+    to_len = strlen(to);
+    from_tail = strrchr(from, '/');
+    to_tail = strrchr(to, '/');
+    if (from_tail != NULL && to_tail != NULL && strcmp(from_tail, to_tail) == 0) {
+        from_len = from_tail - from;
+        to_len = to_tail - to;
+    }
+
+    rd = http_dl_xrealloc(NULL, sizeof(http_dl_redirect_t));
+    if (rd == NULL) {
+        return;
+    }
+    rd->from = http_dl_str_get(from, from_len);
+    rd->to = http_dl_str_get(to, to_len);
+    if (rd->from == NULL || rd->to == NULL) {
+        http_dl_str_put(rd->from);
+        http_dl_str_put(rd->to);
+        http_dl_free(rd);
+        return;
+    }
+
+    list_for_each_entry_safe(rd_old, next_rd, &http_dl_redirect_cache, list, http_dl_redirect_t) {
+        if (rd_old->from == rd->from) {
+            http_dl_redirect_free(rd_old);
+        }
+    }
+
+    if (http_dl_redirect_cache_count >= HTTP_DL_REDIRECT_CACHE_LEN) {
+        /* ̭δʹõһ */
+        http_dl_redirect_free(list_entry(http_dl_redirect_cache.prev, http_dl_redirect_t, list));
+    }
+
+    list_add(&rd->list, &http_dl_redirect_cache);
+    http_dl_redirect_cache_count++;
+
+    http_dl_log_debug("Cache permanent redirect %s -> %s", rd->from, rd->to);
+}
+
+/* ض򻺴дinfoURLзtrue */
+static bool http_dl_redirect_cache_apply(http_dl_info_t *info)
+{
+    http_dl_redirect_t *rd;
+    const char *url;
+    int from_len, ret;
+
+    list_for_each_entry(rd, &http_dl_redirect_cache, list, http_dl_redirect_t) {
+        from_len = http_dl_str_entry(rd->from)->len;
+        if (strncmp(info->url, rd->from, from_len) != 0
+            || (info->url[from_len] != '\0' && info->url[from_len] != '/')) {
+            continue;
+        }
+
+        url = http_dl_str_printf("%s%s", rd->to, info->url + from_len);
+        ret = (url != NULL) ? http_dl_parse_url(url, info) : -HTTP_DL_ERR_RESOURCE;
+        http_dl_str_put(url);
+        if (ret != HTTP_DL_OK) {
+            return false;
+        }
+
+        list_move(&rd->list, &http_dl_redirect_cache);
+        http_dl_log_debug("Redirect cache hit, %s -> %s", rd->from, info->url);
+
+        return true;
+    }
+
+    return false;
+}
+
+static void http_dl_redirect_cache_destroy()
+{
+    http_dl_redirect_t *rd, *next_rd;
+
+    list_for_each_entry_safe(rd, next_rd, &http_dl_redirect_cache, list, http_dl_redirect_t) {
+        http_dl_redirect_free(rd);
+    }
+}
+
+static void http_dl_add_info_to_list(http_dl_info_t *info, http_dl_list_t *list)
+{
+    if (info == NULL || list == NULL) {
+        return;
+    }
+
+    list_add_tail(&info->list, &list->list);
+    list->count++;
+}
+
+/*
+ * selectfddownloading listsocketwatchfdǼλͼУ
+ * summaryĵiλʾwords[i]Ϊ0ǼǺȡO(1)maxfdλó
+ * κʱ׼ȷģ¼ѭ;ɾҲҪɨ衣
+ * downloading listڼsockfd䣬HTTP/2ûԼsocketǼǡ
+ */
+#define HTTP_DL_FDS_BITS    (__SIZEOF_LONG__ * 8)
+#define HTTP_DL_FDS_WORDS   ((FD_SETSIZE + HTTP_DL_FDS_BITS - 1) / HTTP_DL_FDS_BITS)
+#if HTTP_DL_FDS_WORDS > HTTP_DL_FDS_BITS
+#error "FD_SETSIZE is too large for http_dl_fds_t"
+#endif
+
+typedef struct http_dl_fds_s {
+    unsigned long words[HTTP_DL_FDS_WORDS];
+    unsigned long summary;
+    int maxfd;                      /* ûеǼǵfdʱΪ-1 */
+} http_dl_fds_t;
+
+static http_dl_fds_t http_dl_fds = { .maxfd = -1 };
+
+static void http_dl_fds_add(int fd)
+{
+    int w;
+    unsigned long bit;
+
+    if (fd < 0 || fd >= FD_SETSIZE) {
+        return;
+    }
+    w = fd / HTTP_DL_FDS_BITS;
+    bit = 1UL << (fd % HTTP_DL_FDS_BITS);
+    if ((http_dl_fds.words[w] & bit)) {
+        return;
+    }
+
+    http_dl_fds.words[w] |= bit;
+    http_dl_fds.summary |= 1UL << w;
+    if (http_dl_fds.maxfd < fd) {
+        http_dl_fds.maxfd = fd;
+    }
+}
+
+static void http_dl_fds_del(int fd)
+{
+    int w;
+    unsigned long bit;
+
+    if (fd < 0 || fd >= FD_SETSIZE) {
+        return;
+    }
+    w = fd / HTTP_DL_FDS_BITS;
+    bit = 1UL << (fd % HTTP_DL_FDS_BITS);
+    if (!(http_dl_fds.words[w] & bit)) {
+        return;
+    }
+
+    http_dl_fds.words[w] &= ~bit;
+    if (http_dl_fds.words[w] == 0) {
+        http_dl_fds.summary &= ~(1UL << w);
+    }
+    if (fd != http_dl_fds.maxfd) {
+        return;
+    }
+
+    if (http_dl_fds.summary == 0) {
+        http_dl_fds.maxfd = -1;
+        return;
+    }
+    w = HTTP_DL_FDS_BITS - 1 - __builtin_clzl(http_dl_fds.summary);
+    http_dl_fds.maxfd = w * HTTP_DL_FDS_BITS + HTTP_DL_FDS_BITS - 1 - __builtin_clzl(http_dl_fds.words[w]);
+}
+
+static void http_dl_add_info_to_download_list(http_dl_info_t *info)
+{
+    if (info == NULL) {
+        return;
+    }
+
+    http_dl_add_info_to_list(info, &http_dl_list_downloading);
+    if (!(info->flags & HTTP_DL_F_H2)) {
+        http_dl_fds_add(info->sockfd);
+    }
+}
+
+static void http_dl_del_info_from_download_list(http_dl_info_t *info)
+{
+    if (info == NULL) {
+        return;
+    }
+
+    list_del_init(&info->list);
+    http_dl_list_downloading.count--;
+    if (!(info->flags & HTTP_DL_F_H2)) {
+        http_dl_fds_del(info->sockfd);
+    }
+}
+
+void http_dl_init()
+{
+    int i;
+
+    http_dl_tcp_rmem_max = http_dl_sysctl_long("/proc/sys/net/ipv4/tcp_rmem", 2);
+    http_dl_core_rmem_max = http_dl_sysctl_long("/proc/sys/net/core/rmem_max", 0);
+
+    for (i = 0; i < HTTP_DL_PRIO_LEVELS; i++) {
+        http_dl_list_initial[i].count = 0;
+        INIT_LIST_HEAD(&http_dl_list_initial[i].list);
+    }
+    sprintf(http_dl_list_initial[HTTP_DL_PRIO_HIGH].name, "Initial list (high)");
+    sprintf(http_dl_list_initial[HTTP_DL_PRIO_NORMAL].name, "Initial list");
+    sprintf(http_dl_list_initial[HTTP_DL_PRIO_LOW].name, "Initial list (low)");
+
+    http_dl_list_dup.count = 0;
+    INIT_LIST_HEAD(&http_dl_list_dup.list);
+    sprintf(http_dl_list_dup.name, "Duplicate list");
+
+    for (i = 0; i < HTTP_DL_DEDUP_HASH_LEN; i++) {
+        INIT_LIST_HEAD(&http_dl_dedup_local[i]);
+        INIT_LIST_HEAD(&http_dl_dedup_digest[i]);
+        INIT_LIST_HEAD(&http_dl_blobs[i]);
+    }
+    for (i = 0; i < HTTP_DL_STR_HASH_LEN; i++) {
+        INIT_LIST_HEAD(&http_dl_strs[i]);
+    }
+
+    http_dl_list_downloading.count = 0;
+    INIT_LIST_HEAD(&http_dl_list_downloading.list);
+    sprintf(http_dl_list_downloading.name, "Downloading list");
+
+    http_dl_list_finished.count = 0;
+    INIT_LIST_HEAD(&http_dl_list_finished.list);
+    sprintf(http_dl_list_finished.name, "Finished list");
+
+    http_dl_list_retrying.count = 0;
+    INIT_LIST_HEAD(&http_dl_list_retrying.list);
+    sprintf(http_dl_list_retrying.name, "Retrying list");
+
+    /* Եȴʱ */
+    srandom(getpid() ^ http_dl_now_ms());
+
+    /* Զѹرʱдsocket(TLSclose_notify)EPIPEҪźɱ */
+    signal(SIGPIPE, SIG_IGN);
+
+    http_dl_timer_wheel_init(http_dl_now_ms());
+}
+
+static void http_dl_info_put_strs(http_dl_info_t *info)
+{
+    http_dl_str_put(info->url);
+    http_dl_str_put(info->host);
+    http_dl_str_put(info->local);
+    http_dl_str_put(info->location);
+}
+
+/* ͷѾlistȡµ */
+static void http_dl_info_free(http_dl_info_t *info)
+{
+    list_del_init(&info->local_hash);
+    list_del_init(&info->digest_hash);
+    http_dl_timer_del(&info->timer);
+    http_dl_conn_close(info);
+    if (info->filefd >= 0) {
+        http_dl_sink_unmap(info);
+        close(info->filefd);
+    }
+    http_dl_decoder_free(info);
+    http_dl_free(info->digest);
+    http_dl_free(info->repair);
+    http_dl_delta_free(info);
+    http_dl_info_put_strs(info);
+    http_dl_free(info);
+}
+
+static void http_dl_list_destroy(http_dl_list_t *list)
+{
+    http_dl_info_t *info, *next_info;
+
+    if (list == NULL) {
+        return;
+    }
+
+    list_for_each_entry_safe(info, next_info, &list->list, list, http_dl_info_t) {
+        http_dl_log_debug("[%s] delete %s", list->name, info->url);
+        list_del_init(&info->list);
+        http_dl_info_free(info);
+        list->count--;
+    }
+
+    if (list->count != 0) {
+        http_dl_log_error("[%s] FATAL error, after destroy list->count %d (should 0).",
+                                list->name, list->count);
+    } else {
+        http_dl_log_debug("[%s] destroy success.", list->name);
+    }
+}
+
+static void http_dl_h2_destroy();
+static void http_dl_blob_destroy();
+
+void http_dl_destroy()
+{
+    int i;
+
+    http_dl_post_stop();
+    http_dl_h2_destroy();
+    http_dl_host_destroy();
+    http_dl_conn_pool_destroy();
+    http_dl_redirect_cache_destroy();
+    for (i = 0; i < HTTP_DL_PRIO_LEVELS; i++) {
+        http_dl_list_destroy(&http_dl_list_initial[i]);
+    }
+    http_dl_list_destroy(&http_dl_list_dup);
+    http_dl_blob_destroy();
+    http_dl_list_destroy(&http_dl_list_downloading);
+    http_dl_list_destroy(&http_dl_list_retrying);
+    http_dl_list_destroy(&http_dl_list_finished);
+#ifdef HTTP_DL_WITH_OPENSSL
+    http_dl_tls_destroy();
+#endif
+    http_dl_trace_close();
+}
+
+#ifndef HTTP_DL_NO_MAIN
+static void http_dl_list_debug(http_dl_list_t *list)
+{
+    http_dl_info_t *info;
+
+    if (list == NULL) {
+        return;
+    }
+
+    http_dl_print_raw("\n%s [%d]:\n", list->name, list->count);
+    list_for_each_entry(info, &list->list, list, http_dl_info_t) {
+        if (info->recv_len == 0) {
+            http_dl_print_raw("\t%s\n", info->url);
+        } else if (info->encoding != HTTP_DL_ENCODING_IDENTITY) {
+            /* ѹʱͬʱֽֽ */
+            http_dl_print_raw("\t%s wire[%ld B/%ld B], disk[%ld B] [%ld KB/s]\n",
+                                info->local,
+                                info->wire_len,
+                                info->content_len,
+                                info->recv_len,
+                                (info->elapsed_time == -1) ? 0 : info->recv_len / info->elapsed_time);
+        } else if (info->elapsed_time == -1) {
+            http_dl_print_raw("\t%s [%ld B/%ld B], restart[%ld B], total[%ld B]\n",
+                                info->local, info->recv_len, info->content_len,
+                                info->restart_len, info->total_len);
+        } else {
+            http_dl_print_raw("\t%s [%ld B/%ld B], restart[%ld B], total[%ld B] [%ld KB/s]\n",
+                                info->local,
+                                info->recv_len,
+                                info->content_len,
+                                info->restart_len,
+                                info->total_len,
+                                info->recv_len / info->elapsed_time);
+        }
+        if (info->stage == HTTP_DL_STAGE_FINISH && info->digest != NULL
+            && info->digest->hex[0] != '\0') {
+            http_dl_print_raw("\t\t%s %s\n",
+                                http_dl_digest_names[info->digest->type], info->digest->hex);
+        }
+        if (info->retries > 0) {
+            http_dl_print_raw("\t\tretried %d times\n", info->retries);
+        }
+        if (info->rcvbuf > 0) {
+            http_dl_print_raw("\t\trtt[%u us], rcvbuf[%d KB]\n", info->rtt_us, info->rcvbuf >> 10);
+        } else if (info->rtt_us > 0) {
+            http_dl_print_raw("\t\trtt[%u us], rcvbuf[auto]\n", info->rtt_us);
+        }
+        if (info->result != HTTP_DL_OK) {
+            http_dl_print_raw("\t\tFAILED [%d] %s\n", info->result, info->err_msg);
+        }
+    }
+    http_dl_print_raw("--------------\n");
+}
+
+static void http_dl_debug_show()
+{
+    int i;
+
+    for (i = 0; i < HTTP_DL_PRIO_LEVELS; i++) {
+        /* ûõȼʱֻʾĬϵһ */
+        if (i == HTTP_DL_PRIO_NORMAL || http_dl_list_initial[i].count > 0) {
+            http_dl_list_debug(&http_dl_list_initial[i]);
+        }
+    }
+    if (http_dl_list_dup.count > 0) {
+        http_dl_list_debug(&http_dl_list_dup);
+    }
+    http_dl_list_debug(&http_dl_list_downloading);
+    http_dl_list_debug(&http_dl_list_retrying);
+    http_dl_list_debug(&http_dl_list_finished);
+}
+
+/* ֱͼiͰϽ2^i΢(bytesΪtrueʱֽ)׶ĵλ */
+static char *http_dl_hist_bound(int i, bool bytes, char *buf, int len)
+{
+    long us = 1L << i;
+
+    if (bytes) {
+        snprintf(buf, len, (i < 10) ? "%ldB" : (i < 20) ? "%ldKB" : "%ldMB",
+                    us >> ((i < 10) ? 0 : (i < 20) ? 10 : 20));
+    } else if (us < 1000) {
+        snprintf(buf, len, "%ldus", us);
+    } else if (us < 1000000) {
+        snprintf(buf, len, "%ldms", us / 1000);
+    } else {
+        snprintf(buf, len, "%lds", us / 1000000);
+    }
+
+    return buf;
+}
+
+/* һֱͼp50p90p99ֵͰϽ */
+static void http_dl_hist_show(const char *name, unsigned long *hist, bool bytes)
+{
+    static const int pct[] = {50, 90, 99, 100};
+    char bound[sizeof(pct) / sizeof(pct[0])][24];    /* ŵlongӵλض */
+    unsigned long n = 0, acc;
+    int i, k;
+
+    for (i = 0; i < HTTP_DL_HIST_LEN; i++) {
+        n += hist[i];
+    }
+    if (n == 0) {
+        return;
+    }
+
+    for (k = 0, i = 0, acc = hist[0]; k < sizeof(pct) / sizeof(pct[0]); k++) {
+        while (acc * 100 < n * pct[k]) {
+            acc += hist[++i];
+        }
+        (void)http_dl_hist_bound(i, bytes, bound[k], sizeof(bound[k]));
+    }
+    http_dl_print_raw("\t%-16s %8lu  <%-7s <%-7s <%-7s <%s\n", name, n,
+                        bound[0], bound[1], bound[2], bound[3]);
+}
+
+/* ׶ʱֱͼÿ׶δӽ뵽һĽ׶Ϊֹ */
+static void http_dl_stage_hist_show()
+{
+    unsigned long n = 0;
+    int i;
+
+    for (i = 0; i < HTTP_DL_HIST_LEN; i++) {
+        n += http_dl_total_hist[i];
+    }
+    if (n == 0) {
+        return;
+    }
+
+    http_dl_print_raw("\nStage latency [%lu tasks]:\n\t%-16s %8s  %-8s %-8s %-8s %s\n", n,
+                        "stage", "count", "p50", "p90", "p99", "max");
+    for (i = 0; i < HTTP_DL_STAGE_FINISH; i++) {
+        http_dl_hist_show(http_dl_stage_names[i], http_dl_stage_hist[i], false);
+    }
+    http_dl_hist_show("total", http_dl_total_hist, false);
+    http_dl_print_raw("--------------\n");
+}
+
+/* ¼ѭļhttp_dl_prof_t */
+static void http_dl_prof_show()
+{
+    http_dl_prof_t *p = &http_dl_prof;
+    unsigned long busy = MAXVAL(p->busy_ns, 1);
+
+    if (p->polls == 0) {
+        return;
+    }
+
+    http_dl_print_raw("\nEvent loop:\n");
+    http_dl_print_raw("\twakeups[%lu], timeouts[%lu], empty[%lu], ready fds[%lu], %.1f per wakeup\n",
+                        p->polls, p->poll_timeouts, p->poll_empty, p->ready,
+                        (double)p->ready / p->polls);
+    http_dl_print_raw("\treads[%lu], again[%lu], %lu B, %lu B per read\n",
+                        p->reads, p->read_again, p->read_bytes,
+                        p->read_bytes / MAXVAL(p->reads - p->read_again, 1));
+    http_dl_print_raw("\twrites[%lu], %lu B\n", p->writes, p->write_bytes);
+    http_dl_print_raw("\twait[%lu ms], busy[%lu ms]: read %lu%%, parse %lu%%, copy %lu%%, other %lu%%\n",
+                        p->wait_ns / 1000000, p->busy_ns / 1000000,
+                        p->read_ns * 100 / busy, p->parse_ns * 100 / busy, p->copy_ns * 100 / busy,
+                        (busy > p->read_ns + p->parse_ns + p->copy_ns)
+                            ? (busy - p->read_ns - p->parse_ns - p->copy_ns) * 100 / busy : 0);
+    http_dl_print_raw("\t%-16s %8s  %-8s %-8s %-8s %s\n", "", "count", "p50", "p90", "p99", "max");
+    http_dl_hist_show("bytes per read", p->read_hist, true);
+    http_dl_print_raw("--------------\n");
+}
+
+static volatile sig_atomic_t http_dl_dump_req;  /* յSIGUSR1¼ѭ */
+
+static void http_dl_dump_signal(int sig)
+{
+    http_dl_dump_req = 1;
+}
+
+/* SIGUSR1˳ʱб׶ʱ¼ѭļ */
+static void http_dl_dump()
+{
+    http_dl_dump_req = 0;
+    http_dl_debug_show();
+    http_dl_stage_hist_show();
+    http_dl_prof_show();
+}
+#endif
+
+static int http_dl_h2_conn_start(http_dl_info_t *ctrl);
+
+/*
+ * ȡhostͷģ壺֮󣬳Accept-EncodingRangeͷ
+ * ͬһhostֻ⼸ͬ˿ڻUser-Agentʱͬɡ
+ */
+static const char *http_dl_req_tmpl(http_dl_info_t *di, int *len)
+{
+    http_dl_req_tmpl_t *tmpl = &di->hs->req;
+    bool genuine = (di->flags & HTTP_DL_F_GENUINE_AGENT) != 0;
+    char *useragent = genuine ? http_dl_agent_string_genuine : http_dl_agent_string;
+    char *data;
+    int n;
+
+    if (tmpl->data == NULL || tmpl->port != di->port || tmpl->genuine != genuine) {
+        n = snprintf(NULL, 0, HTTP_DL_REQ_TMPL_FMT, useragent, di->host, di->port, HTTP_ACCEPT);
+        data = http_dl_xrealloc(tmpl->data, n + 1);
+        if (data == NULL) {
+            return NULL;
+        }
+        sprintf(data, HTTP_DL_REQ_TMPL_FMT, useragent, di->host, di->port, HTTP_ACCEPT);
+        tmpl->data = data;
+        tmpl->len = n;
+        tmpl->port = di->port;
+        tmpl->genuine = genuine;
+        http_dl_log_debug("Request template of %s:%d rendered.", di->host, di->port);
+    }
+
+    *len = tmpl->len;
+    return tmpl->data;
+}
+
+static void http_dl_iov_add(struct iovec *iov, int *iovcnt, const char *base, int len)
+{
+    iov[*iovcnt].iov_base = (void *)base;
+    iov[*iovcnt].iov_len = len;
+    (*iovcnt)++;
+}
+
+/* ȫдʼȴӦֽڳʱ */
+static void http_dl_req_sent(http_dl_info_t *di)
+{
+    int on = 1;
+
+    /* ӦͷļACKӵſÿЩTCP_QUICKACKֻһ󣬲õ */
+    (void)setsockopt(di->sockfd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+
+    http_dl_log_info("HTTP request sent, awaiting response...");
+    di->stage_ms = http_dl_now_ms();
+    http_dl_task_timer_update(di);
+}
+
+/*
+ * дϴʣµsocketǷģдʱHTTP_DL_F_WANT_WRITE
+ * ¼ѭsocketдٴν룬ڼֽڳʱơ
+ */
+static int http_dl_req_flush(http_dl_info_t *di)
+{
+    int ret;
+
+    ret = di->transport->write(di, di->wbuf, di->wlen);
+    if (ret == -HTTP_DL_ERR_AGAIN) {
+        return HTTP_DL_OK;
+    } else if (ret < 0) {
+        http_dl_log_debug("write HTTP request failed.");
+        return -HTTP_DL_ERR_WRITE;
+    }
+
+    di->wlen -= ret;
+    if (di->wlen > 0) {
+        memmove(di->wbuf, di->wbuf + ret, di->wlen);
+        return HTTP_DL_OK;
+    }
+    http_dl_free(di->wbuf);
+    di->wbuf = NULL;
+    di->flags &= ~HTTP_DL_F_WANT_WRITE;
+    http_dl_req_sent(di);
+
+    return HTTP_DL_OK;
+}
+
+/* writevֻдdoneֽڣʣµƴwbufУhttp_dl_req_flushд */
+static int http_dl_req_save(http_dl_info_t *di, struct iovec *iov, int iovcnt, int done)
+{
+    int i, len = 0, off;
+
+    for (i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+    di->wbuf = http_dl_xrealloc(NULL, len - done);
+    if (di->wbuf == NULL) {
+        return -HTTP_DL_ERR_RESOURCE;
+    }
+
+    for (i = 0, off = 0; i < iovcnt; off += iov[i].iov_len, i++) {
+        if (off + (int)iov[i].iov_len <= done) {
+            continue;
+        }
+        memcpy(di->wbuf + di->wlen, (char *)iov[i].iov_base + MAXVAL(done - off, 0),
+                iov[i].iov_len - MAXVAL(done - off, 0));
+        di->wlen += iov[i].iov_len - MAXVAL(done - off, 0);
+    }
+    di->flags |= HTTP_DL_F_WANT_WRITE;
+    http_dl_task_timer_update(di);
+
+    return HTTP_DL_OK;
+}
+
+static int http_dl_send_req(http_dl_info_t *di)
+{
+    int ret, tmpl_len, range_len = 0, iovcnt = 0, i, len = 0;
+    char range[HTTP_DL_REPAIR_SPEC_LEN + 16];
+    const char *tmpl, *encoding = "";
+    struct iovec iov[8];
+    bool in_progress;
+
+    if (di == NULL) {
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    if (di->stage == HTTP_DL_STAGE_SEND_REQUEST && di->wlen > 0) {
+        /* socketдˣдϴʣµ */
+        return http_dl_req_flush(di);
+    }
+
+    if (di->stage == HTTP_DL_STAGE_INIT) {
+        di->stage_ms = http_dl_now_ms();
+        di->rcvbuf = 0;
+        di->tune_ms = 0;
+        if (!(di->flags & HTTP_DL_F_H2_CTRL) && http_dl_conn_pool_get(di) >= 0) {
+            /* еѾֱ֣ӷ */
+            http_dl_stage_set(di, HTTP_DL_STAGE_SEND_REQUEST);
+        } else {
+            di->transport = http_dl_transport_get(di);
+            ret = http_dl_conn(di->host, di->port, &in_progress);
+            if (ret < 0) {
+                http_dl_log_debug("connect failed: %s:%d", di->host, di->port);
+                return -HTTP_DL_ERR_CONN;
+            }
+            di->sockfd = ret;
+            http_dl_stage_set(di, HTTP_DL_STAGE_CONNECTING);
+            if (in_progress) {
+                /* socketдٴν뱾 */
+                http_dl_task_timer_update(di);
+                return HTTP_DL_OK;
+            }
+        }
+    } else if (di->stage == HTTP_DL_STAGE_CONNECTING) {
+        if (http_dl_conn_finish(di->sockfd) != HTTP_DL_OK) {
+            http_dl_log_debug("connect failed: %s:%d", di->host, di->port);
+            return -HTTP_DL_ERR_CONN;
+        }
+    }
+
+    if (di->stage == HTTP_DL_STAGE_CONNECTING) {
+        /* TCPѾ */
+        if (di->transport->handshake == NULL) {
+            /* TLSһַд¼ѭд */
+            http_dl_stage_set(di, HTTP_DL_STAGE_SEND_REQUEST);
+        } else {
+            http_dl_stage_set(di, HTTP_DL_STAGE_HANDSHAKE);
+        }
+    }
+
+    if (di->stage == HTTP_DL_STAGE_HANDSHAKE) {
+        /* ʱӳʱȴsocket¼ٴν뱾 */
+        ret = di->transport->handshake(di);
+        if (ret == -HTTP_DL_ERR_AGAIN) {
+            return HTTP_DL_OK;
+        } else if (ret != HTTP_DL_OK) {
+            return ret;
+        }
+        di->flags &= ~HTTP_DL_F_WANT_WRITE;
+        http_dl_stage_set(di, HTTP_DL_STAGE_SEND_REQUEST);
+    }
+
+    if (di->flags & HTTP_DL_F_H2_CTRL) {
+        /* HTTP/2ӽˣǰԣɸ */
+        return http_dl_h2_conn_start(di);
+    }
+
+    /* hostģͼƬɣһwritevٷƴ */
+    if (di->hs == NULL || (tmpl = http_dl_req_tmpl(di, &tmpl_len)) == NULL) {
+        http_dl_log_error("Render request template of %s failed.", di->host);
+        return -HTTP_DL_ERR_RESOURCE;
+    }
+
+    if (di->flags & HTTP_DL_F_REPAIR) {
+        /* ޲ҲЭѹԭͬ */
+        range_len = sprintf(range, "Range: %s\r\n", http_dl_repair_spec(di));
+    } else if (di->restart_len != 0) { /* ϵ */
+        range_len = sprintf(range, "Range: bytes=%ld-\r\n", di->restart_len);
+    } else if ((di->flags & HTTP_DL_F_ACCEPT_ENCODING) && !(di->flags & HTTP_DL_F_DELTA)
+               && strlen(HTTP_ACCEPT_ENCODING) > 0) {
+        /* 嵥ҪڴнҲЭѹ */
+        /* ϵʱRangeԵѹݣ޷뱾ļƴӣЭѹ */
+        encoding = "Accept-Encoding: " HTTP_ACCEPT_ENCODING "\r\n";
+    }
+
+    http_dl_iov_add(iov, &iovcnt, "GET ", 4);
+    http_dl_iov_add(iov, &iovcnt, di->path, strlen(di->path));
+    http_dl_iov_add(iov, &iovcnt, " HTTP/1.0\r\n", 11);
+    http_dl_iov_add(iov, &iovcnt, tmpl, tmpl_len);
+    http_dl_iov_add(iov, &iovcnt, encoding, strlen(encoding));
+    http_dl_iov_add(iov, &iovcnt, range, range_len);
+    http_dl_iov_add(iov, &iovcnt, "\r\n", 2);
+    http_dl_log_debug("\n--- request begin ---\nGET %s HTTP/1.0\r\n%s%s%.*s\r\n--- request end ---\n",
+                        di->path, tmpl, encoding, range_len, range);
+
+    ret = di->transport->writev(di, iov, iovcnt);
+    if (ret == -HTTP_DL_ERR_AGAIN) {
+        ret = 0;
+    } else if (ret < 0) {
+        http_dl_log_debug("write HTTP request failed.");
+        return -HTTP_DL_ERR_WRITE;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+    if (ret < len) {
+        /* ͻˣʣµĵsocketдд */
+        di->stage_ms = http_dl_now_ms();
+        return http_dl_req_save(di, iov, iovcnt, ret);
+    }
+    http_dl_req_sent(di);
+
+    return HTTP_DL_OK;
+}
+
+static int http_dl_parse_status_line(http_dl_info_t *info)
+{
+    http_dl_status_t st;
+    int ret, len, adv;
+
+    if (info == NULL) {
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    if (info->stage != HTTP_DL_STAGE_PARSE_STATUS_LINE) {
+        http_dl_log_debug("Wrong stage %d.", info->stage);
+        return -HTTP_DL_ERR_INTERNAL;
+    }
+
+    ret = http_dl_parse_line(info->buf_data, info->buf_tail - info->buf_data,
+                                HTTP_DL_READBUF_LEN, &len, &adv);
+    if (ret == HTTP_DL_PARSE_AGAIN) {
+        /* status lineû... */
+        http_dl_log_debug("Incompleted status line: %.*s",
+                            (int)(info->buf_tail - info->buf_data), info->buf_data);
+        return HTTP_DL_OK;
+    }
+    if (ret == HTTP_DL_PARSE_OK) {
+        ret = http_dl_parse_status(info->buf_data, len, &st);
+    }
+    if (ret != HTTP_DL_PARSE_OK) {
+        http_dl_log_debug("Invalid status line: %.*s",
+                            MINVAL((int)(info->buf_tail - info->buf_data), HTTP_DL_BUF_LEN),
+                            info->buf_data);
+        snprintf(info->err_msg, sizeof(info->err_msg), "Invalid status line");
+        return -HTTP_DL_ERR_INVALID;
+    }
+    http_dl_log_debug("Status line: %.*s", len, info->buf_data);
+
+    /* HTTP/1.1ĬϱӣHTTP/1.0ҪӦConnection: Keep-Alive */
+    if (st.major > 1 || (st.major == 1 && st.minor >= 1)) {
+        info->flags |= HTTP_DL_F_KEEPALIVE;
+    } else {
+        info->flags &= ~HTTP_DL_F_KEEPALIVE;
+    }
+    info->status_code = st.code;
+
+    /* ԭֻгʱΪϢ */
+    if (st.code >= 400 && st.reason_len > 0) {
+        snprintf(info->err_msg, sizeof(info->err_msg), "%.*s", st.reason_len, st.reason);
+    } else {
+        info->err_msg[0] = '\0';
+    }
+
+    http_dl_stage_set(info, HTTP_DL_STAGE_PARSE_HEADER);
+
+    info->buf_data += adv;      /* Թ"\r\n" */
+    if (info->buf_data < info->buf_tail) {
+        /* δ꣬תһstage */
+        return -HTTP_DL_ERR_AGAIN;
+    }
+
+    return HTTP_DL_OK;
+}
+
+/* ͷֲִСдnameΪСд */
+#define HTTP_DL_FIELD_IS(name, nlen, lit) \
+    ((nlen) == sizeof(lit) - 1 && strncasecmp((name), (lit), sizeof(lit) - 1) == 0)
+
+/* һͷnamevalue'\0'HTTP/2ͷҲ */
+static void http_dl_header_field(http_dl_info_t *info, const char *name, int nlen,
+                                 const char *value, int vlen)
+{
+    http_dl_range_t range;
+    const char *dup, *boundary;
+    int blen;
+
+    if (HTTP_DL_FIELD_IS(name, nlen, "content-length")) {
+        if (http_dl_parse_ulong(value, vlen, &info->content_len) != HTTP_DL_PARSE_OK) {
+            http_dl_log_error("Invalid header line: %.*s: %.*s", nlen, name,
+                                MINVAL(vlen, HTTP_DL_BUF_LEN), value);
+            return;
+        }
+        info->flags |= HTTP_DL_F_HAS_LENGTH;
+        if (info->restart_len == 0 && info->total_len == 0) {
+            /* Ƕϵʱtotal_lencontent_len */
+            info->total_len = info->content_len;
+        }
+    } else if (HTTP_DL_FIELD_IS(name, nlen, "content-encoding")) {
+        http_dl_log_debug("Content-Encoding: %.*s", MINVAL(vlen, HTTP_DL_BUF_LEN), value);
+        info->encoding = http_dl_encoding_parse(value, vlen);
+    } else if ((info->flags & HTTP_DL_F_REPAIR) && HTTP_DL_FIELD_IS(name, nlen, "content-range")) {
+        /* Ӧ뱾ļȲʱͷ󱨴 */
+        if (http_dl_repair_range(info, value, vlen) == HTTP_DL_OK) {
+            info->total_len = info->repair->part.entity_length;
+        }
+    } else if ((info->flags & HTTP_DL_F_REPAIR) && HTTP_DL_FIELD_IS(name, nlen, "content-type")
+               && vlen >= 20 && strncasecmp(value, "multipart/byteranges", 20) == 0) {
+        if (http_dl_parse_boundary(value, vlen, &boundary, &blen) == HTTP_DL_PARSE_OK) {
+            info->repair->delim_len = sprintf(info->repair->delim, "--%.*s", blen, boundary);
+        }
+        http_dl_log_debug("Content-Type: %.*s", MINVAL(vlen, HTTP_DL_BUF_LEN), value);
+    } else if (HTTP_DL_FIELD_IS(name, nlen, "content-range")) {
+        if (http_dl_parse_content_range(value, vlen, &range) != HTTP_DL_PARSE_OK) {
+            /* 206ʱûпõContent-Rangeͷ󱨴 */
+            http_dl_log_error("Parse range failed: %s.", info->local);
+            return;
+        }
+        info->flags |= HTTP_DL_F_HAS_RANGE;
+        info->range_first = range.first_byte_pos;
+        info->range_len = range.entity_length;
+        if (range.first_byte_pos < 0) {
+            /* 416䣬ֻļܳȣhttp_dl_resume_checkд */
+            return;
+        }
+        /* rangeɹ鷶Χxxx_len */
+        if (info->restart_len != range.first_byte_pos) {
+            /* 㲻ͷ󱨴 */
+            http_dl_log_error("File %s restart<%ld>, but range<%ld-%ld/%ld>",
+                                info->local,
+                                info->restart_len,
+                                range.first_byte_pos,
+                                range.last_byte_pos,
+                                range.entity_length);
+        } else if (range.entity_length >= 0) {
+            /* Ϊ"*"ʱ֪ļ󣬱ԭtotal_len */
+            info->total_len = range.entity_length;
+        }
+        http_dl_log_debug("File %s restart<%ld>, but range<%ld-%ld/%ld>",
+                            info->local,
+                            info->restart_len,
+                            range.first_byte_pos,
+                            range.last_byte_pos,
+                            range.entity_length);
+    } else if (HTTP_DL_FIELD_IS(name, nlen, "location")) {
+        if (vlen == 0 || (dup = http_dl_str_get(value, vlen)) == NULL) {
+            http_dl_log_error("Invalid header line: %.*s: %.*s", nlen, name,
+                                MINVAL(vlen, HTTP_DL_BUF_LEN), value);
+            return;
+        }
+        http_dl_str_put(info->location);
+        info->location = dup;
+        http_dl_log_debug("Location: %s", info->location);
+    } else if (HTTP_DL_FIELD_IS(name, nlen, "connection")) {
+        if (vlen >= 5 && strncasecmp(value, "close", 5) == 0) {
+            info->flags &= ~HTTP_DL_F_KEEPALIVE;
+        } else if (vlen >= 10 && strncasecmp(value, "keep-alive", 10) == 0) {
+            info->flags |= HTTP_DL_F_KEEPALIVE;
+        }
+    } else if (HTTP_DL_FIELD_IS(name, nlen, "content-type")
+               || HTTP_DL_FIELD_IS(name, nlen, "accept-ranges")
+               || HTTP_DL_FIELD_IS(name, nlen, "last-modified")) {
+        http_dl_log_debug("%.*s: %.*s", nlen, name, MINVAL(vlen, HTTP_DL_BUF_LEN), value);
+    } else {
+        http_dl_log_debug("Unsupported header: %.*s: %.*s", nlen, name,
+                            MINVAL(vlen, HTTP_DL_BUF_LEN), value);
+    }
+}
+
+static int http_dl_header_field_cb(const char *name, int nlen, const char *value, int vlen,
+                                   void *arg)
+{
+    http_dl_header_field(arg, name, nlen, value, vlen);
+
+    return 0;
+}
+
+/*
+ * ʱӦ206restart_lenʼ200˵֧Rangeļأ
+ * вֶ416Content-Rangeܳȵrestart_lenļѾ
+ * Ǵ󣬲ܰӦİвֺ棬ҲܵѾɡ
+ */
+static int http_dl_resume_check(http_dl_info_t *info)
+{
+    if (info->restart_len == 0) {
+        return HTTP_DL_OK;
+    }
+
+    if (info->status_code == HTTP_STATUS_PARTIAL_CONTENTS) {
+        if (!(info->flags & HTTP_DL_F_HAS_RANGE) || info->range_first != info->restart_len) {
+            snprintf(info->err_msg, sizeof(info->err_msg), "Content-Range does not start at %ld",
+                        info->restart_len);
+            return -HTTP_DL_ERR_INVALID;
+        }
+        return HTTP_DL_OK;
+    }
+
+    if (info->status_code == HTTP_STATUS_RANGE_NOT_SATISFIABLE && (info->flags & HTTP_DL_F_HAS_RANGE)
+        && info->range_first < 0 && info->range_len == info->restart_len) {
+        /* ļѾ(ϴΰųٴ)416İ嶪ɴ */
+        http_dl_log_info("%s is already complete, %ld bytes.", info->local, info->restart_len);
+        info->flags |= HTTP_DL_F_DISCARD;
+        info->total_len = info->restart_len;
+        return HTTP_DL_OK;
+    }
+
+    if (info->status_code == HTTP_STATUS_OK) {
+        http_dl_log_info("%s ignored the range, download %s again.", info->host, info->local);
+        if (ftruncate(info->filefd, 0) != 0) {
+            http_dl_log_error("Truncate %s to 0 failed.", info->local);
+            return -HTTP_DL_ERR_WRITE;
+        }
+        info->restart_len = 0;
+        info->recv_len = 0;
+        info->total_len = (info->flags & HTTP_DL_F_HAS_LENGTH) ? info->content_len : 0;
+        if (info->digest != NULL) {
+            http_dl_digest_init(info->digest, info->digest->type);
+        }
+        return HTTP_DL_OK;
+    }
+
+    snprintf(info->err_msg, sizeof(info->err_msg), "Unexpected status %d when resuming at %ld",
+                info->status_code, info->restart_len);
+    return -HTTP_DL_ERR_INVALID;
+}
+
+/* ͷȫ꣬׼հ壻޲Ӧдļʱش */
+static int http_dl_header_done(http_dl_info_t *info)
+{
+    int ret;
+
+    if (H_REDIRECTED(info->status_code) && info->location != NULL) {
+        /* ضİ岻дļLocation */
+        http_dl_log_debug("%s redirected to %s", info->url, info->location);
+        info->flags |= HTTP_DL_F_REDIRECTING;
+    } else if (info->flags & HTTP_DL_F_REPAIR) {
+        ret = http_dl_repair_begin(info);
+        if (ret != HTTP_DL_OK) {
+            return ret;
+        }
+    } else if (info->flags & HTTP_DL_F_DELTA) {
+        ret = http_dl_delta_begin(info);
+        if (ret != HTTP_DL_OK) {
+            return ret;
+        }
+    } else {
+        ret = http_dl_resume_check(info);
+        if (ret != HTTP_DL_OK) {
+            return ret;
+        }
+        if (http_dl_decoder_init(info) != HTTP_DL_OK) {
+            /* ޷ѹʱԭ棬ٲ */
+            http_dl_log_error("Init decoder failed, save %s as it is.", info->local);
+            info->encoding = HTTP_DL_ENCODING_IDENTITY;
+        }
+        ret = http_dl_digest_prefix(info);
+        if (ret != HTTP_DL_OK) {
+            /* вֶժҪֵʱܵУͨ */
+            if (info->digest->expect_len > 0) {
+                snprintf(info->err_msg, sizeof(info->err_msg), "Read local part for digest failed");
+                return ret;
+            }
+            http_dl_free(info->digest);
+            info->digest = NULL;
+        }
+    }
+    http_dl_reset_time(info);
+    http_dl_stage_set(info, HTTP_DL_STAGE_RECV_CONTENT);
+    if (!(info->flags & (HTTP_DL_F_REDIRECTING | HTTP_DL_F_REPAIR | HTTP_DL_F_DELTA | HTTP_DL_F_DISCARD))) {
+        http_dl_sink_map(info);
+    }
+
+    return HTTP_DL_OK;
+}
+
+static int http_dl_parse_header(http_dl_info_t *info)
+{
+    int ret, used;
+
+    if (info == NULL) {
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    if (info->stage != HTTP_DL_STAGE_PARSE_HEADER) {
+        http_dl_log_debug("Wrong stage %d.", info->stage);
+        return -HTTP_DL_ERR_INTERNAL;
+    }
+
+    /* ֻУbufе´ */
+    ret = http_dl_parse_fields(info->buf_data, info->buf_tail - info->buf_data,
+                                HTTP_DL_READBUF_LEN, &used, http_dl_header_field_cb, info);
+    info->buf_data += used;
+    if (ret == HTTP_DL_PARSE_AGAIN) {
+        /* headerûյһУ... */
+        return HTTP_DL_OK;
+    }
+    if (ret != HTTP_DL_PARSE_OK) {
+        http_dl_log_error("%s: invalid header line: %.*s", info->url,
+                            MINVAL((int)(info->buf_tail - info->buf_data), HTTP_DL_BUF_LEN),
+                            info->buf_data);
+        snprintf(info->err_msg, sizeof(info->err_msg), "%s",
+                    (ret == HTTP_DL_PARSE_ETOOLONG) ? "Response header line too long"
+                                                    : "Invalid response header");
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    /* header޸stageΪRECV_CONTENTERR_AGAIN½׶δ */
+    ret = http_dl_header_done(info);
+    return (ret == HTTP_DL_OK) ? -HTTP_DL_ERR_AGAIN : ret;
+}
+
+/*
+ * info->bufһλƬ[buf_data, buf_tail)ǻûݣǶbuf_tail֮
+ * ݴָֻŻؿͷ(ȽУ'\0'β)
+ * ֻʣ²״̬лͷСβռ䲻һʱŰʣµĲƵͷ
+ * ÿζдߵƶһ
+ */
+static void http_dl_adjust_info_buf(http_dl_info_t *info)
+{
+    int data_len, free_space;
+
+    if (info == NULL) {
+        http_dl_log_debug("ERROR argument is NULL.");
+        return;
+    }
+
+    if (info->buf_data == info->buf_tail) {
+        /* info->bufѾ */
+        info->buf_data = info->buf;
+        info->buf_tail = info->buf;
+        return;
+    }
+
+    data_len = info->buf_tail - info->buf_data;
+    free_space = info->buf + HTTP_DL_READBUF_LEN - info->buf_tail;
+    if (info->buf_data == info->buf || free_space >= (HTTP_DL_READBUF_LEN >> 1)) {
+        http_dl_log_debug("no adjustment, free[%d], data[%d], buf<%p>, tail<%p>",
+                            free_space, data_len, info->buf, info->buf_tail);
+        return;
+    }
+
+    http_dl_log_debug("free space [%d], and data length [%d], adjust buffer...",
+                        free_space, data_len);
+    memmove(info->buf, info->buf_data, data_len);
+    info->buf_data = info->buf;
+    info->buf_tail = info->buf_data + data_len;
+}
+
+/*
+ * յİдضӦĶѹĽѹд룬ֱдļ
+ * ĵֽСlenʾдļѹش룬ʱҲȫġ
+ */
+static int http_dl_body_write(http_dl_info_t *info, char *data, int len)
+{
+    long begin = http_dl_now_ns();
+    int ret;
+
+    if (info->flags & (HTTP_DL_F_REDIRECTING | HTTP_DL_F_DISCARD)) {
+        /* ض416ӦİֱӶֻжϰǷ */
+        info->wire_len += len;
+        ret = len;
+    } else if (info->flags & HTTP_DL_F_REPAIR) {
+        ret = http_dl_repair_write(info, data, len);
+        info->wire_len += (ret < 0) ? len : ret;
+    } else if (info->flags & HTTP_DL_F_DELTA) {
+        /* 嵥Ž */
+        ret = http_dl_delta_collect(info, data, len);
+        info->wire_len += (ret < 0) ? len : ret;
+    } else if (info->decoder != NULL) {
+        info->wire_len += len;
+        ret = http_dl_decoder_write(info, data, len);
+        ret = (ret == HTTP_DL_OK) ? len : ret;
+    } else {
+        ret = http_dl_sink_write(info, data, len);
+        info->wire_len += ret;
+    }
+    http_dl_prof.copy_ns += http_dl_now_ns() - begin;
+
+    return ret;
+}
+
+static int http_dl_flush_buf_data(http_dl_info_t *info)
+{
+    int data_len, ret;
+
+    if (info == NULL) {
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    if (info->stage != HTTP_DL_STAGE_RECV_CONTENT) {
+        http_dl_log_debug("flush buf data to file only permitted in HTTP_DL_STAGE_RECV_CONTENT.");
+        info->buf_data = info->buf;
+        info->buf_tail = info->buf;
+        return HTTP_DL_OK;
+    }
+
+    data_len = info->buf_tail - info->buf_data;
+    if (data_len == 0) {
+        /* Ϊ */
+        info->buf_data = info->buf;
+        info->buf_tail = info->buf;
+        return HTTP_DL_OK;
+    } else if (data_len < 0) {
+        http_dl_log_error("FATAL error, buf_tail<%p> is before buf_data<%p>, diff %d.",
+                            info->buf_tail, info->buf_data, data_len);
+        info->buf_tail = info->buf_data;
+        return -HTTP_DL_ERR_INTERNAL;
+    }
+
+    ret = http_dl_body_write(info, info->buf_data, data_len);
+    if (ret >= 0 && ret < data_len) {
+        /* δд */
+        info->buf_data += ret;
+        return -HTTP_DL_ERR_WRITE;
+    }
+
+    /* ݶˣѹʱҲȫ */
+    info->buf_data = info->buf;
+    info->buf_tail = info->buf;
+
+    return (ret < 0) ? ret : HTTP_DL_OK;
+}
+
+static int http_dl_sync_file_data(http_dl_info_t *info)
+{
+    int ret;
+
+    if (info == NULL) {
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    if (info->map != NULL) {
+        /* ӳеڽʱһˢ */
+        ret = msync(info->map, info->restart_len + info->recv_len, MS_SYNC);
+    } else if (info->filefd < 0) {
+        /* 嵥ڴУûļ */
+        ret = 0;
+    } else {
+        ret = fsync(info->filefd);
+    }
+
+    if (ret < 0) {
+        return -HTTP_DL_ERR_FSYNC;
+    } else {
+        return HTTP_DL_OK;
+    }
+}
+
+/* Content-LengthӦǷѾȫ */
+static bool http_dl_body_complete(http_dl_info_t *info)
+{
+    return (info->stage == HTTP_DL_STAGE_RECV_CONTENT
+            && (info->flags & HTTP_DL_F_HAS_LENGTH)
+            && info->wire_len >= info->content_len);
+}
+
+static int http_dl_recv_content(http_dl_info_t *info)
+{
+    int ret;
+
+    if (info == NULL) {
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    if (info->stage != HTTP_DL_STAGE_RECV_CONTENT) {
+        http_dl_log_debug("Wrong stage %d.", info->stage);
+        return -HTTP_DL_ERR_INTERNAL;
+    }
+
+    if (info->buf_data == info->buf_tail) {
+        http_dl_log_debug("No data in buffer.");
+        return HTTP_DL_OK;
+    }
+
+    ret = http_dl_flush_buf_data(info);
+    if (ret != HTTP_DL_OK) {
+        /* XXX TODO: ʧܺ󣬹رӰ */
+        http_dl_log_debug("Flush buffer data to file failed, %s.", info->local);
+        http_dl_sync_file_data(info);   /* XXX TODO: Ҫô??? */
+    }
+
+    return HTTP_DL_OK;
+}
+
+/*
+ * HTTPӦ
+ */
+static int http_dl_recv_resp(http_dl_info_t *info)
+{
+    int ret;
+    int nread, free_space;
+    long allow, begin;
+    unsigned long copy_ns;
+    char *direct;
+
+    if (info == NULL) {
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    if (info->stage <= HTTP_DL_STAGE_SEND_REQUEST) {
+        /* ձݵĳʼ״ֽ̬ڳʱɿгʱ */
+        http_dl_stage_set(info, HTTP_DL_STAGE_PARSE_STATUS_LINE);
+        info->active_ms = http_dl_now_ms();
+        http_dl_task_timer_update(info);
+    }
+
+    direct = http_dl_sink_direct(info, &free_space);
+    if (direct == NULL) {
+        free_space = info->buf + HTTP_DL_READBUF_LEN - info->buf_tail;
+        if (free_space < (HTTP_DL_READBUF_LEN >> 1)) {
+            http_dl_log_info("WARNING: info buffer free space %d too small, (total %d)",
+                                free_space, HTTP_DL_READBUF_LEN);
+        }
+    }
+
+    allow = http_dl_rate_allow(info);
+    if (allow <= 0) {
+        /* ͬһѱ(ȫֻͬhost)ٶ */
+        return HTTP_DL_OK;
+    }
+
+    nread = http_dl_sock_read(info, (direct != NULL) ? direct : info->buf_tail,
+                                MINVAL(free_space, allow));
+    if (nread == -HTTP_DL_ERR_AGAIN) {
+        /* TLS¼û */
+        return HTTP_DL_OK;
+    }
+    if (nread > 0) {
+        http_dl_rate_consume(info, nread);
+        info->active_ms = http_dl_now_ms();
+        http_dl_sock_tune(info, info->active_ms);
+    }
+    if (nread == 0) {
+        /* ԶѹرգӲٸ */
+        info->flags &= ~HTTP_DL_F_KEEPALIVE;
+        if (info->stage != HTTP_DL_STAGE_RECV_CONTENT
+            || ((info->flags & HTTP_DL_F_HAS_LENGTH) && info->wire_len < info->content_len)) {
+            /* ûͶϿʧܴʱдλ */
+            http_dl_log_error("%s: connection closed prematurely.", info->url);
+            snprintf(info->err_msg, sizeof(info->err_msg), "Connection closed prematurely");
+            return -HTTP_DL_ERR_READ;
+        }
+        /* XXX: ؽҪinfo bufferȫflushļУͬsyncļ */
+        if (http_dl_flush_buf_data(info) != HTTP_DL_OK) {
+            http_dl_log_debug("Flush buffer data to %s failed.", info->local);
+        }
+        if (http_dl_sync_file_data(info) != HTTP_DL_OK) {
+            http_dl_log_debug("Sync file %s failed.", info->local);
+        }
+        return -HTTP_DL_ERR_EOF;
+    } else if (nread < 0) {
+        http_dl_log_error("read failed, %d", nread);
+        snprintf(info->err_msg, sizeof(info->err_msg), "Read from %s connection failed",
+                    info->transport->name);
+        return -HTTP_DL_ERR_READ;
+    }
+
+    if (direct != NULL) {
+        /* ӳеֻͼժҪڹûедд */
+        ret = http_dl_body_write(info, direct, nread);
+        if (ret < nread) {
+            return (ret < 0) ? ret : -HTTP_DL_ERR_WRITE;
+        }
+        if (http_dl_body_complete(info)) {
+            if (http_dl_sync_file_data(info) != HTTP_DL_OK) {
+                http_dl_log_debug("Sync file %s failed.", info->local);
+            }
+            return -HTTP_DL_ERR_EOF;
+        }
+        return HTTP_DL_OK;
+    }
+
+    info->buf_tail += nread;
+
+    /* ȥдʱ䣬 */
+    begin = http_dl_now_ns();
+    copy_ns = http_dl_prof.copy_ns;
+again:
+    switch (info->stage) {
+    case HTTP_DL_STAGE_PARSE_STATUS_LINE:
+        ret = http_dl_parse_status_line(info);
+        break;
+    case HTTP_DL_STAGE_PARSE_HEADER:
+        ret = http_dl_parse_header(info);
+        break;
+    case HTTP_DL_STAGE_RECV_CONTENT:
+        ret = http_dl_recv_content(info);
+        break;
+    default:
+        http_dl_log_error("Incorrect stage %d in here.", info->stage);
+        return -HTTP_DL_ERR_INTERNAL;
+        break;
+    }
+
+    if (ret == -HTTP_DL_ERR_AGAIN) {
+        /* bufferл¸stageδ */
+        http_dl_log_debug("Continue next stage process.");
+        goto again;
+    }
+    http_dl_prof.parse_ns += http_dl_now_ns() - begin - (http_dl_prof.copy_ns - copy_ns);
+
+    if (ret == HTTP_DL_OK) {
+        /* ֽ׶λδ꣬ȴ´εݣ */
+        /* XXX: bufferд˴δ */
+        (void)http_dl_adjust_info_buf(info);
+        if (http_dl_body_complete(info)) {
+            /* ꣬keep-aliveӲرգֱӽ */
+            if (!(info->flags & HTTP_DL_F_REDIRECTING)
+                && http_dl_sync_file_data(info) != HTTP_DL_OK) {
+                http_dl_log_debug("Sync file %s failed.", info->local);
+            }
+            return -HTTP_DL_ERR_EOF;
+        }
+    } else {
+        http_dl_log_debug("Process response failed %d.", ret);
+        /* XXX TODO: Ҫflush bufferеô? */
+    }
+
+    return ret;
+}
+
+/* УͨļժҪǼǣ֮ͬһժҪֱӣ */
+typedef struct http_dl_blob_s {
+    struct list_head list;
+    http_dl_digest_type_t type;
+    unsigned char digest[HTTP_DL_DIGEST_MAX_LEN];
+    const char *local;              /* ַеļ */
+    ino_t ino;                      /* ǰȷļûб滻д */
+    off_t size;
+    time_t mtime;
+} http_dl_blob_t;
+
+static bool http_dl_has_expect(http_dl_info_t *info)
+{
+    return info->digest != NULL && info->digest->expect_len > 0;
+}
+
+static unsigned int http_dl_digest_hash(http_dl_info_t *info)
+{
+    return http_dl_hash(info->digest->expect, info->digest->expect_len) % HTTP_DL_DEDUP_HASH_LEN;
+}
+
+static bool http_dl_same_expect(http_dl_info_t *a, http_dl_info_t *b)
+{
+    return http_dl_has_expect(a) && http_dl_has_expect(b)
+           && a->digest->type == b->digest->type
+           && memcmp(a->digest->expect, b->digest->expect, a->digest->expect_len) == 0;
+}
+
+/* дͬһļĽ */
+static http_dl_info_t *http_dl_dedup_find_local(http_dl_info_t *info)
+{
+    http_dl_info_t *pos;
+    struct list_head *head;
+
+    head = &http_dl_dedup_local[http_dl_str_hash(info->local) % HTTP_DL_DEDUP_HASH_LEN];
+    list_for_each_entry(pos, head, local_hash, http_dl_info_t) {
+        if (pos->local == info->local) {
+            return pos;
+        }
+    }
+
+    return NULL;
+}
+
+/* ժҪͬĽ */
+static http_dl_info_t *http_dl_dedup_find_digest(http_dl_info_t *info)
+{
+    http_dl_info_t *pos;
+    struct list_head *head;
+
+    head = &http_dl_dedup_digest[http_dl_digest_hash(info)];
+    list_for_each_entry(pos, head, digest_hash, http_dl_info_t) {
+        if (http_dl_same_expect(pos, info)) {
+            return pos;
+        }
+    }
+
+    return NULL;
+}
+
+static http_dl_blob_t *http_dl_blob_find(http_dl_info_t *info)
+{
+    http_dl_blob_t *blob;
+    struct list_head *head;
+
+    head = &http_dl_blobs[http_dl_digest_hash(info)];
+    list_for_each_entry(blob, head, list, http_dl_blob_t) {
+        if (blob->type == info->digest->type
+            && memcmp(blob->digest, info->digest->expect, info->digest->expect_len) == 0) {
+            return blob;
+        }
+    }
+
+    return NULL;
+}
+
+/* ǼǸУͨļͬһժҪֻµһ */
+static void http_dl_blob_add(http_dl_info_t *info)
+{
+    http_dl_blob_t *blob;
+    struct stat st;
+
+    if (fstat(info->filefd, &st) != 0) {
+        return;
+    }
+
+    blob = http_dl_blob_find(info);
+    if (blob == NULL) {
+        blob = http_dl_xrealloc(NULL, sizeof(http_dl_blob_t));
+        if (blob == NULL) {
+            return;
+        }
+        bzero(blob, sizeof(http_dl_blob_t));
+        blob->type = info->digest->type;
+        memcpy(blob->digest, info->digest->expect, info->digest->expect_len);
+        list_add(&blob->list, &http_dl_blobs[http_dl_digest_hash(info)]);
+    }
+    http_dl_str_put(blob->local);
+    blob->local = http_dl_str_ref(info->local);
+    blob->ino = st.st_ino;
+    blob->size = st.st_size;
+    blob->mtime = st.st_mtime;
+}
+
+static void http_dl_blob_destroy()
+{
+    http_dl_blob_t *blob, *next_blob;
+    int i;
+
+    for (i = 0; i < HTTP_DL_DEDUP_HASH_LEN; i++) {
+        list_for_each_entry_safe(blob, next_blob, &http_dl_blobs[i], list, http_dl_blob_t) {
+            list_del_init(&blob->list);
+            http_dl_str_put(blob->local);
+            http_dl_free(blob);
+        }
+    }
+}
+
+/*
+ * еͬļinfo->localreflink(FICLONEдʱƣļӰ)
+ * ļϵͳ֧ʱΪӲӡ
+ */
+static int http_dl_blob_link(http_dl_blob_t *blob, http_dl_info_t *info)
+{
+    struct stat st;
+    int src, dst, ret = -HTTP_DL_ERR_WRITE;
+
+    if (stat(blob->local, &st) != 0 || st.st_ino != blob->ino
+        || st.st_size != blob->size || st.st_mtime != blob->mtime) {
+        http_dl_log_debug("%s changed since verified, not linking.", blob->local);
+        return -HTTP_DL_ERR_NOTFOUND;
+    }
+    if (blob->local == info->local) {
+        return HTTP_DL_OK;
+    }
+
+#ifdef FICLONE
+    src = open(blob->local, O_RDONLY);
+    dst = open(info->local, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (src >= 0 && dst >= 0 && ioctl(dst, FICLONE, src) == 0) {
+        http_dl_log_info("Reflink %s to %s.", blob->local, info->local);
+        ret = HTTP_DL_OK;
+    }
+    if (src >= 0) {
+        close(src);
+    }
+    if (dst >= 0) {
+        close(dst);
+    }
+#else
+    (void)src;
+    (void)dst;
+#endif
+
+    if (ret != HTTP_DL_OK) {
+        (void)unlink(info->local);
+        if (link(blob->local, info->local) == 0) {
+            http_dl_log_info("Hardlink %s to %s.", blob->local, info->local);
+            ret = HTTP_DL_OK;
+        }
+    }
+    if (ret == HTTP_DL_OK) {
+        info->status_code = HTTP_STATUS_OK;
+        info->recv_len = st.st_size;
+        info->total_len = st.st_size;
+    }
+
+    return ret;
+}
+
+/*
+ * ͬһURLͬһļժҪͬظ񣬼Լֵϲͬһ㷨ժҪֱӱȽϣ
+ * ɹʱ¶һļ㡣HTTP_DL_OKʾ-HTTP_DL_ERR_DIGESTʾ
+ * ޷ʱ-HTTP_DL_ERR_AGAINԼ
+ */
+static int http_dl_dedup_verify(http_dl_info_t *info, http_dl_info_t *dup)
+{
+    char hex[HTTP_DL_DIGEST_MAX_LEN * 2 + 1];
+    unsigned char out[HTTP_DL_DIGEST_MAX_LEN];
+    struct stat st;
+    int i, ret;
+
+    if (!http_dl_has_expect(dup)) {
+        return -HTTP_DL_ERR_AGAIN;
+    }
+
+    if (info->digest != NULL && info->digest->hex[0] != '\0' && info->digest->type == dup->digest->type) {
+        for (i = 0; i < dup->digest->expect_len; i++) {
+            sprintf(hex + i * 2, "%02x", dup->digest->expect[i]);
+        }
+        ret = (strcmp(hex, info->digest->hex) == 0) ? HTTP_DL_OK : -HTTP_DL_ERR_DIGEST;
+    } else if (info->result == HTTP_DL_OK && info->filefd >= 0 && dup->local == info->local
+               && fstat(info->filefd, &st) == 0) {
+        /* ñϲfdļûйر */
+        dup->filefd = info->filefd;
+        ret = http_dl_digest_file(dup, st.st_size);
+        dup->filefd = -1;
+        if (ret != HTTP_DL_OK) {
+            return -HTTP_DL_ERR_AGAIN;
+        }
+        (void)http_dl_digest_final(dup->digest, out);
+        ret = (memcmp(out, dup->digest->expect, dup->digest->expect_len) == 0)
+              ? HTTP_DL_OK : -HTTP_DL_ERR_DIGEST;
+    } else {
+        return -HTTP_DL_ERR_AGAIN;
+    }
+
+    if (ret != HTTP_DL_OK) {
+        http_dl_log_error("%s %s mismatch, coalesced with task %d.", dup->local,
+                            http_dl_digest_names[dup->digest->type], info->id);
+    }
+
+    return ret;
+}
+
+/*
+ * ʱȥȡ£УͨļǼΪblob
+ * ϲظ¼ѭժҪͬ(û)ʱɹͬһURLʧʱһʧܣ
+ * ժҪͬʱժҪм飬ݲ˵ʧܲ
+ * (ȡURL)ءֻ½ֱӽǡ
+ */
+static void http_dl_dedup_finish(http_dl_info_t *info)
+{
+    http_dl_info_t *dup;
+    int ret;
+
+    list_del_init(&info->local_hash);
+    list_del_init(&info->digest_hash);
+
+    if (info->result == HTTP_DL_OK && http_dl_has_expect(info) && info->digest->hex[0] != '\0'
+        && info->filefd >= 0) {
+        http_dl_blob_add(info);
+    }
+
+    if (http_dl_list_dup.count == 0) {
+        return;
+    }
+    list_for_each_entry(dup, &http_dl_list_dup.list, list, http_dl_info_t) {
+        if (dup->dup_of != info) {
+            continue;
+        }
+        dup->dup_of = NULL;
+        if (info->result != HTTP_DL_OK
+            && (info->result == -HTTP_DL_ERR_CANCELED || dup->url != info->url)) {
+            /* Լ */
+            dup->result = -HTTP_DL_ERR_AGAIN;
+            continue;
+        }
+        if ((!http_dl_has_expect(info) && !http_dl_has_expect(dup)) || http_dl_same_expect(info, dup)
+            || (info->result != HTTP_DL_OK && info->result != -HTTP_DL_ERR_DIGEST)) {
+            ret = info->result;
+        } else if (info->result == HTTP_DL_OK && !http_dl_has_expect(dup)) {
+            ret = HTTP_DL_OK;
+        } else {
+            /* ֻͬһURLURLϲĲŻժҪͬ */
+            ret = http_dl_dedup_verify(info, dup);
+        }
+        if (ret == -HTTP_DL_ERR_AGAIN) {
+            dup->result = ret;
+            continue;
+        }
+        dup->result = ret;
+        dup->status_code = info->status_code;
+        dup->restart_len = info->restart_len;
+        dup->recv_len = info->recv_len;
+        dup->content_len = info->content_len;
+        dup->total_len = info->total_len;
+        if (ret == info->result) {
+            memcpy(dup->err_msg, info->err_msg, sizeof(dup->err_msg));
+        } else if (ret == HTTP_DL_OK) {
+            dup->err_msg[0] = '\0';
+        } else {
+            snprintf(dup->err_msg, sizeof(dup->err_msg), "%s mismatch",
+                        http_dl_digest_names[dup->digest->type]);
+        }
+    }
+}
+
+static void http_dl_info_stat(http_dl_info_t *info, http_dl_stat_t *stat)
+{
+    bzero(stat, sizeof(http_dl_stat_t));
+    stat->id = info->id;
+    stat->stage = info->stage;
+    /* HTTP/2¼ѭǰresultݴĲս */
+    stat->result = (info->stage == HTTP_DL_STAGE_FINISH) ? info->result : HTTP_DL_OK;
+    stat->status_code = info->status_code;
+    stat->retries = info->retries;
+    stat->done_len = info->restart_len + info->recv_len;
+    stat->total_len = info->total_len;
+    stat->rtt_us = info->rtt_us;
+    stat->rcvbuf = info->rcvbuf;
+    stat->local = info->local;
+    memcpy(stat->err_msg, info->err_msg, sizeof(stat->err_msg));
+}
+
+#ifdef HTTP_DL_WITH_THREADS
+/* ¼Ķнڵ */
+typedef struct http_dl_event_node_s {
+    http_dl_mpsc_node_t node;
+    http_dl_event_t ev;
+    char strs[];                    /* ev.urlev.stat.localĸеַܿ߳ʹ */
+} http_dl_event_node_t;
+
+/*
+ * ̡߳ÿ߳һMPSCУ¼ѭỵָ̂߳
+ * ͬһ¼ͬһ߳д
+ * ߳ûʱsleepingźӺ󿴵sleepingsem_post
+ * ߳æʱӲҪϵͳá
+ */
+typedef struct http_dl_poster_s {
+    http_dl_mpsc_t queue;
+    pthread_t tid;
+    sem_t sem;
+    int sleeping;
+    int stopping;
+} http_dl_poster_t;
+
+static http_dl_poster_t http_dl_posters[HTTP_DL_POST_THREADS_MAX];
+static int http_dl_post_nthreads;           /* 0ʾû */
+static http_dl_post_cb_t http_dl_post_cb;
+static void *http_dl_post_arg;
+
+static void http_dl_post_handle(http_dl_mpsc_node_t *node)
+{
+    http_dl_event_node_t *en = list_entry(node, http_dl_event_node_t, node);
+
+    http_dl_post_cb(&en->ev, http_dl_post_arg);
+    http_dl_free(en);
+}
+
+static void *http_dl_post_thread(void *arg)
+{
+    http_dl_poster_t *p = arg;
+    http_dl_mpsc_node_t *node;
+
+    for (;;) {
+        node = http_dl_mpsc_pop(&p->queue);
+        if (node != NULL) {
+            http_dl_post_handle(node);
+            continue;
+        }
+        /* stoppingһ֮ϣʱѾΪռ˳ */
+        if (__atomic_load_n(&p->stopping, __ATOMIC_SEQ_CST)) {
+            break;
+        }
+        __atomic_store_n(&p->sleeping, 1, __ATOMIC_SEQ_CST);
+        node = http_dl_mpsc_pop(&p->queue);
+        if (node != NULL) {
+            __atomic_store_n(&p->sleeping, 0, __ATOMIC_SEQ_CST);
+            http_dl_post_handle(node);
+            continue;
+        }
+        while (sem_wait(&p->sem) != 0 && errno == EINTR) {
+            (void)0;
+        }
+    }
+
+    return NULL;
+}
+
+static void http_dl_post_wake(http_dl_poster_t *p)
+{
+    if (__atomic_exchange_n(&p->sleeping, 0, __ATOMIC_SEQ_CST)) {
+        sem_post(&p->sem);
+    }
+}
+
+/* ѽƳ¼̣߳http_dl_finish_req */
+static void http_dl_post_push(http_dl_info_t *info)
+{
+    http_dl_event_node_t *en;
+    http_dl_poster_t *p;
+    int url_len, local_len;
+
+    if (http_dl_post_nthreads == 0) {
+        return;
+    }
+
+    url_len = strlen(info->url) + 1;
+    local_len = strlen(info->local) + 1;
+    en = http_dl_xrealloc(NULL, sizeof(http_dl_event_node_t) + url_len + local_len);
+    if (en == NULL) {
+        http_dl_log_error("Post-process %s failed: out of memory.", info->url);
+        return;
+    }
+    http_dl_info_stat(info, &en->ev.stat);
+    memcpy(en->strs, info->url, url_len);
+    memcpy(en->strs + url_len, info->local, local_len);
+    en->ev.url = en->strs;
+    en->ev.stat.local = en->strs + url_len;
+    en->ev.queued_ms = info->queued_ms;
+    en->ev.done_ms = http_dl_now_ms();
+    en->ev.elapsed_ms = info->elapsed_time;
+
+    p = &http_dl_posters[(unsigned int)info->id % http_dl_post_nthreads];
+    http_dl_mpsc_push(&p->queue, &en->node);
+    http_dl_post_wake(p);
+}
+
+int http_dl_post_start(int nthreads, http_dl_post_cb_t cb, void *arg)
+{
+    http_dl_poster_t *p;
+    int i;
+
+    if (http_dl_post_nthreads != 0 || cb == NULL
+        || nthreads <= 0 || nthreads > HTTP_DL_POST_THREADS_MAX) {
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    http_dl_post_cb = cb;
+    http_dl_post_arg = arg;
+    for (i = 0; i < nthreads; i++) {
+        p = &http_dl_posters[i];
+        http_dl_mpsc_init(&p->queue);
+        p->sleeping = 0;
+        p->stopping = 0;
+        if (sem_init(&p->sem, 0, 0) != 0) {
+            break;
+        }
+        if (pthread_create(&p->tid, NULL, http_dl_post_thread, p) != 0) {
+            sem_destroy(&p->sem);
+            break;
+        }
+        http_dl_post_nthreads++;
+    }
+    if (i < nthreads) {
+        http_dl_log_error("Start post-processing thread failed.");
+        http_dl_post_stop();
+        return -HTTP_DL_ERR_RESOURCE;
+    }
+
+    return HTTP_DL_OK;
+}
+
+void http_dl_post_stop()
+{
+    http_dl_poster_t *p;
+    int i;
+
+    for (i = 0; i < http_dl_post_nthreads; i++) {
+        p = &http_dl_posters[i];
+        __atomic_store_n(&p->stopping, 1, __ATOMIC_SEQ_CST);
+        sem_post(&p->sem);
+    }
+    for (i = 0; i < http_dl_post_nthreads; i++) {
+        p = &http_dl_posters[i];
+        pthread_join(p->tid, NULL);
+        sem_destroy(&p->sem);
+    }
+    http_dl_post_nthreads = 0;
+}
+#else
+static void http_dl_post_push(http_dl_info_t *info)
+{
+    (void)info;
+}
+
+int http_dl_post_start(int nthreads, http_dl_post_cb_t cb, void *arg)
+{
+    http_dl_log_error("Built without threads, post-processing is not supported.");
+    return -HTTP_DL_ERR_INVALID;
+}
+
+void http_dl_post_stop()
+{
+}
+#endif /* HTTP_DL_WITH_THREADS */
+
+static void http_dl_finish_req(http_dl_info_t *info)
+{
+    if (info == NULL) {
+        return;
+    }
+
+    http_dl_timer_del(&info->timer);
+    if (info->result == HTTP_DL_OK) {
+        http_dl_repair_finish(info);
+    }
+    if (info->result == HTTP_DL_OK) {
+        http_dl_digest_verify(info);
+    }
+    http_dl_delta_finish(info);
+    http_dl_sink_unmap(info);
+    http_dl_dedup_finish(info);
+
+    if (info->filefd >= 0) {
+        http_dl_log_debug("close opened file fd %d", info->filefd);
+        close(info->filefd);
+        info->filefd = -1;
+    }
+
+    if (info->sockfd >= 0) {
+        if ((info->flags & HTTP_DL_F_KEEPALIVE) && http_dl_body_complete(info)) {
+            http_dl_conn_pool_put(info);
+        } else {
+            http_dl_conn_close(info);
+        }
+    }
+
+    http_dl_decoder_free(info);
+    http_dl_calc_elapsed(info);
+
+    if (info->flags & HTTP_DL_F_RUNNING) {
+        info->flags &= ~HTTP_DL_F_RUNNING;
+        http_dl_running--;
+        http_dl_running_prio[info->prio]--;
+        http_dl_rate_prio_share();
+    }
+    if (info->deadline_ms != 0 && http_dl_now_ms() > info->deadline_ms) {
+        http_dl_log_info("%s missed its deadline by %ld ms.", info->url,
+                            http_dl_now_ms() - info->deadline_ms);
+    }
+    if (info->flags & HTTP_DL_F_CANCEL) {
+        info->flags &= ~HTTP_DL_F_CANCEL;
+        http_dl_cancel_count--;
+    }
+
+    http_dl_stage_set(info, HTTP_DL_STAGE_FINISH);
+    http_dl_stage_account(info, info->stage_us[HTTP_DL_STAGE_FINISH]);
+    if (info->begin_ms != 0) {
+        http_dl_hist_add(http_dl_total_hist, info->stage_us[HTTP_DL_STAGE_FINISH] - info->begin_ms * 1000);
+    }
+    http_dl_trace_task(info, info->stage_us[HTTP_DL_STAGE_FINISH]);
+    http_dl_add_info_to_list(info, &http_dl_list_finished);
+    http_dl_post_push(info);
+
+    /* ãصпhttp_dl_releaseͷŸ */
+    if (info->done_cb != NULL) {
+        info->done_cb(info, info->done_arg);
+    }
+}
+
+/* һӦ״̬ضǰ */
+static void http_dl_reset_resp(http_dl_info_t *info)
+{
+    http_dl_decoder_free(info);
+    http_dl_repair_reset(info);
+    http_dl_delta_reset(info);
+    http_dl_stage_set(info, HTTP_DL_STAGE_INIT);
+    info->flags &= ~(HTTP_DL_F_KEEPALIVE | HTTP_DL_F_HAS_LENGTH | HTTP_DL_F_REDIRECTING
+                     | HTTP_DL_F_HAS_RANGE | HTTP_DL_F_DISCARD);
+    info->recv_len = 0;
+    info->wire_len = 0;
+    info->content_len = 0;
+    info->total_len = 0;
+    info->status_code = HTTP_DL_OK;
+    info->encoding = HTTP_DL_ENCODING_IDENTITY;
+    http_dl_str_put(info->location);
+    info->location = NULL;
+    bzero(info->err_msg, sizeof(info->err_msg));
+    info->buf_data = info->buf;
+    info->buf_tail = info->buf;
+}
+
+/* ԭȥ·е"."".."Σpath'/'ͷ */
+static void http_dl_remove_dot_segments(char *path)
+{
+    char *src = path, *dst = path;
+
+    while (*src != '\0') {
+        if (strncmp(src, "/./", 3) == 0 || strcmp(src, "/.") == 0) {
+            src += 2;
+            if (*src == '\0') {
+                *dst++ = '/';
+            }
+        } else if (strncmp(src, "/../", 4) == 0 || strcmp(src, "/..") == 0) {
+            src += 3;
+            while (dst > path && *(dst - 1) != '/') {
+                dst--;
+            }
+            if (dst > path) {
+                dst--;
+            }
+            if (*src == '\0') {
+                *dst++ = '/';
+            }
+        } else {
+            do {
+                *dst++ = *src++;
+            } while (*src != '\0' && *src != '/');
+        }
+    }
+    *dst = '\0';
+}
+
+/* LocationõضURL֧־URL··سеַʧܷNULL */
+static const char *http_dl_resolve_location(http_dl_info_t *info)
+{
+    const char *loc = info->location, *url;
+    char *path;
+    int dir_len;
+
+    if (strncasecmp(loc, HTTP_URL_PREFIX, HTTP_URL_PRE_LEN) == 0
+        || strncasecmp(loc, HTTPS_URL_PREFIX, HTTPS_URL_PRE_LEN) == 0) {
+        return http_dl_str_ref(loc);
+    }
+    if (strstr(loc, "://") != NULL) {
+        http_dl_log_error("Unsupported redirect location: %s", loc);
+        return NULL;
+    }
+
+    /* ·ڵǰ·Ŀ¼֮ */
+    dir_len = (loc[0] == '/') ? 0 : strrchr(info->path, '/') + 1 - info->path;
+    path = http_dl_xrealloc(NULL, dir_len + strlen(loc) + 1);
+    if (path == NULL) {
+        return NULL;
+    }
+    sprintf(path, "%.*s%s", dir_len, info->path, loc);
+    http_dl_remove_dot_segments(path);
+    url = http_dl_str_printf("%s%s:%d%s",
+                    (info->flags & HTTP_DL_F_TLS) ? HTTPS_URL_PREFIX : HTTP_URL_PREFIX,
+                    info->host, info->port, path);
+    http_dl_free(path);
+
+    return url;
+}
+
+static int http_dl_task_send(http_dl_info_t *info);
+
+/*
+ * ضӦİ󣬸Location·
+ * ӿɸʱŻӳأĿͬԴhttp_dl_send_reqֱȡӡ
+ */
+static int http_dl_follow_redirect(http_dl_info_t *info)
+{
+    const char *url;
+    int ret;
+
+    if (info->redirects >= HTTP_DL_MAX_REDIRECTS) {
+        http_dl_log_error("%s: too many redirects (%d).", info->url, info->redirects);
+        snprintf(info->err_msg, sizeof(info->err_msg), "Too many redirects");
+        return -HTTP_DL_ERR_REDIRECT;
+    }
+
+    url = http_dl_resolve_location(info);
+    if (url == NULL) {
+        snprintf(info->err_msg, sizeof(info->err_msg), "Invalid redirect location");
+        return -HTTP_DL_ERR_REDIRECT;
+    }
+
+    if (info->status_code == HTTP_STATUS_MOVED_PERMANENTLY) {
+        http_dl_redirect_cache_add(info->url, url);
+    }
+
+    if ((info->flags & HTTP_DL_F_KEEPALIVE) && http_dl_body_complete(info)) {
+        http_dl_conn_pool_put(info);
+    } else {
+        http_dl_conn_close(info);
+    }
+
+    http_dl_log_info("Redirect %s to %s", info->url, url);
+    ret = http_dl_parse_url(url, info);
+    http_dl_str_put(url);
+    if (ret != HTTP_DL_OK) {
+        snprintf(info->err_msg, sizeof(info->err_msg), "Invalid redirect location");
+        return -HTTP_DL_ERR_REDIRECT;
+    }
+
+    info->redirects++;
+    http_dl_reset_resp(info);
+
+    return http_dl_task_send(info);
+}
+
+/* ʱļURLȥȡ嵥 */
+static int http_dl_delta_start(http_dl_info_t *info)
+{
+    http_dl_delta_t *dt = info->delta;
+
+    if (dt->target != NULL) {
+        /* ϲ·Ѿ嵥URL */
+        return HTTP_DL_OK;
+    }
+
+    dt->target = http_dl_str_ref(info->url);
+    if (http_dl_parse_url(dt->manifest, info) != HTTP_DL_OK) {
+        http_dl_log_error("Invalid manifest URL %s for %s.", dt->manifest, dt->target);
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    return HTTP_DL_OK;
+}
+
+/*
+ * һӦ꣺嵥ʱƴʱļ֮ÿһ䷢һ
+ * µѷʱHTTP_DL_OK䶼дʱ-HTTP_DL_ERR_EOFɵ߽
+ */
+static int http_dl_delta_next(http_dl_info_t *info)
+{
+    http_dl_delta_t *dt = info->delta;
+    http_dl_repair_t *rp;
+    int i, ret;
+
+    if (!(info->flags & HTTP_DL_F_REPAIR)) {
+        ret = http_dl_delta_build(info);
+        if (ret != HTTP_DL_OK) {
+            return ret;
+        }
+    } else {
+        for (i = 0; i < info->repair->nranges && info->repair->ranges[i].done; i++) {
+            (void)0;
+        }
+        if (i < info->repair->nranges) {
+            /* ǰˣʱֻûдõ */
+            snprintf(info->err_msg, sizeof(info->err_msg), "Ranges of %s not complete", info->local);
+            return -HTTP_DL_ERR_READ;
+        }
+        if (info->status_code == HTTP_STATUS_OK) {
+            /* ֧RangeļѾдһ */
+            dt->next = dt->nspans;
+        }
+    }
+
+    rp = info->repair;
+    for (rp->nranges = 0; rp->nranges < HTTP_DL_REPAIR_MAX && dt->next < dt->nspans; ) {
+        rp->ranges[rp->nranges++] = dt->spans[dt->next++];
+    }
+
+    /* ӰԭhostŻسУٻļURL */
+    if ((info->flags & HTTP_DL_F_KEEPALIVE) && http_dl_body_complete(info)) {
+        http_dl_conn_pool_put(info);
+    } else {
+        http_dl_conn_close(info);
+    }
+    if (strcmp(info->url, dt->target) != 0 && http_dl_parse_url(dt->target, info) != HTTP_DL_OK) {
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    if (rp->nranges == 0) {
+        return -HTTP_DL_ERR_EOF;
+    }
+    http_dl_log_debug("Delta %s: fetch %d ranges, %ld left.", info->local, rp->nranges,
+                        dt->nspans - dt->next);
+    http_dl_reset_resp(info);
+
+    return http_dl_task_send(info);
+}
+
+/*
+ * HTTP/2(RFC 7540)ͬһhost:portΪһӣʡȥÿСļĽ֡
+ * prior knowledgeֱӷǰ(h2c)httpsͨALPNЭ̡
+ * ֻʵҪĲ֣ûа壬Ҫͷأ÷͡
+ * ֡дӵwbufÿselectǰһдϲΪһwrite
+ */
+/* wbufĩβԤnֽ */
+static unsigned char *http_dl_h2_wreserve(http_dl_h2_conn_t *conn, int n)
+{
+    unsigned char *p;
+    int cap;
+
+    if (conn->wlen + n > conn->wcap) {
+        cap = (conn->wcap == 0) ? HTTP_DL_READBUF_LEN : conn->wcap;
+        while (cap < conn->wlen + n) {
+            cap <<= 1;
+        }
+        p = http_dl_xrealloc(conn->wbuf, cap);
+        if (p == NULL) {
+            return NULL;
+        }
+        conn->wbuf = p;
+        conn->wcap = cap;
+    }
+
+    p = conn->wbuf + conn->wlen;
+    conn->wlen += n;
+
+    return p;
+}
+
+/* wbufĩβһ֡ͷ֡ݵλãɵдlenֽ */
+static unsigned char *http_dl_h2_frame_add(http_dl_h2_conn_t *conn, int len, int type,
+                                           int flags, unsigned int sid)
+{
+    unsigned char *p;
+
+    p = http_dl_h2_wreserve(conn, 9 + len);
+    if (p == NULL) {
+        return NULL;
+    }
+
+    p[0] = (len >> 16) & 0xFF;
+    p[1] = (len >> 8) & 0xFF;
+    p[2] = len & 0xFF;
+    p[3] = type;
+    p[4] = flags;
+    p[5] = (sid >> 24) & 0x7F;
+    p[6] = (sid >> 16) & 0xFF;
+    p[7] = (sid >> 8) & 0xFF;
+    p[8] = sid & 0xFF;
+
+    return p + 9;
+}
+
+static void http_dl_h2_put32(unsigned char *p, unsigned int v)
+{
+    p[0] = (v >> 24) & 0xFF;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+}
+
+static unsigned int http_dl_h2_get32(const unsigned char *p)
+{
+    return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void http_dl_h2_window_update(http_dl_h2_conn_t *conn, unsigned int sid, long inc)
+{
+    unsigned char *p;
+
+    p = http_dl_h2_frame_add(conn, 4, HTTP_DL_H2_WINDOW_UPDATE, 0, sid);
+    if (p != NULL) {
+        http_dl_h2_put32(p, inc);
+    }
+}
+
+static void http_dl_h2_rst_stream(http_dl_h2_conn_t *conn, unsigned int sid, unsigned int code)
+{
+    unsigned char *p;
+
+    p = http_dl_h2_frame_add(conn, 4, HTTP_DL_H2_RST_STREAM, 0, sid);
+    if (p != NULL) {
+        http_dl_h2_put32(p, code);
+    }
+}
+
+/* ӽ(TLS)http_dl_send_reqãǰԺSETTINGS */
+static int http_dl_h2_conn_start(http_dl_info_t *ctrl)
+{
+    http_dl_h2_conn_t *conn = ctrl->h2;
+    unsigned char *p;
+#ifdef HTTP_DL_WITH_OPENSSL
+    const unsigned char *alpn = NULL;
+    unsigned int alpn_len = 0;
+
+    if (ctrl->tls != NULL) {
+        SSL_get0_alpn_selected(ctrl->tls, &alpn, &alpn_len);
+        if (alpn_len != 2 || memcmp(alpn, "h2", 2) != 0) {
+            /* ֮hostHTTP/1ȴе· */
+            http_dl_log_info("%s:%d does not support HTTP/2, fall back to HTTP/1.",
+                                ctrl->host, ctrl->port);
+            ctrl->hs->h2 = false;
+            snprintf(ctrl->err_msg, sizeof(ctrl->err_msg), "HTTP/2 not negotiated");
+            return -HTTP_DL_ERR_AGAIN;
+        }
+    }
+#endif
+
+    p = http_dl_h2_wreserve(conn, strlen(HTTP_DL_H2_PREFACE));
+    if (p == NULL) {
+        return -HTTP_DL_ERR_RESOURCE;
+    }
+    memcpy(p, HTTP_DL_H2_PREFACE, strlen(HTTP_DL_H2_PREFACE));
+
+    p = http_dl_h2_frame_add(conn, 12, HTTP_DL_H2_SETTINGS, 0, 0);
+    if (p == NULL) {
+        return -HTTP_DL_ERR_RESOURCE;
+    }
+    p[0] = 0;
+    p[1] = HTTP_DL_H2_SETTINGS_ENABLE_PUSH;
+    http_dl_h2_put32(p + 2, 0);
+    p[6] = 0;
+    p[7] = HTTP_DL_H2_SETTINGS_INITIAL_WINDOW;
+    http_dl_h2_put32(p + 8, HTTP_DL_H2_STREAM_WINDOW);
+
+    /* ӼڲͨSETTINGS޸ģʼΪ65535 */
+    http_dl_h2_window_update(conn, 0, HTTP_DL_H2_CONN_WINDOW - 65535);
+
+    conn->ready = true;
+    ctrl->stage_ms = http_dl_now_ms();
+    http_dl_task_timer_update(ctrl);
+    http_dl_log_info("HTTP/2 connection to %s:%d established, sockfd %d.",
+                        ctrl->host, ctrl->port, ctrl->sockfd);
+
+    return HTTP_DL_OK;
+}
+
+/* гʱʱPINGѾûյκʱfalseӦر */
+static bool http_dl_h2_conn_ping(http_dl_h2_conn_t *conn)
+{
+    unsigned char *p;
+
+    if (conn->ping_sent) {
+        return false;
+    }
+
+    p = http_dl_h2_frame_add(conn, 8, HTTP_DL_H2_PING, 0, 0);
+    if (p == NULL) {
+        return false;
+    }
+    bzero(p, 8);
+    conn->ping_sent = true;
+
+    return true;
+}
+
+static http_dl_info_t *http_dl_h2_stream_find(http_dl_h2_conn_t *conn, unsigned int sid)
+{
+    http_dl_info_t *info;
+
+    list_for_each_entry(info, &conn->streams, h2_list, http_dl_info_t) {
+        if (info->stream_id == sid) {
+            return info;
+        }
+    }
+
+    return NULL;
+}
+
+/* 뿪ڵ */
+static void http_dl_h2_stream_detach(http_dl_info_t *info)
+{
+    list_del_init(&info->h2_list);
+    if (info->h2 != NULL && info->stream_id != 0) {
+        info->h2->nstreams--;
+    }
+    info->h2 = NULL;
+    info->stream_id = 0;
+}
+
+/*
+ * ()http_dl_h2_done¼ѭresضԡ
+ * ﲻֱӴʱڱdownloading listresݴresultС
+ */
+static void http_dl_h2_stream_done(http_dl_info_t *info, int res)
+{
+    if (info->h2 != NULL) {
+        /* ûԼsocketӵĲ */
+        info->rtt_us = info->h2->ctrl->rtt_us;
+        info->rcvbuf = info->h2->ctrl->rcvbuf;
+    }
+    http_dl_h2_stream_detach(info);
+    http_dl_timer_del(&info->timer);
+    info->result = res;
+    list_add_tail(&info->h2_list, &http_dl_h2_done);
+}
+
+/* (ʱԻ˳)ڽеֹ֪ͨͣ */
+static void http_dl_h2_stream_close(http_dl_info_t *info)
+{
+    if (info->h2 != NULL && info->stream_id != 0) {
+        http_dl_h2_rst_stream(info->h2, info->stream_id, HTTP_DL_H2_CANCEL);
+    }
+    http_dl_h2_stream_detach(info);
+}
+
+/* յEND_STREAMǷ */
+static void http_dl_h2_stream_end(http_dl_info_t *info)
+{
+    if (info->stage != HTTP_DL_STAGE_RECV_CONTENT
+        || ((info->flags & HTTP_DL_F_HAS_LENGTH) && info->wire_len < info->content_len)) {
+        http_dl_log_error("%s: stream %u ended prematurely.", info->url, info->stream_id);
+        snprintf(info->err_msg, sizeof(info->err_msg), "Stream ended prematurely");
+        http_dl_h2_stream_done(info, -HTTP_DL_ERR_READ);
+        return;
+    }
+
+    if (!(info->flags & HTTP_DL_F_REDIRECTING) && http_dl_sync_file_data(info) != HTTP_DL_OK) {
+        http_dl_log_debug("Sync file %s failed.", info->local);
+    }
+    http_dl_h2_stream_done(info, -HTTP_DL_ERR_EOF);
+}
+
+/* HPACKͷϳ"Name: value\r\n"HTTP/1ͷ */
+static int http_dl_h2_header_cb(const char *name, int nlen, const char *value, int vlen, void *arg)
+{
+    http_dl_info_t *info = arg;
+
+    if (info == NULL || info->stage != HTTP_DL_STAGE_PARSE_HEADER) {
+        /* Ѿȡǰ֮trailerֻҪHPACK״̬ */
+        return 0;
+    }
+
+    if (nlen == 7 && memcmp(name, ":status", 7) == 0) {
+        if (vlen == 3 && isdigit(value[0]) && isdigit(value[1]) && isdigit(value[2])) {
+            info->status_code = 100 * (value[0] - '0') + 10 * (value[1] - '0') + (value[2] - '0');
+            http_dl_log_debug("Status code is %d", info->status_code);
+        }
+        return 0;
+    }
+
+    if (name[0] == ':') {
+        return 0;
+    }
+
+    http_dl_header_field(info, name, nlen, value, vlen);
+
+    return 0;
+}
+
+/* һͷ飬ǷڶҪ룬HPACK̬᲻ͬ */
+static int http_dl_h2_on_headers(http_dl_h2_conn_t *conn, unsigned int sid,
+                                 unsigned char *block, int len, int flags)
+{
+    http_dl_info_t *info;
+    int ret;
+
+    info = http_dl_h2_stream_find(conn, sid);
+    if (info != NULL && info->stage == HTTP_DL_STAGE_SEND_REQUEST) {
+        /* ӦĵһHEADERSֽڳʱɿгʱ */
+        http_dl_stage_set(info, HTTP_DL_STAGE_PARSE_HEADER);
+        info->status_code = 0;
+        info->active_ms = conn->ctrl->active_ms;
+        http_dl_task_timer_update(info);
+    }
+
+    if (http_dl_hpack_decode(conn->hpack, block, len, http_dl_h2_header_cb, info) != 0) {
+        snprintf(conn->ctrl->err_msg, sizeof(conn->ctrl->err_msg), "HPACK decode failed");
+        return -HTTP_DL_ERR_READ;
+    }
+
+    if (info == NULL) {
+        return HTTP_DL_OK;
+    }
+
+    if (info->stage == HTTP_DL_STAGE_PARSE_HEADER) {
+        if (info->status_code == 0) {
+            http_dl_h2_rst_stream(conn, sid, HTTP_DL_H2_PROTOCOL_ERROR);
+            snprintf(info->err_msg, sizeof(info->err_msg), "No :status in HTTP/2 response");
+            http_dl_h2_stream_done(info, -HTTP_DL_ERR_READ);
+            return HTTP_DL_OK;
+        }
+        if (info->status_code < 200) {
+            /* 1xxȴյӦ */
+            http_dl_stage_set(info, HTTP_DL_STAGE_SEND_REQUEST);
+        } else if ((ret = http_dl_header_done(info)) != HTTP_DL_OK) {
+            http_dl_h2_rst_stream(conn, sid, HTTP_DL_H2_CANCEL);
+            http_dl_h2_stream_done(info, ret);
+            return HTTP_DL_OK;
+        }
+    }
+
+    if (flags & HTTP_DL_H2_FLAG_END_STREAM) {
+        http_dl_h2_stream_end(info);
+    }
+
+    return HTTP_DL_OK;
+}
+
+static int http_dl_h2_on_data(http_dl_h2_conn_t *conn, unsigned int sid, int flags,
+                              unsigned char *p, int len, int frame_len)
+{
+    http_dl_info_t *info;
+    int ret;
+
+    /* ذ֡㣬䣬ѾȡҲҪӴ */
+    conn->recv_unacked += frame_len;
+    if (conn->recv_unacked >= HTTP_DL_H2_CONN_WINDOW / 2) {
+        http_dl_h2_window_update(conn, 0, conn->recv_unacked);
+        conn->recv_unacked = 0;
+    }
+
+    info = http_dl_h2_stream_find(conn, sid);
+    if (info == NULL) {
+        return HTTP_DL_OK;
+    }
+
+    if (info->stage != HTTP_DL_STAGE_RECV_CONTENT) {
+        http_dl_h2_rst_stream(conn, sid, HTTP_DL_H2_PROTOCOL_ERROR);
+        snprintf(info->err_msg, sizeof(info->err_msg), "DATA before HEADERS");
+        http_dl_h2_stream_done(info, -HTTP_DL_ERR_READ);
+        return HTTP_DL_OK;
+    }
+
+    info->active_ms = conn->ctrl->active_ms;
+    if (len > 0) {
+        ret = http_dl_body_write(info, (char *)p, len);
+        if (ret != len) {
+            http_dl_h2_rst_stream(conn, sid, HTTP_DL_H2_CANCEL);
+            http_dl_h2_stream_done(info, -HTTP_DL_ERR_WRITE);
+            return HTTP_DL_OK;
+        }
+    }
+
+    if (flags & HTTP_DL_H2_FLAG_END_STREAM) {
+        http_dl_h2_stream_end(info);
+        return HTTP_DL_OK;
+    }
+
+    info->h2_unacked += frame_len;
+    if (info->h2_unacked >= HTTP_DL_H2_STREAM_WINDOW / 2) {
+        http_dl_h2_window_update(conn, sid, info->h2_unacked);
+        info->h2_unacked = 0;
+    }
+
+    return HTTP_DL_OK;
+}
+
+/*
+ * GOAWAYID꣬Ӳٷµlast_id֮ûдԻһӣ
+ * ԴGOAWAYʱѭûֱӻӡ
+ */
+static void http_dl_h2_conn_goaway(http_dl_h2_conn_t *conn, unsigned int last_id)
+{
+    http_dl_info_t *info, *next_info;
+
+    conn->goaway = true;
+    list_for_each_entry_safe(info, next_info, &conn->streams, h2_list, http_dl_info_t) {
+        if (info->stream_id > last_id) {
+            snprintf(info->err_msg, sizeof(info->err_msg), "Stream refused by GOAWAY");
+            http_dl_h2_stream_done(info, -HTTP_DL_ERR_READ);
+        }
+    }
+    list_for_each_entry_safe(info, next_info, &conn->waiting, h2_list, http_dl_info_t) {
+        http_dl_h2_stream_done(info, -HTTP_DL_ERR_AGAIN);
+    }
+}
+
+/* ȥDATAHEADERS */
+static int http_dl_h2_unpad(int flags, unsigned char **p, int *len)
+{
+    int pad;
+
+    if (!(flags & HTTP_DL_H2_FLAG_PADDED)) {
+        return HTTP_DL_OK;
+    }
+
+    if (*len < 1 || (pad = (*p)[0]) >= *len) {
+        return -HTTP_DL_ERR_INVALID;
+    }
+    (*p)++;
+    *len -= 1 + pad;
+
+    return HTTP_DL_OK;
+}
+
+/* һ֡شʱӹر */
+static int http_dl_h2_frame_proc(http_dl_h2_conn_t *conn, int type, int flags,
+                                 unsigned int sid, unsigned char *p, int len)
+{
+    http_dl_info_t *info;
+    unsigned char *ack;
+    unsigned int id, val;
+    int i, frame_len = len;
+
+    if (conn->hstream != 0 && type != HTTP_DL_H2_CONTINUATION) {
+        /* ͷ */
+        goto protocol_error;
+    }
+    if (!conn->settings && type != HTTP_DL_H2_SETTINGS) {
+        /* ĵһ֡SETTINGS */
+        goto protocol_error;
+    }
+
+    switch (type) {
+    case HTTP_DL_H2_DATA:
+        if (sid == 0 || http_dl_h2_unpad(flags, &p, &len) != HTTP_DL_OK) {
+            goto protocol_error;
+        }
+        return http_dl_h2_on_data(conn, sid, flags, p, len, frame_len);
+    case HTTP_DL_H2_HEADERS:
+        if (sid == 0 || http_dl_h2_unpad(flags, &p, &len) != HTTP_DL_OK) {
+            goto protocol_error;
+        }
+        if (flags & HTTP_DL_H2_FLAG_PRIORITY) {
+            if (len < 5) {
+                goto protocol_error;
+            }
+            p += 5;
+            len -= 5;
+        }
+        if (flags & HTTP_DL_H2_FLAG_END_HEADERS) {
+            return http_dl_h2_on_headers(conn, sid, p, len, flags);
+        }
+        conn->hstream = sid;
+        conn->hflags = flags;
+        conn->hlen = 0;
+        /* fall throughCONTINUATIONƴ */
+    case HTTP_DL_H2_CONTINUATION:
+        if (sid != conn->hstream || conn->hlen + len > HTTP_DL_H2_HBUF_LEN) {
+            goto protocol_error;
+        }
+        if (conn->hbuf == NULL) {
+            conn->hbuf = http_dl_xrealloc(NULL, HTTP_DL_H2_HBUF_LEN);
+            if (conn->hbuf == NULL) {
+                return -HTTP_DL_ERR_RESOURCE;
+            }
+        }
+        memcpy(conn->hbuf + conn->hlen, p, len);
+        conn->hlen += len;
+        if (type == HTTP_DL_H2_CONTINUATION && (flags & HTTP_DL_H2_FLAG_END_HEADERS)) {
+            conn->hstream = 0;
+            return http_dl_h2_on_headers(conn, sid, conn->hbuf, conn->hlen, conn->hflags);
+        }
+        return HTTP_DL_OK;
+    case HTTP_DL_H2_RST_STREAM:
+        if (sid == 0 || len != 4) {
+            goto protocol_error;
+        }
+        info = http_dl_h2_stream_find(conn, sid);
+        if (info != NULL) {
+            http_dl_log_error("%s: stream %u reset by server, error %u.",
+                                info->url, sid, http_dl_h2_get32(p));
+            snprintf(info->err_msg, sizeof(info->err_msg), "Stream reset by server, error %u",
+                        http_dl_h2_get32(p));
+            http_dl_h2_stream_done(info, -HTTP_DL_ERR_READ);
+        }
+        return HTTP_DL_OK;
+    case HTTP_DL_H2_SETTINGS:
+        if (sid != 0 || len % 6 != 0) {
+            goto protocol_error;
+        }
+        if (flags & HTTP_DL_H2_FLAG_ACK) {
+            return HTTP_DL_OK;
+        }
+        conn->settings = true;
+        for (i = 0; i < len; i += 6) {
+            id = (p[i] << 8) | p[i + 1];
+            val = http_dl_h2_get32(p + i + 2);
+            if (id == HTTP_DL_H2_SETTINGS_MAX_STREAMS) {
+                conn->max_streams = MINVAL(val, HTTP_DL_H2_MAX_STREAMS);
+                http_dl_log_debug("%s:%d allows %u concurrent streams.",
+                                    conn->ctrl->host, conn->ctrl->port, val);
+            }
+        }
+        (void)http_dl_h2_frame_add(conn, 0, HTTP_DL_H2_SETTINGS, HTTP_DL_H2_FLAG_ACK, 0);
+        return HTTP_DL_OK;
+    case HTTP_DL_H2_PING:
+        if (sid != 0 || len != 8) {
+            goto protocol_error;
+        }
+        if (!(flags & HTTP_DL_H2_FLAG_ACK)) {
+            ack = http_dl_h2_frame_add(conn, 8, HTTP_DL_H2_PING, HTTP_DL_H2_FLAG_ACK, 0);
+            if (ack != NULL) {
+                memcpy(ack, p, 8);
+            }
+        }
+        return HTTP_DL_OK;
+    case HTTP_DL_H2_GOAWAY:
+        if (sid != 0 || len < 8) {
+            goto protocol_error;
+        }
+        id = http_dl_h2_get32(p) & 0x7FFFFFFF;
+        http_dl_log_info("HTTP/2 connection to %s:%d going away, last stream %u, error %u.",
+                            conn->ctrl->host, conn->ctrl->port, id, http_dl_h2_get32(p + 4));
+        http_dl_h2_conn_goaway(conn, id);
+        return HTTP_DL_OK;
+    case HTTP_DL_H2_PUSH_PROMISE:
+        /* SETTINGSѾ */
+        goto protocol_error;
+    default:
+        /* PRIORITYWINDOW_UPDATE(ֻGETҪʹ)δ֪ͺ */
+        return HTTP_DL_OK;
+    }
+
+protocol_error:
+    http_dl_log_error("HTTP/2 protocol error, frame type %d, stream %u.", type, sid);
+    snprintf(conn->ctrl->err_msg, sizeof(conn->ctrl->err_msg), "HTTP/2 protocol error");
+    return -HTTP_DL_ERR_READ;
+}
+
+/* socketɶݺ֡֡´ */
+static int http_dl_h2_conn_recv(http_dl_h2_conn_t *conn)
+{
+    http_dl_info_t *ctrl = conn->ctrl;
+    unsigned char *p;
+    unsigned int len;
+    int nread, pos = 0, ret;
+    long allow, begin;
+    unsigned long copy_ns;
+
+    allow = http_dl_rate_allow(ctrl);
+    if (allow <= 0) {
+        return HTTP_DL_OK;
+    }
+
+    nread = http_dl_sock_read(ctrl, (char *)conn->rbuf + conn->rlen,
+                                MINVAL(HTTP_DL_H2_RBUF_LEN - conn->rlen, allow));
+    if (nread == -HTTP_DL_ERR_AGAIN) {
+        return HTTP_DL_OK;
+    } else if (nread == 0) {
+        snprintf(ctrl->err_msg, sizeof(ctrl->err_msg), "Connection closed by server");
+        return -HTTP_DL_ERR_READ;
+    } else if (nread < 0) {
+        snprintf(ctrl->err_msg, sizeof(ctrl->err_msg), "Read from %s connection failed",
+                    ctrl->transport->name);
+        return -HTTP_DL_ERR_READ;
+    }
+
+    http_dl_rate_consume(ctrl, nread);
+    ctrl->active_ms = http_dl_now_ms();
+    conn->ping_sent = false;
+    if (ctrl->stage != HTTP_DL_STAGE_RECV_CONTENT) {
+        /* յSETTINGSֽڳʱɿгʱ */
+        http_dl_stage_set(ctrl, HTTP_DL_STAGE_RECV_CONTENT);
+        http_dl_task_timer_update(ctrl);
+    }
+    conn->rlen += nread;
+
+    /* ȥдʱ䣬 */
+    begin = http_dl_now_ns();
+    copy_ns = http_dl_prof.copy_ns;
+    while (conn->rlen - pos >= 9) {
+        p = conn->rbuf + pos;
+        len = (p[0] << 16) | (p[1] << 8) | p[2];
+        if (len > HTTP_DL_H2_FRAME_LEN) {
+            snprintf(ctrl->err_msg, sizeof(ctrl->err_msg), "HTTP/2 frame too large");
+            return -HTTP_DL_ERR_READ;
+        }
+        if (conn->rlen - pos < 9 + len) {
+            break;
+        }
+        ret = http_dl_h2_frame_proc(conn, p[3], p[4], http_dl_h2_get32(p + 5) & 0x7FFFFFFF,
+                                    p + 9, len);
+        if (ret != HTTP_DL_OK) {
+            return ret;
+        }
+        pos += 9 + len;
+    }
+    http_dl_prof.parse_ns += http_dl_now_ns() - begin - (http_dl_prof.copy_ns - copy_ns);
+
+    if (pos > 0) {
+        memmove(conn->rbuf, conn->rbuf + pos, conn->rlen - pos);
+        conn->rlen -= pos;
+    }
+
+    return HTTP_DL_OK;
+}
+
+/* ͷ飬http_dl_send_reqеHTTP/1ͬдHEADERS֡ */
+static int http_dl_h2_stream_open(http_dl_h2_conn_t *conn, http_dl_info_t *info)
+{
+    unsigned char block[HTTP_DL_H2_HDR_LEN], *p;
+    char authority[HTTP_DL_H2_HDR_LEN], range[HTTP_DL_BUF_LEN];
+    struct {
+        int index;
+        const char *value;
+    } fields[6];
+    int i, n, ret, nfields = 0;
+
+    n = http_dl_hpack_encode_indexed(block, sizeof(block), HTTP_DL_HPACK_METHOD_GET);
+    ret = http_dl_hpack_encode_indexed(block + n, sizeof(block) - n,
+                (info->flags & HTTP_DL_F_TLS) ? HTTP_DL_HPACK_SCHEME_HTTPS : HTTP_DL_HPACK_SCHEME_HTTP);
+    n += ret;
+
+    if (snprintf(authority, sizeof(authority), "%s:%d", info->host, info->port) >= sizeof(authority)) {
+        http_dl_log_error("HTTP/2 request of %s is too long.", info->url);
+        return -HTTP_DL_ERR_INVALID;
+    }
+    fields[nfields].index = HTTP_DL_HPACK_PATH;
+    fields[nfields++].value = info->path;
+    fields[nfields].index = HTTP_DL_HPACK_AUTHORITY;
+    fields[nfields++].value = authority;
+    fields[nfields].index = HTTP_DL_HPACK_USER_AGENT;
+    fields[nfields++].value = (info->flags & HTTP_DL_F_GENUINE_AGENT) ?
+                                http_dl_agent_string_genuine : http_dl_agent_string;
+    fields[nfields].index = HTTP_DL_HPACK_ACCEPT;
+    fields[nfields++].value = HTTP_ACCEPT;
+    if ((info->flags & HTTP_DL_F_ACCEPT_ENCODING) && info->restart_len == 0
+        && !(info->flags & (HTTP_DL_F_REPAIR | HTTP_DL_F_DELTA)) && strlen(HTTP_ACCEPT_ENCODING) > 0) {
+        /* HTTP/1ͬϵʱЭѹ */
+        fields[nfields].index = HTTP_DL_HPACK_ACCEPT_ENCODING;
+        fields[nfields++].value = HTTP_ACCEPT_ENCODING;
+    }
+    if (info->flags & HTTP_DL_F_REPAIR) {
+        fields[nfields].index = HTTP_DL_HPACK_RANGE;
+        fields[nfields++].value = http_dl_repair_spec(info);
+    } else if (info->restart_len != 0) {
+        snprintf(range, sizeof(range), "bytes=%ld-", info->restart_len);
+        fields[nfields].index = HTTP_DL_HPACK_RANGE;
+        fields[nfields++].value = range;
+    }
+
+    for (i = 0; i < nfields; i++) {
+        ret = http_dl_hpack_encode_literal(block + n, sizeof(block) - n,
+                                           fields[i].index, fields[i].value, strlen(fields[i].value));
+        if (ret < 0) {
+            http_dl_log_error("HTTP/2 request of %s is too long.", info->url);
+            return -HTTP_DL_ERR_INVALID;
+        }
+        n += ret;
+    }
+
+    p = http_dl_h2_frame_add(conn, n, HTTP_DL_H2_HEADERS,
+                    HTTP_DL_H2_FLAG_END_STREAM | HTTP_DL_H2_FLAG_END_HEADERS, info->stream_id);
+    if (p == NULL) {
+        return -HTTP_DL_ERR_RESOURCE;
+    }
+    memcpy(p, block, n);
+
+    return HTTP_DL_OK;
+}
+
+/* ڲڣΪȴе񷢳 */
+static void http_dl_h2_submit(http_dl_h2_conn_t *conn)
+{
+    http_dl_info_t *info;
+    long now = http_dl_now_ms();
+
+    while (conn->ready && !conn->goaway && conn->nstreams < conn->max_streams
+            && !list_empty(&conn->waiting)) {
+        if (conn->next_stream_id > 0x7FFFFFFF) {
+            /* ID꣬һ */
+            http_dl_h2_conn_goaway(conn, 0x7FFFFFFF);
+            break;
+        }
+
+        info = list_entry(conn->waiting.next, http_dl_info_t, h2_list);
+        info->stream_id = conn->next_stream_id;
+        if (http_dl_h2_stream_open(conn, info) != HTTP_DL_OK) {
+            info->stream_id = 0;
+            snprintf(info->err_msg, sizeof(info->err_msg), "Build HTTP/2 request failed");
+            http_dl_h2_stream_done(info, -HTTP_DL_ERR_INVALID);
+            continue;
+        }
+        conn->next_stream_id += 2;
+        list_move_tail(&info->h2_list, &conn->streams);
+        conn->nstreams++;
+
+        info->h2_unacked = 0;
+        http_dl_stage_set(info, HTTP_DL_STAGE_SEND_REQUEST);
+        info->stage_ms = now;
+        http_dl_task_timer_update(info);
+        http_dl_log_info("HTTP/2 request sent on stream %u, awaiting response...", info->stream_id);
+    }
+}
+
+/* ͷӺͿϵѾ뿪 */
+static void http_dl_h2_conn_free(http_dl_h2_conn_t *conn)
+{
+    http_dl_info_t *ctrl = conn->ctrl;
+
+    list_del_init(&conn->list);
+    if (!list_empty(&ctrl->list)) {
+        http_dl_del_info_from_download_list(ctrl);
+    }
+    http_dl_timer_del(&ctrl->timer);
+    http_dl_conn_close(ctrl);
+    http_dl_info_put_strs(ctrl);
+    http_dl_free(ctrl);
+
+    http_dl_hpack_destroy(conn->hpack);
+    http_dl_free(conn->hpack);
+    http_dl_free(conn->rbuf);
+    http_dl_free(conn->hbuf);
+    http_dl_free(conn->wbuf);
+    http_dl_free(conn);
+}
+
+/*
+ * ӳ(֡дʧܻʱ)е񰴶ʧԣ
+ * errΪ-HTTP_DL_ERR_AGAIN(ûЭ̵HTTP/2)ʱֱ·
+ */
+static void http_dl_h2_conn_fail(http_dl_h2_conn_t *conn, int err)
+{
+    http_dl_info_t *info, *next_info, *ctrl = conn->ctrl;
+    int res;
+
+    if (err != -HTTP_DL_ERR_AGAIN && conn->ready && !conn->settings
+        && !(ctrl->flags & HTTP_DL_F_TLS)) {
+        /* ӷǰԺûյSETTINGS֧h2c */
+        http_dl_log_info("%s:%d does not support HTTP/2, fall back to HTTP/1.",
+                            ctrl->host, ctrl->port);
+        ctrl->hs->h2 = false;
+        err = -HTTP_DL_ERR_AGAIN;
+    }
+    res = (err == -HTTP_DL_ERR_AGAIN) ? err : -HTTP_DL_ERR_READ;
+
+    if (ctrl->err_msg[0] == '\0') {
+        snprintf(ctrl->err_msg, sizeof(ctrl->err_msg), "HTTP/2 connection failed");
+    }
+    if (err != -HTTP_DL_ERR_AGAIN) {
+        http_dl_log_error("HTTP/2 connection to %s:%d failed (%d): %s",
+                            ctrl->host, ctrl->port, err, ctrl->err_msg);
+    }
+
+    list_for_each_entry_safe(info, next_info, &conn->streams, h2_list, http_dl_info_t) {
+        snprintf(info->err_msg, sizeof(info->err_msg), "%s", ctrl->err_msg);
+        http_dl_h2_stream_done(info, res);
+    }
+    list_for_each_entry_safe(info, next_info, &conn->waiting, h2_list, http_dl_info_t) {
+        snprintf(info->err_msg, sizeof(info->err_msg), "%s", ctrl->err_msg);
+        http_dl_h2_stream_done(info, res);
+    }
+
+    http_dl_h2_conn_free(conn);
+}
+
+static void http_dl_task_timeout(http_dl_timer_t *timer);
+
+/* ½infohost:portӣһ¼ѭʼʱ */
+static http_dl_h2_conn_t *http_dl_h2_conn_new(http_dl_info_t *info)
+{
+    http_dl_h2_conn_t *conn;
+    http_dl_info_t *ctrl;
+
+    conn = http_dl_xrealloc(NULL, sizeof(http_dl_h2_conn_t));
+    ctrl = http_dl_info_alloc();
+    if (conn != NULL) {
+        bzero(conn, sizeof(http_dl_h2_conn_t));
+        conn->hpack = http_dl_xrealloc(NULL, sizeof(http_dl_hpack_t));
+        conn->rbuf = http_dl_xrealloc(NULL, HTTP_DL_H2_RBUF_LEN);
+    }
+    if (ctrl != NULL) {
+        ctrl->url = http_dl_str_printf("%s%s:%d/",
+                        (info->flags & HTTP_DL_F_TLS) ? HTTPS_URL_PREFIX : HTTP_URL_PREFIX,
+                        info->host, info->port);
+    }
+    if (conn == NULL || ctrl == NULL || conn->hpack == NULL || conn->rbuf == NULL
+        || ctrl->url == NULL) {
+        if (conn != NULL) {
+            http_dl_free(conn->hpack);
+            http_dl_free(conn->rbuf);
+        }
+        if (ctrl != NULL) {
+            http_dl_str_put(ctrl->url);
+        }
+        http_dl_free(conn);
+        http_dl_free(ctrl);
+        return NULL;
+    }
+
+    http_dl_hpack_init(conn->hpack, HTTP_DL_HPACK_TABLE_SIZE);
+    INIT_LIST_HEAD(&conn->streams);
+    INIT_LIST_HEAD(&conn->waiting);
+    conn->max_streams = HTTP_DL_H2_MAX_STREAMS;
+    conn->next_stream_id = 1;
+    conn->ctrl = ctrl;
+
+    ctrl->host = http_dl_str_ref(info->host);
+    ctrl->port = info->port;
+    ctrl->flags = HTTP_DL_F_H2_CTRL | (info->flags & HTTP_DL_F_TLS);
+    ctrl->path = ctrl->url + strlen(ctrl->url) - 1;
+    ctrl->stage = HTTP_DL_STAGE_INIT;
+    ctrl->sockfd = -1;
+    ctrl->filefd = -1;
+    ctrl->buf_data = ctrl->buf;
+    ctrl->buf_tail = ctrl->buf;
+    ctrl->hs = info->hs;
+    ctrl->h2 = conn;
+    ctrl->timer.func = http_dl_task_timeout;
+    INIT_LIST_HEAD(&ctrl->list);
+    INIT_LIST_HEAD(&ctrl->h2_list);
+    INIT_LIST_HEAD(&ctrl->timer.list);
+
+    list_add_tail(&conn->list, &http_dl_h2_conns);
+    http_dl_log_info("New HTTP/2 connection to %s:%d.", ctrl->host, ctrl->port);
+
+    return conn;
+}
+
+/* 뵽host:portHTTP/2ӣһ¼ѭʼʱ */
+static int http_dl_h2_task_add(http_dl_info_t *info)
+{
+    http_dl_h2_conn_t *conn;
+    http_dl_info_t *ctrl;
+
+    list_for_each_entry(conn, &http_dl_h2_conns, list, http_dl_h2_conn_t) {
+        ctrl = conn->ctrl;
+        if (!conn->goaway && ctrl->port == info->port
+            && (ctrl->flags & HTTP_DL_F_TLS) == (info->flags & HTTP_DL_F_TLS)
+            && ctrl->host == info->host) {
+            break;
+        }
+    }
+
+    if (&conn->list == &http_dl_h2_conns) {
+        conn = http_dl_h2_conn_new(info);
+        if (conn == NULL) {
+            snprintf(info->err_msg, sizeof(info->err_msg), "Create HTTP/2 connection failed");
+            return -HTTP_DL_ERR_RESOURCE;
+        }
+    }
+
+    info->flags |= HTTP_DL_F_H2;
+    info->h2 = conn;
+    info->stream_id = 0;
+    list_add_tail(&info->h2_list, &conn->waiting);
+
+    return HTTP_DL_OK;
+}
+
+/*
+ * дwbufлܵ֡socketдʱʣµƵͷ
+ * ¼ѭsocketдд
+ */
+static int http_dl_h2_flush(http_dl_h2_conn_t *conn)
+{
+    http_dl_info_t *ctrl = conn->ctrl;
+    int ret, done = 0;
+
+    while (done < conn->wlen) {
+        ret = ctrl->transport->write(ctrl, (char *)conn->wbuf + done, conn->wlen - done);
+        if (ret == -HTTP_DL_ERR_AGAIN) {
+            break;
+        } else if (ret < 0) {
+            snprintf(ctrl->err_msg, sizeof(ctrl->err_msg), "Write to %s connection failed",
+                        ctrl->transport->name);
+            return -HTTP_DL_ERR_WRITE;
+        }
+        done += ret;
+    }
+    conn->wlen -= done;
+    if (conn->wlen > 0 && done > 0) {
+        memmove(conn->wbuf, conn->wbuf + done, conn->wlen);
+    }
+
+    return HTTP_DL_OK;
+}
+
+/*
+ * ÿselect֮ǰӣرѾûӣΪӷconnect
+ * ȴеٰѻܵ֡һд
+ */
+static void http_dl_h2_proc_conns()
+{
+    http_dl_h2_conn_t *conn, *next_conn;
+    http_dl_info_t *ctrl;
+    unsigned char *p;
+    int res;
+
+    list_for_each_entry_safe(conn, next_conn, &http_dl_h2_conns, list, http_dl_h2_conn_t) {
+        ctrl = conn->ctrl;
+        if (conn->nstreams == 0 && list_empty(&conn->waiting)
+            && (!http_dl_h2_linger || !conn->ready || conn->goaway)) {
+            if (conn->ready) {
+                /* ûˣ֪ͨر */
+                p = http_dl_h2_frame_add(conn, 8, HTTP_DL_H2_GOAWAY, 0, 0);
+                if (p != NULL) {
+                    bzero(p, 8);
+                    (void)ctrl->transport->write(ctrl, (char *)conn->wbuf, conn->wlen);
+                }
+            }
+            http_dl_log_info("Close HTTP/2 connection to %s:%d.", ctrl->host, ctrl->port);
+            http_dl_h2_conn_free(conn);
+            continue;
+        }
+
+        if (ctrl->stage == HTTP_DL_STAGE_INIT) {
+            res = http_dl_send_req(ctrl);
+            if (res != HTTP_DL_OK) {
+                if (ctrl->err_msg[0] == '\0') {
+                    snprintf(ctrl->err_msg, sizeof(ctrl->err_msg), "Connect failed");
+                }
+                http_dl_h2_conn_fail(conn, res);
+                continue;
+            }
+            http_dl_add_info_to_download_list(ctrl);
+        }
+
+        http_dl_h2_submit(conn);
+        if (conn->ready && conn->wlen > 0) {
+            res = http_dl_h2_flush(conn);
+            if (res != HTTP_DL_OK) {
+                http_dl_h2_conn_fail(conn, res);
+                continue;
+            }
+        }
+    }
+}
+
+/* ˳ʱͷӣϵԵlistͷ */
+static void http_dl_h2_destroy()
+{
+    http_dl_h2_conn_t *conn, *next_conn;
+    http_dl_info_t *info, *next_info;
+
+    list_for_each_entry_safe(conn, next_conn, &http_dl_h2_conns, list, http_dl_h2_conn_t) {
+        list_for_each_entry_safe(info, next_info, &conn->streams, h2_list, http_dl_info_t) {
+            http_dl_h2_stream_detach(info);
+        }
+        list_for_each_entry_safe(info, next_info, &conn->waiting, h2_list, http_dl_info_t) {
+            http_dl_h2_stream_detach(info);
+        }
+        http_dl_h2_conn_free(conn);
+    }
+}
+
+/*
+ * رյǰӣ׼Ѿдļλ
+ * ѹ޷мضϵʼʱĳȺء
+ */
+static int http_dl_retry_reset(http_dl_info_t *info)
+{
+    http_dl_timer_del(&info->timer);
+    http_dl_conn_close(info);
+
+    if (info->stage == HTTP_DL_STAGE_RECV_CONTENT
+        && !(info->flags & (HTTP_DL_F_REDIRECTING | HTTP_DL_F_DISCARD))) {
+        if (info->decoder == NULL) {
+            if (http_dl_flush_buf_data(info) != HTTP_DL_OK) {
+                http_dl_log_debug("Flush buffer data to %s failed.", info->local);
+            }
+            http_dl_sink_unmap(info);
+            if (!(info->flags & (HTTP_DL_F_REPAIR | HTTP_DL_F_DELTA))) {
+                info->restart_len += info->recv_len;
+            }
+        } else if (ftruncate(info->filefd, info->restart_len) != 0) {
+            http_dl_log_error("Truncate %s to %ld failed.", info->local, info->restart_len);
+            return -HTTP_DL_ERR_WRITE;
+        }
+    }
+
+    if (info->digest != NULL) {
+        /* ¿ʼհʱļеĲٶһ */
+        http_dl_digest_init(info->digest, info->digest->type);
+    }
+
+    http_dl_reset_resp(info);
+
+    return HTTP_DL_OK;
+}
+
+/* nǰĵȴʱ䣺ָ˱ܣһ̶һͬʱ */
+static long http_dl_retry_backoff(int n)
+{
+    long delay = HTTP_DL_RETRY_BASE_MS;
+
+    while (--n > 0 && delay < HTTP_DL_RETRY_MAX_MS) {
+        delay <<= 1;
+    }
+    delay = MINVAL(delay, HTTP_DL_RETRY_MAX_MS);
+
+    return delay / 2 + random() % (delay / 2 + 1);
+}
+
+static void http_dl_task_start(http_dl_info_t *info);
+
+static void http_dl_task_retry(http_dl_timer_t *timer)
+{
+    http_dl_info_t *info = list_entry(timer, http_dl_info_t, timer);
+
+    list_del_init(&info->list);
+    http_dl_list_retrying.count--;
+    http_dl_task_start(info);
+}
+
+/*
+ * ʱӰҴδʱretrying list
+ * ˱ܵȴɶʱ·󣻷¼ǰѾԭlistȡ¡
+ */
+static void http_dl_task_fail(http_dl_info_t *info, int err, bool retry)
+{
+    long delay;
+
+    if (info->flags & HTTP_DL_F_H2_CTRL) {
+        /* HTTP/2ӳϵ */
+        http_dl_h2_conn_fail(info->h2, err);
+        return;
+    }
+
+    if (retry && info->retries < http_dl_max_retries) {
+        http_dl_log_error("%s failed (%d): %s", info->url, err, info->err_msg);
+        if (http_dl_retry_reset(info) == HTTP_DL_OK) {
+            info->retries++;
+            delay = http_dl_retry_backoff(info->retries);
+            http_dl_log_info("Retry %s in %ld ms (%d/%d)...", info->url, delay,
+                                info->retries, http_dl_max_retries);
+            info->timer.func = http_dl_task_retry;
+            http_dl_timer_mod(&info->timer,
+                    (http_dl_now_ms() + delay + HTTP_DL_TIMER_TICK_MS - 1) / HTTP_DL_TIMER_TICK_MS);
+            http_dl_add_info_to_list(info, &http_dl_list_retrying);
+            return;
+        }
+        snprintf(info->err_msg, sizeof(info->err_msg), "Reset for retry failed");
+    }
+
+    info->result = err;
+    if (info->err_msg[0] == '\0') {
+        snprintf(info->err_msg, sizeof(info->err_msg), "Request failed");
+    }
+    http_dl_finish_req(info);
+}
+
+static void http_dl_task_timeout(http_dl_timer_t *timer)
+{
+    http_dl_info_t *info = list_entry(timer, http_dl_info_t, timer);
+    const char *what;
+    long now, deadline;
+
+    now = http_dl_now_ms();
+    deadline = http_dl_task_deadline(info, &what);
+    if (deadline == 0) {
+        return;
+    }
+
+    if (deadline > now || (strcmp(what, "Idle") == 0 && http_dl_rate_wait_ms(info, now) > 0)) {
+        /* ڼյݣٵȴ */
+        if (deadline <= now) {
+            info->active_ms = now;
+        }
+        http_dl_task_timer_update(info);
+        return;
+    }
+
+    if ((info->flags & HTTP_DL_F_H2_CTRL) && strcmp(what, "Idle") == 0
+        && info->h2->nstreams == 0 && list_empty(&info->h2->waiting)) {
+        /* Ŀӵڣһ¼ѭʼʱر */
+        info->h2->goaway = true;
+        info->active_ms = now;
+        http_dl_task_timer_update(info);
+        return;
+    }
+    if ((info->flags & HTTP_DL_F_H2_CTRL) && strcmp(what, "Idle") == 0
+        && http_dl_h2_conn_ping(info->h2)) {
+        /* ϵڵȷPINGȷǷ */
+        info->active_ms = now;
+        http_dl_task_timer_update(info);
+        return;
+    }
+
+    http_dl_log_error("%s: %s timeout, sockfd %d.", info->url, what, info->sockfd);
+    snprintf(info->err_msg, sizeof(info->err_msg), "%s timeout", what);
+    http_dl_del_info_from_download_list(info);
+    /* ʱҲû */
+    http_dl_task_fail(info, -HTTP_DL_ERR_TIMEOUT, strcmp(what, "Total") != 0);
+}
+
+static void http_dl_task_start(http_dl_info_t *info)
+{
+    int res;
+
+    info->timer.func = http_dl_task_timeout;
+    if (info->begin_ms == 0) {
+        /* ʱӵһη𣬰 */
+        info->begin_ms = http_dl_now_ms();
+    }
+
+    res = http_dl_task_send(info);
+    if (res == HTTP_DL_OK) {
+        http_dl_add_info_to_download_list(info);
+    } else {
+        if (info->err_msg[0] == '\0') {
+            snprintf(info->err_msg, sizeof(info->err_msg), "Connect or send request failed");
+        }
+        http_dl_task_fail(info, res, true);
+    }
+}
+
+/* -HָhostHTTP/2ӣHTTP/1 */
+static int http_dl_task_send(http_dl_info_t *info)
+{
+    if (info->stage == HTTP_DL_STAGE_INIT) {
+        /* һγԴ￪ʼHTTP/2ŶӵʱҲINIT */
+        info->stage_us[HTTP_DL_STAGE_INIT] = http_dl_now_us();
+        (void)http_dl_redirect_cache_apply(info);
+        info->hs = http_dl_host_get(info->host);
+    }
+
+    if (info->hs != NULL && info->hs->h2) {
+        return http_dl_h2_task_add(info);
+    }
+
+    info->flags &= ~HTTP_DL_F_H2;
+    return http_dl_send_req(info);
+}
+
+/*
+ * һνյĽض򣬻߳󵥶ԣӰ
+ * ʱdownloading listУrsetwsetΪNULLʱڱselectеĽ
+ */
+static void http_dl_task_recv_done(http_dl_info_t *info, int res, fd_set *rset, fd_set *wset)
+{
+    if (res == HTTP_DL_OK) {
+        /* ôݣٴμ */
+        return;
+    }
+
+    http_dl_del_info_from_download_list(info);
+    if (res == -HTTP_DL_ERR_EOF) {
+        /* ôؽҪһ */
+        if (info->flags & HTTP_DL_F_REDIRECTING) {
+            res = http_dl_follow_redirect(info);
+        } else if (info->flags & HTTP_DL_F_DELTA) {
+            res = http_dl_delta_next(info);
+        }
+        if (res == -HTTP_DL_ERR_EOF) {
+            http_dl_finish_req(info);
+            return;
+        }
+        if (res == HTTP_DL_OK) {
+            /* µѷselectµsockfdЧ */
+            http_dl_add_info_to_download_list(info);
+            if (rset != NULL && info->sockfd >= 0) {
+                FD_CLR(info->sockfd, rset);
+                FD_CLR(info->sockfd, wset);
+            }
+        } else {
+            /* ĿϿԣض嵥ֱӽ */
+            http_dl_task_fail(info, res, res != -HTTP_DL_ERR_REDIRECT && res != -HTTP_DL_ERR_INVALID);
+        }
+        return;
+    }
+
+    if (res == -HTTP_DL_ERR_AGAIN) {
+        /* HTTP/2ϻûб·𣬲 */
+        http_dl_reset_resp(info);
+        http_dl_task_start(info);
+        return;
+    }
+
+    /* ֻԳ */
+    http_dl_log_error("receive data from %s, sockfd %d failed.", info->url, info->sockfd);
+    if (res != -HTTP_DL_ERR_READ && info->err_msg[0] == '\0') {
+        snprintf(info->err_msg, sizeof(info->err_msg), "Process response failed");
+    }
+    http_dl_task_fail(info, res, res == -HTTP_DL_ERR_READ);
+}
 
-/*
- * -HTTP_DL_ERR_INVALIDʾӦֱһ;
- * -HTTP_DL_ERR_NOTFOUNDʾname뵱ǰвƥ䣬һв;
- * HTTP_DL_OKʾǰɴһˡ
- */
-static int http_dl_header_process(const char *header,
-                                  const char *name,
-                                  int (*procfun)(const char *, void *),
-                                  void *arg)
+/* HTTP/2Ѿ */
+static void http_dl_h2_proc_done()
 {
-    const char *val;
-    int gap;
+    http_dl_info_t *info;
+    int res;
 
-    if (header == NULL
-        || name == NULL
-        || procfun == NULL
-        || arg == NULL) {
-        return -HTTP_DL_ERR_INVALID;
+    while (!list_empty(&http_dl_h2_done)) {
+        info = list_entry(http_dl_h2_done.next, http_dl_info_t, h2_list);
+        list_del_init(&info->h2_list);
+        res = info->result;
+        info->result = HTTP_DL_OK;
+        http_dl_task_recv_done(info, res, NULL, NULL);
     }
+}
 
-    /* Check whether HEADER matches NAME.  */
-    while (*name && (tolower(*name) == tolower(*header))) {
-        ++name, ++header;
+/* info->prioŶӣͬһнֹʱİֹʱȺǰ棬Ƚȳ */
+static void http_dl_queue_add(http_dl_info_t *info)
+{
+    http_dl_list_t *queue = &http_dl_list_initial[info->prio];
+    http_dl_info_t *pos;
+
+    info->queued_ms = http_dl_now_ms();
+    if (info->deadline_ms == 0) {
+        http_dl_add_info_to_list(info, queue);
+        return;
     }
 
-    if (*name || *header++ != ':') {
-        return -HTTP_DL_ERR_NOTFOUND;
+    list_for_each_entry(pos, &queue->list, list, http_dl_info_t) {
+        if (pos->deadline_ms == 0 || pos->deadline_ms > info->deadline_ms) {
+            break;
+        }
+    }
+    /* pos֮ǰûҵʱposͷĩβ */
+    list_add_tail(&info->list, &pos->list);
+    queue->count++;
+}
+
+static int http_dl_queue_count()
+{
+    int i, count = 0;
+
+    for (i = 0; i < HTTP_DL_PRIO_LEVELS; i++) {
+        count += http_dl_list_initial[i].count;
     }
 
-    gap = http_dl_clac_lws(header);
-    val = header;
-    val += gap;
+    return count;
+}
+
+/* ֹŶӹõһ쵽ֹʱֱᵽ߼ÿһ */
+static void http_dl_queue_age(long now)
+{
+    http_dl_info_t *info, *next_info;
+    http_dl_prio_t prio, to;
 
-    /* HTTP_DL_OK-HTTP_DL_ERR_INVALID */
-    return ((*procfun)(val, arg));
+    if (now - http_dl_sched_check_ms < 1000) {
+        return;
+    }
+    http_dl_sched_check_ms = now;
+
+    for (prio = HTTP_DL_PRIO_HIGH + 1; prio < HTTP_DL_PRIO_LEVELS; prio++) {
+        list_for_each_entry_safe(info, next_info, &http_dl_list_initial[prio].list, list,
+                                    http_dl_info_t) {
+            if (info->deadline_ms != 0 && info->deadline_ms - now <= HTTP_DL_PRIO_URGENT_MS) {
+                to = HTTP_DL_PRIO_HIGH;
+            } else if (now - info->queued_ms >= HTTP_DL_PRIO_AGING_MS) {
+                to = prio - 1;
+            } else {
+                continue;
+            }
+            list_del_init(&info->list);
+            http_dl_list_initial[prio].count--;
+            http_dl_log_debug("Promote %s from %s to %s.", info->url,
+                                http_dl_list_initial[prio].name, http_dl_list_initial[to].name);
+            info->prio = to;
+            http_dl_queue_add(info);
+        }
+    }
 }
 
-static int http_dl_parse_header(http_dl_info_t *info)
+/* ȼӸߵͷŶӵֱͬʱеﵽ-j */
+static void http_dl_sched()
+{
+    http_dl_list_t *queue;
+    http_dl_info_t *info;
+    http_dl_prio_t prio;
+
+    if (http_dl_queue_count() == 0) {
+        return;
+    }
+
+    http_dl_queue_age(http_dl_now_ms());
+
+    for (prio = HTTP_DL_PRIO_HIGH; prio < HTTP_DL_PRIO_LEVELS; prio++) {
+        queue = &http_dl_list_initial[prio];
+        while (queue->count > 0
+               && (http_dl_max_running == 0 || http_dl_running < http_dl_max_running)) {
+            info = list_entry(queue->list.next, http_dl_info_t, list);
+            list_del_init(&info->list);
+            queue->count--;
+
+            info->flags |= HTTP_DL_F_RUNNING;
+            http_dl_running++;
+            http_dl_running_prio[prio]++;
+            http_dl_rate_prio_share();
+            http_dl_task_start(info);
+        }
+    }
+}
+
+/* ϲϣhttp_dl_proc_dups */
+static void http_dl_dedup_follow(http_dl_info_t *info, http_dl_info_t *leader)
+{
+    info->dup_of = leader;
+    http_dl_add_info_to_list(info, &http_dl_list_dup);
+    if (leader != NULL) {
+        http_dl_log_info("Coalesce %s with task %d.", info->url, leader->id);
+    }
+}
+
+/*
+ * ǰȥأļͬĽURLժҪҲͬʱϲдͬһļ
+ * ժҪеͬʱϲУļͬʱֱӡǲŶء
+ */
+static int http_dl_dedup_start(http_dl_info_t *info)
 {
+    http_dl_info_t *leader;
     int ret;
-    char *line_end;
-    int hlen;
-    char print_buf[HTTP_DL_BUF_LEN];
-    http_dl_range_t range;
 
-    if (info == NULL) {
-        return -HTTP_DL_ERR_INVALID;
+    leader = http_dl_dedup_find_local(info);
+    if (leader != NULL) {
+        if (strcmp(leader->url, info->url) != 0 && !http_dl_same_expect(leader, info)) {
+            http_dl_log_error("%s is in use by task %d (%s).", info->local, leader->id, leader->url);
+            return -HTTP_DL_ERR_INVALID;
+        }
+        http_dl_dedup_follow(info, leader);
+        return HTTP_DL_OK;
     }
 
-    if (info->stage != HTTP_DL_STAGE_PARSE_HEADER) {
-        http_dl_log_debug("Wrong stage %d.", info->stage);
-        return -HTTP_DL_ERR_INTERNAL;
+    if (http_dl_has_expect(info)) {
+        leader = http_dl_dedup_find_digest(info);
+        if (leader != NULL) {
+            http_dl_dedup_follow(info, leader);
+            return HTTP_DL_OK;
+        }
+        if (http_dl_blob_find(info) != NULL) {
+            /* һ¼ѭ */
+            info->result = HTTP_DL_OK;
+            http_dl_dedup_follow(info, NULL);
+            return HTTP_DL_OK;
+        }
+    }
+
+    if (info->flags & HTTP_DL_F_DELTA) {
+        /* յ嵥Ŵʱļhttp_dl_delta_build */
+        ret = http_dl_delta_start(info);
+    } else {
+        ret = http_dl_init_filefd(info);
+    }
+    if (ret != HTTP_DL_OK) {
+        http_dl_log_error("Open %s failed.", info->local);
+        return ret;
+    }
+    if (info->flags & HTTP_DL_F_REPAIR) {
+        ret = http_dl_repair_prepare(info);
+        if (ret != HTTP_DL_OK) {
+            return ret;
+        }
+        if (info->repair->nranges == 0) {
+            /* ûҪ޲䣬һ¼ѭֱӽ */
+            http_dl_log_info("Nothing to repair in %s.", info->local);
+            http_dl_dedup_follow(info, NULL);
+            return HTTP_DL_OK;
+        }
     }
+    list_add(&info->local_hash, &http_dl_dedup_local[http_dl_str_hash(info->local) % HTTP_DL_DEDUP_HASH_LEN]);
+    if (http_dl_has_expect(info)) {
+        list_add(&info->digest_hash, &http_dl_dedup_digest[http_dl_digest_hash(info)]);
+    }
+    http_dl_queue_add(info);
 
-    *(info->buf_tail) = '\0';   /* ַʱȷԽ */
+    return HTTP_DL_OK;
+}
 
-    while (1) {
-        bzero(print_buf, HTTP_DL_BUF_LEN);
-        line_end = strstr(info->buf_data, "\r\n");
-        if (line_end == NULL) {
-            /* headerûյһУ... */
-            http_dl_log_debug("Incompleted header line: %s", info->buf_data);
-            break;
+/* ϲ񣺱ϲ󣬹ĽͬݵļԼ */
+static void http_dl_proc_dups()
+{
+    http_dl_info_t *info, *next_info;
+    http_dl_blob_t *blob;
+
+    if (http_dl_list_dup.count == 0) {
+        return;
+    }
+
+    list_for_each_entry_safe(info, next_info, &http_dl_list_dup.list, list, http_dl_info_t) {
+        if (info->dup_of != NULL && !(info->flags & HTTP_DL_F_CANCEL)) {
+            continue;
         }
+        list_del_init(&info->list);
+        http_dl_list_dup.count--;
 
-        if (info->buf_data == line_end) {
-            /* header޸stageΪRECV_CONTENTERR_AGAIN½׶δ */
-            http_dl_reset_time(info);
-            info->stage = HTTP_DL_STAGE_RECV_CONTENT;
-            info->buf_data += 2;
-            return -HTTP_DL_ERR_AGAIN;
+        if (info->flags & HTTP_DL_F_CANCEL) {
+            info->dup_of = NULL;
+            info->result = -HTTP_DL_ERR_CANCELED;
+            snprintf(info->err_msg, sizeof(info->err_msg), "Canceled");
+            http_dl_finish_req(info);
+            continue;
         }
 
-        ret = http_dl_header_process(info->buf_data,
-                                     "Content-Length",
-                                     http_dl_header_extract_long_num,
-                                     &info->content_len);
-        if (ret == HTTP_DL_OK || ret == -HTTP_DL_ERR_INVALID) {
-            if (info->restart_len == 0 && info->total_len == 0) {
-                /* Ƕϵʱtotal_lencontent_len */
-                info->total_len = info->content_len;
-            }
-            goto header_line_done;
-        }
-
-        ret = http_dl_header_process(info->buf_data,
-                                     "Content-Type",
-                                     http_dl_header_dup_str_to_buf,
-                                     print_buf);
-        if (ret == HTTP_DL_OK || ret == -HTTP_DL_ERR_INVALID) {
-            if (strlen(print_buf) > 0) {
-                http_dl_log_debug("Content-Type: %s", print_buf);
-            }
-            goto header_line_done;
-        }
-
-        ret = http_dl_header_process(info->buf_data,
-                                     "Accept-Ranges",
-                                     http_dl_header_dup_str_to_buf,
-                                     print_buf);
-        if (ret == HTTP_DL_OK || ret == -HTTP_DL_ERR_INVALID) {
-            if (strlen(print_buf) > 0) {
-                http_dl_log_debug("Accept-Ranges: %s", print_buf);
-            }
-            goto header_line_done;
-        }
-
-        bzero(&range, sizeof(range));
-        ret = http_dl_header_process(info->buf_data,
-                                     "Content-Range",
-                                     http_dl_header_parse_range,
-                                     &range);
-        if (ret == HTTP_DL_OK) {
-            /* rangeɹ鷶Χxxx_len */
-            if (info->restart_len != range.first_byte_pos) {
-                /* XXX TODO: μ??? */
-                http_dl_log_error("File %s restart<%ld>, but range<%ld-%ld/%ld>",
-                                    info->local,
-                                    info->restart_len,
-                                    range.first_byte_pos,
-                                    range.last_byte_pos,
-                                    range.entity_length);
-            } else {
-                info->total_len = range.entity_length;
+        if (info->result == HTTP_DL_OK && http_dl_has_expect(info)) {
+            /* ϲһļֱУļ */
+            blob = http_dl_blob_find(info);
+            if (blob != NULL && http_dl_blob_link(blob, info) != HTTP_DL_OK) {
+                info->result = -HTTP_DL_ERR_AGAIN;
             }
-            http_dl_log_debug("File %s restart<%ld>, but range<%ld-%ld/%ld>",
-                                info->local,
-                                info->restart_len,
-                                range.first_byte_pos,
-                                range.last_byte_pos,
-                                range.entity_length);
-            goto header_line_done;
-        } else if (ret == -HTTP_DL_ERR_INVALID) {
-            /* rangeʧ */
-            /* XXX TODO */
-            http_dl_log_error("Parse range failed: %s.", info->local);
-            goto header_line_done;
         }
-
-        ret = http_dl_header_process(info->buf_data,
-                                     "Last-Modified",
-                                     http_dl_header_dup_str_to_buf,
-                                     print_buf);
-        if (ret == HTTP_DL_OK || ret == -HTTP_DL_ERR_INVALID) {
-            if (strlen(print_buf) > 0) {
-                http_dl_log_debug("Last-Modified: %s", print_buf);
+        if (info->result == -HTTP_DL_ERR_AGAIN) {
+            info->result = HTTP_DL_OK;
+            if (http_dl_dedup_start(info) == HTTP_DL_OK) {
+                continue;
             }
-            goto header_line_done;
+            info->result = -HTTP_DL_ERR_FOPEN;
+            snprintf(info->err_msg, sizeof(info->err_msg), "Open local file failed");
         }
+        http_dl_finish_req(info);
+    }
+}
+
+/* ȡѾдļĲֱ֮ */
+static void http_dl_proc_cancel()
+{
+    http_dl_list_t *lists[] = {
+        &http_dl_list_initial[HTTP_DL_PRIO_HIGH],
+        &http_dl_list_initial[HTTP_DL_PRIO_NORMAL],
+        &http_dl_list_initial[HTTP_DL_PRIO_LOW],
+        &http_dl_list_downloading,
+        &http_dl_list_retrying,
+    };
+    http_dl_info_t *info, *next_info;
+    int i;
+
+    if (http_dl_cancel_count == 0) {
+        return;
+    }
 
-        hlen = line_end - info->buf_data;
-        if (hlen > 0){
-            memcpy(print_buf, info->buf_data, MINVAL(hlen, (HTTP_DL_BUF_LEN - 1)));
-            http_dl_log_debug("Unsupported header: %s", print_buf);
+    for (i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+        list_for_each_entry_safe(info, next_info, &lists[i]->list, list, http_dl_info_t) {
+            if (!(info->flags & HTTP_DL_F_CANCEL)) {
+                continue;
+            }
+            if (lists[i] == &http_dl_list_downloading) {
+                http_dl_del_info_from_download_list(info);
+            } else {
+                list_del_init(&info->list);
+                lists[i]->count--;
+            }
+            http_dl_log_info("Cancel %s.", info->url);
+            http_dl_conn_close(info);
+            info->result = -HTTP_DL_ERR_CANCELED;
+            snprintf(info->err_msg, sizeof(info->err_msg), "Canceled");
+            http_dl_finish_req(info);
         }
+    }
+}
 
-header_line_done:
-        /* Ӧɻ */
-        if (ret == -HTTP_DL_ERR_INVALID) {
-            http_dl_log_error("Invalid header line: %s", info->buf_data);
+/* ڸlistвlistΪNULLʱڵlist */
+static http_dl_info_t *http_dl_task_find(int id, http_dl_list_t **list)
+{
+    http_dl_list_t *lists[] = {
+        &http_dl_list_initial[HTTP_DL_PRIO_HIGH],
+        &http_dl_list_initial[HTTP_DL_PRIO_NORMAL],
+        &http_dl_list_initial[HTTP_DL_PRIO_LOW],
+        &http_dl_list_downloading,
+        &http_dl_list_retrying,
+        &http_dl_list_dup,
+        &http_dl_list_finished,
+    };
+    http_dl_info_t *info;
+    int i;
+
+    if (id <= 0) {
+        return NULL;
+    }
+
+    for (i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+        list_for_each_entry(info, &lists[i]->list, list, http_dl_info_t) {
+            if (info->id == id) {
+                if (list != NULL) {
+                    *list = lists[i];
+                }
+                return info;
+            }
         }
-        info->buf_data = line_end + 2;
     }
 
-    return HTTP_DL_OK;
+    return NULL;
 }
 
-static inline void http_dl_move_data(char *dst, char *src, char *end)
+/*
+ * ύһoptsΪURL֮ѡ(http_dl_parse_task_opts)ΪNULL
+ * һhttp_dl_pollʱ𡣳ɹţʧܷ-HTTP_DL_ERR_xxx
+ */
+int http_dl_submit(const char *url, const char *opts, http_dl_done_cb_t cb, void *arg)
 {
-    while (src < end) {
-        *dst = *src;
-        dst++;
-        src++;
+    char opts_buf[HTTP_DL_CLIENT_BUF_LEN];
+    http_dl_info_t *di;
+
+    if (url == NULL || (opts != NULL && strlen(opts) >= sizeof(opts_buf))) {
+        return -HTTP_DL_ERR_INVALID;
+    }
+
+    di = http_dl_create_info(url);
+    if (di == NULL) {
+        http_dl_log_info("Create download task %s failed.", url);
+        return -HTTP_DL_ERR_INVALID;
+    }
+    di->flags |= http_dl_task_flags;
+    http_dl_bucket_init(&di->bucket, http_dl_rate_task);
+
+    if (http_dl_digest_default != HTTP_DL_DIGEST_NONE
+        && http_dl_digest_attach(di, http_dl_digest_default, NULL, 0) != HTTP_DL_OK) {
+        http_dl_log_error("Enable digest for %s failed.", url);
+    }
+    if (opts != NULL) {
+        snprintf(opts_buf, sizeof(opts_buf), "%s", opts);
+        if (http_dl_parse_task_opts(di, opts_buf) != HTTP_DL_OK) {
+            http_dl_log_info("Create download task %s failed.", url);
+            http_dl_info_free(di);
+            return -HTTP_DL_ERR_INVALID;
+        }
+    }
+
+    di->id = ++http_dl_task_next_id;
+    di->done_cb = cb;
+    di->done_arg = arg;
+    if (http_dl_dedup_start(di) != HTTP_DL_OK) {
+        http_dl_log_info("Create download task %s failed.", url);
+        http_dl_info_free(di);
+        return -HTTP_DL_ERR_INVALID;
     }
+
+    http_dl_log_info("Create download task %s success.", url);
+
+    return di->id;
 }
 
-static void http_dl_adjust_info_buf(http_dl_info_t *info)
+/*
+ * ȡûнһhttp_dl_pollʼʱΪ-HTTP_DL_ERR_CANCELED
+ * ﲻֱӽ˿ɻصеá
+ */
+int http_dl_cancel(int id)
 {
-    int data_len, free_space;
+    http_dl_info_t *info;
+    http_dl_list_t *list;
 
+    info = http_dl_task_find(id, &list);
     if (info == NULL) {
-        http_dl_log_debug("ERROR argument is NULL.");
-        return;
+        return -HTTP_DL_ERR_NOTFOUND;
+    }
+    if (list == &http_dl_list_finished) {
+        return -HTTP_DL_ERR_INVALID;
     }
 
-    if (info->buf_data == info->buf_tail) {
-        /* info->bufѾ */
-        bzero(info->buf, HTTP_DL_READBUF_LEN);
-        info->buf_data = info->buf;
-        info->buf_tail = info->buf;
-        return;
+    if (!(info->flags & HTTP_DL_F_CANCEL)) {
+        info->flags |= HTTP_DL_F_CANCEL;
+        http_dl_cancel_count++;
     }
 
-    data_len = info->buf_tail - info->buf_data;
+    return HTTP_DL_OK;
+}
 
-    free_space = info->buf + HTTP_DL_READBUF_LEN - info->buf_tail;
-    if (free_space < (HTTP_DL_READBUF_LEN >> 2)) {
-        http_dl_log_debug("buf_tail<%p> reaching buffer end<%p>, adjust buffer...",
-                            info->buf_tail, info->buf + HTTP_DL_READBUF_LEN);
-        http_dl_move_data(info->buf, info->buf_data, info->buf_tail);
-        info->buf_data = info->buf;
-        info->buf_tail = info->buf_data + data_len;
+int http_dl_query(int id, http_dl_stat_t *stat)
+{
+    http_dl_info_t *info;
 
-        return;
-    } else if ((free_space < (HTTP_DL_READBUF_LEN >> 1))
-                && (data_len < (HTTP_DL_READBUF_LEN >> 2))) {
-        http_dl_log_debug("free space [%d], and data length [%d], adjust buffer...",
-                            free_space, data_len);
-        http_dl_move_data(info->buf, info->buf_data, info->buf_tail);
-        info->buf_data = info->buf;
-        info->buf_tail = info->buf_data + data_len;
+    info = http_dl_task_find(id, NULL);
+    if (info == NULL || stat == NULL) {
+        return -HTTP_DL_ERR_NOTFOUND;
+    }
 
-        return;
-    } else {
-        http_dl_log_debug("no adjustment, free[%d], data[%d], buf<%p>, tail<%p>",
-                            free_space, data_len, info->buf, info->buf_tail);
+    http_dl_info_stat(info, stat);
 
-        return;
-    }
+    return HTTP_DL_OK;
 }
 
-static int http_dl_flush_buf_data(http_dl_info_t *info)
+/* ͷѾ֮ٲѯ */
+int http_dl_release(int id)
 {
-    int data_len, ret;
+    http_dl_info_t *info;
+    http_dl_list_t *list;
 
+    info = http_dl_task_find(id, &list);
     if (info == NULL) {
+        return -HTTP_DL_ERR_NOTFOUND;
+    }
+    if (list != &http_dl_list_finished) {
         return -HTTP_DL_ERR_INVALID;
     }
 
-    if (info->stage != HTTP_DL_STAGE_RECV_CONTENT) {
-        http_dl_log_debug("flush buf data to file only permitted in HTTP_DL_STAGE_RECV_CONTENT.");
-        info->buf_data = info->buf;
-        info->buf_tail = info->buf;
-        return HTTP_DL_OK;
+    list_del_init(&info->list);
+    list->count--;
+    http_dl_info_free(info);
+
+    return HTTP_DL_OK;
+}
+
+void http_dl_watch_add(http_dl_watch_t *watch)
+{
+    list_add_tail(&watch->list, &http_dl_watches);
+    http_dl_fds_add(watch->fd);
+}
+
+void http_dl_watch_del(http_dl_watch_t *watch)
+{
+    list_del_init(&watch->list);
+    http_dl_fds_del(watch->fd);
+}
+
+/*
+ * ¼ѭһ֣ȡ񣬰ȼŶӵselectȴtimeout_ms
+ * (С0ʱֻȵĶʱ)ٴշͳʱ
+ * ػûнûҲûwatchʱֱӷ0select-HTTP_DL_ERR_SOCK
+ */
+int http_dl_poll(long timeout_ms)
+{
+    http_dl_list_t *dl_list;
+    http_dl_info_t *info, *next_info;
+    http_dl_watch_t *watch, *next_watch;
+    struct timeval tv;
+    fd_set rset, wset;
+    int res, read_res;
+    long now, wait_ms, throttle_ms, begin, wait_begin, wait_end;
+    unsigned long read_bytes;
+
+    begin = http_dl_now_ns();
+    dl_list = &http_dl_list_downloading;
+
+    http_dl_proc_cancel();
+    http_dl_proc_dups();
+    http_dl_sched();
+
+    /* HTTP/2һֽӺ߿ܻµĹ */
+    do {
+        http_dl_h2_proc_done();
+        http_dl_h2_proc_conns();
+    } while (!list_empty(&http_dl_h2_done));
+
+    if (dl_list->count == 0 && http_dl_list_retrying.count == 0 && list_empty(&http_dl_watches)) {
+        return 0;
     }
 
-    data_len = info->buf_tail - info->buf_data;
-    if (data_len == 0) {
-        /* Ϊ */
-        info->buf_data = info->buf;
-        info->buf_tail = info->buf;
-        return HTTP_DL_OK;
-    } else if (data_len < 0) {
-        http_dl_log_error("FATAL error, buf_tail<%p> is before buf_data<%p>, diff %d.",
-                            info->buf_tail, info->buf_data, data_len);
-        info->buf_tail = info->buf_data;
-        return -HTTP_DL_ERR_INTERNAL;
+    /*
+     * ӵûддɶ
+     * Ʋֲɶں˽ջУ
+     * TCP÷ͣselectȵơ
+     */
+    FD_ZERO(&rset);
+    FD_ZERO(&wset);
+    now = http_dl_now_ms();
+    wait_ms = http_dl_timer_next_ms(now);
+    if (wait_ms < 0) {
+        wait_ms = HTTP_DL_READ_TIMEOUT * 1000;
+    }
+    if (timeout_ms >= 0) {
+        wait_ms = MINVAL(wait_ms, timeout_ms);
+    }
+    list_for_each_entry(info, &dl_list->list, list, http_dl_info_t) {
+        if (info->flags & HTTP_DL_F_H2) {
+            /* ӵĿȡ */
+            continue;
+        }
+        if (info->stage == HTTP_DL_STAGE_CONNECTING || (info->flags & HTTP_DL_F_WANT_WRITE)) {
+            FD_SET(info->sockfd, &wset);
+            continue;
+        } else if (info->stage == HTTP_DL_STAGE_HANDSHAKE) {
+            FD_SET(info->sockfd, &rset);
+            continue;
+        }
+        throttle_ms = http_dl_rate_wait_ms(info, now);
+        if (throttle_ms > 0) {
+            wait_ms = MINVAL(wait_ms, throttle_ms);
+            continue;
+        }
+        if (http_dl_conn_pending(info) > 0) {
+            /* TLSлнܺõݣselectܵȴ */
+            wait_ms = 0;
+        }
+        if ((info->flags & HTTP_DL_F_H2_CTRL) && info->h2->ready && info->h2->wlen > 0) {
+            /* һûд֡дд */
+            FD_SET(info->sockfd, &wset);
+        }
+        FD_SET(info->sockfd, &rset);
+    }
+    list_for_each_entry(watch, &http_dl_watches, list, http_dl_watch_t) {
+        FD_SET(watch->fd, &rset);
     }
 
-    ret = http_dl_write(info->filefd, info->buf_data, data_len);
-    info->recv_len += ret;
-    if (ret < data_len) {
-        /* δд */
-        info->buf_data += ret;
-        return -HTTP_DL_ERR_WRITE;
+    bzero(&tv, sizeof(tv));
+    tv.tv_sec = wait_ms / 1000;
+    tv.tv_usec = (wait_ms % 1000) * 1000;
+
+    wait_begin = http_dl_now_ns();
+    res = select(http_dl_fds.maxfd + 1, &rset, &wset, NULL, &tv);
+    wait_end = http_dl_now_ns();
+    http_dl_prof.wait_ns += wait_end - wait_begin;
+    http_dl_prof.polls++;
+    if (res == 0) {
+        http_dl_prof.poll_timeouts++;
+    } else if (res > 0) {
+        http_dl_prof.ready += res;
+    }
+    read_bytes = http_dl_prof.read_bytes;
+    if (res == -1 && errno == EINTR) {
+        /* жϣfdϵû */
+        http_dl_log_debug("select interrupted by signal.");
+        FD_ZERO(&rset);
+        FD_ZERO(&wset);
+    } else if (res < 0){
+        /*  */
+        http_dl_log_error("select failed, return %d", res);
+        return -HTTP_DL_ERR_SOCK;
+    }
+
+    list_for_each_entry_safe(info, next_info, &dl_list->list, list, http_dl_info_t) {
+        if (info->flags & HTTP_DL_F_H2) {
+            continue;
+        }
+        if (info->stage == HTTP_DL_STAGE_CONNECTING || info->stage == HTTP_DL_STAGE_HANDSHAKE
+            || (info->flags & HTTP_DL_F_WANT_WRITE)) {
+            if (!FD_ISSET(info->sockfd, &wset) && !FD_ISSET(info->sockfd, &rset)) {
+                continue;
+            }
+            FD_CLR(info->sockfd, &wset);
+            FD_CLR(info->sockfd, &rset);
+            res = http_dl_send_req(info);
+            if (res != HTTP_DL_OK) {
+                http_dl_del_info_from_download_list(info);
+                if (info->err_msg[0] == '\0') {
+                    snprintf(info->err_msg, sizeof(info->err_msg),
+                                "Connect or send request failed");
+                }
+                http_dl_task_fail(info, res, true);
+            }
+            continue;
+        }
+
+        if ((info->flags & HTTP_DL_F_H2_CTRL) && FD_ISSET(info->sockfd, &wset)) {
+            FD_CLR(info->sockfd, &wset);
+            res = http_dl_h2_flush(info->h2);
+            if (res != HTTP_DL_OK) {
+                http_dl_del_info_from_download_list(info);
+                http_dl_task_fail(info, res, true);
+                continue;
+            }
+        }
+
+        if (!FD_ISSET(info->sockfd, &rset) && http_dl_conn_pending(info) == 0) {
+            continue;
+        }
+
+        if (info->flags & HTTP_DL_F_H2_CTRL) {
+            res = http_dl_h2_conn_recv(info->h2);
+            if (res != HTTP_DL_OK) {
+                http_dl_del_info_from_download_list(info);
+                http_dl_task_fail(info, res, true);
+            } else {
+                http_dl_sock_tune(info, info->active_ms);
+            }
+            continue;
+        }
+
+        read_res = http_dl_recv_resp(info);
+        http_dl_task_recv_done(info, read_res, &rset, &wset);
     }
 
-    /* ݶд */
-    info->buf_data = info->buf;
-    info->buf_tail = info->buf;
+    list_for_each_entry_safe(watch, next_watch, &http_dl_watches, list, http_dl_watch_t) {
+        if (FD_ISSET(watch->fd, &rset)) {
+            watch->func(watch);
+        }
+    }
 
-    return HTTP_DL_OK;
+    /* ڶ֮յݵ񲻻ᱻΪгʱ */
+    http_dl_timer_run(http_dl_now_ms());
+
+    if (res > 0 && http_dl_prof.read_bytes == read_bytes) {
+        http_dl_prof.poll_empty++;
+    }
+    http_dl_prof.busy_ns += http_dl_now_ns() - begin - (wait_end - wait_begin);
+
+    return http_dl_queue_count() + dl_list->count + http_dl_list_retrying.count
+           + http_dl_list_dup.count;
 }
 
-static int http_dl_sync_file_data(http_dl_info_t *info)
+#ifndef HTTP_DL_NO_MAIN
+static int http_dl_list_proc_downloading()
 {
-    int ret;
+    int res;
 
-    if (info == NULL) {
+    if (http_dl_list_downloading.count == 0 && http_dl_list_retrying.count == 0) {
         return -HTTP_DL_ERR_INVALID;
     }
 
-    ret = fsync(info->filefd);
+    while ((res = http_dl_poll(-1)) > 0) {
+        if (http_dl_dump_req) {
+            http_dl_dump();
+        }
+    }
+    if (res == 0) {
+        http_dl_log_info("All finished...");
+    }
+
+    return (res < 0) ? res : HTTP_DL_OK;
+}
 
-    if (ret < 0) {
-        return -HTTP_DL_ERR_FSYNC;
-    } else {
-        return HTTP_DL_OK;
+static int http_dl_list_proc_finished()
+{
+    return HTTP_DL_OK;
+}
+
+/* -T connect,first_byte,idle,totalλ룬ֻǰ */
+static int http_dl_parse_timeouts(char *arg)
+{
+    long *timeouts[] = {
+        &http_dl_timeout_connect,
+        &http_dl_timeout_first_byte,
+        &http_dl_timeout_idle,
+        &http_dl_timeout_total,
+    };
+    char *end;
+    long val;
+    int i;
+
+    for (i = 0; i < sizeof(timeouts) / sizeof(timeouts[0]); i++) {
+        val = strtol(arg, &end, 10);
+        if (end == arg || val < 0) {
+            return -HTTP_DL_ERR_INVALID;
+        }
+        *timeouts[i] = val * 1000;
+        if (*end == '\0') {
+            return HTTP_DL_OK;
+        }
+        if (*end != ',') {
+            return -HTTP_DL_ERR_INVALID;
+        }
+        arg = end + 1;
     }
+
+    return -HTTP_DL_ERR_INVALID;
 }
 
-static int http_dl_recv_content(http_dl_info_t *info)
+static volatile sig_atomic_t http_dl_stopping;  /* ػյSIGINT/SIGTERM */
+static int http_dl_daemon_clients;
+
+static void http_dl_daemon_stop(int sig)
 {
-    int ret;
+    http_dl_stopping = 1;
+}
 
-    if (info == NULL) {
-        return -HTTP_DL_ERR_INVALID;
+/* ͻ˶ϿûнʱȲͷ */
+static void http_dl_client_close(http_dl_client_t *client)
+{
+    if (client->watch.fd < 0) {
+        return;
     }
+    http_dl_watch_del(&client->watch);
+    close(client->watch.fd);
+    client->watch.fd = -1;
+    http_dl_daemon_clients--;
+}
 
-    if (info->stage != HTTP_DL_STAGE_RECV_CONTENT) {
-        http_dl_log_debug("Wrong stage %d.", info->stage);
-        return -HTTP_DL_ERR_INTERNAL;
+static void http_dl_client_put(http_dl_client_t *client)
+{
+    if (client->watch.fd < 0 && client->ntasks == 0) {
+        http_dl_free(client);
     }
+}
 
-    if (info->buf_data == info->buf_tail) {
-        http_dl_log_debug("No data in buffer.");
-        return HTTP_DL_OK;
+/* ظһУдȥ(ͻ˲ѶϿ)ʱϿͻ */
+static void http_dl_client_reply(http_dl_client_t *client, const char *fmt, ...)
+{
+    char line[HTTP_DL_CLIENT_BUF_LEN];
+    va_list ap;
+    int len;
+
+    if (client->watch.fd < 0) {
+        return;
     }
 
-    ret = http_dl_flush_buf_data(info);
-    if (ret != HTTP_DL_OK) {
-        /* XXX TODO: ʧܺ󣬹رӰ */
-        http_dl_log_debug("Flush buffer data to file failed, %s.", info->local);
-        http_dl_sync_file_data(info);   /* XXX TODO: Ҫô??? */
+    va_start(ap, fmt);
+    len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    len = MINVAL(len, sizeof(line) - 1);
+
+    if (send(client->watch.fd, line, len, MSG_NOSIGNAL | MSG_DONTWAIT) != len) {
+        http_dl_log_error("Reply to client fd %d failed, disconnect it.", client->watch.fd);
+        http_dl_client_close(client);
     }
+}
 
-    return HTTP_DL_OK;
+/* رύĿͻ˺ͷ */
+static void http_dl_daemon_done(http_dl_info_t *info, void *arg)
+{
+    http_dl_client_t *client = arg;
+
+    http_dl_client_reply(client, "DONE %d %d %ld %s %s\n", info->id, info->result,
+                            info->restart_len + info->recv_len, info->local,
+                            (info->result == HTTP_DL_OK) ? "OK" : info->err_msg);
+    client->ntasks--;
+    http_dl_client_put(client);
+    (void)http_dl_release(info->id);
 }
 
 /*
- * HTTPӦ
+ * һ
+ *   GET <url> [opts]   ύ񣬻ظOK <id>ʱظDONE <id> <result> <bytes> <local> <msg>
+ *   CANCEL <id>        ظOK <id>-HTTP_DL_ERR_CANCELED
+ *   QUERY <id>         ظSTAT <id> <stage> <result> <bytes> <total> <local>
+ * ʱظERR <code> <msg>
  */
-static int http_dl_recv_resp(http_dl_info_t *info)
+static void http_dl_client_cmd(http_dl_client_t *client, char *line)
 {
-    int ret;
-    int nread, free_space;
-
-    if (info == NULL) {
-        return -HTTP_DL_ERR_INVALID;
+    http_dl_stat_t stat;
+    char *arg, *opts;
+    int id, res;
+
+    arg = strpbrk(line, " \t");
+    if (arg != NULL) {
+        *arg++ = '\0';
+        arg += strspn(arg, " \t");
     }
-
-    if (info->stage <= HTTP_DL_STAGE_SEND_REQUEST) {
-        /* ձݵĳʼ״̬ */
-        info->stage = HTTP_DL_STAGE_PARSE_STATUS_LINE;
+    if (line[0] == '\0') {
+        return;
     }
-
-    free_space = info->buf + HTTP_DL_READBUF_LEN - info->buf_tail;
-    if (free_space < (HTTP_DL_READBUF_LEN >> 1)) {
-        http_dl_log_info("WARNING: info buffer free space %d too small, (total %d)",
-                            free_space, HTTP_DL_READBUF_LEN);
+    if (arg == NULL || arg[0] == '\0') {
+        http_dl_client_reply(client, "ERR %d Missing argument\n", -HTTP_DL_ERR_INVALID);
+        return;
     }
 
-    nread = read(info->sockfd, info->buf_tail, free_space);
-    if (nread == 0) {
-        /* XXX: ؽҪinfo bufferȫflushļУͬsyncļ */
-        if (http_dl_flush_buf_data(info) != HTTP_DL_OK) {
-            http_dl_log_debug("Flush buffer data to %s failed.", info->local);
+    if (strcmp(line, "GET") == 0) {
+        opts = strpbrk(arg, " \t");
+        if (opts != NULL) {
+            *opts++ = '\0';
         }
-        if (http_dl_sync_file_data(info) != HTTP_DL_OK) {
-            http_dl_log_debug("Sync file %s failed.", info->local);
+        id = http_dl_submit(arg, opts, http_dl_daemon_done, client);
+        if (id < 0) {
+            http_dl_client_reply(client, "ERR %d Create task failed\n", id);
+            return;
         }
-        return -HTTP_DL_ERR_EOF;
-    } else if (nread < 0) {
-        http_dl_log_error("read failed, %d", nread);
-        return -HTTP_DL_ERR_READ;
+        client->ntasks++;
+        http_dl_client_reply(client, "OK %d\n", id);
+    } else if (strcmp(line, "CANCEL") == 0) {
+        id = strtol(arg, NULL, 10);
+        res = http_dl_cancel(id);
+        if (res != HTTP_DL_OK) {
+            http_dl_client_reply(client, "ERR %d Task %d not running\n", res, id);
+            return;
+        }
+        http_dl_client_reply(client, "OK %d\n", id);
+    } else if (strcmp(line, "QUERY") == 0) {
+        id = strtol(arg, NULL, 10);
+        res = http_dl_query(id, &stat);
+        if (res != HTTP_DL_OK) {
+            http_dl_client_reply(client, "ERR %d Task %d not found\n", res, id);
+            return;
+        }
+        http_dl_client_reply(client, "STAT %d %d %d %ld %ld %s\n", stat.id, stat.stage,
+                                stat.result, stat.done_len, stat.total_len, stat.local);
+    } else {
+        http_dl_client_reply(client, "ERR %d Unknown command %s\n", -HTTP_DL_ERR_INVALID, line);
     }
+}
 
-    info->buf_tail += nread;
+static void http_dl_client_read(http_dl_watch_t *watch)
+{
+    http_dl_client_t *client = list_entry(watch, http_dl_client_t, watch);
+    char *p, *end;
+    int nread;
 
-again:
-    switch (info->stage) {
-    case HTTP_DL_STAGE_PARSE_STATUS_LINE:
-        ret = http_dl_parse_status_line(info);
-        break;
-    case HTTP_DL_STAGE_PARSE_HEADER:
-        ret = http_dl_parse_header(info);
-        break;
-    case HTTP_DL_STAGE_RECV_CONTENT:
-        ret = http_dl_recv_content(info);
-        break;
-    default:
-        http_dl_log_error("Incorrect stage %d in here.", info->stage);
-        return -HTTP_DL_ERR_INTERNAL;
-        break;
+    nread = read(watch->fd, client->buf + client->len, sizeof(client->buf) - 1 - client->len);
+    if (nread < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    } else if (nread <= 0) {
+        http_dl_client_close(client);
+        http_dl_client_put(client);
+        return;
     }
-
-    if (ret == -HTTP_DL_ERR_AGAIN) {
-        /* bufferл¸stageδ */
-        http_dl_log_debug("Continue next stage process.");
-        goto again;
-    } else if (ret == HTTP_DL_OK) {
-        /* ֽ׶λδ꣬ȴ´εݣ */
-        /* XXX: bufferд˴δ */
-        (void)http_dl_adjust_info_buf(info);
-    } else {
-        http_dl_log_debug("Process response failed %d.", ret);
-        /* XXX TODO: Ҫflush bufferеô? */
+    client->len += nread;
+
+    p = client->buf;
+    while (client->watch.fd >= 0
+           && (end = memchr(p, '\n', client->buf + client->len - p)) != NULL) {
+        *end = '\0';
+        if (end > p && end[-1] == '\r') {
+            end[-1] = '\0';
+        }
+        http_dl_client_cmd(client, p);
+        p = end + 1;
+    }
+    if (client->watch.fd < 0) {
+        http_dl_client_put(client);
+        return;
     }
 
-    return ret;
+    client->len -= p - client->buf;
+    memmove(client->buf, p, client->len);
+    if (client->len == sizeof(client->buf) - 1) {
+        http_dl_client_reply(client, "ERR %d Line too long\n", -HTTP_DL_ERR_INVALID);
+        http_dl_client_close(client);
+        http_dl_client_put(client);
+    }
 }
 
-static void http_dl_finish_req(http_dl_info_t *info)
+static void http_dl_daemon_accept(http_dl_watch_t *watch)
 {
-    if (info == NULL) {
-        return;
-    }
+    http_dl_client_t *client;
+    int fd;
 
-    if (info->filefd >= 0) {
-        http_dl_log_debug("close opened file fd %d", info->filefd);
-        close(info->filefd);
-        info->filefd = -1;
+    fd = accept(watch->fd, NULL, NULL);
+    if (fd < 0) {
+        return;
     }
-
-    if (info->sockfd >= 0) {
-        http_dl_log_debug("close opened socket fd %d", info->sockfd);
-        close(info->sockfd);
-        info->sockfd = -1;
+    if (http_dl_daemon_clients >= HTTP_DL_CLIENTS_MAX || fd >= FD_SETSIZE
+        || (client = http_dl_xrealloc(NULL, sizeof(http_dl_client_t))) == NULL) {
+        http_dl_log_error("Too many clients, reject fd %d.", fd);
+        close(fd);
+        return;
     }
 
-    http_dl_calc_elapsed(info);
-
-    info->stage = HTTP_DL_STAGE_FINISH;
-    http_dl_add_info_to_list(info, &http_dl_list_finished);
+    bzero(client, sizeof(http_dl_client_t));
+    (void)http_dl_set_nonblock(fd, true);
+    client->watch.fd = fd;
+    client->watch.func = http_dl_client_read;
+    http_dl_watch_add(&client->watch);
+    http_dl_daemon_clients++;
+    http_dl_log_debug("Accept client fd %d.", fd);
 }
 
-static int http_dl_list_proc_downloading()
+/*
+ * ػ̣UNIX socketϽֱյSIGINTSIGTERM
+ * ӳءTLSỰhost״̬ڸ֮䱣
+ */
+static int http_dl_daemon_run(const char *path)
 {
-    http_dl_list_t *dl_list;
-    http_dl_info_t *info, *next_info;
-    struct timeval tv;
-    fd_set rset, rset_org;
-    int res, read_res;
-    int ntimes = 0;
+    http_dl_watch_t listener, *watch, *next_watch;
+    http_dl_client_t *client;
+    struct sockaddr_un sa;
+    int fd;
 
-    dl_list = &http_dl_list_downloading;
-    if (dl_list->count == 0) {
+    bzero(&sa, sizeof(sa));
+    if (strlen(path) >= sizeof(sa.sun_path)) {
+        http_dl_log_error("Socket path %s is too long.", path);
         return -HTTP_DL_ERR_INVALID;
     }
+    sa.sun_family = AF_UNIX;
+    memcpy(sa.sun_path, path, strlen(path));
 
-    FD_ZERO(&rset_org);
-    list_for_each_entry(info, &dl_list->list, list, http_dl_info_t) {
-        FD_SET(info->sockfd, &rset_org);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -HTTP_DL_ERR_SOCK;
     }
-
-    while (1) {
-        if (dl_list->count == 0) {
-            http_dl_log_info("All finished...");
+    (void)unlink(path);
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0 || listen(fd, 16) != 0) {
+        http_dl_log_error("Listen on %s failed, errno %d.", path, errno);
+        close(fd);
+        return -HTTP_DL_ERR_SOCK;
+    }
+    (void)http_dl_set_nonblock(fd, true);
+
+    listener.fd = fd;
+    listener.func = http_dl_daemon_accept;
+    http_dl_h2_linger = true;
+    http_dl_watch_add(&listener);
+    signal(SIGINT, http_dl_daemon_stop);
+    signal(SIGTERM, http_dl_daemon_stop);
+    http_dl_log_info("Listening on %s...", path);
+
+    while (!http_dl_stopping) {
+        if (http_dl_poll(-1) < 0) {
             break;
         }
-
-        bzero(&tv, sizeof(tv));
-        tv.tv_sec = HTTP_DL_READ_TIMEOUT;
-        tv.tv_usec = 0;
-
-        FD_ZERO(&rset);
-        memcpy(&rset, &rset_org, sizeof(fd_set));
-
-        res = select(dl_list->maxfd + 1, &rset, NULL, NULL, &tv);
-        if (res == 0) {
-            /* ʱ */
-            ntimes++;
-            http_dl_log_debug("[%d] select timeout (%d secs)", ntimes, HTTP_DL_READ_TIMEOUT);
-            if (ntimes > HTTP_DL_TIMEOUT_RETRIES) {
-                http_dl_log_error("select timeout...");
-                break;
-            }
-            continue;
-        } else if (res == -1 && errno == EINTR) {
-            /* ж */
-            http_dl_log_debug("select interrupted by signal.");
-            continue;
-        } else if (res < 0){
-            /*  */
-            http_dl_log_error("select failed, return %d", res);
-            break;
+        if (http_dl_dump_req) {
+            http_dl_dump();
         }
-        ntimes = 0; /* óʱ¼ */
-
-        list_for_each_entry_safe(info, next_info, &dl_list->list, list, http_dl_info_t) {
-            if (!FD_ISSET(info->sockfd, &rset)) {
-                continue;
-            }
+    }
 
-            read_res = http_dl_recv_resp(info);
-            if (read_res == -HTTP_DL_ERR_EOF) {
-                /* ôؽ */
-                FD_CLR(info->sockfd, &rset_org);
-                http_dl_del_info_from_download_list(info);
-                http_dl_finish_req(info);
-                continue;
-            } else if (read_res == HTTP_DL_OK) {
-                /* ôݣٴμ */
-                continue;
-            } else {
-                /* أ */
-                http_dl_log_error("receive data from %s, sockfd %d failed.",
-                                        info->url, info->sockfd);
-                return -HTTP_DL_ERR_READ;
-            }
-        }
+    http_dl_log_info("Stopping, unfinished tasks are kept for resuming later.");
+    http_dl_watch_del(&listener);
+    close(fd);
+    (void)unlink(path);
+    list_for_each_entry_safe(watch, next_watch, &http_dl_watches, list, http_dl_watch_t) {
+        client = list_entry(watch, http_dl_client_t, watch);
+        http_dl_client_close(client);
+        http_dl_client_put(client);
     }
 
     return HTTP_DL_OK;
 }
 
-static int http_dl_list_proc_finished()
+/*
+ * -Pں߳жÿسɹļִļΪһ
+ * argmainƴõ"<> \"$1\""ļΪ$1shellƴӵУõеַ
+ */
+static void http_dl_post_exec(const http_dl_event_t *ev, void *arg)
 {
-    return HTTP_DL_OK;
+    extern char **environ;
+    char *argv[] = { "sh", "-c", arg, "sh", (char *)ev->stat.local, NULL };
+    pid_t pid;
+    int status;
+
+    if (ev->stat.result != HTTP_DL_OK || ev->stat.status_code / 100 != 2) {
+        return;
+    }
+
+    if (posix_spawn(&pid, "/bin/sh", NULL, NULL, argv, environ) != 0) {
+        http_dl_log_error("Run post-processing command for %s failed.", ev->stat.local);
+        return;
+    }
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+        (void)0;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        http_dl_log_error("Post-processing %s failed, status %d.", ev->stat.local, status);
+    } else {
+        http_dl_log_info("Post-processed %s, %ld ms after queued.", ev->stat.local,
+                            ev->done_ms - ev->queued_ms);
+    }
 }
 
 int main(int argc, char *argv[])
 {
-    FILE *fp;
-    char url_buf[HTTP_DL_URL_LEN];
-    int url_len, ret = HTTP_DL_OK;
-    http_dl_info_t *di;
+    FILE *fp = NULL;
+    char *url_buf = NULL;
+    size_t url_cap = 0;
+    ssize_t url_len;
+    int ret = HTTP_DL_OK;
+    int opt;
+    char *opts, *daemon_path = NULL, *post_cmd = NULL, *post_sh = NULL, *trace_path = NULL;
+    int post_threads = HTTP_DL_POST_THREADS;
+    long trace_slow_ms = HTTP_DL_TRACE_SLOW_MS;
+    long manifest_block = 0, rate, num;
+    char *tls_cafile = NULL;
+    bool tls_insecure = false;
+
+    while ((opt = getopt(argc, argv, "zc:r:R:t:T:n:A:kH:D:j:P:w:B:b:g:G:M:")) != -1) {
+        switch (opt) {
+        case 'M':
+            if (http_dl_parse_ulong(optarg, strlen(optarg), &num) != HTTP_DL_PARSE_OK
+                || (num != 0 && (num < HTTP_DL_DELTA_BLOCK_MIN || num > HTTP_DL_DELTA_BLOCK_MAX))) {
+                http_dl_log_error("Invalid block size %s, must be 0 or %d..%d.", optarg,
+                                    HTTP_DL_DELTA_BLOCK_MIN, HTTP_DL_DELTA_BLOCK_MAX);
+                goto usage;
+            }
+            manifest_block = (num == 0) ? HTTP_DL_DELTA_BLOCK_LEN : num;
+            break;
+        case 'g':
+            trace_path = optarg;
+            break;
+        case 'G':
+            /* ΢ʱȽϣ1000 */
+            if (http_dl_parse_ulong(optarg, strlen(optarg), &num) != HTTP_DL_PARSE_OK
+                || num > LONG_MAX / 1000) {
+                http_dl_log_error("Invalid slow task threshold %s.", optarg);
+                goto usage;
+            }
+            trace_slow_ms = num;
+            break;
+        case 'B':
+            /* ջintãֽںܳINT_MAX */
+            if (http_dl_parse_ulong(optarg, strlen(optarg), &num) != HTTP_DL_PARSE_OK
+                || num > (INT_MAX >> 10)) {
+                http_dl_log_error("Invalid receive buffer limit %s, at most %d KB.", optarg, INT_MAX >> 10);
+                goto usage;
+            }
+            http_dl_rcvbuf_max = num * 1024;
+            break;
+        case 'b':
+            if (http_dl_parse_ulong(optarg, strlen(optarg), &num) != HTTP_DL_PARSE_OK || num > INT_MAX) {
+                http_dl_log_error("Invalid busy-poll time %s.", optarg);
+                goto usage;
+            }
+            http_dl_busy_poll = num;
+            break;
+        case 'P':
+            post_cmd = optarg;
+            break;
+        case 'w':
+            if (http_dl_parse_ulong(optarg, strlen(optarg), &num) != HTTP_DL_PARSE_OK
+                || num == 0 || num > HTTP_DL_POST_THREADS_MAX) {
+                http_dl_log_error("Invalid post-processing threads %s, must be 1..%d.",
+                                    optarg, HTTP_DL_POST_THREADS_MAX);
+                goto usage;
+            }
+            post_threads = num;
+            break;
+        case 'j':
+            if (http_dl_parse_ulong(optarg, strlen(optarg), &num) != HTTP_DL_PARSE_OK || num > INT_MAX) {
+                http_dl_log_error("Invalid task limit %s.", optarg);
+                goto usage;
+            }
+            http_dl_max_running = num;
+            break;
+        case 'D':
+            daemon_path = optarg;
+            break;
+        case 'A':
+            tls_cafile = optarg;
+            break;
+        case 'k':
+            tls_insecure = true;
+            break;
+        case 'H':
+            if (http_dl_h2_hosts_count >= HTTP_DL_H2_HOSTS_LEN) {
+                http_dl_log_error("Too many HTTP/2 hosts, at most %d.", HTTP_DL_H2_HOSTS_LEN);
+                goto usage;
+            }
+            http_dl_h2_hosts[http_dl_h2_hosts_count++] = optarg;
+            break;
+        case 'n':
+            if (http_dl_parse_ulong(optarg, strlen(optarg), &num) != HTTP_DL_PARSE_OK || num > INT_MAX) {
+                http_dl_log_error("Invalid retries %s.", optarg);
+                goto usage;
+            }
+            http_dl_max_retries = num;
+            break;
+        case 'T':
+            if (http_dl_parse_timeouts(optarg) != HTTP_DL_OK) {
+                http_dl_log_error("Invalid timeouts %s.", optarg);
+                goto usage;
+            }
+            break;
+        case 'r':
+        case 'R':
+        case 't':
+            if (http_dl_parse_rate(optarg, strlen(optarg), &rate) != HTTP_DL_OK) {
+                http_dl_log_error("Invalid rate %s for -%c.", optarg, opt);
+                goto usage;
+            }
+            if (opt == 'r') {
+                http_dl_bucket_init(&http_dl_rate_global, rate);
+            } else if (opt == 'R') {
+                http_dl_rate_host = rate;
+            } else {
+                http_dl_rate_task = rate;
+            }
+            break;
+        case 'c':
+            http_dl_digest_default = http_dl_digest_type_parse(optarg, strlen(optarg));
+            if (http_dl_digest_default == HTTP_DL_DIGEST_NONE) {
+                http_dl_log_error("Unknown digest %s.", optarg);
+                goto usage;
+            }
+            break;
+        case 'z':
+            if (strlen(HTTP_ACCEPT_ENCODING) == 0) {
+                http_dl_log_info("Built without zlib/zstd, -z is ignored.");
+            }
+            http_dl_task_flags |= HTTP_DL_F_ACCEPT_ENCODING;
+            break;
+        default:
+            goto usage;
+        }
+    }
 
-    if (argc != 2) {
-        http_dl_print_raw("Usage: %s <url_list.txt>\n", argv[0]);
-        return -HTTP_DL_ERR_INVALID;
+    if (manifest_block > 0) {
+        /* ֻɿ嵥 */
+        if (optind != argc - 1) {
+            goto usage;
+        }
+        return http_dl_delta_manifest(argv[optind], manifest_block, STDOUT_FILENO);
+    }
+
+    /* ػģʽURLбʡ */
+    if (optind != argc - 1 && !(daemon_path != NULL && optind == argc)) {
+        goto usage;
     }
 
     http_dl_init();
+    signal(SIGUSR1, http_dl_dump_signal);
 
-    fp = fopen(argv[1], "r");
-    if (fp == NULL) {
-        http_dl_log_error("Open file %s failed", argv[1]);
-        return -HTTP_DL_ERR_FOPEN;
+    if (trace_path != NULL && http_dl_trace_open(trace_path, trace_slow_ms) != HTTP_DL_OK) {
+        ret = -HTTP_DL_ERR_FOPEN;
+        goto err_out;
     }
 
-    while (1) {
-        bzero(url_buf, sizeof(url_buf));
-        if (fgets(url_buf, sizeof(url_buf), fp) == NULL) {
-            break;
-        }
+    if ((tls_cafile != NULL || tls_insecure)
+        && (ret = http_dl_tls_config(tls_cafile, tls_insecure)) != HTTP_DL_OK) {
+        goto err_out;
+    }
 
-        url_len = strlen(url_buf);
-        if (url_buf[url_len - 1] != '\n') {
-            http_dl_log_error("URL in file %s is too long", argv[1]);
+    if (post_cmd != NULL) {
+        /* ĳȲƣʵʳƴãֱ߳ʹ */
+        post_sh = http_dl_xrealloc(NULL, strlen(post_cmd) + sizeof(" \"$1\""));
+        if (post_sh == NULL) {
+            ret = -HTTP_DL_ERR_RESOURCE;
+            goto err_out;
+        }
+        sprintf(post_sh, "%s \"$1\"", post_cmd);
+        if (http_dl_post_start(post_threads, http_dl_post_exec, post_sh) != HTTP_DL_OK) {
             ret = -HTTP_DL_ERR_INVALID;
             goto err_out;
         }
-        url_buf[url_len - 1] = '\0';
+    }
 
-        di = http_dl_create_info(url_buf);
-        if (di == NULL) {
-            http_dl_log_info("Create download task %s failed.", url_buf);
-            continue;
+    if (optind == argc) {
+        goto run;
+    }
+
+    fp = fopen(argv[optind], "r");
+    if (fp == NULL) {
+        http_dl_log_error("Open file %s failed", argv[optind]);
+        return -HTTP_DL_ERR_FOPEN;
+    }
+
+    /* URLĳȲ */
+    while ((url_len = getline(&url_buf, &url_cap, fp)) > 0) {
+        if (url_buf[url_len - 1] == '\n') {
+            url_buf[url_len - 1] = '\0';
+        }
+
+        /* URL֮ԸԿհ׷ָѡ */
+        opts = strpbrk(url_buf, " \t");
+        if (opts != NULL) {
+            *opts++ = '\0';
         }
 
-        http_dl_add_info_to_list(di, &http_dl_list_initial);
+        (void)http_dl_submit(url_buf, opts, NULL, NULL);
+    }
 
-        http_dl_log_info("Create download task %s success.", url_buf);
+run:
+    if (daemon_path != NULL) {
+        /* бе֮ͻύһ */
+        ret = http_dl_daemon_run(daemon_path);
+        goto err_out;
     }
 
     http_dl_debug_show();
 
-    http_dl_list_proc_initial();
+    http_dl_sched();
 
     http_dl_debug_show();
 
@@ -1379,8 +7616,62 @@ int main(int argc, char *argv[])
     http_dl_debug_show();
 
 err_out:
+    http_dl_stage_hist_show();
+    http_dl_prof_show();
     http_dl_destroy();
-    fclose(fp);
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    http_dl_free(url_buf);
+    http_dl_free(post_sh);
 
     return ret;
+
+usage:
+    http_dl_print_raw("Usage: %s [-z] [-c sha256|crc32c|xxh64] [-r KB/s] [-R KB/s] [-t KB/s]"
+                      " [-T connect,first_byte,idle,total] [-n retries] [-A ca.pem] [-k] [-H host]"
+                      " [-j tasks] [-P command] [-w threads] [-B KB] [-b usec]"
+                      " [-g trace.json] [-G ms] <url_list.txt>\n"
+                      "       %s [options] -D <socket> [url_list.txt]\n"
+                      "       %s -M <block size> <file> > file.manifest\n"
+                      "  -z  negotiate compressed transfer (Accept-Encoding: %s)\n"
+                      "  -c  compute the digest of every downloaded file\n"
+                      "  -r  limit the total download rate\n"
+                      "  -R  limit the download rate of each host\n"
+                      "  -t  limit the download rate of each task\n"
+                      "  -T  per-task timeouts in seconds, 0 disables one (default %d,%d,%d,%d)\n"
+                      "  -n  retry a failed task at most this many times (default %d)\n"
+                      "  -A  verify https servers with the CA certificates in this file\n"
+                      "  -k  do not verify https servers\n"
+                      "  -H  fetch from this host (\"*\" for all) over HTTP/2, may be repeated;\n"
+                      "      http uses prior knowledge (h2c), https negotiates h2 by ALPN\n"
+                      "  -j  run at most this many tasks at a time, higher priority first"
+                      " (default 0, no limit)\n"
+                      "  -P  run this shell command on every downloaded file (appended as the last\n"
+                      "      argument) in post-processing threads, outside the download loop\n"
+                      "  -w  number of post-processing threads, 1..%d (default %d)\n"
+                      "  -B  largest socket receive buffer to size from measured rate x RTT\n"
+                      "      when the kernel's autotuning limit is too low (default %d, 0 disables)\n"
+                      "  -b  busy-poll the socket for this many microseconds (SO_BUSY_POLL)\n"
+                      "  -g  write the stages of slow tasks to this file as Chrome trace JSON\n"
+                      "  -G  a task is slow when it takes at least this many ms (default %d)\n"
+                      "  -D  run as a daemon taking jobs on this UNIX socket until SIGINT/SIGTERM,\n"
+                      "      one command per line: GET <url> [opts], CANCEL <id>, QUERY <id>\n"
+                      "  -M  write the block manifest of <file> for delta= to stdout, the block\n"
+                      "      size in bytes (0 for the default %d) must be %d..%d\n"
+                      "Each line of url_list.txt is an URL, optionally followed by\n"
+                      "sha256=<hex>, crc32c=<hex> or xxh64=<hex> to verify the file,\n"
+                      "rate=<KB/s> to limit this task, prio=high|normal|low to queue it,\n"
+                      "deadline=<seconds> to run it ahead of its level, and\n"
+                      "repair=<first-last,...>|holes to refetch only these byte ranges (or the\n"
+                      "holes) of the existing local file and patch them in place, and\n"
+                      "delta=<manifest url> [base=<old file>] to fetch only the blocks that are\n"
+                      "not in the old file (default the local file itself).\n",
+                      argv[0], argv[0], argv[0], HTTP_ACCEPT_ENCODING,
+                      HTTP_DL_CONNECT_TIMEOUT, HTTP_DL_FIRST_BYTE_TIMEOUT,
+                      HTTP_DL_READ_TIMEOUT, HTTP_DL_TOTAL_TIMEOUT, HTTP_DL_MAX_RETRIES,
+                      HTTP_DL_POST_THREADS_MAX, HTTP_DL_POST_THREADS, HTTP_DL_RCVBUF_MAX >> 10, HTTP_DL_TRACE_SLOW_MS,
+                      HTTP_DL_DELTA_BLOCK_LEN, HTTP_DL_DELTA_BLOCK_MIN, HTTP_DL_DELTA_BLOCK_MAX);
+    return -HTTP_DL_ERR_INVALID;
 }
+#endif /* HTTP_DL_NO_MAIN */